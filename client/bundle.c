@@ -0,0 +1,195 @@
+/*========================================================================
+ * bundle.c  --  Receives many small files as one transfer.
+ *
+ * With 'set bundle', GET * asks for the files up to the given size
+ * MAX_BUNDLE_FILES at a time, as bundles: the request names
+ * TS_BUNDLE_HACK_CMD instead of a file, followed by a manifest of the
+ * files, and the server sends them back to back in a single block
+ * stream (see server/bundle.c for the exchange).  The table it replies
+ * with says where each file starts, and the disk thread writes every
+ * block into the files it overlaps at their own offsets.  The rest of
+ * the transfer doesn't know it is receiving more than one file.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <fcntl.h>        /* for open()                            */
+#include <stdlib.h>       /* for *alloc() and free()               */
+#include <string.h>       /* for standard string routines          */
+#include <unistd.h>       /* for pwrite(), close()                 */
+
+#include <tsunami-client.h>
+
+
+/*------------------------------------------------------------------------
+ * void bundle_close(ttp_session_t *session);
+ *
+ * Closes the local files of the bundle being received, forgets the
+ * table of them and takes the bundle out of the session, if there is
+ * one.  The manifest and the bundle itself are the caller's.
+ *------------------------------------------------------------------------*/
+void bundle_close(ttp_session_t *session)
+{
+    ttp_bundle_t *bundle = session->bundle;
+    u_int32_t     i;
+
+    if (bundle == NULL)
+	return;
+
+    session->bundle = NULL;
+    if (bundle->files == NULL)
+	return;
+
+    for (i = 0; i < bundle->count; ++i) {
+	if (bundle->files[i].fd >= 0)
+	    close(bundle->files[i].fd);
+	free(bundle->files[i].name);
+    }
+    free(bundle->files);
+    bundle->files = NULL;
+    bundle->count = 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int bundle_open(ttp_session_t *session);
+ *
+ * Creates the local files of the bundle being received, each at its
+ * full size, along with any directories they go into.  A file that
+ * can't be created where the server has it goes into the current
+ * directory instead, as with GET *.  Returns 0 on success and non-zero
+ * on failure.
+ *------------------------------------------------------------------------*/
+int bundle_open(ttp_session_t *session)
+{
+    ttp_bundle_t      *bundle = session->bundle;
+    ttp_bundle_file_t *file;
+    const char        *name;
+    u_int32_t          existing = 0;
+    u_int32_t          i;
+
+    for (i = 0; i < bundle->count; ++i) {
+	file = &bundle->files[i];
+	name = file->name;
+	if (name[0] != '/')
+	    create_parents(name);
+	if (!access(name, F_OK))
+	    ++existing;
+	file->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if ((file->fd < 0) && (strrchr(name, '/') != NULL) && (strlen(strrchr(name, '/')) > 1)) {
+	    printf("Warning: could not open file %s for writing, trying local directory instead.\n", name);
+	    name = strrchr(name, '/') + 1;
+	    file->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if ((file->fd < 0) || (ftruncate(file->fd, file->size) < 0)) {
+	    sprintf(g_error, "Could not open local file '%s' for writing", name);
+	    return warn(g_error);
+	}
+    }
+
+    if (existing > 0)
+	printf("Warning: overwriting %u existing files\n", existing);
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int bundle_request(ttp_session_t *session);
+ *
+ * Sends the manifest of the bundle being asked for, once the server
+ * has taken the request, and reads the table of the files that the
+ * server packed.  Those must be files of the manifest, in its order.
+ * Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int bundle_request(ttp_session_t *session)
+{
+    ttp_bundle_t      *bundle = session->bundle;
+    ttp_bundle_file_t *file;
+    char               line[MAX_RELAY_NAME];
+    u_int32_t          length = 0;
+    u_int32_t          count, i, j;
+    u_int64_t          offset = 0;
+    ull_t              size;
+
+    /* name the files */
+    for (i = 0; i < bundle->asked; ++i)
+	length += strlen(bundle->manifest[i]) + 1;
+    fprintf(session->server, "%u\n%u\n", bundle->asked, length);
+    for (i = 0; i < bundle->asked; ++i)
+	fwrite(bundle->manifest[i], strlen(bundle->manifest[i]) + 1, 1, session->server);
+    if (fflush(session->server))
+	return warn("Could not send bundle manifest");
+
+    /* and learn which of them come, and how long they are */
+    if ((fread_line(session->server, line, sizeof(line)) < 0) || (sscanf(line, "%u", &count) < 1) || (count > bundle->asked))
+	return warn("Could not read bundle table");
+    bundle->files = (ttp_bundle_file_t *) calloc(max(count, 1), sizeof(ttp_bundle_file_t));
+    if (bundle->files == NULL)
+	error("Could not allocate bundle table");
+    for (i = 0, j = 0; i < count; ++i) {
+	file     = &bundle->files[i];
+	file->fd = -1;
+	if (fread_line(session->server, line, sizeof(line)) < 0)
+	    return warn("Could not read bundle table");
+	while ((j < bundle->asked) && strcmp(line, bundle->manifest[j]))
+	    ++j;
+	if (j == bundle->asked)
+	    return warn("Server sent a file that is not in the bundle");
+	file->name = strdup(line);
+	if ((fread_line(session->server, line, sizeof(line)) < 0) || (sscanf(line, "%llu", &size) < 1))
+	    return warn("Could not read bundle table");
+	file->size    = size;
+	file->offset  = offset;
+	offset       += file->size;
+	bundle->count = i + 1;
+    }
+
+    if (count < bundle->asked)
+	printf("Warning: server left %u of %u files out of the bundle\n", bundle->asked - count, bundle->asked);
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int bundle_write(ttp_session_t *session, u_int64_t block_index,
+ *                  const u_char *block, u_int32_t length);
+ *
+ * Writes the given block of the bundle, of the given length, into the
+ * files that it overlaps.  Returns 0 on success and non-zero on
+ * failure.
+ *------------------------------------------------------------------------*/
+int bundle_write(ttp_session_t *session, u_int64_t block_index, const u_char *block, u_int32_t length)
+{
+    ttp_bundle_t      *bundle = session->bundle;
+    u_int64_t          start  = ((u_int64_t) session->parameter->block_size) * (block_index - 1);
+    u_int64_t          end    = start + length;
+    u_int64_t          from, to;
+    u_int32_t          low    = 0;
+    u_int32_t          high   = bundle->count;
+    u_int32_t          middle;
+    ttp_bundle_file_t *file;
+
+    /* find the last file that starts before the block */
+    while (low + 1 < high) {
+	middle = (low + high) / 2;
+	if (bundle->files[middle].offset <= start)
+	    low = middle;
+	else
+	    high = middle;
+    }
+
+    /* and write its part of the block into it and those after it */
+    for (file = &bundle->files[low]; (file < bundle->files + bundle->count) && (file->offset < end); ++file) {
+	from = max(start, file->offset);
+	to   = min(end,   file->offset + file->size);
+	if (to <= from)
+	    continue;
+	if (pwrite(file->fd, block + (from - start), to - from, from - file->offset) < (ssize_t) (to - from)) {
+	    sprintf(g_error, "Could not write block %llu of the bundle to '%s'", (ull_t) block_index, file->name);
+	    return warn(g_error);
+	}
+    }
+
+    return 0;
+}
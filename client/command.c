@@ -61,10 +61,12 @@
  * INFORMATION GENERATED USING SOFTWARE.
  *========================================================================*/
 
+#include <poll.h>         /* for poll()                            */
 #include <pthread.h>      /* for the pthreads library              */
 #include <stdlib.h>       /* for *alloc() and free()               */
 #include <string.h>       /* for standard string routines          */
 #include <sys/socket.h>   /* for the BSD socket library            */
+#include <sys/uio.h>      /* for struct iovec                      */
 #include <sys/time.h>     /* for gettimeofday()                    */
 #include <time.h>         /* for time()                            */
 #include <unistd.h>       /* for standard Unix system calls        */
@@ -78,9 +80,15 @@
  * Prototypes for module-scope routines.
  *------------------------------------------------------------------------*/
 
+u_int32_t bundle_first(char **names, u_int64_t *sizes, u_int32_t count, u_int64_t largest);
 void *disk_thread   (void *arg);
+void  disk_stop     (ring_buffer_t *ring, pthread_t disk_thread_id);
 void  dump_blockmap (const char *postfix, const ttp_transfer_t *xfer);
+int   list_files    (ttp_session_t *session, char ***names, u_int64_t **sizes, u_int32_t *count);
 int   parse_fraction(const char *fraction, u_int16_t *num, u_int16_t *den);
+void  pipeline_close(ring_buffer_t *ring, int udp_fd, pthread_t disk_thread_id);
+void  sample_delay  (ttp_transfer_t *xfer, u_int64_t sent);
+int   recv_datagram (ttp_transfer_t *xfer, u_char *datagram, size_t length);
 
 
 /*------------------------------------------------------------------------
@@ -199,44 +207,30 @@ ttp_session_t *command_connect(command_t *command, ttp_parameter_t *parameter)
  *
  * Tries to request a list of server shared files and their sizes.
  * Returns 0 on a successful transfer and nonzero on an error condition.
- * Allocates and fills out session->fileslist struct, the caller needs to 
- * free it after use.
  *------------------------------------------------------------------------*/
 int command_dir(command_t *command, ttp_session_t *session)
 {
-    u_char    result;
-    char      read_str[2048];
-    u_int16_t num_files, i;
-    size_t    filelen;
-    u_int16_t status = 0;
+    char      **file_names;
+    u_int64_t  *file_sizes;
+    u_int32_t   num_files, i;
     
     /* make sure that we have an open session */
     if (session == NULL || session->server == NULL)
 	return warn("Not connected to a Tsunami server");
 
     /* send request and parse the result */
-    fprintf(session->server, "%s\n", TS_DIRLIST_HACK_CMD);
-    
-    status = fread(&result, 1, 1, session->server);
-    if (status < 1)
-        return warn("Could not read response to directory request");
-    if (result == 8)
-        return warn("Server does no support listing of shared files");
-    
-    read_str[0] = result;  
-    fread_line(session->server, &read_str[1], sizeof(read_str)-2);
-    num_files = atoi(read_str);
+    if (list_files(session, &file_names, &file_sizes, &num_files) < 0)
+        return -1;
     
     fprintf(stderr, "Remote file list:\n");
     for (i=0; i<num_files; i++) {
-        fread_line(session->server, read_str, sizeof(read_str)-1);
-        fprintf(stderr, " %2d) %-64s", i+1, read_str);
-        fread_line(session->server, read_str, sizeof(read_str)-1);
-        filelen = atol(read_str);
-        fprintf(stderr, "%8Lu bytes\n", (ull_t)filelen);
+        fprintf(stderr, " %2d) %-64s", i+1, file_names[i]);
+        fprintf(stderr, "%8Lu bytes\n", (ull_t)file_sizes[i]);
+        free(file_names[i]);
     } 
     fprintf(stderr, "\n");
-    fwrite("\0", 1, 1, session->server);
+    free(file_names);
+    free(file_sizes);
     return 0;
 }
 
@@ -253,27 +247,40 @@ int command_get(command_t *command, ttp_session_t *session)
 {
     u_char         *datagram = NULL;            /* the buffer (in ring) for incoming blocks       */
     u_char         *local_datagram = NULL;      /* the local temp space for incoming block        */
-    u_int32_t       this_block = 0;             /* the block number for the block just received   */
+    u_int64_t       this_block = 0;             /* the block number for the block just received   */
     u_int16_t       this_type = 0;              /* the block type for the block just received     */
+    ttp_header_t    header;                     /* the header of the block just received          */
     u_int64_t       delta = 0;                  /* generic holder of elapsed times                */
-    u_int32_t       block = 0;                  /* generic holder of a block number               */
+    u_int64_t       block = 0;                  /* generic holder of a block number               */
     u_int32_t       dumpcount = 0;
 
     double          mbit_thru, mbit_good;       /* helpers for final statistics                   */
     double          mbit_file;
     double          time_secs;
+    path_profile_t  profile;                    /* what we know about the path to the server      */
+    u_int64_t       configured_rate  = 0;       /* the target rate before seeding from a profile  */
+    u_int32_t       configured_block = 0;       /* the block size before seeding from a profile   */
 
     ttp_transfer_t *xfer          = &(session->transfer);
     retransmit_t   *rexmit        = &(session->transfer.retransmit);
     int             status = 0;
     pthread_t       disk_thread_id = 0;
+    int             disk_running = 0;           /* 1 while our own disk thread has to be stopped  */
+    int             locked = 0;                 /* 1 while we hold the transfer against streams   */
+    ttp_transfer_t  kept;                       /* the file before in a pipelined GET *           */
+    int             keeping = 0;                /* 1 while its port, ring and disk thread go on   */
 
     /* The following variables will be used only in multiple file transfer
      * session they are used to recieve the file names and other parameters
      */
     int             multimode = 0;
     char          **file_names = NULL;
+    u_int64_t      *file_sizes = NULL;            /* the sizes of the files, if we bundle       */
     u_int32_t       f_counter = 0, f_total = 0, f_arrsize = 0;
+    u_int32_t       f_next = 0;                   /* the file after the current one or bundle   */
+    u_int32_t       f_index;
+    u_int32_t       f_bundled = 0;                /* the files at the front small enough to bundle */
+    ttp_bundle_t    bundle;                       /* the bundle of the current ones, if any     */
 
     /* this struct wil hold the RTT time */
     struct timeval ping_s, ping_e;
@@ -289,9 +296,51 @@ int command_get(command_t *command, ttp_session_t *session)
 
     /* reinitialize the transfer data */
     memset(xfer, 0, sizeof(*xfer));
+    memset(&bundle, 0, sizeof(bundle));
+
+    /* small files are bundled, for which GET * needs the file list with their sizes */
+    if (!strcmp("*", command->text[1]) && (session->parameter->bundle > 0) && (session->parameter->mirrors == NULL) &&
+        (list_files(session, &file_names, &file_sizes, &f_total) == 0)) {
+
+       multimode = 1;
+       if (f_total <= 0) {
+          free(file_names);
+          free(file_sizes);
+          return warn("Server advertised no files to get");
+       }
+       f_bundled = bundle_first(file_names, file_sizes, f_total, session->parameter->bundle);
+       printf("\nServer is sharing %u files, %u of them small enough to bundle\n", f_total, f_bundled);
+
+    /* or gotten several at a time, for which GET * needs the file list up front */
+    } else if (!strcmp("*", command->text[1]) && (session->parameter->concurrent > 1) && (session->parameter->bundle == 0) &&
+               (session->parameter->mirrors == NULL) && (list_files(session, &file_names, &file_sizes, &f_total) == 0)) {
+       ttp_job_t *jobs;
+
+       if (f_total <= 0) {
+          free(file_names);
+          free(file_sizes);
+          return warn("Server advertised no files to get");
+       }
+       jobs = (ttp_job_t *) calloc(f_total, sizeof(ttp_job_t));
+       if (jobs == NULL)
+          error("Could not allocate file list");
+       for (f_counter = 0; f_counter < f_total; ++f_counter) {
+          jobs[f_counter].host            = session->parameter->server_name;
+          jobs[f_counter].remote_filename = file_names[f_counter];
+          jobs[f_counter].local_filename  = file_names[f_counter];
+       }
+       printf("\nServer is sharing %u files, getting %u at a time\n", f_total, min(session->parameter->concurrent, f_total));
+       status = concurrent_get(session->parameter, jobs, f_total);
+
+       for (f_counter = 0; f_counter < f_total; ++f_counter)
+          free(file_names[f_counter]);
+       free(file_names);
+       free(file_sizes);
+       free(jobs);
+       return status;
 
     /* if the client asking for multiple files to be transfered */
-    if(!strcmp("*",command->text[1])) {
+    } else if(!strcmp("*",command->text[1])) {
        char  filearray_size[10];
        char  file_count[10];
 
@@ -346,9 +395,27 @@ int command_get(command_t *command, ttp_session_t *session)
        f_total = 1;
     }
 
+    /* the files of a GET * share the data port, ring and disk thread if the server agrees */
+    session->parameter->pipeline_file = (multimode && session->parameter->pipeline && (session->parameter->mirrors == NULL) &&
+                                         (session->parameter->rx_queues <= 1)) ? 1 : 0;
+
     f_counter = 0;
     do /*---loop for single and multi file request---*/
     {
+    f_next = f_counter + 1;
+
+    /* the small files go up to MAX_BUNDLE_FILES at a time, as long as there is data among them */
+    if (f_counter < f_bundled) {
+       memset(&bundle, 0, sizeof(bundle));
+       bundle.manifest = file_names + f_counter;
+       bundle.asked    = min(f_bundled - f_counter, MAX_BUNDLE_FILES);
+       for (f_index = f_counter; f_index < f_counter + bundle.asked; ++f_index)
+          if (file_sizes[f_index] > 0) {
+             session->bundle = &bundle;
+             f_next = f_counter + bundle.asked;
+             break;
+          }
+    }
 
     /* store the remote filename */
     if(!multimode)
@@ -372,19 +439,88 @@ int command_get(command_t *command, ttp_session_t *session)
     } else {
        /* don't trim, GET* writes into remotefilename dir if exists, otherwise into CWD */
        xfer->local_filename = file_names[f_counter];
-       printf("GET *: now requesting file '%s'\n", xfer->local_filename);
+       if (session->bundle != NULL)
+          printf("GET *: now requesting %u files from '%s' on as a bundle\n", bundle.asked, xfer->local_filename);
+       else
+          printf("GET *: now requesting file '%s'\n", xfer->local_filename);
+    }
+
+    /* a bundle goes by the name that asks for one, its files have their own */
+    if (session->bundle != NULL) {
+       xfer->remote_filename = TS_BUNDLE_HACK_CMD;
+       xfer->local_filename  = TS_BUNDLE_HACK_CMD;
     }
 
+    /* warm-start from what past transfers learned about this server */
+    configured_rate  = session->parameter->target_rate;
+    configured_block = session->parameter->block_size;
+    session->parameter->start_rate = 0;
+    session->parameter->rtt_hint   = 0;
+    if ((session->parameter->profile != NULL) &&
+        !profile_lookup(session->parameter->profile, session->parameter->server_name, session->parameter->server_port, &profile))
+        profile_seed(session->parameter, &profile);
+
     /* negotiate the file request with the server */
-    if (ttp_open_transfer(session, xfer->remote_filename, xfer->local_filename) < 0)
+    if (ttp_open_transfer(session, xfer->remote_filename, xfer->local_filename) < 0) {
+        journal_close(session, 0);
+        bundle_close(session);
+        session->parameter->target_rate = configured_rate;
+        session->parameter->block_size  = configured_block;
+
+        /* a server that doesn't know bundles gets asked for the files one by one */
+        if (bundle.refused && !keeping) {
+            bundle.refused = 0;
+            f_bundled      = 0;
+            f_next         = f_counter;
+            continue;
+        }
+        if (keeping)
+            pipeline_close(kept.ring_buffer, kept.udp_fd, disk_thread_id);
 	return warn("File transfer request failed");
+    }
+
+    /* in a pipelined GET *, go on with the data port, ring and disk thread of the file before */
+    if (keeping && (xfer->pipeline != session->parameter->pipeline_file)) {
+        pipeline_close(kept.ring_buffer, kept.udp_fd, disk_thread_id);
+        journal_close(session, 0);
+        if (xfer->file != NULL) { fclose(xfer->file);    xfer->file     = NULL; }
+        bundle_close(session);
+        relay_map_close(session, TS_RELAY_FAILED);
+        session->parameter->target_rate = configured_rate;
+        session->parameter->block_size  = configured_block;
+	return warn("Server did not go on with the pipelined transfer");
+    } else if (keeping) {
+        xfer->udp_fd       = kept.udp_fd;
+        xfer->udp_buffer   = kept.udp_buffer;
+        xfer->udp_buffer_stuck = kept.udp_buffer_stuck;
+        xfer->rxq_ovfl     = kept.rxq_ovfl;
+        xfer->socket_drops = kept.socket_drops;
+        xfer->ring_buffer  = kept.ring_buffer;
+    }
+
+    /* have the mirrors get ready to send along */
+    if (mirror_open(session) < 0) {
+        journal_close(session, 0);
+        bundle_close(session);
+        relay_map_close(session, TS_RELAY_FAILED);
+        session->parameter->target_rate = configured_rate;
+        session->parameter->block_size  = configured_block;
+	return warn("Could not set up the mirrors");
+    }
 
     /* create the UDP data socket */
-    if (ttp_open_port(session) < 0)
+    if (ttp_open_port(session) < 0) {
+        mirror_close(session);
+        journal_close(session, 0);
+        bundle_close(session);
+        relay_map_close(session, TS_RELAY_FAILED);
+        session->parameter->target_rate = configured_rate;
+        session->parameter->block_size  = configured_block;
 	return warn("Creation of data socket failed");
+    }
 
     /* allocate the retransmission table */
-    rexmit->table = (u_int32_t *) calloc(DEFAULT_TABLE_SIZE, sizeof(u_int32_t));
+    rexmit->table = (u_int64_t *) calloc(DEFAULT_TABLE_SIZE, sizeof(u_int64_t));
     if (rexmit->table == NULL)
 	error("Could not allocate retransmission table");
 
@@ -393,44 +529,72 @@ int command_get(command_t *command, ttp_session_t *session)
     if (xfer->received == NULL)
 	error("Could not allocate received-data bitfield");
 
+    /* a resumed transfer has some of the blocks from before, a synced one those that are the same */
+    journal_apply(session);
+    sync_apply(session);
+
     /* allocate the ring buffer */
-    xfer->ring_buffer = ring_create(session);
+    if (!keeping)
+        xfer->ring_buffer = ring_create(session);
 
     /* allocate the faster local buffer */
-    local_datagram = (u_char *) calloc(6 + session->parameter->block_size, sizeof(u_char));
+    local_datagram = (u_char *) calloc(xfer->header_size + session->parameter->block_size, sizeof(u_char));
     if (local_datagram == NULL)
         error("Could not allocate fast local datagram buffer in command_get()");
 
-    /* start up the disk I/O thread */
-    status = pthread_create(&disk_thread_id, NULL, disk_thread, session);
-    if (status != 0)
-	error("Could not create I/O thread");
+    /* allocate the FEC groups */
+    if ((xfer->fec != TS_FEC_NONE) && (fec_init(session) < 0))
+        error("Could not allocate FEC groups");
+
+    /* start up the disk I/O thread, or hand the ring to the engine of concurrent transfers */
+    if (session->concurrent != NULL) {
+        concurrent_attach(session);
+    } else if (!keeping) {
+        status = pthread_create(&disk_thread_id, NULL, disk_thread, session);
+        if (status != 0)
+	    error("Could not create I/O thread");
+        disk_running = 1;
+    }
 
     /* Finish initializing the retransmission object */
     rexmit->table_size = DEFAULT_TABLE_SIZE;
     rexmit->index_max  = 0;
 
-    /* we start by expecting block #1 */
+    /* start up the receivers of any further streams, they wait for us to let go of the transfer */
+    if (stream_start(session) < 0)
+        error("Could not start UDP streams");
+    locked = 1;
+
+    /* we start by expecting block #1, and split the rest of the file among the mirrors */
     xfer->next_block = 1;
     xfer->gapless_to_block = 0;
+    if (mirror_assign(session) < 0)
+        goto abort;
 
    /*---------------------------
    * START TIMING
    *---------------------------*/
 
    memset(&xfer->stats, 0, sizeof(xfer->stats));
-   xfer->stats.start_udp_errors = get_udp_in_errors();
+   xfer->stats.start_udp_errors = xfer->rxq_ovfl ? (u_int64_t) xfer->socket_drops + xfer->mcast_drops : get_udp_in_errors();
    xfer->stats.this_udp_errors = xfer->stats.start_udp_errors;
+   xfer->stats.last_udp_errors = xfer->stats.start_udp_errors;
    gettimeofday(&(xfer->stats.start_time), NULL);
    gettimeofday(&(xfer->stats.this_time),  NULL);
    if (session->parameter->transcript_yn)
       xscript_data_start(session, &(xfer->stats.start_time));
 
+   /* a resumed or synced file may need no data at all */
+   if ((xfer->resumed || (xfer->sync_segment > 0)) && (xfer->blocks_left == 0))
+      goto complete;
+
    /* until we break out of the transfer */
    while (1) {
 
-      /* try to receive a datagram */
-      status = recvfrom(xfer->udp_fd, local_datagram, 6 + session->parameter->block_size, 0, NULL, 0);
+      /* try to receive a datagram, letting the stream threads at the transfer meanwhile */
+      pthread_mutex_unlock(&xfer->stream_lock);
+      status = recv_datagram(xfer, local_datagram, xfer->header_size + session->parameter->block_size);
+      pthread_mutex_lock(&xfer->stream_lock);
       if (status < 0) {
           warn("UDP data transmission error");
           printf("Apparently frozen transfer, trying to do retransmit request\n");
@@ -441,11 +605,32 @@ int command_get(command_t *command, ttp_session_t *session)
       }
 
       /* retrieve the block number and block type */
-      this_block = ntohl(*((u_int32_t *) local_datagram));       // in range of 1..xfer->block_count
-      this_type  = ntohs(*((u_int16_t *) (local_datagram + 4))); // TS_BLOCK_ORIGINAL etc
+      ttp_header_unpack(local_datagram, &header, xfer->header_flags);
+      this_block = header.block;  // in range of 1..xfer->block_count
+      this_type  = header.type;   // TS_BLOCK_ORIGINAL etc
+
+      /* the files of a pipelined GET * share the port, late blocks of the one before are dropped */
+      if ((xfer->header_flags & TS_HDR_FILE) && (header.file != xfer->pipeline))
+          continue;
+
+      /* parity blocks only go to their FEC group, they are not part of the file */
+      if (this_type == TS_BLOCK_PARITY) {
+          xfer->stats.total_blocks++;
+          xfer->stats.total_fec_parity++;
+          if (xfer->fec != TS_FEC_NONE)
+              fec_accept_parity(session, this_block, local_datagram + xfer->header_size);
+          goto send_stats;
+      }
+      xfer->last_block = this_block;
+
+      /* keep track of the one-way delay */
+      if (xfer->header_flags & TS_HDR_TIMESTAMP)
+          sample_delay(xfer, header.timestamp);
 
       /* keep statistics on received blocks */
       xfer->stats.total_blocks++;
+      if (xfer->stream != NULL)
+          xfer->stream[0].this_blocks++;
       if (this_type != TS_BLOCK_RETRANSMISSION) {
           xfer->stats.this_flow_originals++;
       } else {
@@ -453,6 +638,11 @@ int command_get(command_t *command, ttp_session_t *session)
           xfer->stats.total_recvd_retransmits++;
       }
 
+      /* new blocks also go to their FEC group, where they may help rebuild others */
+      if ((xfer->fec != TS_FEC_NONE) && !got_block(session, this_block))
+          if (fec_accept_block(session, this_block, this_type, local_datagram + xfer->header_size) < 0)
+              goto abort;
+
       /* main transfer control logic */
       if (!ring_full(xfer->ring_buffer)) /* don't let disk-I/O freeze stop feedback of stats to server */
       if (!got_block(session, this_block) || this_type == TS_BLOCK_TERMINATE || xfer->restart_pending)
@@ -463,7 +653,7 @@ int command_get(command_t *command, ttp_session_t *session)
 
               /* reserve ring space, copy the data in, confirm the reservation */
               datagram = ring_reserve(xfer->ring_buffer);
-              memcpy(datagram, local_datagram, 6 + session->parameter->block_size);
+              memcpy(datagram, local_datagram, xfer->header_size + session->parameter->block_size);
               if (ring_confirm(xfer->ring_buffer) < 0) {
                   warn("Error in accepting block");
                   goto abort;
@@ -474,7 +664,7 @@ int command_get(command_t *command, ttp_session_t *session)
               if (xfer->blocks_left > 0) {
                   --(xfer->blocks_left);
               } else {
-                  printf("Oops! Negative-going blocks_left count at block: type=%c this=%u final=%u left=%u\n", this_type, this_block, xfer->block_count, xfer->blocks_left);
+                  printf("Oops! Negative-going blocks_left count at block: type=%c this=%llu final=%llu left=%llu\n", this_type, (ull_t) this_block, (ull_t) xfer->block_count, (ull_t) xfer->blocks_left);
               }
           }
 
@@ -485,8 +675,13 @@ int command_get(command_t *command, ttp_session_t *session)
               }
           }
 
-          /* queue any retransmits we need */
-          if (this_block > xfer->next_block) {
+          /* with several streams or mirrors, the originals of all of them together say what went missing */
+          if (xfer->stream != NULL) {
+              if ((this_type == TS_BLOCK_ORIGINAL) && (stream_passed(session, &xfer->stream[0], this_block) < 0))
+                  goto abort;
+
+          /* otherwise queue any retransmits we need */
+          } else if (this_block > xfer->next_block) {
 
              /* lossy transfer mode */
              if (!session->parameter->lossless) {
@@ -498,12 +693,14 @@ int command_get(command_t *command, ttp_session_t *session)
                     double path_capability;
                     path_capability  = 0.8 * (xfer->stats.this_transmit_rate + xfer->stats.this_retransmit_rate); // reduced effective Mbit/s rate
                     path_capability *= (0.001 * session->parameter->losswindow_ms); // MBit inside window, round-trip user estimated in losswindow_ms!
-                    u_int32_t earliest_block = this_block -
+                    u_int64_t earliest_block = this_block -
                        min(
                          1024 * 1024 * path_capability / (8 * session->parameter->block_size),  // # of blocks inside window
                          (this_block - xfer->gapless_to_block)                                  // # of blocks missing (tops)
                        );
                     for (block = earliest_block; block < this_block; ++block) {
+                        if (fec_pending(session, block))
+                            continue;
                         if (ttp_request_retransmit(session, block) < 0) {
                             warn("Retransmission request failed");
                             goto abort;
@@ -517,6 +714,8 @@ int command_get(command_t *command, ttp_session_t *session)
              /* lossless transfer mode, request all missing data to be resent */
              } else {
                 for (block = xfer->next_block; block < this_block; ++block) {
+                    if (fec_pending(session, block))
+                        continue;
                     if (ttp_request_retransmit(session, block) < 0) {
                         warn("Retransmission request failed");
                         goto abort;
@@ -532,7 +731,7 @@ int command_get(command_t *command, ttp_session_t *session)
 
           /* if this is an orignal, we expect to receive the successor to this block next */
           /* transmit restart note: these resent blocks are labeled original as well      */
-          if (this_type == TS_BLOCK_ORIGINAL) {
+          if ((this_type == TS_BLOCK_ORIGINAL) && (xfer->stream == NULL)) {
               xfer->next_block = this_block + 1;
           }
 
@@ -545,8 +744,9 @@ int command_get(command_t *command, ttp_session_t *session)
           if (this_type == TS_BLOCK_TERMINATE) {
 
               #if DEBUG_RETX
-              fprintf(stderr, "Got end block: blk %u, final blk %u, left blks %u, tail %u, head %u\n",
-                      this_block, xfer->block_count, xfer->blocks_left, xfer->gapless_to_block, xfer->next_block);
+              fprintf(stderr, "Got end block: blk %llu, final blk %llu, left blks %llu, tail %llu, head %llu\n",
+                      (ull_t) this_block, (ull_t) xfer->block_count, (ull_t) xfer->blocks_left,
+                      (ull_t) xfer->gapless_to_block, (ull_t) xfer->next_block);
               #endif
 
               /* got all blocks by now */
@@ -558,8 +758,10 @@ int command_get(command_t *command, ttp_session_t *session)
                   }
               }
 
-              /* add possible still missing blocks to retransmit list */
-              for (block = xfer->gapless_to_block+1; block < xfer->block_count; ++block) {
+              /* tail phase: ask for the complete missing set at once, the server repairs it */
+              /* at the target rate and follows up with another terminate block            */
+              rexmit->index_max = 0;
+              for (block = xfer->gapless_to_block+1; block <= xfer->block_count; ++block) {
                   if (ttp_request_retransmit(session, block) < 0) {
                       warn("Retransmission request failed");
                       goto abort;
@@ -600,28 +802,41 @@ int command_get(command_t *command, ttp_session_t *session)
 
     } /* Transfer of the file completes here*/
 
+ complete:
     printf("Transfer complete. Flushing to disk and signaling server to stop...\n");
+    pthread_mutex_unlock(&xfer->stream_lock);
+    locked = 0;
+    stream_stop(session);
+    mirror_close(session);
 
     /*---------------------------
      * STOP TIMING
      *---------------------------*/
 
-    /* tell the server to quit transmitting */
-    close(xfer->udp_fd);
+    /* tell the server to quit transmitting, the next file of a pipelined GET * keeps the port */
+    keeping = (xfer->pipeline > 0) && (f_next < f_total);
+    if (!keeping) {
+        close(xfer->udp_fd);
+        xfer->udp_fd = -1;
+    }
+    if (xfer->mcast_fd >= 0) {
+        close(xfer->mcast_fd);
+        xfer->mcast_fd = -1;
+    }
     if (ttp_request_stop(session) < 0) {
 	warn("Could not request end of transfer");
 	goto abort;
     }
 
-    /* add a stop block to the ring buffer */
-    datagram = ring_reserve(xfer->ring_buffer);
-    *((u_int32_t *) datagram) = 0;
-    if (ring_confirm(xfer->ring_buffer) < 0)
-	warn("Error in terminating disk thread");
-
-    /* wait for the disk thread to die */
-    if (pthread_join(disk_thread_id, NULL) < 0)
-	warn("Disk thread terminated with error");
+    /* and the disk thread, which only has to catch up with us before the next file */
+    if (keeping || (session->concurrent != NULL)) {
+        if (ring_drain(xfer->ring_buffer) < 0)
+            goto abort;
+        concurrent_detach(session);
+    } else {
+        disk_stop(xfer->ring_buffer, disk_thread_id);
+        disk_running = 0;
+    }
 
     /*------------------------------------
      * MORE TRUE POINT TO STOP TIMING ;-)
@@ -641,14 +856,23 @@ int command_get(command_t *command, ttp_session_t *session)
 
     /* display the final results */
     mbit_thru     = 8.0 * xfer->stats.total_blocks * session->parameter->block_size;
-    mbit_good     = mbit_thru - 8.0 * xfer->stats.total_recvd_retransmits * session->parameter->block_size;
+    mbit_good     = mbit_thru - 8.0 * (xfer->stats.total_recvd_retransmits + xfer->stats.total_fec_parity) * session->parameter->block_size;
     mbit_file     = 8.0 * xfer->file_size;
     mbit_thru    /= (1024.0*1024.0);
     mbit_good    /= (1024.0*1024.0);
     mbit_file    /= (1024.0*1024.0);
     time_secs     = delta / 1e6;
-    printf("PC performance figure : %llu packets dropped (if high this indicates receiving PC overload)\n", 
+    if (xfer->rxq_ovfl) {
+        xfer->stats.this_udp_errors = (u_int64_t) xfer->socket_drops + xfer->mcast_drops;
+        printf("PC performance figure : %llu packets dropped at our socket (if high this indicates receiving PC overload)\n",
+                                         (ull_t)(xfer->stats.this_udp_errors - xfer->stats.start_udp_errors));
+        if (xfer->stats.this_udp_errors > xfer->stats.start_udp_errors)
+            printf("UDP receive buffer    : %u bytes after socket overflows%s\n", xfer->udp_buffer,
+                   xfer->udp_buffer_stuck ? ", could not grow further" : "");
+    } else {
+        printf("PC performance figure : %llu packets dropped (if high this indicates receiving PC overload)\n",
                                          (ull_t)(xfer->stats.this_udp_errors - xfer->stats.start_udp_errors));
+    }
     printf("Transfer duration     : %0.2f seconds\n", time_secs);
     printf("Total packet data     : %0.2f Mbit\n", mbit_thru);
     printf("Goodput data          : %0.2f Mbit\n", mbit_good);
@@ -656,12 +880,18 @@ int command_get(command_t *command, ttp_session_t *session)
     printf("Throughput            : %0.2f Mbps\n", mbit_thru / time_secs);
     printf("Goodput w/ restarts   : %0.2f Mbps\n", mbit_good / time_secs);
     printf("Final file rate       : %0.2f Mbps\n", mbit_file / time_secs);
+    if (xfer->ecn)
+        printf("ECN CE marks          : %u (%.2f%% of packets)\n", xfer->stats.total_ce_marks,
+                  100.0 * xfer->stats.total_ce_marks / max(xfer->stats.total_blocks, 1));
+    if (xfer->fec != TS_FEC_NONE)
+        printf("FEC                   : %llu blocks rebuilt from %llu parity blocks (%s, groups of %u)\n",
+                  (ull_t) xfer->stats.total_fec_recovered, (ull_t) xfer->stats.total_fec_parity, FEC_NAMES[xfer->fec], xfer->fec_group);
     printf("Transfer mode         : ");
     if (session->parameter->lossless) {
         if (xfer->stats.total_lost == 0) {
            printf("lossless\n");
         } else {
-           printf("lossless mode - but lost count=%u > 0, please file a bug report!!\n", xfer->stats.total_lost);
+           printf("lossless mode - but lost count=%llu > 0, please file a bug report!!\n", (ull_t) xfer->stats.total_lost);
         }
     } else { 
         if (session->parameter->losswindow_ms == 0) {
@@ -685,14 +915,35 @@ int command_get(command_t *command, ttp_session_t *session)
        dump_blockmap(".blockmap", xfer);
     }
 
-    /* close our open files */
+    /* close our open files, and tell a relaying server the file is complete */
+    journal_close(session, xfer->stats.total_lost == 0);
     if (xfer->file     != NULL) { fclose(xfer->file);    xfer->file     = NULL; }
+    bundle_close(session);
+    relay_map_close(session, TS_RELAY_DONE);
 
     /* deallocate memory */
-    ring_destroy(xfer->ring_buffer);
+    if (!keeping)
+        ring_destroy(xfer->ring_buffer);
     if (rexmit->table != NULL)  { free(rexmit->table);   rexmit->table  = NULL; }
     if (xfer->received != NULL) { free(xfer->received);  xfer->received = NULL; }
     if (local_datagram != NULL) { free(local_datagram);  local_datagram = NULL; }
+    if (xfer->fec_slots  != NULL) { free(xfer->fec_slots);   xfer->fec_slots  = NULL; }
+    if (xfer->fec_buffer != NULL) { free(xfer->fec_buffer);  xfer->fec_buffer = NULL; }
+
+    /* remember what this transfer learned about the path */
+    if ((session->parameter->profile != NULL) && (time_secs >= PROFILE_MIN_TIME)) {
+        memset(&profile, 0, sizeof(profile));
+        strncpy(profile.host, session->parameter->server_name, sizeof(profile.host) - 1);
+        profile.port       = session->parameter->server_port;
+        profile.rate       = 8.0 * xfer->file_size / time_secs;
+        profile.rtt        = xfer->probe_rtt;
+        profile.loss       = (double) xfer->stats.total_recvd_retransmits / max(xfer->stats.total_blocks, 1);
+        profile.block_size = session->parameter->block_size;
+        profile.best_rate  = profile.rate;
+        profile_update(session->parameter->profile, &profile);
+    }
+    session->parameter->target_rate = configured_rate;
+    session->parameter->block_size  = configured_block;
 
     /* update the target rate */
     if (session->parameter->rate_adjust) {
@@ -700,8 +951,14 @@ int command_get(command_t *command, ttp_session_t *session)
         printf("Adjusting target rate to %d Mbps for next transfer.\n", (int)(session->parameter->target_rate/1e6));
     }
 
+    /* hold on to the file's port, ring and disk thread for the next one */
+    if (keeping) {
+        kept = *xfer;
+        session->parameter->pipeline_file = xfer->pipeline + 1;
+    }
+
     /* more files in "GET *" ? */
-    } while(++f_counter<f_total);
+    } while((f_counter = f_next) < f_total);
 
     /* deallocate file list */
     if(multimode) {
@@ -709,6 +966,7 @@ int command_get(command_t *command, ttp_session_t *session)
            free(file_names[f_counter]);
        }
        free(file_names);
+       free(file_sizes);
     }
 
     /* we succeeded */
@@ -716,12 +974,35 @@ int command_get(command_t *command, ttp_session_t *session)
 
  abort:
     fprintf(stderr, "Transfer not successful.  (WARNING: You may need to reconnect.)\n\n");
-    close(xfer->udp_fd);
+    if (locked)
+        pthread_mutex_unlock(&xfer->stream_lock);
+    stream_stop(session);
+    mirror_close(session);
+    session->parameter->target_rate = configured_rate;
+    session->parameter->block_size  = configured_block;
+
+    /* the sockets may be closed already, and transfers running at once share our descriptors */
+    if (xfer->udp_fd >= 0)
+        close(xfer->udp_fd);
+    if (xfer->mcast_fd >= 0)
+        close(xfer->mcast_fd);
+    xfer->udp_fd   = -1;
+    xfer->mcast_fd = -1;
+
+    /* nothing may still write from the ring or into the journal when they go */
+    if (disk_running)
+        disk_stop(xfer->ring_buffer, disk_thread_id);
+    concurrent_detach(session);
     ring_destroy(xfer->ring_buffer);
+    journal_close(session, 0);
     if (xfer->file     != NULL) { fclose(xfer->file);    xfer->file     = NULL; }
+    bundle_close(session);
+    relay_map_close(session, TS_RELAY_FAILED);
     if (rexmit->table  != NULL) { free(rexmit->table);   rexmit->table  = NULL; }
     if (xfer->received != NULL) { free(xfer->received);  xfer->received = NULL; }
     if (local_datagram != NULL) { free(local_datagram);  local_datagram = NULL; }    
+    if (xfer->fec_slots  != NULL) { free(xfer->fec_slots);   xfer->fec_slots  = NULL; }
+    if (xfer->fec_buffer != NULL) { free(xfer->fec_buffer);  xfer->fec_buffer = NULL; }
     return -1;
 }
 
@@ -738,7 +1019,7 @@ int command_help(command_t *command, ttp_session_t *session)
     /* if no command was supplied */
     if (command->count < 2) {
 	printf("Help is available for the following commands:\n\n");
-	printf("    close    connect    get    dir    help    quit    set\n\n");
+	printf("    close    connect    get    dir    help    mget    quit    set\n\n");
 	printf("Use 'help <command>' for help on an individual command.\n\n");
 
     /* handle the CLOSE command */
@@ -765,6 +1046,14 @@ int command_help(command_t *command, ttp_session_t *session)
 	printf("Tsunami file transfer protocol.  If the local filename is not\n");
 	printf("specified, the final part of the remote filename (after the last path\n");
 	printf("separator) will be used.\n\n");
+	printf("With 'set concurrent', 'get *' gets that many files at a time, with\n");
+	printf("the target rate split among them.\n\n");
+	printf("With 'set resume yes', a get of a file that an earlier get left\n");
+	printf("unfinished fetches only the blocks still missing, if the remote file\n");
+	printf("has not changed since.\n\n");
+	printf("With 'set sync yes', a get of a file that is here already fetches\n");
+	printf("only the parts that differ from the remote file, and 'get *' skips\n");
+	printf("the files that are the same.\n\n");
 
     /* handle the DIR command */
     } else if (!strcasecmp(command->text[1], "dir")) {
@@ -775,6 +1064,14 @@ int command_help(command_t *command, ttp_session_t *session)
     } else if (!strcasecmp(command->text[1], "help")) {
 	printf("Come on.  You know what that command does.\n\n");
 
+    /* handle the MGET command */
+    } else if (!strcasecmp(command->text[1], "mget")) {
+	printf("Usage: mget [<remote-host>:]<remote-file> ...\n\n");
+	printf("Retrieves the given remote files, as many of them at a time as 'set\n");
+	printf("concurrent' says and with the target rate split among them.  Each\n");
+	printf("file may come from a server of its own, the default server otherwise.\n");
+	printf("The files are named locally as with 'get'.\n\n");
+
     /* handle the QUIT command */
     } else if (!strcasecmp(command->text[1], "quit")) {
 	printf("Usage: quit\n\n");
@@ -801,6 +1098,60 @@ int command_help(command_t *command, ttp_session_t *session)
 }
 
 
+/*------------------------------------------------------------------------
+ * int command_mget(command_t *command, ttp_parameter_t *parameter);
+ *
+ * Tries to retrieve the remote files given in the command, each of
+ * them named as [host:]file, as many at a time as the parameters say.
+ * Every transfer has a session of its own, so this works without a
+ * connection.  Returns 0 if every file arrived and nonzero otherwise.
+ *------------------------------------------------------------------------*/
+int command_mget(command_t *command, ttp_parameter_t *parameter)
+{
+    ttp_job_t *jobs;
+    char      *names[MAX_COMMAND_WORDS];
+    char      *colon, *slash;
+    u_int32_t  count = command->count - 1;
+    u_int32_t  i;
+    int        status;
+
+    /* make sure that we have remote file names */
+    if (command->count < 2)
+	return warn("Invalid command syntax (use 'help mget' for details)");
+    if (parameter->mirrors != NULL)
+	return warn("MGET does not take mirrors");
+
+    /* split off the hosts, and name the local files as GET does */
+    jobs = (ttp_job_t *) calloc(count, sizeof(ttp_job_t));
+    if (jobs == NULL)
+	error("Could not allocate file list");
+    for (i = 0; i < count; ++i) {
+	names[i] = strdup(command->text[i + 1]);
+	if (names[i] == NULL)
+	    error("Could not allocate file list");
+	colon = strchr(names[i], ':');
+	if (colon != NULL) {
+	    *colon = '\0';
+	    jobs[i].host            = names[i];
+	    jobs[i].remote_filename = colon + 1;
+	} else {
+	    jobs[i].host            = parameter->server_name;
+	    jobs[i].remote_filename = names[i];
+	}
+	slash = strrchr(jobs[i].remote_filename, '/');
+	jobs[i].local_filename = (slash == NULL) ? jobs[i].remote_filename : slash + 1;
+    }
+
+    printf("Getting %u files, %u at a time\n", count, min(max(parameter->concurrent, 1), count));
+    status = concurrent_get(parameter, jobs, count);
+
+    for (i = 0; i < count; ++i)
+	free(names[i]);
+    free(jobs);
+    return status;
+}
+
+
 /*------------------------------------------------------------------------
  * int command_quit(command_t *command, ttp_session_t *session);
  *
@@ -845,24 +1196,31 @@ int command_set(command_t *command, ttp_parameter_t *parameter)
     } else if (!strcasecmp(command->text[1], "port"))       parameter->server_port   = atoi(command->text[2]);
       else if (!strcasecmp(command->text[1], "udpport"))    parameter->client_port   = atoi(command->text[2]);
       else if (!strcasecmp(command->text[1], "buffer"))     parameter->udp_buffer    = atol(command->text[2]);
-      else if (!strcasecmp(command->text[1], "blocksize"))  parameter->block_size    = atol(command->text[2]);
+      else if (!strcasecmp(command->text[1], "blocksize")) {
+        parameter->block_size     = atol(command->text[2]);
+        parameter->block_size_set = 1;
+      }
       else if (!strcasecmp(command->text[1], "verbose"))    parameter->verbose_yn    = (strcmp(command->text[2], "yes") == 0);
       else if (!strcasecmp(command->text[1], "transcript")) parameter->transcript_yn = (strcmp(command->text[2], "yes") == 0);
       else if (!strcasecmp(command->text[1], "ip"))         parameter->ipv6_yn       = (strcmp(command->text[2], "v6")  == 0);
       else if (!strcasecmp(command->text[1], "output"))     parameter->output_mode   = (strcmp(command->text[2], "screen") ? LINE_MODE : SCREEN_MODE);
       else if (!strcasecmp(command->text[1], "rateadjust")) parameter->rate_adjust   = (strcmp(command->text[2], "yes") == 0);
       else if (!strcasecmp(command->text[1], "rate"))       { 
-        long multiplier = 1;
+        double multiplier = 1;
         char *cmd = (char*)command->text[2];
         char cpy[256];
         int l = strlen(cmd);
         strcpy(cpy, cmd);
-        if(l>1 && (toupper(cpy[l-1]))=='M') { 
-            multiplier = 1000000; cpy[l-1]='\0';  
+        if(l>1 && (toupper(cpy[l-1]))=='K') { 
+            multiplier = 1e3; cpy[l-1]='\0';  
+        } else if(l>1 && (toupper(cpy[l-1]))=='M') { 
+            multiplier = 1e6; cpy[l-1]='\0';  
         } else if(l>1 && toupper(cpy[l-1])=='G') { 
-            multiplier = 1000000000; cpy[l-1]='\0';   
+            multiplier = 1e9; cpy[l-1]='\0';   
+        } else if(l>1 && toupper(cpy[l-1])=='T') { 
+            multiplier = 1e12; cpy[l-1]='\0';   
         }
-        parameter->target_rate   = multiplier * atol(cpy); 
+        parameter->target_rate   = (u_int64_t) (multiplier * atof(cpy)); 
       }
       else if (!strcasecmp(command->text[1], "error"))        parameter->error_rate    = atof(command->text[2]) * 1000.0;
       else if (!strcasecmp(command->text[1], "slowdown"))     parse_fraction(command->text[2], &parameter->slower_num, &parameter->slower_den);
@@ -871,6 +1229,57 @@ int command_set(command_t *command, ttp_parameter_t *parameter)
       else if (!strcasecmp(command->text[1], "lossless"))     parameter->lossless      = (strcmp(command->text[2], "yes") == 0);
       else if (!strcasecmp(command->text[1], "losswindow"))   parameter->losswindow_ms = atol(command->text[2]);
       else if (!strcasecmp(command->text[1], "blockdump"))    parameter->blockdump     = (strcmp(command->text[2], "yes") == 0);    
+      else if (!strcasecmp(command->text[1], "timestamps"))   parameter->timestamps    = (strcmp(command->text[2], "yes") == 0);
+      else if (!strcasecmp(command->text[1], "delaytarget"))  parameter->delay_target  = atol(command->text[2]);
+      else if (!strcasecmp(command->text[1], "ecn"))          parameter->ecn           = (strcmp(command->text[2], "yes") == 0);
+      else if (!strcasecmp(command->text[1], "probe"))        parameter->probe_train   = min(atol(command->text[2]), MAX_PROBE_TRAIN);
+      else if (!strcasecmp(command->text[1], "pmtu"))         parameter->pmtu          = (strcmp(command->text[2], "yes") == 0);
+      else if (!strcasecmp(command->text[1], "fecgroup"))     parameter->fec_group     = max(2, min(atol(command->text[2]), MAX_FEC_GROUP));
+      else if (!strcasecmp(command->text[1], "tailcopies"))   parameter->tail_copies   = min(atol(command->text[2]), MAX_TAIL_COPIES);
+      else if (!strcasecmp(command->text[1], "backpressure")) parameter->backpressure  = (strcmp(command->text[2], "yes") == 0);
+      else if (!strcasecmp(command->text[1], "streams"))      parameter->streams       = max(1, min(atol(command->text[2]), MAX_STREAMS));
+      else if (!strcasecmp(command->text[1], "rxqueues"))     parameter->rx_queues     = max(1, min(atol(command->text[2]), MAX_STREAMS));
+      else if (!strcasecmp(command->text[1], "multicast"))    parameter->multicast     = (strcmp(command->text[2], "yes") == 0);
+      else if (!strcasecmp(command->text[1], "relaymap"))     parameter->relaymap      = (strcmp(command->text[2], "yes") == 0);
+      else if (!strcasecmp(command->text[1], "pipeline"))     parameter->pipeline      = (strcmp(command->text[2], "yes") == 0);
+      else if (!strcasecmp(command->text[1], "bundle"))       parameter->bundle        = atol(command->text[2]);
+      else if (!strcasecmp(command->text[1], "concurrent"))   parameter->concurrent    = max(1, min(atol(command->text[2]), MAX_CONCURRENT));
+      else if (!strcasecmp(command->text[1], "resume"))       parameter->resume        = (strcmp(command->text[2], "yes") == 0);
+      else if (!strcasecmp(command->text[1], "sync"))         parameter->sync          = (strcmp(command->text[2], "yes") == 0);
+      else if (!strcasecmp(command->text[1], "fec")) {
+        int fec = get_fec_by_name(command->text[2]);
+        if (fec < 0)
+            warn("Unknown FEC code");
+        else
+            parameter->fec = fec;
+      }
+      else if (!strcasecmp(command->text[1], "congestion")) {
+        int congestion = get_congestion_by_name(command->text[2]);
+        if (congestion < 0)
+            warn("Unknown congestion controller");
+        else
+            parameter->congestion = congestion;
+      }
+      else if (!strcasecmp(command->text[1], "profile")) {
+        if (parameter->profile != NULL) free(parameter->profile);
+        parameter->profile = NULL;
+        if (!strcmp(command->text[2], "yes")) {
+            char  name[MAX_PROFILE_NAME];
+            char *home = getenv("HOME");
+            snprintf(name, sizeof(name), "%s/%s", (home != NULL) ? home : ".", DEFAULT_PROFILE_FILE);
+            parameter->profile = strdup(name);
+        } else if (strcmp(command->text[2], "no")) {
+            parameter->profile = strdup(command->text[2]);
+        }
+      }
+      else if (!strcasecmp(command->text[1], "paths")) {
+        if (parameter->paths != NULL) free(parameter->paths);
+        parameter->paths = strcmp(command->text[2], "none") ? strdup(command->text[2]) : NULL;
+      }
+      else if (!strcasecmp(command->text[1], "mirrors")) {
+        if (parameter->mirrors != NULL) free(parameter->mirrors);
+        parameter->mirrors = strcmp(command->text[2], "none") ? strdup(command->text[2]) : NULL;
+      }
       else if (!strcasecmp(command->text[1], "passphrase")) {
         if (parameter->passphrase != NULL) free(parameter->passphrase);
         parameter->passphrase = strdup(command->text[2]);
@@ -888,7 +1297,7 @@ int command_set(command_t *command, ttp_parameter_t *parameter)
     if (do_all || !strcasecmp(command->text[1], "transcript")) printf("transcript = %s\n",  parameter->transcript_yn ? "yes" : "no");
     if (do_all || !strcasecmp(command->text[1], "ip"))         printf("ip = %s\n",          parameter->ipv6_yn       ? "v6"  : "v4");
     if (do_all || !strcasecmp(command->text[1], "output"))     printf("output = %s\n",      (parameter->output_mode == SCREEN_MODE) ? "screen" : "line");
-    if (do_all || !strcasecmp(command->text[1], "rate"))       printf("rate = %u\n",        parameter->target_rate);
+    if (do_all || !strcasecmp(command->text[1], "rate"))       printf("rate = %llu\n",      (ull_t)parameter->target_rate);
     if (do_all || !strcasecmp(command->text[1], "rateadjust")) printf("rateadjust = %s\n",  parameter->rate_adjust   ? "yes" : "no");
     if (do_all || !strcasecmp(command->text[1], "error"))      printf("error = %0.2f%%\n",  parameter->error_rate / 1000.0);
     if (do_all || !strcasecmp(command->text[1], "slowdown"))   printf("slowdown = %d/%d\n", parameter->slower_num, parameter->slower_den);
@@ -897,6 +1306,31 @@ int command_set(command_t *command, ttp_parameter_t *parameter)
     if (do_all || !strcasecmp(command->text[1], "lossless"))   printf("lossless = %s\n",    parameter->lossless ? "yes" : "no");
     if (do_all || !strcasecmp(command->text[1], "losswindow")) printf("losswindow = %d msec\n", parameter->losswindow_ms);
     if (do_all || !strcasecmp(command->text[1], "blockdump"))  printf("blockdump = %s\n",   parameter->blockdump ? "yes" : "no");
+    if (do_all || !strcasecmp(command->text[1], "congestion")) printf("congestion = %s\n",  CONGESTION_NAMES[parameter->congestion]);
+    if (do_all || !strcasecmp(command->text[1], "timestamps")) printf("timestamps = %s\n",  parameter->timestamps ? "yes" : "no");
+    if (do_all || !strcasecmp(command->text[1], "delaytarget")) printf("delaytarget = %d msec\n", parameter->delay_target);
+    if (do_all || !strcasecmp(command->text[1], "ecn"))        printf("ecn = %s\n",         parameter->ecn ? "yes" : "no");
+    if (do_all || !strcasecmp(command->text[1], "probe"))      printf("probe = %u datagrams\n", parameter->probe_train);
+    if (do_all || !strcasecmp(command->text[1], "pmtu"))       printf("pmtu = %s\n",        parameter->pmtu ? "yes" : "no");
+    if (do_all || !strcasecmp(command->text[1], "fec"))        printf("fec = %s\n",         FEC_NAMES[parameter->fec]);
+    if (do_all || !strcasecmp(command->text[1], "fecgroup"))   printf("fecgroup = %u blocks\n", parameter->fec_group);
+    if (do_all || !strcasecmp(command->text[1], "tailcopies")) printf("tailcopies = %u blocks\n", parameter->tail_copies);
+    if (do_all || !strcasecmp(command->text[1], "backpressure")) printf("backpressure = %s\n", parameter->backpressure ? "yes" : "no");
+    if (do_all || !strcasecmp(command->text[1], "streams")) printf("streams = %u\n", parameter->streams);
+    if (do_all || !strcasecmp(command->text[1], "rxqueues")) printf("rxqueues = %u\n", parameter->rx_queues);
+    if (do_all || !strcasecmp(command->text[1], "paths"))      printf("paths = %s\n",       (parameter->paths == NULL) ? "none" : parameter->paths);
+    if (do_all || !strcasecmp(command->text[1], "mirrors"))    printf("mirrors = %s\n",     (parameter->mirrors == NULL) ? "none" : parameter->mirrors);
+    if (do_all || !strcasecmp(command->text[1], "multicast"))  printf("multicast = %s\n",   parameter->multicast ? "yes" : "no");
+    if (do_all || !strcasecmp(command->text[1], "relaymap"))   printf("relaymap = %s\n",    parameter->relaymap ? "yes" : "no");
+    if (do_all || !strcasecmp(command->text[1], "pipeline"))   printf("pipeline = %s\n",    parameter->pipeline ? "yes" : "no");
+    if (do_all || !strcasecmp(command->text[1], "bundle")) {
+        if (parameter->bundle > 0) printf("bundle = %u bytes\n", parameter->bundle);
+        else                       printf("bundle = no\n");
+    }
+    if (do_all || !strcasecmp(command->text[1], "concurrent")) printf("concurrent = %u\n", parameter->concurrent);
+    if (do_all || !strcasecmp(command->text[1], "resume"))     printf("resume = %s\n",      parameter->resume ? "yes" : "no");
+    if (do_all || !strcasecmp(command->text[1], "sync"))       printf("sync = %s\n",        parameter->sync ? "yes" : "no");
+    if (do_all || !strcasecmp(command->text[1], "profile"))    printf("profile = %s\n",     (parameter->profile == NULL) ? "no" : parameter->profile);
     if (do_all || !strcasecmp(command->text[1], "passphrase")) printf("passphrase = %s\n",  (parameter->passphrase == NULL) ? "default" : "<user-specified>");
     printf("\n");
 
@@ -905,48 +1339,136 @@ int command_set(command_t *command, ttp_parameter_t *parameter)
 }
 
 
+/*------------------------------------------------------------------------
+ * u_int32_t bundle_first(char **names, u_int64_t *sizes, u_int32_t count,
+ *                        u_int64_t largest);
+ *
+ * Moves the files of the given list that are no larger than the given
+ * size to the front of it, in the order of the list, and returns how
+ * many there are.  The others follow in their order.
+ *------------------------------------------------------------------------*/
+u_int32_t bundle_first(char **names, u_int64_t *sizes, u_int32_t count, u_int64_t largest)
+{
+    char      **moved_names = (char **)     malloc(max(count, 1) * sizeof(char *));
+    u_int64_t  *moved_sizes = (u_int64_t *) malloc(max(count, 1) * sizeof(u_int64_t));
+    u_int32_t   small;
+    u_int32_t   i, j;
+
+    if ((moved_names == NULL) || (moved_sizes == NULL))
+        error("Could not allocate file list");
+
+    for (i = 0, j = 0; i < count; ++i)
+        if (sizes[i] <= largest) {
+            moved_names[j]   = names[i];
+            moved_sizes[j++] = sizes[i];
+        }
+    small = j;
+    for (i = 0; i < count; ++i)
+        if (sizes[i] > largest) {
+            moved_names[j]   = names[i];
+            moved_sizes[j++] = sizes[i];
+        }
+
+    memcpy(names, moved_names, count * sizeof(char *));
+    memcpy(sizes, moved_sizes, count * sizeof(u_int64_t));
+    free(moved_names);
+    free(moved_sizes);
+    return small;
+}
+
+
 /*------------------------------------------------------------------------
  * void *disk_thread(void *arg);
  *
  * This is the thread that takes care of saved received blocks to disk.
  * It runs until the network thread sends it a datagram with a block
- * number of 0.  The return value has no meaning.
+ * number of 0, through all the files of a pipelined GET *.  The return
+ * value has no meaning.
  *------------------------------------------------------------------------*/
 void *disk_thread(void *arg)
 {
     ttp_session_t *session = (ttp_session_t *) arg;
+    ring_buffer_t *ring    = session->transfer.ring_buffer;
     u_char        *datagram;
     int            status;
-    u_int32_t      block_index;
-    u_int16_t      block_type;
+    ttp_header_t   header;
+    struct timeval start;
 
     /* while the world is turning */
     while (1) {
 
 	/* get another block */
-	datagram    = ring_peek(session->transfer.ring_buffer);
-	block_index = ntohl(*((u_int32_t *) datagram));
-	block_type  = ntohs(*((u_int16_t *) (datagram + 4)));
+	datagram    = ring_peek(ring);
+	ttp_header_unpack(datagram, &header, session->transfer.header_flags);
 
 	/* quit if we got the mythical 0 block */
-	if (block_index == 0) {
+	if (header.block == 0) {
 	    printf("!!!!\n");
 	    return NULL;
 	}
 
-	/* save it to disk */
-	status = accept_block(session, block_index, datagram + 6);
+	/* save it to disk, timing the write for the server's backpressure */
+	gettimeofday(&start, NULL);
+	status = accept_block(session, header.block, datagram + session->transfer.header_size);
 	if (status < 0) {
 	    warn("Block accept failed");
 	    return NULL;
 	}
+	session->transfer.stats.disk_usec += get_usec_since(&start);
+	session->transfer.stats.disk_blocks++;
 
 	/* pop the block */
-	ring_pop(session->transfer.ring_buffer);
+	ring_pop(ring);
     }
 }
 
 
+/*------------------------------------------------------------------------
+ * int list_files(ttp_session_t *session, char ***names,
+ *                u_int64_t **sizes, u_int32_t *count);
+ *
+ * Asks the server for the list of its shared files and their sizes.
+ * The names and sizes are returned in arrays, which the caller has to
+ * free along with the names.  Returns 0 on success and nonzero on an
+ * error condition, in which case there is nothing to free.
+ *------------------------------------------------------------------------*/
+int list_files(ttp_session_t *session, char ***names, u_int64_t **sizes, u_int32_t *count)
+{
+    u_char    result;
+    char      read_str[2048];
+    u_int32_t i;
+
+    /* send request and parse the result */
+    fprintf(session->server, "%s\n", TS_DIRLIST_HACK_CMD);
+    if (fflush(session->server))
+        return warn("Could not request file list");
+
+    if (fread(&result, 1, 1, session->server) < 1)
+        return warn("Could not read response to directory request");
+    if (result == 8)
+        return warn("Server does no support listing of shared files");
+
+    read_str[0] = result;
+    fread_line(session->server, &read_str[1], sizeof(read_str)-2);
+    *count = strtoul(read_str, NULL, 10);
+
+    *names = (char **)     malloc(max(*count, 1) * sizeof(char *));
+    *sizes = (u_int64_t *) malloc(max(*count, 1) * sizeof(u_int64_t));
+    if ((*names == NULL) || (*sizes == NULL))
+        error("Could not allocate file list");
+    for (i=0; i<*count; i++) {
+        fread_line(session->server, read_str, sizeof(read_str)-1);
+        (*names)[i] = strdup(read_str);
+        fread_line(session->server, read_str, sizeof(read_str)-1);
+        (*sizes)[i] = strtoull(read_str, NULL, 10);
+    }
+
+    fwrite("\0", 1, 1, session->server);
+    fflush(session->server);
+    return 0;
+}
+
+
 /*------------------------------------------------------------------------
  * int parse_fraction(const char *fraction,
  *                    u_int16_t *num, u_int16_t *den);
@@ -974,11 +1496,161 @@ int parse_fraction(const char *fraction, u_int16_t *num, u_int16_t *den)
 
 
 /*------------------------------------------------------------------------
- * int got_block(ttp_session_t* session, u_int32_t blocknr)
+ * void disk_stop(ring_buffer_t *ring, pthread_t disk_thread_id);
+ *
+ * Queues a stop block behind the blocks in the ring and waits for the
+ * disk thread to write those and end.
+ *------------------------------------------------------------------------*/
+void disk_stop(ring_buffer_t *ring, pthread_t disk_thread_id)
+{
+    u_char *datagram;
+
+    /* the disk thread stops at a block 0, whatever the headers */
+    datagram = ring_reserve(ring);
+    memset(datagram, 0, MAX_HEADER_SIZE);
+    if (ring_confirm(ring) < 0)
+	warn("Error in terminating disk thread");
+    if (pthread_join(disk_thread_id, NULL) < 0)
+	warn("Disk thread terminated with error");
+}
+
+
+/*------------------------------------------------------------------------
+ * void pipeline_close(ring_buffer_t *ring, int udp_fd,
+ *                     pthread_t disk_thread_id);
+ *
+ * Lets go of the data port, ring and disk thread that a pipelined
+ * GET * kept for a next file that didn't come about.
+ *------------------------------------------------------------------------*/
+void pipeline_close(ring_buffer_t *ring, int udp_fd, pthread_t disk_thread_id)
+{
+    disk_stop(ring, disk_thread_id);
+    ring_destroy(ring);
+    close(udp_fd);
+}
+
+
+/*------------------------------------------------------------------------
+ * void sample_delay(ttp_transfer_t *xfer, u_int64_t sent);
+ *
+ * Adds the one-way delay of a datagram with the given sender timestamp
+ * to the delay statistics.  The delay contains the unknown offset
+ * between the server and client clocks; it cancels out against the
+ * base delay, which is the minimum over the last DELAY_HISTORY minutes
+ * so that a slow drift between the two clocks ages out.  The timestamp
+ * is also kept to be echoed to the server, which finds the RTT from it.
+ *------------------------------------------------------------------------*/
+void sample_delay(ttp_transfer_t *xfer, u_int64_t sent)
+{
+    statistics_t   *stats = &(xfer->stats);
+    struct timeval  now;
+    int64_t         delay;
+    time_t          minute;
+    int             slot;
+
+    /* find the delay, including the clock offset */
+    gettimeofday(&now, NULL);
+    delay  = (1000000LL * now.tv_sec + now.tv_usec) - (int64_t) sent;
+    minute = now.tv_sec / 60;
+    slot   = minute % DELAY_HISTORY;
+
+    /* update the minimum of this minute */
+    if ((stats->base_minute[slot] != minute) || (delay < stats->base_delay[slot])) {
+        stats->base_minute[slot] = minute;
+        stats->base_delay[slot]  = delay;
+    }
+
+    /* and the mean of this interval */
+    stats->this_delay_sum += delay;
+    stats->this_delay_count++;
+    stats->echo_sent    = sent;
+    stats->echo_arrival = now;
+}
+
+
+/*------------------------------------------------------------------------
+ * int recv_datagram(ttp_transfer_t *xfer, u_char *datagram,
+ *                   size_t length);
+ *
+ * Receives the next datagram of the transfer into the given buffer.
+ * If the data is ECN capable, the TOS byte of the datagram is looked
+ * up in the ancillary data and CE marks are counted in the statistics.
+ * With SO_RXQ_OVFL, the kernel's count of datagrams dropped at the
+ * socket so far comes along as well.  In a multicast group, the
+ * originals come on the group's socket and repairs on our own, and
+ * whichever has a datagram waiting is read; each keeps a drop count
+ * of its own.
+ * Returns the datagram length, or a negative value on failure.
+ *------------------------------------------------------------------------*/
+int recv_datagram(ttp_transfer_t *xfer, u_char *datagram, size_t length)
+{
+    struct msghdr   msg;
+    struct iovec    iov;
+    struct cmsghdr *cmsg;
+    u_char          control[96];
+    int             tos;
+    int             status;
+    int             fd = xfer->udp_fd;
+
+    /* wait for either socket of a multicast group */
+    if (xfer->mcast_fd >= 0) {
+        struct pollfd ready[2];
+        ready[0].fd     = xfer->udp_fd;
+        ready[0].events = POLLIN;
+        ready[1].fd     = xfer->mcast_fd;
+        ready[1].events = POLLIN;
+        status = poll(ready, 2, -1);
+        if (status < 0)
+            return status;
+        if (!(ready[0].revents & POLLIN))
+            fd = xfer->mcast_fd;
+    }
+
+    /* nothing to look at without ECN or the socket drop count */
+    if (!xfer->ecn && !xfer->rxq_ovfl)
+        return recvfrom(fd, datagram, length, 0, NULL, 0);
+
+    /* receive the datagram together with its TOS byte and the drop count */
+    iov.iov_base = datagram;
+    iov.iov_len  = length;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+    status = recvmsg(fd, &msg, 0);
+    if (status < 0)
+        return status;
+
+    /* count the datagrams that a router marked as congestion experienced */
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        #ifdef SO_RXQ_OVFL
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL)) {
+            memcpy((fd == xfer->mcast_fd) ? &xfer->mcast_drops : &xfer->socket_drops, CMSG_DATA(cmsg), sizeof(xfer->socket_drops));
+            continue;
+        }
+        #endif
+        tos = 0;
+        if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_TOS))
+            tos = *(u_char *) CMSG_DATA(cmsg);
+        else if ((cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_TCLASS))
+            memcpy(&tos, CMSG_DATA(cmsg), sizeof(tos));
+        if ((tos & 0x03) == 0x03) {
+            xfer->stats.this_ce_marks++;
+            xfer->stats.total_ce_marks++;
+        }
+    }
+
+    return status;
+}
+
+
+/*------------------------------------------------------------------------
+ * int got_block(ttp_session_t* session, u_int64_t blocknr)
  *
  * Returns non-0 if the block has already been received
  *------------------------------------------------------------------------*/
-inline int got_block(ttp_session_t* session, u_int32_t blocknr)
+inline int got_block(ttp_session_t* session, u_int64_t blocknr)
 {
     if (blocknr > session->transfer.block_count)
         return 1;
@@ -993,8 +1665,9 @@ inline int got_block(ttp_session_t* session, u_int32_t blocknr)
  *------------------------------------------------------------------------*/
 void dump_blockmap(const char *postfix, const ttp_transfer_t *xfer)
 {
-    FILE *fbits;
-    char *fname;
+    FILE     *fbits;
+    char     *fname;
+    u_int32_t count = min(xfer->block_count, 0xffffffffULL);
 
     /* append postfix */
     fname = calloc(strlen(xfer->local_filename) + strlen(postfix) + 1, sizeof(u_char));
@@ -1004,7 +1677,7 @@ void dump_blockmap(const char *postfix, const ttp_transfer_t *xfer)
     /* write: [4 bytes block_count] [map byte 0] [map byte 1] ... [map N (partial final byte)] */
     fbits = fopen(fname, "wb");
     if (fbits != NULL) {
-        fwrite(&xfer->block_count, sizeof(xfer->block_count), 1, fbits);
+        fwrite(&count, sizeof(count), 1, fbits);
         fwrite(xfer->received, sizeof(u_char), xfer->block_count / 8 + 1, fbits);
         fclose(fbits);
     } else {
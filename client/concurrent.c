@@ -0,0 +1,479 @@
+/*========================================================================
+ * concurrent.c  --  Runs several transfers at once.
+ *
+ * With 'set concurrent', GET * and MGET get up to that many files at
+ * the same time, each over a session of its own with its server: a
+ * worker thread per slot takes the next file of the list, connects to
+ * its server unless it is there already and gets the file as a plain
+ * GET would.  What the transfers share is looked after here.
+ *
+ * The target rate is split among the transfers that are running, so
+ * that together they don't ask for more than one transfer would.  At
+ * every report, a transfer that delivers well below an even split is
+ * given a little more than it delivers (SHARE_HEADROOM) and the rest
+ * is split evenly among the others, over and over until the shares
+ * settle, as in max-min fair sharing.  Servers that take TS_OPT_RATE_SHARE
+ * are told of a new share with REQUEST_TARGET_RATE; older ones keep
+ * the share the transfer started with.
+ *
+ * The blocks of all transfers are written by a single disk engine
+ * thread instead of a disk thread each: it takes turns among the rings
+ * that have blocks waiting, up to ENGINE_BATCH blocks at a time, so
+ * that the transfers don't fight over the disk.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <pthread.h>      /* for the pthreads library              */
+#include <signal.h>       /* for signal()                          */
+#include <stdlib.h>       /* for *alloc() and free()               */
+#include <string.h>       /* for standard string routines          */
+#include <sys/time.h>     /* for gettimeofday()                    */
+
+#include <tsunami-client.h>
+
+/* a worker thread, which runs the transfers of one slot one after the other */
+typedef struct {
+    ttp_concurrent_t   *concurrent;               /* the transfers it is one of                  */
+    u_int16_t           slot;                     /* its slot among them                         */
+    ttp_parameter_t     parameter;                /* the parameters of its session               */
+    ttp_session_t      *session;                  /* the session with its server, or NULL        */
+    pthread_t           thread;                   /* the thread itself                           */
+} ttp_worker_t;
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+void   concurrent_allocate(ttp_concurrent_t *concurrent);
+void  *concurrent_engine  (void *arg);
+void   concurrent_hangup  (ttp_worker_t *worker);
+double concurrent_join    (ttp_concurrent_t *concurrent, u_int16_t slot);
+void   concurrent_leave   (ttp_concurrent_t *concurrent, u_int16_t slot);
+void  *concurrent_worker  (void *arg);
+
+
+/*------------------------------------------------------------------------
+ * void concurrent_attach(ttp_session_t *session);
+ *
+ * Has the disk engine write the blocks of the transfer of the given
+ * session from now on.
+ *------------------------------------------------------------------------*/
+void concurrent_attach(ttp_session_t *session)
+{
+    ttp_concurrent_t *concurrent = session->concurrent;
+
+    pthread_mutex_lock(&concurrent->lock);
+    concurrent->writer[session->slot]      = session;
+    session->transfer.ring_buffer->engine = concurrent;
+    pthread_mutex_unlock(&concurrent->lock);
+}
+
+
+/*------------------------------------------------------------------------
+ * void concurrent_detach(ttp_session_t *session);
+ *
+ * Takes the transfer of the given session away from the disk engine,
+ * once the engine is through with the blocks it is writing.  Blocks
+ * still in the ring are left there.  Nothing happens if the transfer
+ * is not attached.
+ *------------------------------------------------------------------------*/
+void concurrent_detach(ttp_session_t *session)
+{
+    ttp_concurrent_t *concurrent = session->concurrent;
+    ring_buffer_t    *ring       = session->transfer.ring_buffer;
+
+    if ((concurrent == NULL) || (ring == NULL) || (ring->engine == NULL))
+	return;
+
+    pthread_mutex_lock(&concurrent->lock);
+    while (concurrent->busy == session)
+	pthread_cond_wait(&concurrent->wake, &concurrent->lock);
+    concurrent->writer[session->slot] = NULL;
+    concurrent->pending -= min(concurrent->pending, (u_int32_t) ring->count_data);
+    ring->engine = NULL;
+    pthread_mutex_unlock(&concurrent->lock);
+}
+
+
+/*------------------------------------------------------------------------
+ * int concurrent_get(ttp_parameter_t *parameter, const ttp_job_t *jobs,
+ *                    u_int32_t count);
+ *
+ * Gets the given files, as many of them at once as the parameters say
+ * and with their target rate split among them.  Returns 0 if every
+ * file arrived and non-zero otherwise.
+ *------------------------------------------------------------------------*/
+int concurrent_get(ttp_parameter_t *parameter, const ttp_job_t *jobs, u_int32_t count)
+{
+    ttp_concurrent_t  concurrent;
+    ttp_worker_t     *workers;
+    u_int16_t         running = min(min(max(parameter->concurrent, 1), MAX_CONCURRENT), count);
+    struct timeval    start;
+    double            time_secs;
+    u_int16_t         i;
+
+    if (count == 0)
+	return 0;
+
+    memset(&concurrent, 0, sizeof(concurrent));
+    if ((pthread_mutex_init(&concurrent.lock, NULL) != 0) || (pthread_cond_init(&concurrent.wake, NULL) != 0))
+	error("Could not create lock for concurrent transfers");
+    concurrent.total_rate = parameter->target_rate;
+    concurrent.jobs       = jobs;
+    concurrent.job_count  = count;
+
+    workers = (ttp_worker_t *) calloc(running, sizeof(ttp_worker_t));
+    if (workers == NULL)
+	error("Could not allocate concurrent transfers");
+
+    /* a server that goes away must not take the other transfers with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* start the disk engine and the workers, each with a session of its own */
+    gettimeofday(&start, NULL);
+    if (pthread_create(&concurrent.engine, NULL, concurrent_engine, &concurrent) != 0)
+	error("Could not create disk engine thread");
+    for (i = 0; i < running; ++i) {
+	workers[i].concurrent            = &concurrent;
+	workers[i].slot                  = i;
+	workers[i].parameter             = *parameter;
+	workers[i].parameter.server_name = NULL;
+	workers[i].parameter.mirrors     = NULL;
+	workers[i].parameter.profile     = NULL;
+	workers[i].parameter.rate_adjust = 0;
+	if (pthread_create(&workers[i].thread, NULL, concurrent_worker, &workers[i]) != 0)
+	    error("Could not create transfer thread");
+    }
+
+    /* and wait for them to run out of files */
+    for (i = 0; i < running; ++i)
+	pthread_join(workers[i].thread, NULL);
+    pthread_mutex_lock(&concurrent.lock);
+    concurrent.engine_stop = 1;
+    pthread_cond_broadcast(&concurrent.wake);
+    pthread_mutex_unlock(&concurrent.lock);
+    pthread_join(concurrent.engine, NULL);
+
+    time_secs = get_usec_since(&start) / 1e6;
+    printf("Received %u of %u files, %0.2f Mbit in %0.2f seconds at %0.2f Mbps, %u at a time\n",
+	   count - concurrent.job_failed, count, 8.0 * concurrent.bytes / (1024.0 * 1024.0), time_secs,
+	   8.0 * concurrent.bytes / (1024.0 * 1024.0) / max(time_secs, 1e-6), running);
+
+    free(workers);
+    pthread_cond_destroy(&concurrent.wake);
+    pthread_mutex_destroy(&concurrent.lock);
+    return (concurrent.job_failed > 0) ? -1 : 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void concurrent_notify(ttp_concurrent_t *concurrent);
+ *
+ * Tells the disk engine that another block is waiting in a ring.
+ *------------------------------------------------------------------------*/
+void concurrent_notify(ttp_concurrent_t *concurrent)
+{
+    pthread_mutex_lock(&concurrent->lock);
+    ++concurrent->pending;
+    pthread_cond_signal(&concurrent->wake);
+    pthread_mutex_unlock(&concurrent->lock);
+}
+
+
+/*------------------------------------------------------------------------
+ * int concurrent_report(ttp_session_t *session);
+ *
+ * Enters the rate that the transfer of the given session delivered in
+ * the last interval, splits the target rate anew and tells the server
+ * the share of the transfer if it changed enough.  Returns 0 on success
+ * and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int concurrent_report(ttp_session_t *session)
+{
+    ttp_concurrent_t *concurrent = session->concurrent;
+    ttp_parameter_t  *param      = session->parameter;
+    retransmission_t  retransmission;
+    u_int64_t         rate;
+    double            share;
+
+    if (concurrent == NULL)
+	return 0;
+
+    /* the startup of a transfer says nothing about what it could take */
+    pthread_mutex_lock(&concurrent->lock);
+    if (++concurrent->reports[session->slot] >= SHARE_SETTLE)
+	concurrent->demand[session->slot] = max(session->transfer.stats.this_transmit_rate * 1024.0 * 1024.0, 1.0);
+    concurrent_allocate(concurrent);
+    share = concurrent->share[session->slot];
+    pthread_mutex_unlock(&concurrent->lock);
+
+    if (!session->transfer.rate_share || (share < 1.0) ||
+	((share > (1.0 - SHARE_CHANGE) * param->target_rate) && (share < (1.0 + SHARE_CHANGE) * param->target_rate)))
+	return 0;
+
+    /* the new target goes where the block number would */
+    rate = (u_int64_t) share;
+    param->target_rate = rate;
+    memset(&retransmission, 0, sizeof(retransmission));
+    retransmission.request_type = htons(REQUEST_TARGET_RATE);
+    retransmission.block        = htonl((u_int32_t) rate);
+    retransmission.block_high   = htonl((u_int32_t) (rate >> 32));
+    if ((fwrite(&retransmission, sizeof(retransmission), 1, session->server) < 1) || fflush(session->server))
+	return warn("Could not send new target rate");
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void concurrent_allocate(ttp_concurrent_t *concurrent);
+ *
+ * Splits the total target rate among the running transfers.  Those
+ * that deliver well below what the others get are held to a little
+ * more than they deliver, but never below SHARE_FLOOR of an even split
+ * so that one that stalled for a moment gets going again quickly.  The
+ * caller holds the lock.
+ *------------------------------------------------------------------------*/
+void concurrent_allocate(ttp_concurrent_t *concurrent)
+{
+    u_char    held[MAX_CONCURRENT];
+    double    left  = concurrent->total_rate;
+    double    floor, want;
+    u_int16_t count = 0;
+    u_int16_t open, settled;
+    int       i;
+
+    for (i = 0; i < MAX_CONCURRENT; ++i)
+	count += concurrent->active[i];
+    if (count == 0)
+	return;
+    floor = SHARE_FLOOR * concurrent->total_rate / count;
+    memset(held, 0, sizeof(held));
+
+    /* hold the slow ones to what they take, until no one else is slow next to the even split of the rest */
+    open = count;
+    do {
+	settled = 0;
+	for (i = 0; i < MAX_CONCURRENT; ++i) {
+	    if (!concurrent->active[i] || held[i] || (concurrent->demand[i] == 0.0) || (open <= 1))
+		continue;
+	    want = max(SHARE_HEADROOM * concurrent->demand[i], floor);
+	    if (want < left / open) {
+		concurrent->share[i] = want;
+		left -= want;
+		held[i] = 1;
+		--open;
+		++settled;
+	    }
+	}
+    } while (settled > 0);
+
+    /* and split the rest among the others */
+    for (i = 0; i < MAX_CONCURRENT; ++i)
+	if (concurrent->active[i] && !held[i])
+	    concurrent->share[i] = left / open;
+}
+
+
+/*------------------------------------------------------------------------
+ * void *concurrent_engine(void *arg);
+ *
+ * This is the disk engine thread, which writes out the blocks of every
+ * attached transfer, taking turns among them.  It runs until it is
+ * told to stop and no blocks are pending.  The return value has no
+ * meaning.
+ *------------------------------------------------------------------------*/
+void *concurrent_engine(void *arg)
+{
+    ttp_concurrent_t *concurrent = (ttp_concurrent_t *) arg;
+    ttp_session_t    *session;
+    ring_buffer_t    *ring;
+    u_char           *datagram;
+    ttp_header_t      header;
+    struct timeval    start;
+    u_int32_t         written;
+    int               i, slot;
+
+    pthread_mutex_lock(&concurrent->lock);
+    while (1) {
+
+	/* wait for a block */
+	while ((concurrent->pending == 0) && !concurrent->engine_stop)
+	    pthread_cond_wait(&concurrent->wake, &concurrent->lock);
+	if (concurrent->pending == 0)
+	    break;
+
+	/* find the next transfer that has one, a block may have gone out before we heard of it */
+	session = NULL;
+	for (i = 0; (i < MAX_CONCURRENT) && (session == NULL); ++i) {
+	    slot = (concurrent->turn + i) % MAX_CONCURRENT;
+	    if ((concurrent->writer[slot] != NULL) && (concurrent->writer[slot]->transfer.ring_buffer->count_data > 0)) {
+		session          = concurrent->writer[slot];
+		concurrent->turn = (slot + 1) % MAX_CONCURRENT;
+	    }
+	}
+	if (session == NULL) {
+	    concurrent->pending = 0;
+	    continue;
+	}
+	concurrent->busy = session;
+	pthread_mutex_unlock(&concurrent->lock);
+
+	/* write a batch of its blocks, timing the writes as the disk thread does */
+	ring = session->transfer.ring_buffer;
+	for (written = 0; (written < ENGINE_BATCH) && (ring->count_data > 0); ++written) {
+	    datagram = ring_peek(ring);
+	    ttp_header_unpack(datagram, &header, session->transfer.header_flags);
+	    gettimeofday(&start, NULL);
+	    if (accept_block(session, header.block, datagram + session->transfer.header_size) < 0)
+		warn("Block accept failed");
+	    session->transfer.stats.disk_usec += get_usec_since(&start);
+	    session->transfer.stats.disk_blocks++;
+	    ring_pop(ring);
+	}
+
+	/* and let a transfer waiting to detach go on */
+	pthread_mutex_lock(&concurrent->lock);
+	concurrent->pending -= min(concurrent->pending, written);
+	concurrent->busy     = NULL;
+	pthread_cond_broadcast(&concurrent->wake);
+    }
+    pthread_mutex_unlock(&concurrent->lock);
+
+    return NULL;
+}
+
+
+/*------------------------------------------------------------------------
+ * void concurrent_hangup(ttp_worker_t *worker);
+ *
+ * Closes the session of the given worker, if it has one.
+ *------------------------------------------------------------------------*/
+void concurrent_hangup(ttp_worker_t *worker)
+{
+    if (worker->session == NULL)
+	return;
+
+    command_close(NULL, worker->session);
+    free(worker->session);
+    free(worker->parameter.server_name);
+    worker->session              = NULL;
+    worker->parameter.server_name = NULL;
+}
+
+
+/*------------------------------------------------------------------------
+ * double concurrent_join(ttp_concurrent_t *concurrent, u_int16_t slot);
+ *
+ * Enters a new transfer in the given slot and returns the target rate
+ * it starts with (bps).
+ *------------------------------------------------------------------------*/
+double concurrent_join(ttp_concurrent_t *concurrent, u_int16_t slot)
+{
+    double share;
+
+    pthread_mutex_lock(&concurrent->lock);
+    concurrent->active [slot] = 1;
+    concurrent->reports[slot] = 0;
+    concurrent->demand [slot] = 0.0;
+    concurrent_allocate(concurrent);
+    share = concurrent->share[slot];
+    pthread_mutex_unlock(&concurrent->lock);
+
+    return share;
+}
+
+
+/*------------------------------------------------------------------------
+ * void concurrent_leave(ttp_concurrent_t *concurrent, u_int16_t slot);
+ *
+ * Takes the transfer in the given slot out of the split of the target
+ * rate, so that the others get its share at their next report.
+ *------------------------------------------------------------------------*/
+void concurrent_leave(ttp_concurrent_t *concurrent, u_int16_t slot)
+{
+    pthread_mutex_lock(&concurrent->lock);
+    concurrent->active[slot] = 0;
+    concurrent_allocate(concurrent);
+    pthread_mutex_unlock(&concurrent->lock);
+}
+
+
+/*------------------------------------------------------------------------
+ * void *concurrent_worker(void *arg);
+ *
+ * This is a worker thread, which gets one file of the list after the
+ * other until none are left.  It keeps its session while the files
+ * come from the same server.  The return value has no meaning.
+ *------------------------------------------------------------------------*/
+void *concurrent_worker(void *arg)
+{
+    ttp_worker_t     *worker     = (ttp_worker_t *) arg;
+    ttp_concurrent_t *concurrent = worker->concurrent;
+    const ttp_job_t  *job;
+    command_t         command;
+    char              port[8];
+    u_int32_t         number;
+    int               status;
+
+    while (1) {
+
+	/* take the next file */
+	pthread_mutex_lock(&concurrent->lock);
+	if (concurrent->job_next == concurrent->job_count) {
+	    pthread_mutex_unlock(&concurrent->lock);
+	    break;
+	}
+	job    = &concurrent->jobs[concurrent->job_next];
+	number = ++concurrent->job_next;
+	pthread_mutex_unlock(&concurrent->lock);
+
+	/* and get to its server, unless we are there already */
+	if ((worker->session != NULL) && strcmp(worker->parameter.server_name, job->host))
+	    concurrent_hangup(worker);
+	if (worker->session == NULL) {
+	    snprintf(port, sizeof(port), "%u", worker->parameter.server_port);
+	    command.count   = 3;
+	    command.text[0] = "connect";
+	    command.text[1] = job->host;
+	    command.text[2] = port;
+	    worker->session = command_connect(&command, &worker->parameter);
+	    if (worker->session == NULL) {
+		free(worker->parameter.server_name);
+		worker->parameter.server_name = NULL;
+		pthread_mutex_lock(&concurrent->lock);
+		++concurrent->job_failed;
+		pthread_mutex_unlock(&concurrent->lock);
+		continue;
+	    }
+	    worker->session->concurrent = concurrent;
+	    worker->session->slot       = worker->slot;
+	}
+
+	/* get it as a plain GET would, with a share of the target rate */
+	printf("File %u of %u: '%s' from %s\n", number, concurrent->job_count, job->remote_filename, job->host);
+	command.count   = 3;
+	command.text[0] = "get";
+	command.text[1] = job->remote_filename;
+	command.text[2] = job->local_filename;
+	worker->parameter.target_rate = concurrent_join(concurrent, worker->slot);
+	status = command_get(&command, worker->session);
+	concurrent_leave(concurrent, worker->slot);
+
+	/* a failed transfer may have left the session in a muddle */
+	pthread_mutex_lock(&concurrent->lock);
+	if (status < 0)
+	    ++concurrent->job_failed;
+	else
+	    concurrent->bytes += worker->session->transfer.file_size;
+	pthread_mutex_unlock(&concurrent->lock);
+	if (status < 0)
+	    concurrent_hangup(worker);
+    }
+
+    concurrent_hangup(worker);
+    return NULL;
+}
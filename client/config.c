@@ -93,6 +93,25 @@ const u_char     DEFAULT_LOSSLESS      = 1;            /* default to lossless tr
 const u_int32_t  DEFAULT_LOSSWINDOW_MS = 1000;         /* default time window (msec) for semi-lossless */
 
 const u_char     DEFAULT_BLOCKDUMP     = 0;            /* on default do not write bitmap dump to file  */
+const u_int16_t  DEFAULT_CONGESTION    = TS_CC_TSUNAMI;/* default to the classic error rate controller */
+const u_char     DEFAULT_TIMESTAMPS    = 0;            /* on default no sender timestamps in datagrams */
+const u_int32_t  DEFAULT_DELAY_TARGET  = 25;           /* a scavenger transfer tolerates 25ms of queue */
+const u_char     DEFAULT_ECN           = 0;            /* on default the data is not ECN capable       */
+const u_int32_t  DEFAULT_PROBE_TRAIN   = 32;           /* probe the path with 32 datagrams at startup  */
+const u_char     DEFAULT_PMTU          = 1;            /* on default avoid IP fragmentation of blocks  */
+const u_int16_t  DEFAULT_FEC           = TS_FEC_NONE;  /* on default no parity, only retransmissions   */
+const u_int32_t  DEFAULT_FEC_GROUP     = 16;           /* parity over groups of 16 blocks              */
+const u_int32_t  DEFAULT_TAIL_COPIES   = 0;            /* on default the final blocks are sent once    */
+const u_char     DEFAULT_BACKPRESSURE  = 1;            /* on default the server paces to our headroom  */
+const u_char     DEFAULT_MULTICAST     = 0;            /* on default the data comes by unicast         */
+const u_char     DEFAULT_RELAYMAP      = 0;            /* on default no relay map is kept              */
+const u_char     DEFAULT_PIPELINE      = 1;            /* on default GET * keeps the data port         */
+const u_int32_t  DEFAULT_BUNDLE        = 0;            /* on default GET * asks for each file alone    */
+const u_int16_t  DEFAULT_STREAMS       = 1;            /* on default all data comes over one socket    */
+const u_int16_t  DEFAULT_RX_QUEUES     = 1;            /* on default one thread receives the data port */
+const u_int16_t  DEFAULT_CONCURRENT    = 1;            /* on default one transfer at a time            */
+const u_char     DEFAULT_RESUME        = 0;            /* on default interrupted transfers start over  */
+const u_char     DEFAULT_SYNC          = 0;            /* on default an existing copy is overwritten   */
 
 const int        MAX_COMMAND_LENGTH    = 1024;         /* maximum length of a single command           */
 
@@ -132,6 +151,25 @@ void reset_client(ttp_parameter_t *parameter)
     parameter->lossless      = DEFAULT_LOSSLESS;
     parameter->losswindow_ms = DEFAULT_LOSSWINDOW_MS;
     parameter->blockdump     = DEFAULT_BLOCKDUMP;
+    parameter->congestion    = DEFAULT_CONGESTION;
+    parameter->timestamps    = DEFAULT_TIMESTAMPS;
+    parameter->delay_target  = DEFAULT_DELAY_TARGET;
+    parameter->ecn           = DEFAULT_ECN;
+    parameter->probe_train   = DEFAULT_PROBE_TRAIN;
+    parameter->pmtu          = DEFAULT_PMTU;
+    parameter->fec           = DEFAULT_FEC;
+    parameter->fec_group     = DEFAULT_FEC_GROUP;
+    parameter->tail_copies   = DEFAULT_TAIL_COPIES;
+    parameter->backpressure  = DEFAULT_BACKPRESSURE;
+    parameter->streams       = DEFAULT_STREAMS;
+    parameter->rx_queues     = DEFAULT_RX_QUEUES;
+    parameter->multicast     = DEFAULT_MULTICAST;
+    parameter->relaymap      = DEFAULT_RELAYMAP;
+    parameter->pipeline      = DEFAULT_PIPELINE;
+    parameter->bundle        = DEFAULT_BUNDLE;
+    parameter->concurrent    = DEFAULT_CONCURRENT;
+    parameter->resume        = DEFAULT_RESUME;
+    parameter->sync          = DEFAULT_SYNC;
 
     /* make sure the strdup() worked */
     if (parameter->server_name == NULL)
@@ -0,0 +1,282 @@
+/*========================================================================
+ * fec.c  --  Forward error correction for Tsunami client.
+ *
+ * With FEC negotiated, the client keeps copies of the data blocks of
+ * the last FEC_WINDOW groups together with the parity blocks that came
+ * in for them (see common/fec.c for the codes).  As soon as a group
+ * has as many parity blocks as it misses data blocks, the missing ones
+ * are rebuilt and go to the disk thread like received blocks.
+ *
+ * Gaps in the group that is still arriving are not asked for right
+ * away: its parity is yet to come.  The server sends the parity of a
+ * group before the first block of the next one, so when an original
+ * block of a newer group shows up, whatever the older group still
+ * misses is requested for retransmission after all.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <stdlib.h>       /* for *alloc() and free()               */
+#include <string.h>       /* for memcpy()                          */
+
+#include <tsunami-client.h>
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+int         fec_close  (ttp_session_t *session, u_int64_t group);
+int         fec_deliver(ttp_session_t *session, u_int64_t block, const u_char *data);
+int         fec_repair (ttp_session_t *session, fec_slot_t *slot);
+fec_slot_t *fec_slot   (ttp_session_t *session, u_int64_t group, int take_over);
+
+
+/*------------------------------------------------------------------------
+ * int fec_accept_block(ttp_session_t *session, u_int64_t block,
+ *                      u_int16_t type, const u_char *data);
+ *
+ * Adds a data block that just came in to its FEC group and tries to
+ * repair the group.  Original blocks of a new group also close the
+ * group before it, see above.  Returns the number of blocks rebuilt,
+ * or -1 if a retransmission request failed.
+ *------------------------------------------------------------------------*/
+int fec_accept_block(ttp_session_t *session, u_int64_t block, u_int16_t type, const u_char *data)
+{
+    ttp_transfer_t *xfer   = &session->transfer;
+    u_int32_t       size   = session->parameter->block_size;
+    u_int64_t       group  = (block - 1) / xfer->fec_group;
+    u_int32_t       column = (block - 1) % xfer->fec_group;
+    fec_slot_t     *slot;
+
+    /* originals of a newer group mean that the parity of the current one has been sent */
+    if ((type != TS_BLOCK_RETRANSMISSION) && (group > xfer->fec_current)) {
+	if (fec_close(session, xfer->fec_current) < 0)
+	    return -1;
+	xfer->fec_current = group;
+    }
+
+    /* retransmissions are only kept for groups that are still open */
+    slot = fec_slot(session, group, (type == TS_BLOCK_RETRANSMISSION) ? 0 : 2);
+    if (slot == NULL)
+	return 0;
+
+    if (!slot->have[column]) {
+	memcpy(slot->data + column * size, data, size);
+	slot->have[column] = 1;
+	slot->present++;
+    }
+
+    return fec_repair(session, slot);
+}
+
+
+/*------------------------------------------------------------------------
+ * int fec_accept_parity(ttp_session_t *session, u_int64_t number,
+ *                       const u_char *data);
+ *
+ * Adds the parity block with the given block number (see
+ * parity_block()) to its FEC group and tries to repair the group.
+ * Returns the number of blocks rebuilt.
+ *------------------------------------------------------------------------*/
+int fec_accept_parity(ttp_session_t *session, u_int64_t number, const u_char *data)
+{
+    ttp_transfer_t *xfer  = &session->transfer;
+    u_int32_t       size  = session->parameter->block_size;
+    u_int64_t       group = number / MAX_FEC_PARITY;
+    u_int16_t       row   = number % MAX_FEC_PARITY;
+    fec_slot_t     *slot;
+    u_int32_t       i;
+
+    if (group * xfer->fec_group >= xfer->block_count)
+	return 0;
+
+    slot = fec_slot(session, group, 1);
+    if (slot == NULL)
+	return 0;
+    for (i = 0; i < slot->parities; ++i)
+	if (slot->rows[i] == row)
+	    return 0;
+
+    memcpy(slot->data + (xfer->fec_group + slot->parities) * size, data, size);
+    slot->rows[slot->parities++] = row;
+
+    return fec_repair(session, slot);
+}
+
+
+/*------------------------------------------------------------------------
+ * int fec_init(ttp_session_t *session);
+ *
+ * Allocates the FEC groups for a new transfer.  Returns 0 on success
+ * and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int fec_init(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    size_t          room = (size_t) (xfer->fec_group + MAX_FEC_PARITY) * session->parameter->block_size;
+    int             i;
+
+    xfer->fec_slots  = (fec_slot_t *) calloc(FEC_WINDOW, sizeof(fec_slot_t));
+    xfer->fec_buffer = (u_char *) malloc(FEC_WINDOW * room);
+    if ((xfer->fec_slots == NULL) || (xfer->fec_buffer == NULL))
+	return warn("Could not allocate FEC groups");
+
+    for (i = 0; i < FEC_WINDOW; ++i)
+	xfer->fec_slots[i].data = xfer->fec_buffer + i * room;
+    xfer->fec_current = 0;
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int fec_pending(ttp_session_t *session, u_int64_t block);
+ *
+ * Returns non-zero if the given block belongs to the group that is
+ * still arriving, whose parity may yet rebuild it, and 0 if it should
+ * be asked for now.
+ *------------------------------------------------------------------------*/
+int fec_pending(ttp_session_t *session, u_int64_t block)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+
+    return (xfer->fec != TS_FEC_NONE) && ((block - 1) / xfer->fec_group >= xfer->fec_current);
+}
+
+
+/*------------------------------------------------------------------------
+ * int fec_close(ttp_session_t *session, u_int64_t group);
+ *
+ * Requests the blocks of the given group that neither came in nor
+ * could be rebuilt, as far as they were passed over (the rest is up
+ * to the gap detection).  Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int fec_close(ttp_session_t *session, u_int64_t group)
+{
+    ttp_transfer_t *xfer  = &session->transfer;
+    u_int64_t       block = group * xfer->fec_group + 1;
+    u_int64_t       last  = min((group + 1) * xfer->fec_group, xfer->block_count);
+
+    /* lossy transfers don't ask for anything */
+    if (!session->parameter->lossless && (session->parameter->losswindow_ms == 0))
+	return 0;
+
+    for (; (block <= last) && (block < xfer->next_block); ++block)
+	if (!got_block(session, block) && (ttp_request_retransmit(session, block) < 0))
+	    return warn("Retransmission request failed");
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int fec_deliver(ttp_session_t *session, u_int64_t block,
+ *                 const u_char *data);
+ *
+ * Queues a rebuilt block for the disk thread and marks it as received.
+ * If the ring buffer is full, the block is left to be retransmitted.
+ * Returns 1 if the block was queued and 0 otherwise.
+ *------------------------------------------------------------------------*/
+int fec_deliver(ttp_session_t *session, u_int64_t block, const u_char *data)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    ttp_header_t    header;
+    u_char         *datagram;
+
+    if (ring_full(xfer->ring_buffer))
+	return 0;
+
+    memset(&header, 0, sizeof(header));
+    header.block = block;
+    header.type  = TS_BLOCK_RETRANSMISSION;
+    datagram = ring_reserve(xfer->ring_buffer);
+    ttp_header_pack(datagram, &header, xfer->header_flags);
+    memcpy(datagram + xfer->header_size, data, session->parameter->block_size);
+    if (ring_confirm(xfer->ring_buffer) < 0)
+	return warn("Error in accepting rebuilt block");
+
+    xfer->received[block / 8] |= (1 << (block % 8));
+    if (xfer->blocks_left > 0)
+	--(xfer->blocks_left);
+    xfer->stats.this_fec_recovered++;
+    xfer->stats.total_fec_recovered++;
+
+    return 1;
+}
+
+
+/*------------------------------------------------------------------------
+ * int fec_repair(ttp_session_t *session, fec_slot_t *slot);
+ *
+ * Rebuilds the missing data blocks of the group in the given slot if
+ * there are enough parity blocks for it.  Returns the number of blocks
+ * rebuilt.
+ *------------------------------------------------------------------------*/
+int fec_repair(ttp_session_t *session, fec_slot_t *slot)
+{
+    ttp_transfer_t *xfer  = &session->transfer;
+    u_int32_t       size  = session->parameter->block_size;
+    u_int64_t       first = slot->group * xfer->fec_group + 1;
+    u_int32_t       k     = min(xfer->fec_group, xfer->block_count - first + 1);
+    u_char         *data[MAX_FEC_GROUP];
+    u_char         *parity[MAX_FEC_PARITY];
+    u_int32_t       i, wanted = 0;
+    int             count = 0;
+
+    /* see if there is anything to do, and whether it can be done */
+    if ((slot->parities == 0) || (slot->present >= k) || (k - slot->present > slot->parities))
+	return 0;
+    for (i = 0; i < k; ++i)
+	if (!slot->have[i] && !got_block(session, first + i))
+	    ++wanted;
+    if (wanted == 0)
+	return 0;
+
+    for (i = 0; i < k; ++i)
+	data[i] = slot->data + i * size;
+    for (i = 0; i < slot->parities; ++i)
+	parity[i] = slot->data + (xfer->fec_group + i) * size;
+    if (fec_decode(xfer->fec, k, data, slot->have, parity, slot->rows, slot->parities, size) <= 0)
+	return 0;
+
+    /* the parity was used up as scratch space, the group is complete now */
+    slot->parities = 0;
+    for (i = 0; i < k; ++i)
+	if (!slot->have[i]) {
+	    slot->have[i] = 1;
+	    slot->present++;
+	    if (!got_block(session, first + i))
+		count += fec_deliver(session, first + i, data[i]);
+	}
+
+    return count;
+}
+
+
+/*------------------------------------------------------------------------
+ * fec_slot_t *fec_slot(ttp_session_t *session, u_int64_t group,
+ *                      int take_over);
+ *
+ * Returns the slot that holds the given group.  If it holds another
+ * group, it is cleared for this one if take_over is non-zero and the
+ * other group is older (or take_over is 2 and the other group is any
+ * other), and NULL is returned otherwise.
+ *------------------------------------------------------------------------*/
+fec_slot_t *fec_slot(ttp_session_t *session, u_int64_t group, int take_over)
+{
+    fec_slot_t *slot = &session->transfer.fec_slots[group % FEC_WINDOW];
+
+    if (slot->used && (slot->group == group))
+	return slot;
+    if (slot->used && ((take_over == 0) || ((take_over == 1) && (slot->group > group))))
+	return NULL;
+
+    slot->used     = 1;
+    slot->group    = group;
+    slot->present  = 0;
+    slot->parities = 0;
+    memset(slot->have, 0, sizeof(slot->have));
+    return slot;
+}
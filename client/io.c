@@ -60,16 +60,28 @@
  * INFORMATION GENERATED USING SOFTWARE.
  *========================================================================*/
 
+#include <errno.h>       /* for errno                      */
+#include <fcntl.h>       /* for open()                     */
+#include <stdlib.h>      /* for free()                     */
+#include <string.h>      /* for memcpy()                   */
+#include <sys/mman.h>    /* for mmap()                     */
+#include <sys/stat.h>    /* for mkdir()                    */
+#include <unistd.h>      /* for ftruncate(), getpid()      */
+
 #include <tsunami-client.h>
 
 /*------------------------------------------------------------------------
  * int accept_block(ttp_session_t *session,
- *                  u_int32_t block_index, u_char *block);
+ *                  u_int64_t block_index, u_char *block);
  *
  * Accepts the given block of data, which involves writing the block
- * to disk.  Returns 0 on success and nonzero on failure.
+ * to disk.  With a relay map, the block is flushed out and marked in
+ * the map, so that the relaying server can pick it up from the file.
+ * With a journal, the block goes into it as well.  The blocks of a
+ * bundle go into the files they are made of.
+ * Returns 0 on success and nonzero on failure.
  *------------------------------------------------------------------------*/
-int accept_block(ttp_session_t *session, u_int32_t block_index, u_char *block)
+int accept_block(ttp_session_t *session, u_int64_t block_index, u_char *block)
 {
     ttp_transfer_t  *transfer   = &session->transfer;
     u_int32_t        block_size = session->parameter->block_size;
@@ -100,19 +112,34 @@ int accept_block(ttp_session_t *session, u_int32_t block_index, u_char *block)
     #endif
  
     #ifndef DEBUG_DISKLESS
+    /* a bundle has no file of its own */
+    if (session->bundle != NULL)
+        return bundle_write(session, block_index, block, write_size);
+
     /* seek to the proper location */
     status = fseeko(transfer->file, ((u_int64_t) block_size) * (block_index - 1), SEEK_SET);
     if (status < 0) {
-        sprintf(g_error, "Could not seek at block %d of file", block_index);
+        sprintf(g_error, "Could not seek at block %llu of file", (ull_t) block_index);
         return warn(g_error);
     }
 
     /* write the block to disk */
     status = fwrite(block, 1, write_size, transfer->file);
     if (status < write_size) {
-        sprintf(g_error, "Could not write block %d of file", block_index);
+        sprintf(g_error, "Could not write block %llu of file", (ull_t) block_index);
         return warn(g_error);
     }
+
+    /* let the relaying server know it can have the block */
+    if (transfer->relay_map != NULL) {
+        u_char *bits = (u_char *) (transfer->relay_map + 1);
+        if (fflush(transfer->file))
+            return warn("Could not flush block for the relay");
+        __sync_fetch_and_or(&bits[(block_index - 1) / 8], 1 << ((block_index - 1) % 8));
+    }
+
+    /* and keep track of it for a resume */
+    journal_mark(session, block_index);
     #endif
 
     /* we succeeded */
@@ -120,6 +147,105 @@ int accept_block(ttp_session_t *session, u_int32_t block_index, u_char *block)
 }
 
 
+/*------------------------------------------------------------------------
+ * int create_parents(const char *path);
+ *
+ * Creates the directories that the given file goes into, as far as
+ * they aren't there yet.  Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int create_parents(const char *path)
+{
+    char *parent = strdup(path);
+    char *slash;
+
+    if (parent == NULL)
+        return warn("Memory allocation error");
+
+    /* the first character is no separator worth stopping at */
+    for (slash = (parent[0] != '\0') ? strchr(parent + 1, '/') : NULL; slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if ((mkdir(parent, 0755) < 0) && (errno != EEXIST)) {
+            sprintf(g_error, "Could not create directory '%s'", parent);
+            free(parent);
+            return warn(g_error);
+        }
+        *slash = '/';
+    }
+
+    free(parent);
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int relay_map_open(ttp_session_t *session);
+ *
+ * Sets up the relay map of the file we're about to receive, next to
+ * it under the same name with TS_RELAY_EXTENSION, if the user asked
+ * for one.  A relaying server may have put a placeholder there, which
+ * is overwritten.  Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int relay_map_open(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer = &session->transfer;
+    ttp_relay_map_t  head;
+    char             name[MAX_RELAY_NAME];
+    void            *map;
+    int              fd;
+
+    xfer->relay_map = NULL;
+    if (!session->parameter->relaymap || session->parameter->mirror)
+        return 0;
+
+    /* make room for the head and a bit per block, all of them clear */
+    snprintf(name, sizeof(name), "%s%s", xfer->local_filename, TS_RELAY_EXTENSION);
+    xfer->relay_length = sizeof(ttp_relay_map_t) + xfer->block_count / 8 + 1;
+    fd = open(name, O_RDWR | O_CREAT, 0644);
+    if ((fd < 0) || (ftruncate(fd, 0) < 0) || (ftruncate(fd, xfer->relay_length) < 0)) {
+        if (fd >= 0)
+            close(fd);
+        return warn("Could not create relay map");
+    }
+    map = mmap(NULL, xfer->relay_length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return warn("Could not map relay map");
+
+    /* the block size goes in last, it tells the server the map is ready */
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, TS_RELAY_MAGIC, sizeof(head.magic));
+    head.file_size  = xfer->file_size;
+    head.pid        = getpid();
+    head.state      = TS_RELAY_FETCHING;
+    memcpy(map, &head, sizeof(head));
+    __sync_synchronize();
+    ((ttp_relay_map_t *) map)->block_size = session->parameter->block_size;
+
+    xfer->relay_map = (ttp_relay_map_t *) map;
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void relay_map_close(ttp_session_t *session, u_int32_t state);
+ *
+ * Leaves the given final state (TS_RELAY_*) in the relay map of the
+ * transfer, if it has one, and lets go of it.  The file must have been
+ * flushed for TS_RELAY_DONE.
+ *------------------------------------------------------------------------*/
+void relay_map_close(ttp_session_t *session, u_int32_t state)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+
+    if (xfer->relay_map == NULL)
+        return;
+
+    xfer->relay_map->state = state;
+    munmap(xfer->relay_map, xfer->relay_length);
+    xfer->relay_map = NULL;
+}
+
+
 /*========================================================================
  * $Log: io.c,v $
  * Revision 1.7  2008/05/25 15:36:44  jwagnerhki
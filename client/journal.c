@@ -0,0 +1,408 @@
+/*========================================================================
+ * journal.c  --  Journal of the blocks on disk, to resume transfers.
+ *
+ * With 'set resume', the client keeps a journal next to the file it
+ * receives (the name plus JOURNAL_EXTENSION): a head that says which
+ * file of the server it is of, by size and modification time, and the
+ * block size, followed by records of ranges of blocks that are safely
+ * on disk.  The disk thread gathers the blocks it writes into ranges
+ * and, about once a second, syncs the file and only then appends the
+ * ranges.  A crash can lose the last second of records, never claim
+ * a block that isn't there, and a torn record fails its check and
+ * ends the journal.
+ *
+ * A later GET of the same file finds the journal and asks the server
+ * to resume (TS_OPT_RESUME, see server/resume.c).  If the file there
+ * is still the same, we send the ranges we miss, the server sends no
+ * other originals, and the blocks we have count as received from the
+ * start.  Otherwise the file starts over with a new journal.  The
+ * journal goes away once the file is complete.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <fcntl.h>        /* for open()                            */
+#include <stdlib.h>       /* for *alloc() and free()               */
+#include <string.h>       /* for standard string routines          */
+#include <sys/time.h>     /* for gettimeofday()                    */
+#include <unistd.h>       /* for read(), write(), fsync(), unlink() */
+
+#include <tsunami-client.h>
+
+#define journal_held(journal,block) ((journal)->held[(block) / 8] & (1 << ((block) % 8)))
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+u_int32_t journal_check (u_int64_t first, u_int32_t count);
+u_int32_t journal_ranges(const ttp_journal_t *journal, u_int64_t blocks, u_int64_t skip, u_int64_t *ranges);
+void      journal_sync  (ttp_session_t *session);
+
+
+/*------------------------------------------------------------------------
+ * void journal_apply(ttp_session_t *session);
+ *
+ * Marks the blocks that a resumed transfer has on disk from before as
+ * received, and as written in the relay map if there is one.  Must be
+ * called once the received bitfield is allocated.
+ *------------------------------------------------------------------------*/
+void journal_apply(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer    = &session->transfer;
+    ttp_journal_t  *journal =  session->journal;
+    u_int64_t       block;
+
+    if ((journal == NULL) || (journal->held == NULL))
+	return;
+
+    memcpy(xfer->received, journal->held, xfer->block_count / 8 + 2);
+    xfer->blocks_left -= min(journal->held_count, xfer->blocks_left);
+    if (xfer->relay_map != NULL)
+	for (block = 1; block <= xfer->block_count; ++block)
+	    if (journal_held(journal, block))
+		((u_char *) (xfer->relay_map + 1))[(block - 1) / 8] |= 1 << ((block - 1) % 8);
+
+    printf("Resuming '%s' with %llu of %llu blocks on disk from before.\n", xfer->local_filename,
+	   (ull_t) journal->held_count, (ull_t) xfer->block_count);
+    free(journal->held);
+    journal->held = NULL;
+}
+
+
+/*------------------------------------------------------------------------
+ * void journal_close(ttp_session_t *session, int complete);
+ *
+ * Closes the journal of the transfer, if it has one.  If the file is
+ * complete, it is synced and the journal deleted, otherwise the ranges
+ * still pending go into the journal for a later resume.
+ *------------------------------------------------------------------------*/
+void journal_close(ttp_session_t *session, int complete)
+{
+    ttp_transfer_t *xfer    = &session->transfer;
+    ttp_journal_t  *journal =  session->journal;
+
+    if (journal == NULL)
+	return;
+
+    if (journal->fd >= 0) {
+	if (!complete) {
+	    journal_sync(session);
+	    printf("The journal of '%s' is kept, with 'set resume yes' a GET of it goes on from there.\n", xfer->local_filename);
+	} else if ((xfer->file != NULL) && (fflush(xfer->file) || fsync(fileno(xfer->file)))) {
+	    warn("Could not sync the received file, keeping its journal");
+	} else {
+	    unlink(journal->name);
+	}
+	if (journal->fd >= 0)
+	    close(journal->fd);
+    }
+
+    session->journal = NULL;
+    free(journal->held);
+    free(journal->name);
+    free(journal);
+}
+
+
+/*------------------------------------------------------------------------
+ * int journal_load(ttp_session_t *session, const char *local_filename);
+ *
+ * Sets up the journal of a transfer of the file to the given local
+ * file, and reads in the blocks it says are on disk if a journal of
+ * an earlier transfer is there.  Bundles, mirrors and the sessions of
+ * mirrors keep no journal.  Returns non-zero if the transfer keeps a
+ * journal.
+ *------------------------------------------------------------------------*/
+int journal_load(ttp_session_t *session, const char *local_filename)
+{
+    ttp_parameter_t      *param = session->parameter;
+    ttp_journal_t        *journal;
+    ttp_journal_record_t *record;
+    u_int64_t             blocks, block;
+    ssize_t               length;
+    int                   fd;
+
+    journal_close(session, 0);
+    if (!param->resume || (session->bundle != NULL) || param->mirror)
+	return 0;
+    if (param->mirrors != NULL) {
+	warn("Transfers from mirrors are not resumed, keeping no journal");
+	return 0;
+    }
+
+    journal = (ttp_journal_t *) calloc(1, sizeof(ttp_journal_t));
+    if (journal != NULL)
+	journal->name = (char *) malloc(strlen(local_filename) + sizeof(JOURNAL_EXTENSION));
+    if ((journal == NULL) || (journal->name == NULL)) {
+	free(journal);
+	warn("Could not allocate journal, keeping none");
+	return 0;
+    }
+    sprintf(journal->name, "%s%s", local_filename, JOURNAL_EXTENSION);
+    journal->fd      = -1;
+    session->journal = journal;
+
+    /* an earlier journal counts if it is whole and the file it is of is still here */
+    fd = open(journal->name, O_RDONLY);
+    if (fd < 0)
+	return 1;
+    if ((read(fd, &journal->head, sizeof(journal->head)) < (ssize_t) sizeof(journal->head)) ||
+	memcmp(journal->head.magic, JOURNAL_MAGIC, sizeof(journal->head.magic)) ||
+	(journal->head.file_size == 0) || (journal->head.block_size == 0) || (journal->head.block_size > MAX_BLOCK_SIZE) ||
+	access(local_filename, W_OK)) {
+	memset(&journal->head, 0, sizeof(journal->head));
+	close(fd);
+	return 1;
+    }
+
+    blocks = (journal->head.file_size / journal->head.block_size) + ((journal->head.file_size % journal->head.block_size) != 0);
+    journal->held = (u_char *) calloc(blocks / 8 + 2, sizeof(u_char));
+    if (journal->held == NULL) {
+	memset(&journal->head, 0, sizeof(journal->head));
+	close(fd);
+	warn("Could not allocate journal bitfield");
+	return 1;
+    }
+
+    /* the records go until the first one that doesn't check out */
+    while ((length = read(fd, journal->pending, sizeof(journal->pending))) > 0) {
+	for (record = journal->pending; (char *) (record + 1) <= (char *) journal->pending + length; ++record) {
+	    if ((record->check != journal_check(record->first, record->count)) ||
+		(record->first == 0) || (record->count == 0) || (record->first + record->count - 1 > blocks))
+		break;
+	    for (block = record->first; block < record->first + record->count; ++block)
+		if (!journal_held(journal, block)) {
+		    journal->held[block / 8] |= 1 << (block % 8);
+		    ++journal->held_count;
+		}
+	}
+	if ((char *) record < (char *) journal->pending + length)
+	    break;
+    }
+    close(fd);
+
+    if (param->verbose_yn)
+	printf("Found a journal of '%s' with %llu of %llu blocks.\n", local_filename, (ull_t) journal->held_count, (ull_t) blocks);
+    return 1;
+}
+
+
+/*------------------------------------------------------------------------
+ * void journal_mark(ttp_session_t *session, u_int64_t block);
+ *
+ * Notes that the given block has been written to the file.  Called by
+ * the disk thread, which also syncs the journal when it is due.
+ *------------------------------------------------------------------------*/
+void journal_mark(ttp_session_t *session, u_int64_t block)
+{
+    ttp_journal_t        *journal = session->journal;
+    ttp_journal_record_t *last;
+
+    if ((journal == NULL) || (journal->fd < 0))
+	return;
+
+    /* a block right after the last range extends it */
+    last = journal->pending + journal->pending_count - 1;
+    if ((journal->pending_count > 0) && (last->first + last->count == block) && (last->count < 0xffffffffU)) {
+	last->count++;
+    } else {
+	if (journal->pending_count == JOURNAL_PENDING)
+	    journal_sync(session);
+	last        = journal->pending + journal->pending_count++;
+	last->first = block;
+	last->count = 1;
+    }
+
+    if (get_usec_since(&journal->sync_time) >= JOURNAL_SYNC)
+	journal_sync(session);
+}
+
+
+/*------------------------------------------------------------------------
+ * int journal_open(ttp_session_t *session);
+ *
+ * Opens the journal for the transfer just negotiated, once the local
+ * file is open: a resumed transfer goes on with the journal it has,
+ * any other one starts a new one, as long as the server says what its
+ * file is.  A journal that can't be written is not an error, the
+ * transfer just goes on without it.  Returns 0.
+ *------------------------------------------------------------------------*/
+int journal_open(ttp_session_t *session)
+{
+    ttp_transfer_t     *xfer    = &session->transfer;
+    ttp_journal_t      *journal =  session->journal;
+    ttp_journal_head_t *head;
+
+    if (journal == NULL)
+	return 0;
+    gettimeofday(&journal->sync_time, NULL);
+
+    /* go on where the journal left off */
+    if (xfer->resumed) {
+	journal->fd = open(journal->name, O_WRONLY | O_APPEND);
+	if (journal->fd < 0)
+	    warn("Could not reopen the journal, going on without it");
+	return 0;
+    }
+
+    /* or start over */
+    if (journal->held != NULL) {
+	printf("The file has changed on the server since the journal of '%s', starting over.\n", xfer->local_filename);
+	free(journal->held);
+	journal->held       = NULL;
+	journal->held_count = 0;
+    }
+    if (xfer->file_time == 0) {
+	journal_close(session, 0);
+	warn("Server does not resume transfers, keeping no journal");
+	return 0;
+    }
+
+    head = &journal->head;
+    memcpy(head->magic, JOURNAL_MAGIC, sizeof(head->magic));
+    head->file_size  = xfer->file_size;
+    head->file_time  = xfer->file_time;
+    head->block_size = session->parameter->block_size;
+    head->reserved   = 0;
+    journal->fd = open(journal->name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if ((journal->fd >= 0) && (write(journal->fd, head, sizeof(*head)) < (ssize_t) sizeof(*head))) {
+	close(journal->fd);
+	journal->fd = -1;
+    }
+    if (journal->fd < 0)
+	warn("Could not create the journal, going on without it");
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int journal_request(ttp_session_t *session);
+ *
+ * Sends the server the ranges of blocks of the resumed transfer that
+ * are not on disk.  Blocks on disk between two missing ranges are
+ * asked for again if that keeps the ranges within MAX_RESUME_RANGES.
+ * Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int journal_request(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer    = &session->transfer;
+    ttp_journal_t  *journal =  session->journal;
+    u_int64_t      *ranges;
+    u_int64_t       skip  = 0;
+    u_int32_t       count = 0;
+    u_int32_t       i;
+
+    /* find the fewest blocks to ask for again that make few enough ranges */
+    if ((journal != NULL) && (journal->held != NULL))
+	while ((count = journal_ranges(journal, xfer->block_count, skip, NULL)) > MAX_RESUME_RANGES)
+	    skip = max(1, 2 * skip);
+
+    ranges = (u_int64_t *) malloc(2 * sizeof(u_int64_t) * max(count, 1));
+    if (ranges == NULL)
+	return warn("Could not allocate missing ranges");
+    if (count > 0)
+	journal_ranges(journal, xfer->block_count, skip, ranges);
+    for (i = 0; i < 2 * count; ++i)
+	ranges[i] = htonll(ranges[i]);
+
+    i = htonl(count);
+    if ((fwrite(&i, 4, 1, session->server) < 1) ||
+	((count > 0) && (fwrite(ranges, 2 * sizeof(u_int64_t), count, session->server) < count)) ||
+	fflush(session->server)) {
+	free(ranges);
+	return warn("Could not send missing ranges");
+    }
+
+    free(ranges);
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * u_int32_t journal_check(u_int64_t first, u_int32_t count);
+ *
+ * Returns the check value of a journal record of the given range.
+ *------------------------------------------------------------------------*/
+u_int32_t journal_check(u_int64_t first, u_int32_t count)
+{
+    return ((u_int32_t) first ^ (u_int32_t) (first >> 32) ^ (count * 2654435761U)) ^ 0x4a524e4c;
+}
+
+
+/*------------------------------------------------------------------------
+ * u_int32_t journal_ranges(const ttp_journal_t *journal,
+ *                          u_int64_t blocks, u_int64_t skip,
+ *                          u_int64_t *ranges);
+ *
+ * Counts the ranges of blocks out of the given number that are not on
+ * disk, taking runs of up to skip blocks on disk between them as
+ * missing, and stores the first and end block of each into the given
+ * array, unless it is NULL.  Returns the number of ranges.
+ *------------------------------------------------------------------------*/
+u_int32_t journal_ranges(const ttp_journal_t *journal, u_int64_t blocks, u_int64_t skip, u_int64_t *ranges)
+{
+    u_int64_t block = 1;
+    u_int64_t first, next;
+    u_int32_t count = 0;
+
+    while (1) {
+	while ((block <= blocks) && journal_held(journal, block))
+	    ++block;
+	if (block > blocks)
+	    break;
+
+	/* the missing range goes on across short runs of blocks on disk */
+	first = block;
+	while (1) {
+	    while ((block <= blocks) && !journal_held(journal, block))
+		++block;
+	    for (next = block; (next <= blocks) && journal_held(journal, next) && (next - block < skip); ++next);
+	    if ((next > blocks) || journal_held(journal, next))
+		break;
+	    block = next;
+	}
+
+	if (ranges != NULL) {
+	    ranges[2 * count]     = first;
+	    ranges[2 * count + 1] = block;
+	}
+	if (++count == 0xffffffffU)
+	    break;
+    }
+
+    return count;
+}
+
+
+/*------------------------------------------------------------------------
+ * void journal_sync(ttp_session_t *session);
+ *
+ * Syncs the file being received and then appends the ranges written
+ * since the last sync to the journal.  If that fails, the transfer
+ * goes on without the journal, which stays as it was.
+ *------------------------------------------------------------------------*/
+void journal_sync(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer    = &session->transfer;
+    ttp_journal_t  *journal =  session->journal;
+    size_t          length  =  journal->pending_count * sizeof(ttp_journal_record_t);
+    u_int32_t       i;
+
+    gettimeofday(&journal->sync_time, NULL);
+    if ((journal->fd < 0) || (journal->pending_count == 0) || (xfer->file == NULL))
+	return;
+
+    for (i = 0; i < journal->pending_count; ++i)
+	journal->pending[i].check = journal_check(journal->pending[i].first, journal->pending[i].count);
+    journal->pending_count = 0;
+
+    if (fflush(xfer->file) || fsync(fileno(xfer->file)) || (write(journal->fd, journal->pending, length) < (ssize_t) length)) {
+	warn("Could not update the journal, going on without it");
+	close(journal->fd);
+	journal->fd = -1;
+    }
+}
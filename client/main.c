@@ -148,7 +148,7 @@ int main(int argc, const char *argv[])
                argc_curr += 2;
                break;
             }
-            if (!strcasecmp(argv[argc_curr], "get")) {
+            if (!strcasecmp(argv[argc_curr], "get") || !strcasecmp(argv[argc_curr], "mget")) {
                if (argc_curr+1 < argc) {
                   strcpy(ptr_command_text, argv[argc_curr]);
                   strcat(command_text, " ");
@@ -194,6 +194,7 @@ int main(int argc, const char *argv[])
       else if (!strcasecmp(command.text[0], "get"))               command_get    (&command, session);
       else if (!strcasecmp(command.text[0], "dir"))               command_dir    (&command, session);
       else if (!strcasecmp(command.text[0], "help"))              command_help   (&command, session);
+      else if (!strcasecmp(command.text[0], "mget"))              command_mget   (&command, &parameter);
       else if (!strcasecmp(command.text[0], "quit"))              command_quit   (&command, session);
       else if (!strcasecmp(command.text[0], "exit"))              command_quit   (&command, session);
       else if (!strcasecmp(command.text[0], "bye"))               command_quit   (&command, session);
@@ -0,0 +1,441 @@
+/*========================================================================
+ * mirror.c  --  Downloads from several mirrored servers at once.
+ *
+ * With 'set mirrors', the client opens a session with each mirror
+ * besides the one with the server and asks all of them for the same
+ * file.  The mirrors are told to wait (TS_OPT_MIRROR), and each source
+ * is then given a range of blocks of its own to send as originals:
+ * REQUEST_RESTART moves it to the start of the range and REQUEST_RANGE
+ * sets its end.  The data of a mirror comes in as a further stream of
+ * the transfer (see stream.c), into the same ring buffer and bitmap.
+ *
+ * At every report, a source that is through with its range takes half
+ * of what is left of the busiest other one, or all of what is left of
+ * one that has gone quiet, so that the fast sources end up sending
+ * most of the file.  Repairs are all asked of the server, and once
+ * every source is done, the server gets the last block, with a range
+ * ending past it, and finishes the transfer with its usual tail phase.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <signal.h>       /* for signal()                          */
+#include <stdlib.h>       /* for *alloc() and free()               */
+#include <string.h>       /* for standard string routines          */
+#include <unistd.h>       /* for close()                           */
+
+#include <tsunami-client.h>
+
+#define MIRROR_STEAL_MIN  64    /* the fewest blocks that are worth moving to another source */
+#define MIRROR_QUIET      4     /* reports without originals after which a busy source is given up */
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+int        mirror_done   (const ttp_stream_t *source);
+void       mirror_drop   (ttp_mirror_t *mirror);
+u_int64_t  mirror_left   (const ttp_stream_t *source);
+int        mirror_range  (ttp_session_t *session, ttp_stream_t *source, u_int64_t first, u_int64_t end);
+int        mirror_request(ttp_session_t *session, const ttp_stream_t *source, u_int16_t type, u_int64_t block);
+
+
+/*------------------------------------------------------------------------
+ * int mirror_assign(ttp_session_t *session);
+ *
+ * Splits the file among the server and the mirrors, in ranges of the
+ * same size.  The last block is left to the server.  Returns 0 on
+ * success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int mirror_assign(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    u_int64_t       span;
+    u_int64_t       first;
+    int             i;
+
+    if (xfer->mirrors == 0)
+	return 0;
+
+    span = (xfer->block_count - 1) / (xfer->mirrors + 1);
+    for (i = 0; i <= xfer->mirrors; ++i) {
+	first = 1 + i * span;
+	if (mirror_range(session, &xfer->stream[i], first, (i == xfer->mirrors) ? xfer->block_count : first + span) < 0)
+	    return -1;
+    }
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void mirror_close(ttp_session_t *session);
+ *
+ * Tells the mirrors to stop, closes their sessions and adds the blocks
+ * they brought to the statistics of the transfer.  Their sockets are
+ * closed along with the streams, unless the streams never got them.
+ *------------------------------------------------------------------------*/
+void mirror_close(ttp_session_t *session)
+{
+    ttp_transfer_t   *xfer = &session->transfer;
+    ttp_mirror_t     *mirror;
+    retransmission_t  retransmission;
+    int               i;
+
+    memset(&retransmission, 0, sizeof(retransmission));
+    retransmission.request_type = htons(REQUEST_STOP);
+
+    for (i = 0; i < xfer->mirrors; ++i) {
+	mirror = &xfer->mirror[i];
+	xfer->stats.total_blocks += mirror->total_blocks;
+	if (session->parameter->verbose_yn)
+	    printf("Mirror %s:%u sent %llu blocks.\n", mirror->parameter.server_name, mirror->parameter.server_port,
+		   (ull_t) mirror->total_blocks);
+
+	if (!ferror(mirror->session->server) && (fwrite(&retransmission, sizeof(retransmission), 1, mirror->session->server) == 1))
+	    fflush(mirror->session->server);
+	if (mirror->stream == NULL)
+	    close(mirror->session->transfer.udp_fd);
+	mirror_drop(mirror);
+    }
+
+    free(xfer->mirror);
+    xfer->mirror  = NULL;
+    xfer->mirrors = 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int mirror_open(ttp_session_t *session);
+ *
+ * Connects to the mirrors (a comma separated list of "host" or
+ * "host:port"), requests the file of the transfer just opened from
+ * each of them and opens their data sockets.  A mirror that can't be
+ * reached or doesn't have the same file, of the same size and with
+ * the same modification time as the server's, is left out.  The ranges are
+ * found by their originals like those of several streams, so mirrors
+ * are only used under the same conditions.  Returns 0 on success and
+ * non-zero on failure.
+ *------------------------------------------------------------------------*/
+int mirror_open(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    ttp_mirror_t    *mirror;
+    command_t        command;
+    const char      *entry;
+    char             host[256];
+    char             port[8];
+    char            *colon;
+    size_t           length;
+    int              count;
+
+    xfer->mirrors = 0;
+    xfer->mirror  = NULL;
+    if (param->mirrors == NULL)
+	return 0;
+
+    if ((xfer->streams > 1) || (xfer->fec != TS_FEC_NONE) || (!param->lossless && (param->losswindow_ms > 0))) {
+	warn("Mirrors are only used in lossless and lossy mode without FEC, receiving from the server alone");
+	return 0;
+    }
+
+    for (count = 1, entry = param->mirrors; (entry = strchr(entry, ',')) != NULL; ++entry)
+	++count;
+    count = min(count, MAX_STREAMS - 1);
+    xfer->mirror = (ttp_mirror_t *) calloc(count, sizeof(ttp_mirror_t));
+    if (xfer->mirror == NULL)
+	return warn("Could not allocate mirrors");
+
+    /* a mirror that goes away must not take the client with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    for (entry = param->mirrors; (entry != NULL) && (xfer->mirrors < count); entry = strchr(entry, ',') ? strchr(entry, ',') + 1 : NULL) {
+
+	/* take the host and port apart, an address with several colons is IPv6 without a port */
+	length = min(strcspn(entry, ","), sizeof(host) - 1);
+	memcpy(host, entry, length);
+	host[length] = '\0';
+	snprintf(port, sizeof(port), "%u", param->server_port);
+	colon = strchr(host, ':');
+	if ((colon != NULL) && (colon == strrchr(host, ':'))) {
+	    *colon = '\0';
+	    snprintf(port, sizeof(port), "%s", colon + 1);
+	}
+
+	/* the mirror sends its ranges in plain originals to a port after ours */
+	mirror = &xfer->mirror[xfer->mirrors];
+	memset(mirror, 0, sizeof(*mirror));
+	mirror->parameter               = *param;
+	mirror->parameter.server_name   = NULL;
+	mirror->parameter.client_port   = param->client_port + 1 + xfer->mirrors;
+	mirror->parameter.transcript_yn = 0;
+	mirror->parameter.ecn           = 0;
+	mirror->parameter.probe_train   = 0;
+	mirror->parameter.pmtu          = 0;
+	mirror->parameter.fec           = TS_FEC_NONE;
+	mirror->parameter.tail_copies   = 0;
+	mirror->parameter.streams       = 1;
+	mirror->parameter.rx_queues     = 1;
+	mirror->parameter.paths         = NULL;
+	mirror->parameter.mirrors       = NULL;
+	mirror->parameter.mirror        = 1;
+	mirror->parameter.multicast     = 0;
+	mirror->parameter.relaymap      = 0;
+	mirror->parameter.pipeline      = 0;
+	mirror->parameter.pipeline_file = 0;
+	mirror->parameter.profile       = NULL;
+	mirror->parameter.start_rate    = 0;
+	mirror->parameter.rtt_hint      = 0;
+
+	command.count   = 3;
+	command.text[0] = "connect";
+	command.text[1] = host;
+	command.text[2] = port;
+	mirror->session = command_connect(&command, &mirror->parameter);
+	if (mirror->session == NULL) {
+	    sprintf(g_error, "Could not connect to mirror %s:%s, leaving it out", host, port);
+	    warn(g_error);
+	    mirror_drop(mirror);
+	    continue;
+	}
+
+	if ((ttp_open_transfer(mirror->session, xfer->remote_filename, xfer->local_filename) < 0) ||
+	    !mirror->session->transfer.mirrored ||
+	    (mirror->session->transfer.file_size    != xfer->file_size) ||
+	    (mirror->session->transfer.file_time    != xfer->file_time) ||
+	    (mirror->session->transfer.header_flags != xfer->header_flags)) {
+	    sprintf(g_error, "Mirror %s:%s won't send the same file, leaving it out", host, port);
+	    warn(g_error);
+	    mirror_drop(mirror);
+	    continue;
+	}
+
+	if (ttp_open_port(mirror->session) < 0) {
+	    sprintf(g_error, "Could not open a data port for mirror %s:%s, leaving it out", host, port);
+	    warn(g_error);
+	    mirror_drop(mirror);
+	    continue;
+	}
+
+	printf("Receiving part of the file from mirror %s:%s.\n", host, port);
+	++xfer->mirrors;
+    }
+
+    if (xfer->mirrors == 0) {
+	free(xfer->mirror);
+	xfer->mirror = NULL;
+    }
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int mirror_report(ttp_session_t *session, u_int64_t delta);
+ *
+ * Sends every mirror its feedback for the last delta usec, with the
+ * loss taken from the originals that came in against how far along
+ * its range it got, and then moves work from the slow sources to
+ * those that are done, see above.  Must be called with the transfer
+ * lock held, before stream_report() starts the next interval.  Returns
+ * 0 on success and non-zero if the server could not be reached.
+ *------------------------------------------------------------------------*/
+int mirror_report(ttp_session_t *session, u_int64_t delta)
+{
+    ttp_transfer_t   *xfer = &session->transfer;
+    double            fb   = session->parameter->history / 100.0;
+    u_int32_t         ring_free;
+    ttp_mirror_t     *mirror;
+    ttp_stream_t     *source, *victim;
+    retransmission_t  retransmission;
+    u_int64_t         advance, end, cut;
+    double            loss, rate;
+    FILE             *server;
+    int               i, j;
+
+    if ((xfer->mirrors == 0) || (xfer->stream == NULL))
+	return 0;
+    ring_free = MAX_BLOCKS_QUEUED - 1 - xfer->ring_buffer->count_data - xfer->ring_buffer->count_reserved;
+
+    /* the feedback to the mirrors, skipping those whose connection failed */
+    for (i = 0; i < xfer->mirrors; ++i) {
+	mirror  = &xfer->mirror[i];
+	source  = mirror->stream;
+	server  = mirror->session->server;
+	advance = source->last_original - mirror->report_original;
+	loss    = (advance > 0) ? max(0.0, 1.0 - (double) source->this_originals / advance) : 0.0;
+	rate    = 8.0 * source->this_blocks * session->parameter->block_size / max(delta, 1) * 1000.0;
+	mirror->error_rate      = fb * mirror->error_rate + (1.0 - fb) * 500*100 * loss;
+	mirror->report_original = source->last_original;
+	if (ferror(server))
+	    continue;
+
+	memset(&retransmission, 0, sizeof(retransmission));
+	retransmission.request_type  = htons(REQUEST_ERROR_RATE);
+	retransmission.block         = htonl((u_int32_t) source->last_original);
+	retransmission.block_high    = htonl((u_int32_t) (source->last_original >> 32));
+	retransmission.error_rate    = htonl((u_int32_t) mirror->error_rate);
+	retransmission.delivery_rate = htonl((u_int32_t) min(rate, 4294967295.0));
+	retransmission.received      = htonl(source->this_blocks);
+	retransmission.ring_free     = htonl(ring_free);
+	if ((fwrite(&retransmission, sizeof(retransmission), 1, server) < 1) || fflush(server)) {
+	    sprintf(g_error, "Lost the connection to mirror %s:%u", mirror->parameter.server_name, mirror->parameter.server_port);
+	    warn(g_error);
+	}
+    }
+
+    /* a source counts as quiet while it has work and brings no originals */
+    for (i = 0; i <= xfer->mirrors; ++i) {
+	source = &xfer->stream[i];
+	if (source->this_originals > 0)
+	    source->quiet = 0;
+	else if (mirror_left(source) > 0)
+	    source->quiet++;
+    }
+
+    /* every source that is done takes half the work of the busiest one, or all the work of one given up */
+    for (i = 0; i <= xfer->mirrors; ++i) {
+	if (!mirror_done(&xfer->stream[i]) || (xfer->stream[i].quiet >= MIRROR_QUIET))
+	    continue;
+
+	victim = NULL;
+	for (j = 0; j <= xfer->mirrors; ++j) {
+	    source = &xfer->stream[j];
+	    if ((j == i) || mirror_done(source))
+		continue;
+	    if (source->quiet >= MIRROR_QUIET) {
+		if ((victim == NULL) || (victim->quiet < MIRROR_QUIET) || (mirror_left(source) > mirror_left(victim)))
+		    victim = source;
+	    } else if ((mirror_left(source) >= 2 * MIRROR_STEAL_MIN) &&
+		       ((victim == NULL) || ((victim->quiet < MIRROR_QUIET) && (mirror_left(source) > mirror_left(victim)))))
+		victim = source;
+	}
+	if (victim == NULL)
+	    break;
+
+	end = victim->range_end;
+	cut = victim->last_original + 1;
+	if (victim->quiet < MIRROR_QUIET)
+	    cut += mirror_left(victim) / 2;
+	if (session->parameter->verbose_yn)
+	    printf("Moving blocks %llu to %llu from source %d to source %d.\n", (ull_t) cut, (ull_t) end - 1, victim->index, i);
+	if ((mirror_request(session, victim, REQUEST_RANGE, cut) < 0) || (mirror_range(session, &xfer->stream[i], cut, end) < 0))
+	    return -1;
+	victim->range_end = cut;
+    }
+
+    /* once every source is done, the server sends the last block and goes into its tail phase */
+    for (i = 0; (i <= xfer->mirrors) && mirror_done(&xfer->stream[i]); ++i);
+    if ((i > xfer->mirrors) && (xfer->stream[0].range_end <= xfer->block_count))
+	return mirror_range(session, &xfer->stream[0], xfer->block_count, xfer->block_count + 1);
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int mirror_done(const ttp_stream_t *source);
+ *
+ * Returns non-zero if the given source has sent its range, but for a
+ * few blocks that have not come in since the last report, which are
+ * left to the repairs.
+ *------------------------------------------------------------------------*/
+int mirror_done(const ttp_stream_t *source)
+{
+    u_int64_t left = mirror_left(source);
+
+    return (left == 0) || ((source->quiet > 0) && (left < MIRROR_STEAL_MIN));
+}
+
+
+/*------------------------------------------------------------------------
+ * void mirror_drop(ttp_mirror_t *mirror);
+ *
+ * Closes the session with the given mirror, as far as it got, and
+ * frees it.
+ *------------------------------------------------------------------------*/
+void mirror_drop(ttp_mirror_t *mirror)
+{
+    if (mirror->session != NULL) {
+	fclose(mirror->session->server);
+	free(mirror->session->server_address);
+	free(mirror->session);
+	mirror->session = NULL;
+    }
+    if (mirror->parameter.server_name != NULL) {
+	free(mirror->parameter.server_name);
+	mirror->parameter.server_name = NULL;
+    }
+}
+
+
+/*------------------------------------------------------------------------
+ * u_int64_t mirror_left(const ttp_stream_t *source);
+ *
+ * Returns the number of blocks of its range that the given source has
+ * yet to send, as far as we know.  The last block of the file is not
+ * counted, it belongs to the tail phase.
+ *------------------------------------------------------------------------*/
+u_int64_t mirror_left(const ttp_stream_t *source)
+{
+    u_int64_t end = min(source->range_end, source->session->transfer.block_count);
+
+    return (end > source->last_original + 1) ? end - source->last_original - 1 : 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int mirror_range(ttp_session_t *session, ttp_stream_t *source,
+ *                  u_int64_t first, u_int64_t end);
+ *
+ * Has the given source send the originals from block first up to the
+ * block before end.  The restart goes first, so that the source does
+ * not run on past the end of its old range into the blocks of others.
+ * Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int mirror_range(ttp_session_t *session, ttp_stream_t *source, u_int64_t first, u_int64_t end)
+{
+    if ((first > 1) && (mirror_request(session, source, REQUEST_RESTART, first - 1) < 0))
+	return -1;
+    if (mirror_request(session, source, REQUEST_RANGE, end) < 0)
+	return -1;
+
+    source->range_first   = first;
+    source->range_end     = end;
+    source->last_original = first - 1;
+    source->quiet         = 0;
+    if (source->mirror != NULL)
+	source->mirror->report_original = first - 1;
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int mirror_request(ttp_session_t *session, const ttp_stream_t *source,
+ *                    u_int16_t type, u_int64_t block);
+ *
+ * Sends a request of the given type for the given block to the given
+ * source.  A lost connection to a mirror is not an error, the mirror
+ * just goes quiet and its work moves elsewhere.  Returns 0 on success
+ * and non-zero if the server could not be reached.
+ *------------------------------------------------------------------------*/
+int mirror_request(ttp_session_t *session, const ttp_stream_t *source, u_int16_t type, u_int64_t block)
+{
+    FILE             *server = (source->mirror != NULL) ? source->mirror->session->server : session->server;
+    retransmission_t  retransmission;
+
+    if ((source->mirror != NULL) && ferror(server))
+	return 0;
+
+    memset(&retransmission, 0, sizeof(retransmission));
+    retransmission.request_type = htons(type);
+    retransmission.block        = htonl((u_int32_t) block);
+    retransmission.block_high   = htonl((u_int32_t) (block >> 32));
+    if ((fwrite(&retransmission, sizeof(retransmission), 1, server) < 1) || fflush(server))
+	return (source->mirror != NULL) ? 0 : warn("Could not send range request");
+
+    return 0;
+}
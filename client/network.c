@@ -159,6 +159,156 @@ int create_tcp_socket(ttp_session_t *session, const char *server_name, u_int16_t
 }
 
 
+/*------------------------------------------------------------------------
+ * int get_path_mtu(ttp_session_t *session);
+ *
+ * Returns the path MTU towards the server, as far as the kernel has
+ * learned it for the control connection (TCP always does path MTU
+ * discovery), or 0 if it can't tell.
+ *------------------------------------------------------------------------*/
+int get_path_mtu(ttp_session_t *session)
+{
+    int       mtu    = 0;
+    socklen_t length = sizeof(mtu);
+    int       status = -1;
+
+    #if defined(IP_MTU) && defined(IPV6_MTU)
+    if (session->parameter->ipv6_yn)
+        status = getsockopt(fileno(session->server), IPPROTO_IPV6, IPV6_MTU, &mtu, &length);
+    else
+        status = getsockopt(fileno(session->server), IPPROTO_IP,   IP_MTU,   &mtu, &length);
+    #endif
+
+    return (status < 0) ? 0 : mtu;
+}
+
+
+/*------------------------------------------------------------------------
+ * int test_ecn_socket(ttp_parameter_t *parameter);
+ *
+ * Returns non-zero if a UDP socket of the kind create_udp_socket()
+ * makes can deliver the TOS byte of each datagram, so that we don't
+ * ask for ECN capable data whose marks we would never see.
+ *------------------------------------------------------------------------*/
+int test_ecn_socket(ttp_parameter_t *parameter)
+{
+    int socket_fd;
+    int status;
+    int yes = 1;
+
+    socket_fd = socket(parameter->ipv6_yn ? AF_INET6 : AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd < 0)
+        return 0;
+
+    if (parameter->ipv6_yn)
+        status = setsockopt(socket_fd, IPPROTO_IPV6, IPV6_RECVTCLASS, &yes, sizeof(yes));
+    else
+        status = setsockopt(socket_fd, IPPROTO_IP,   IP_RECVTOS,      &yes, sizeof(yes));
+
+    close(socket_fd);
+    return (status == 0);
+}
+
+
+/*------------------------------------------------------------------------
+ * u_int32_t grow_udp_buffer(ttp_session_t *session);
+ *
+ * Doubles the receive buffer of the data socket, up to MAX_UDP_BUFFER,
+ * after the socket overflowed.  SO_RCVBUFFORCE gets past the system
+ * limit if we have the privileges for it.  Keeps the size the kernel
+ * reports back.  Returns the new size, or 0 if the buffer could not
+ * grow any further; it is marked stuck then and we don't try again.
+ *------------------------------------------------------------------------*/
+u_int32_t grow_udp_buffer(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer   = &session->transfer;
+    int             wanted = min(2 * (u_int64_t) xfer->udp_buffer, MAX_UDP_BUFFER);
+    int             before = 0, after = 0;
+    socklen_t       length = sizeof(before);
+    int             status = -1;
+
+    if (xfer->udp_buffer_stuck)
+        return 0;
+    if (wanted <= xfer->udp_buffer) {
+        xfer->udp_buffer_stuck = 1;
+        return 0;
+    }
+
+    getsockopt(xfer->udp_fd, SOL_SOCKET, SO_RCVBUF, &before, &length);
+    #ifdef SO_RCVBUFFORCE
+    status = setsockopt(xfer->udp_fd, SOL_SOCKET, SO_RCVBUFFORCE, &wanted, sizeof(wanted));
+    #endif
+    if (status < 0)
+        status = setsockopt(xfer->udp_fd, SOL_SOCKET, SO_RCVBUF, &wanted, sizeof(wanted));
+    length = sizeof(after);
+    getsockopt(xfer->udp_fd, SOL_SOCKET, SO_RCVBUF, &after, &length);
+
+    /* the system limit may keep the buffer where it was without telling us */
+    if (after > 0)
+        xfer->udp_buffer = after;
+    if ((status < 0) || (after <= before)) {
+        xfer->udp_buffer_stuck = 1;
+        return 0;
+    }
+
+    return xfer->udp_buffer;
+}
+
+
+/*------------------------------------------------------------------------
+ * int create_mcast_socket(ttp_session_t *session);
+ *
+ * Opens a second UDP socket for the transfer, bound to the port of the
+ * multicast group the server sends the originals to and joined to the
+ * group on the interface of the control connection.  The port is
+ * shared with the other receivers on this host.  Returns the file
+ * descriptor of the socket on success and -1 on error.
+ *------------------------------------------------------------------------*/
+int create_mcast_socket(ttp_session_t *session)
+{
+    ttp_transfer_t     *xfer = &session->transfer;
+    struct sockaddr_in  address;
+    struct sockaddr_in  local;
+    socklen_t           length = sizeof(local);
+    struct ip_mreq      membership;
+    int                 socket_fd;
+    int                 yes = 1;
+
+    socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd < 0)
+	return warn("Could not create multicast socket");
+
+    /* several clients on this host may be in the group */
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0)
+	warn("Could not make multicast socket reusable");
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &session->parameter->udp_buffer, sizeof(session->parameter->udp_buffer)) < 0)
+	warn("Error in resizing UDP receive buffer");
+
+    /* bind to the group's port, taking the group's datagrams only */
+    memset(&address, 0, sizeof(address));
+    address.sin_family      = AF_INET;
+    address.sin_addr.s_addr = htonl(xfer->mcast_group);
+    address.sin_port        = htons(xfer->mcast_port);
+    if (bind(socket_fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+	close(socket_fd);
+	return warn("Could not bind multicast socket");
+    }
+
+    /* and join the group where the server is reached */
+    memset(&local, 0, sizeof(local));
+    getsockname(fileno(session->server), (struct sockaddr *) &local, &length);
+    membership.imr_multiaddr.s_addr = htonl(xfer->mcast_group);
+    membership.imr_interface        = local.sin_addr;
+    if (setsockopt(socket_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+	close(socket_fd);
+	return warn("Could not join multicast group");
+    }
+
+    fprintf(stderr, "Receiving multicast data from %s:%u\n", inet_ntoa(membership.imr_multiaddr), xfer->mcast_port);
+    return socket_fd;
+}
+
+
 /*------------------------------------------------------------------------
  * int create_udp_socket(ttp_parameter_t *parameter);
  *
@@ -0,0 +1,222 @@
+/*========================================================================
+ * profile.c  --  Path profile cache for Tsunami client.
+ *
+ * Keeps what past transfers learned about each server (host and TCP
+ * port) in a small text file, one line per destination:
+ *
+ *   host port stamp rate rtt loss block_size best_rate
+ *
+ * with the achieved file rate (bps), the round-trip time (usec) and the
+ * fraction of received blocks that were retransmissions, each averaged
+ * over past transfers, and the block size of the fastest transfer
+ * together with its rate.  The weight of a profile halves after
+ * PROFILE_HALF_LIFE seconds and keeps decaying after that, so that a
+ * new transfer is seeded less and less by stale data; entries older
+ * than PROFILE_MAX_AGE are dropped.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <stdio.h>        /* for fopen(), fprintf(), etc.          */
+#include <stdlib.h>       /* for *alloc() and free()               */
+#include <string.h>       /* for standard string routines          */
+#include <time.h>         /* for time()                            */
+
+#include <tsunami-client.h>
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+int profile_read (const char *filename, path_profile_t *profiles, int max_count);
+
+
+/*------------------------------------------------------------------------
+ * int profile_lookup(const char *filename, const char *host,
+ *                    u_int16_t port, path_profile_t *profile);
+ *
+ * Looks up the profile of the given destination in the given profile
+ * file.  Returns 0 if there is one and non-zero otherwise.
+ *------------------------------------------------------------------------*/
+int profile_lookup(const char *filename, const char *host, u_int16_t port, path_profile_t *profile)
+{
+    path_profile_t *profiles;
+    int             count, i;
+    int             status = -1;
+
+    profiles = (path_profile_t *) calloc(PROFILE_MAX_ENTRIES, sizeof(path_profile_t));
+    if (profiles == NULL)
+	return warn("Could not allocate path profiles");
+
+    count = profile_read(filename, profiles, PROFILE_MAX_ENTRIES);
+    for (i = 0; i < count; ++i)
+	if ((profiles[i].port == port) && !strcmp(profiles[i].host, host)) {
+	    *profile = profiles[i];
+	    status   = 0;
+	    break;
+	}
+
+    free(profiles);
+    return status;
+}
+
+
+/*------------------------------------------------------------------------
+ * int profile_update(const char *filename, const path_profile_t *sample);
+ *
+ * Merges the results of a transfer into the profile of its destination
+ * and rewrites the profile file, dropping entries that are too old.
+ * The new file is written next to the old one and renamed over it, so
+ * that a crash never leaves a truncated profile file behind.  Returns 0
+ * on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int profile_update(const char *filename, const path_profile_t *sample)
+{
+    path_profile_t *profiles;
+    path_profile_t *entry = NULL;
+    char            tempname[MAX_PROFILE_NAME + 8];
+    FILE           *file;
+    time_t          now = time(NULL);
+    double          weight;
+    int             count, i;
+
+    profiles = (path_profile_t *) calloc(PROFILE_MAX_ENTRIES, sizeof(path_profile_t));
+    if (profiles == NULL)
+	return warn("Could not allocate path profiles");
+    count = profile_read(filename, profiles, PROFILE_MAX_ENTRIES);
+
+    /* find the entry of this destination, or make room for it */
+    for (i = 0; i < count; ++i)
+	if ((profiles[i].port == sample->port) && !strcmp(profiles[i].host, sample->host))
+	    entry = &profiles[i];
+    if (entry == NULL) {
+	if (count == PROFILE_MAX_ENTRIES) {
+	    entry = &profiles[0];
+	    for (i = 1; i < count; ++i)
+		if (profiles[i].stamp < entry->stamp)
+		    entry = &profiles[i];
+	} else {
+	    entry = &profiles[count++];
+	}
+	*entry = *sample;
+
+    /* average the sample in, old data counts less the older it is */
+    } else {
+	weight       = 0.5 * profile_weight(entry);
+	entry->rate  = weight * entry->rate + (1.0 - weight) * sample->rate;
+	entry->loss  = weight * entry->loss + (1.0 - weight) * sample->loss;
+	if (sample->rtt > 0.0)
+	    entry->rtt = (entry->rtt > 0.0) ? (weight * entry->rtt + (1.0 - weight) * sample->rtt) : sample->rtt;
+	if (sample->best_rate >= profile_weight(entry) * entry->best_rate) {
+	    entry->block_size = sample->block_size;
+	    entry->best_rate  = sample->best_rate;
+	}
+    }
+    entry->stamp = now;
+
+    /* write out everything that is still fresh enough */
+    snprintf(tempname, sizeof(tempname), "%s.new", filename);
+    file = fopen(tempname, "w");
+    if (file == NULL) {
+	free(profiles);
+	return warn("Could not write path profile file");
+    }
+    fprintf(file, "# tsunami path profiles: host port stamp rate rtt loss block_size best_rate\n");
+    for (i = 0; i < count; ++i)
+	if (now - profiles[i].stamp <= PROFILE_MAX_AGE)
+	    fprintf(file, "%s %u %ld %.0f %.0f %.6f %u %.0f\n",
+		    profiles[i].host, profiles[i].port, (long) profiles[i].stamp, profiles[i].rate,
+		    profiles[i].rtt, profiles[i].loss, profiles[i].block_size, profiles[i].best_rate);
+    free(profiles);
+    if (fclose(file) || rename(tempname, filename))
+	return warn("Could not write path profile file");
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void profile_seed(ttp_parameter_t *parameter,
+ *                   const path_profile_t *profile);
+ *
+ * Seeds the parameters of the next transfer from the given profile:
+ * the target rate comes down to a little over the best goodput measured
+ * before, the transfer starts at the usual rate instead of a third of
+ * the target, the server gets the RTT in advance, and if the user did
+ * not set a block size, the best one so far is used.  The older the
+ * profile, the closer the rates stay to the configured ones.
+ *
+ * The usual rate is measured under the target seeded from the profile
+ * before, so capping against it would lower the target on every run;
+ * the best goodput only goes up when a transfer does better.
+ *------------------------------------------------------------------------*/
+void profile_seed(ttp_parameter_t *parameter, const path_profile_t *profile)
+{
+    double weight  = profile_weight(profile);
+    double goodput = max(profile->rate, profile->best_rate);
+    double rate    = weight * PROFILE_HEADROOM * goodput + (1.0 - weight) * parameter->target_rate;
+
+    parameter->target_rate = min(parameter->target_rate, rate);
+    parameter->start_rate  = min(parameter->target_rate, weight * profile->rate + (1.0 - weight) * parameter->target_rate / 3);
+    parameter->rtt_hint    = profile->rtt;
+    if (!parameter->block_size_set && (profile->block_size > 0) && (profile->block_size <= MAX_BLOCK_SIZE))
+	parameter->block_size = profile->block_size;
+
+    printf("Path profile (%0.1f hours old): %0.1f Mbps, RTT %0.2f ms, %0.2f%% retransmits, block size %u\n",
+	   (time(NULL) - profile->stamp) / 3600.0, profile->rate / 1e6, profile->rtt / 1000.0, 100.0 * profile->loss, profile->block_size);
+    printf("Starting at %0.1f Mbps with a target of %0.1f Mbps.\n", parameter->start_rate / 1e6, parameter->target_rate / 1e6);
+}
+
+
+/*------------------------------------------------------------------------
+ * double profile_weight(const path_profile_t *profile);
+ *
+ * Returns how much the given profile is still worth, from 1.0 for a
+ * brand new profile down towards 0.0 for a very old one.
+ *------------------------------------------------------------------------*/
+double profile_weight(const path_profile_t *profile)
+{
+    double age = time(NULL) - profile->stamp;
+
+    return 1.0 / (1.0 + max(age, 0.0) / PROFILE_HALF_LIFE);
+}
+
+
+/*------------------------------------------------------------------------
+ * int profile_read(const char *filename, path_profile_t *profiles,
+ *                  int max_count);
+ *
+ * Reads up to max_count profiles from the given file.  A missing file
+ * holds no profiles, malformed lines are skipped.  Returns the number
+ * of profiles read.
+ *------------------------------------------------------------------------*/
+int profile_read(const char *filename, path_profile_t *profiles, int max_count)
+{
+    FILE          *file;
+    char           line[MAX_PROFILE_NAME + 128];
+    path_profile_t entry;
+    unsigned int   port;
+    long           stamp;
+    int            count = 0;
+
+    file = fopen(filename, "r");
+    if (file == NULL)
+	return 0;
+
+    while ((count < max_count) && (fgets(line, sizeof(line), file) != NULL)) {
+	if (line[0] == '#')
+	    continue;
+	memset(&entry, 0, sizeof(entry));
+	if (sscanf(line, "%255s %u %ld %lf %lf %lf %u %lf", entry.host, &port, &stamp, &entry.rate,
+		   &entry.rtt, &entry.loss, &entry.block_size, &entry.best_rate) != 8)
+	    continue;
+	entry.port  = port;
+	entry.stamp = stamp;
+	profiles[count++] = entry;
+    }
+
+    fclose(file);
+    return count;
+}
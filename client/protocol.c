@@ -63,6 +63,7 @@
 
 #include <stdlib.h>       /* for *alloc() and free()               */
 #include <string.h>       /* for standard string routines          */
+#include <sys/select.h>   /* for select()                          */
 #include <sys/socket.h>   /* for the BSD socket library            */
 #include <sys/time.h>     /* for gettimeofday()                    */
 #include <time.h>         /* for time()                            */
@@ -71,6 +72,14 @@
 #include <tsunami-client.h>
 //#define DEBUG_RETX xxx // enable to show retransmit debug infos
 
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+int ttp_read_option (ttp_session_t *session, u_int16_t *key, u_int64_t *value);
+int ttp_write_option(ttp_session_t *session, u_int16_t key, u_int64_t value);
+int ttp_recv_probe  (ttp_session_t *session);
+
 /*------------------------------------------------------------------------
  * int ttp_authenticate(ttp_session_t *session, u_char *secret);
  *
@@ -164,6 +173,12 @@ int ttp_negotiate(ttp_session_t *session)
  * the name of a file to transfer).  If the request is accepted, we
  * retrieve the file parameters, open the file for writing, and return
  * 0 for success.  If anything goes wrong, we return a non-zero value.
+ *
+ * With a bundle in the session, its files are asked for instead, and
+ * opened for writing in place of the file.  With 'set resume', a
+ * journal of an earlier transfer of the file is picked up, and the
+ * server asked for only the blocks it misses.  With 'set sync', a copy
+ * of the file that is here already gets only the blocks that differ.
  *------------------------------------------------------------------------*/
 int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const char *local_filename)
 {
@@ -171,8 +186,22 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
     u_int32_t        temp;      /* used for transmitting 32-bit values */
     u_int16_t        temp16;    /* used for transmitting 16-bit values */
     int              status;
+    int              mtu, fit;
     ttp_transfer_t  *xfer  = &session->transfer;
     ttp_parameter_t *param =  session->parameter;
+    u_int32_t        header_flags = ((param->timestamps || (param->congestion != TS_CC_TSUNAMI)) ? TS_HDR_TIMESTAMP : 0) | TS_HDR_WIDE |
+                                    ((param->pipeline_file > 0) ? TS_HDR_FILE : 0);
+    u_int16_t        streams = param->streams;
+    const char      *path;
+    int              resume;
+    u_int64_t        sync_size;
+    u_char           ecn = param->ecn;
+
+    /* with paths, there is a stream for each of them besides the main one */
+    if (param->paths != NULL)
+        for (streams = 2, path = param->paths; (path = strchr(path, ',')) != NULL; ++path)
+            ++streams;
+    streams = min(streams, MAX_STREAMS);
 
     /* submit the transfer request */
     status = fprintf(session->server, "%s\n", remote_filename);
@@ -185,12 +214,54 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
 	return warn("Could not read response to file request");
 
     /* make sure the result was a good one */
-    if (result != 0)
+    if ((result != 0) && (session->bundle != NULL)) {
+        session->bundle->refused = 1;
+	return warn("Server does not send bundles");
+    } else if (result != 0)
 	return warn("Server: File does not exist or cannot be transmitted");
 
+    /* a bundle names its files, and the server says which of them it can send */
+    if (session->bundle != NULL) {
+        if (bundle_request(session) < 0)
+            return warn("Could not request bundle");
+        if (fread(&result, 1, 1, session->server) < 1)
+            return warn("Could not read response to bundle request");
+        if (result != 0)
+            return warn("Server: None of the bundled files can be transmitted");
+    }
+
+    /* see if a block, its headers included, fits into a single IP packet on the way here */
+    mtu = get_path_mtu(session);
+    fit = mtu - (param->ipv6_yn ? 40 : 20) - 8 - ttp_header_size(header_flags);
+    if ((mtu > 0) && (fit >= 512) && (param->block_size > fit)) {
+        if (param->pmtu) {
+            printf("Using %d byte blocks instead of %u to fit the path MTU of %d bytes.\n", fit, param->block_size, mtu);
+            param->block_size = fit;
+        } else {
+            printf("Note: %u byte blocks are fragmented on this path (MTU %d bytes), 'set blocksize %d' avoids that.\n",
+                   param->block_size, mtu, fit);
+        }
+    }
+
+    /* a transfer resumed from a journal goes on in the blocks of the journal */
+    resume = journal_load(session, local_filename);
+    if (resume && (session->journal->held != NULL) && (session->journal->head.block_size != param->block_size)) {
+        printf("Using %u byte blocks as the journal of '%s' does.\n", session->journal->head.block_size, local_filename);
+        param->block_size = session->journal->head.block_size;
+    }
+
+    /* and one of a file we have a copy of may only need the blocks that changed */
+    sync_size = sync_offer(session, local_filename);
+
+    /* ask for ECN capable data only if the data socket can show us the marks */
+    if (ecn && !test_ecn_socket(param)) {
+        warn("Could not enable reception of ECN marks, asking for no ECN");
+        ecn = 0;
+    }
+
     /* Submit the block size, target bitrate, and maximum error rate */
     temp = htonl(param->block_size);   if (fwrite(&temp, 4, 1, session->server) < 1) return warn("Could not submit block size");
-    temp = htonl(param->target_rate);  if (fwrite(&temp, 4, 1, session->server) < 1) return warn("Could not submit target rate");
+    temp = htonl(min(param->target_rate, 0xffffffffULL));  if (fwrite(&temp, 4, 1, session->server) < 1) return warn("Could not submit target rate");
     temp = htonl(param->error_rate);   if (fwrite(&temp, 4, 1, session->server) < 1) return warn("Could not submit error rate");
     if (fflush(session->server))
 	return warn("Could not flush control channel");
@@ -200,6 +271,50 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
     temp16 = htons(param->slower_den);  if (fwrite(&temp16, 2, 1, session->server) < 1) return warn("Could not submit slowdown denominator");
     temp16 = htons(param->faster_num);  if (fwrite(&temp16, 2, 1, session->server) < 1) return warn("Could not submit speedup numerator");
     temp16 = htons(param->faster_den);  if (fwrite(&temp16, 2, 1, session->server) < 1) return warn("Could not submit speedup denominator");
+
+    /* submit the transfer options we would like, the full target rate first */
+    if (ttp_write_option(session, TS_OPT_TARGET_RATE, param->target_rate) < 0) return warn("Could not submit target rate");
+    if (ttp_write_option(session, TS_OPT_CONGESTION, param->congestion) < 0) return warn("Could not submit congestion controller");
+    if (ttp_write_option(session, TS_OPT_HEADER,     header_flags)       < 0) return warn("Could not submit header extensions");
+    if (param->congestion == TS_CC_LEDBAT)
+        if (ttp_write_option(session, TS_OPT_DELAY_TARGET, 1000 * (u_int64_t) param->delay_target) < 0) return warn("Could not submit target delay");
+    if (ttp_write_option(session, TS_OPT_ECN,        ecn)               < 0) return warn("Could not submit ECN setting");
+    if (ttp_write_option(session, TS_OPT_PROBE,      param->probe_train) < 0) return warn("Could not submit probe length");
+    if (param->start_rate > 0)
+        if (ttp_write_option(session, TS_OPT_START_RATE, param->start_rate) < 0) return warn("Could not submit start rate");
+    if (param->rtt_hint > 0)
+        if (ttp_write_option(session, TS_OPT_RTT_HINT,   param->rtt_hint)   < 0) return warn("Could not submit RTT hint");
+    if (param->fec != TS_FEC_NONE) {
+        if (ttp_write_option(session, TS_OPT_FEC,       param->fec)       < 0) return warn("Could not submit FEC code");
+        if (ttp_write_option(session, TS_OPT_FEC_GROUP, param->fec_group) < 0) return warn("Could not submit FEC group size");
+    }
+    if (param->tail_copies > 0)
+        if (ttp_write_option(session, TS_OPT_TAIL_COPIES, param->tail_copies) < 0) return warn("Could not submit tail copies");
+    if (ttp_write_option(session, TS_OPT_BACKPRESSURE, param->backpressure) < 0) return warn("Could not submit backpressure setting");
+    if ((streams > 1) && (param->mirrors == NULL) && (param->fec == TS_FEC_NONE) && (param->lossless || (param->losswindow_ms == 0))) {
+        if (ttp_write_option(session, TS_OPT_STREAMS, streams) < 0) return warn("Could not submit stream count");
+        if (param->paths != NULL)
+            if (ttp_write_option(session, TS_OPT_PATHS, 1) < 0) return warn("Could not submit stream addresses");
+    }
+    if (param->mirror)
+        if (ttp_write_option(session, TS_OPT_MIRROR, 1) < 0) return warn("Could not submit mirror mode");
+    if (param->multicast && (param->mirrors == NULL) && !param->ipv6_yn)
+        if (ttp_write_option(session, TS_OPT_MULTICAST, 1) < 0) return warn("Could not submit multicast request");
+    if (param->pipeline_file > 0)
+        if (ttp_write_option(session, TS_OPT_PIPELINE, param->pipeline_file) < 0) return warn("Could not submit pipeline file number");
+    if (session->concurrent != NULL)
+        if (ttp_write_option(session, TS_OPT_RATE_SHARE, 1) < 0) return warn("Could not submit rate sharing");
+    if (resume) {
+        if (ttp_write_option(session, TS_OPT_RESUME, session->journal->head.file_time) < 0) return warn("Could not submit journal");
+        if (session->journal->held != NULL)
+            if (ttp_write_option(session, TS_OPT_RESUME_SIZE, session->journal->head.file_size) < 0) return warn("Could not submit journal");
+    } else if ((param->mirrors != NULL) || param->mirror) {
+        /* without a journal, just to learn the modification time that tells the copies of mirrors apart */
+        if (ttp_write_option(session, TS_OPT_RESUME, 0) < 0) return warn("Could not ask for file modification time");
+    }
+    if (sync_size > 0)
+        if (ttp_write_option(session, TS_OPT_SYNC, sync_size) < 0) return warn("Could not submit size of local copy");
+    if (ttp_write_option(session, TS_OPT_END,        0)                 < 0) return warn("Could not submit end of options");
     if (fflush(session->server))
 	return warn("Could not flush control channel");
 
@@ -211,16 +326,128 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
     /* read in the file length, block size, block count, and run epoch */
     if (fread(&xfer->file_size,   8, 1, session->server) < 1) return warn("Could not read file size");         xfer->file_size   = ntohll(xfer->file_size);
     if (fread(&temp,              4, 1, session->server) < 1) return warn("Could not read block size");        if (htonl(temp) != param->block_size) return warn("Block size disagreement");
-    if (fread(&xfer->block_count, 4, 1, session->server) < 1) return warn("Could not read number of blocks");  xfer->block_count = ntohl (xfer->block_count);
+    if (fread(&temp,              4, 1, session->server) < 1) return warn("Could not read number of blocks");  xfer->block_count = ntohl (temp);
     if (fread(&xfer->epoch,       4, 1, session->server) < 1) return warn("Could not read run epoch");         xfer->epoch       = ntohl (xfer->epoch);
 
+    /* read in the transfer options that the server put into effect, anything not listed is off */
+    while (1) {
+        u_int16_t key;
+        u_int64_t value;
+        if (ttp_read_option(session, &key, &value) < 0) return warn("Could not read transfer options");
+        if (key == TS_OPT_END)
+            break;
+        else if ((key == TS_OPT_CONGESTION) && (value < TS_CC_COUNT))
+            xfer->congestion = value;
+        else if (key == TS_OPT_HEADER)
+            xfer->header_flags = value;
+        else if (key == TS_OPT_DELAY_TARGET)
+            xfer->delay_target = value;
+        else if (key == TS_OPT_ECN)
+            xfer->ecn = (value != 0);
+        else if (key == TS_OPT_PROBE)
+            xfer->probe_train = min(value, MAX_PROBE_TRAIN);
+        else if (key == TS_OPT_IPD)
+            xfer->ipd_time = value;
+        else if ((key == TS_OPT_FEC) && (value < TS_FEC_COUNT))
+            xfer->fec = value;
+        else if ((key == TS_OPT_FEC_GROUP) && (value >= 2) && (value <= MAX_FEC_GROUP))
+            xfer->fec_group = value;
+        else if (key == TS_OPT_TAIL_COPIES)
+            xfer->tail_copies = min(value, MAX_TAIL_COPIES);
+        else if (key == TS_OPT_BACKPRESSURE)
+            xfer->backpressure = (value != 0);
+        else if (key == TS_OPT_STREAMS)
+            xfer->streams = min(value, MAX_STREAMS);
+        else if (key == TS_OPT_PATHS)
+            xfer->paths = (value != 0);
+        else if (key == TS_OPT_MIRROR)
+            xfer->mirrored = (value != 0);
+        else if ((key == TS_OPT_MULTICAST) && (value != 0)) {
+            xfer->multicast   = 1;
+            xfer->mcast_group = value >> 16;
+            xfer->mcast_port  = value & 0xffff;
+        }
+        else if (key == TS_OPT_PIPELINE)
+            xfer->pipeline = value;
+        else if (key == TS_OPT_RATE_SHARE)
+            xfer->rate_share = (value != 0);
+        else if (key == TS_OPT_RESUME)
+            xfer->file_time = value;
+        else if (key == TS_OPT_RESUME_SIZE)
+            xfer->resumed = (value != 0);
+        else if ((key == TS_OPT_SYNC) && (value > 0))
+            xfer->sync_segment = value;
+    }
+    if (xfer->fec_group == 0)
+        xfer->fec = TS_FEC_NONE;
+    if (xfer->streams == 0)
+        xfer->streams = 1;
+    if ((param->paths != NULL) && (xfer->streams > 1) && !xfer->paths)
+        warn("Server won't take stream addresses, using the default paths");
+    if (param->multicast && (param->mirrors == NULL) && !xfer->multicast)
+        warn("Server won't multicast, receiving by unicast");
+    xfer->header_size = ttp_header_size(xfer->header_flags);
+
+    /* the block count field is only 32 bits wide, with wide block numbers it comes from the file size */
+    if (xfer->header_flags & TS_HDR_WIDE)
+        xfer->block_count = (xfer->file_size / param->block_size) + ((xfer->file_size % param->block_size) != 0);
+
+    /* a resumed transfer says which blocks it still misses */
+    if (xfer->resumed && (journal_request(session) < 0))
+        return warn("Could not resume the transfer");
+
+    /* a synced one says what its copy has, and learns which blocks differ */
+    if ((sync_size > 0) && (xfer->sync_segment == 0))
+        warn("Server does not sync this file, getting all of it");
+    if ((xfer->sync_segment > 0) && (sync_request(session) < 0))
+        return warn("Could not sync the file");
+
     /* we start out with every block yet to transfer */
     xfer->blocks_left = xfer->block_count;
 
+    /* make crude estimate of blocks on the wire if RTT delay is 500ms */
+    xfer->on_wire_estimate = (u_int32_t)(0.5 * param->target_rate/(8*param->block_size));
+    xfer->on_wire_estimate = min(xfer->block_count, xfer->on_wire_estimate);
+
+    /* a mirror just sends, the file is written through the session with the server */
+    if (param->mirror)
+        return 0;
+
+    /* the files of a bundle are written where they belong */
+    if (session->bundle != NULL) {
+        if (bundle_open(session) < 0)
+            return warn("Could not open the bundled files for writing");
+        return 0;
+    }
+
+    /* a relative name may lead into directories that aren't here yet */
+    if (xfer->local_filename[0] != '/')
+        create_parents(xfer->local_filename);
+
+    /* a resumed file is written into where it is, what the journal has stays */
+    if (xfer->resumed) {
+        xfer->file = fopen(xfer->local_filename, "r+b");
+        if (xfer->file == NULL)
+            return warn("Could not open local file to resume");
+    }
+
+    /* and so is a synced one, cut to the length of the file on the server */
+    if (xfer->sync_segment > 0) {
+        xfer->file = fopen(xfer->local_filename, "r+b");
+        if (xfer->file == NULL)
+            return warn("Could not open local file to sync");
+        if (ftruncate(fileno(xfer->file), xfer->file_size) < 0) {
+            fclose(xfer->file);
+            xfer->file = NULL;
+            return warn("Could not truncate local file to sync");
+        }
+    }
+
     /* try to open the local file for writing */
-    if (!access(xfer->local_filename, F_OK))
+    if ((xfer->file == NULL) && !access(xfer->local_filename, F_OK))
         printf("Warning: overwriting existing file '%s'\n", local_filename);     
-    xfer->file = fopen(xfer->local_filename, "wb");
+    if (xfer->file == NULL)
+        xfer->file = fopen(xfer->local_filename, "wb");
     if (xfer->file == NULL) {
         char * trimmed = rindex(xfer->local_filename, '/');
         if ((trimmed != NULL) && (strlen(trimmed)>1)) {
@@ -235,6 +462,16 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
         }
     }
 
+    /* and keep a map of what is on disk for a relaying server if asked to */
+    if (relay_map_open(session) < 0) {
+        fclose(xfer->file);
+        xfer->file = NULL;
+        return warn("Could not set up the relay map");
+    }
+
+    /* and a journal of it to resume from if asked to */
+    journal_open(session);
+
     #ifdef VSIB_REALTIME
     /* try to open the vsib for output */
     xfer->vsib = fopen("/dev/vsib", "wb");
@@ -247,14 +484,6 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
     return warn("Could not reserve space for ring buffer");
     #endif
 
-    /* make crude estimate of blocks on the wire if RTT delay is 500ms */
-    xfer->on_wire_estimate = (u_int32_t)(0.5 * param->target_rate/(8*param->block_size));
-    xfer->on_wire_estimate = min(xfer->block_count, xfer->on_wire_estimate);
-
-    /* if we're doing a transcript */
-    if (param->transcript_yn)
-	xscript_open(session);
-
     /* indicate success */
     return 0;
 }
@@ -265,7 +494,11 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
  *
  * Creates a new UDP socket for receiving the file data associated with
  * our pending transfer and communicates the port number back to the
- * server.  Returns 0 on success and non-zero on failure.
+ * server.  If a startup probe was negotiated, it is received and
+ * reported before the transcript is started.  The files of a pipelined
+ * GET * after the first keep the socket of the file before, which the
+ * caller puts back into the transfer.  Returns 0 on success and
+ * non-zero on failure.
  *------------------------------------------------------------------------*/
 int ttp_open_port(ttp_session_t *session)
 {
@@ -274,11 +507,64 @@ int ttp_open_port(ttp_session_t *session)
     int             status;
     u_int16_t      *port;
 
+    /* the server already knows the port of a pipelined GET * */
+    if (session->transfer.pipeline > 1) {
+	session->transfer.mcast_fd = -1;
+	if (session->parameter->transcript_yn)
+	    xscript_open(session);
+	return 0;
+    }
+
     /* open a new datagram socket */
+    session->transfer.mcast_fd = -1;
     session->transfer.udp_fd = create_udp_socket(session->parameter);
     if (session->transfer.udp_fd < 0)
 	return warn("Could not create UDP socket");
 
+    /* and share its port among several sockets if asked to */
+    if (stream_share_port(session) < 0)
+	return warn("Could not share UDP port");
+
+    /* and join the multicast group that the originals are sent to, repairs still come to the port above */
+    if (session->transfer.multicast) {
+	session->transfer.mcast_fd = create_mcast_socket(session);
+	if (session->transfer.mcast_fd < 0) {
+	    close(session->transfer.udp_fd);
+	    return warn("Could not join multicast group");
+	}
+	session->transfer.mcast_drops = 0;
+    }
+
+    /* have the kernel's count of datagrams dropped at these sockets delivered with each datagram */
+    {
+	int       actual = 0;
+	socklen_t length = sizeof(actual);
+	getsockopt(session->transfer.udp_fd, SOL_SOCKET, SO_RCVBUF, &actual, &length);
+	session->transfer.udp_buffer       = (actual > 0) ? actual : session->parameter->udp_buffer;
+	session->transfer.udp_buffer_stuck = 0;
+    }
+    #ifdef SO_RXQ_OVFL
+    {
+	int yes = 1;
+	session->transfer.rxq_ovfl = (setsockopt(session->transfer.udp_fd, SOL_SOCKET, SO_RXQ_OVFL, &yes, sizeof(yes)) == 0) &&
+	                             ((session->transfer.mcast_fd < 0) ||
+	                              (setsockopt(session->transfer.mcast_fd, SOL_SOCKET, SO_RXQ_OVFL, &yes, sizeof(yes)) == 0));
+    }
+    #endif
+
+    /* have the TOS byte of ECN capable data delivered with each datagram */
+    if (session->transfer.ecn) {
+	int yes = 1;
+	if (session->parameter->ipv6_yn)
+	    status = setsockopt(session->transfer.udp_fd, IPPROTO_IPV6, IPV6_RECVTCLASS, &yes, sizeof(yes));
+	else
+	    status = setsockopt(session->transfer.udp_fd, IPPROTO_IP,   IP_RECVTOS,      &yes, sizeof(yes));
+	if (status < 0) {
+	    warn("Could not enable reception of ECN marks");
+	    session->transfer.ecn = 0;
+	}
+    }
+
     /* find out the port number we're using */
     memset(&udp_address, 0, sizeof(udp_address));
     getsockname(session->transfer.udp_fd, (struct sockaddr *) &udp_address, &udp_length);
@@ -286,13 +572,28 @@ int ttp_open_port(ttp_session_t *session)
     /* get a hold of the port number */
     port = (session->parameter->ipv6_yn ? &((struct sockaddr_in6 *) &udp_address)->sin6_port : &((struct sockaddr_in *) &udp_address)->sin_port);
 
-    /* send that port number to the server */
+    /* send that port number to the server, followed by those of any further streams */
     status = fwrite(port, 2, 1, session->server);
-    if ((status < 1) || fflush(session->server)) {
+    if ((status < 1) || (stream_open(session) < 0) || fflush(session->server)) {
 	close(session->transfer.udp_fd);
+	if (session->transfer.mcast_fd >= 0)
+	    close(session->transfer.mcast_fd);
 	return warn("Could not send UDP port number");
     }
 
+    /* let the server measure the path */
+    if (session->transfer.probe_train > 0)
+	if (ttp_recv_probe(session) < 0) {
+	    close(session->transfer.udp_fd);
+	    if (session->transfer.mcast_fd >= 0)
+		close(session->transfer.mcast_fd);
+	    return warn("Startup probe failed");
+	}
+
+    /* if we're doing a transcript */
+    if (session->parameter->transcript_yn)
+	xscript_open(session);
+
     /* we succeeded */
     return 0;
 }
@@ -312,7 +613,7 @@ int ttp_repeat_retransmit(ttp_session_t *session)
     retransmission_t  retransmission[MAX_RETRANSMISSION_BUFFER];  /* the retransmission request object        */
     int               entry;                                      /* an index into the retransmission table   */
     int               status;
-    int               block;
+    u_int64_t         block;
     int               count = 0;
     retransmit_t     *rexmit = &(session->transfer.retransmit);
     ttp_transfer_t   *xfer = &session->transfer;
@@ -340,7 +641,8 @@ int ttp_repeat_retransmit(ttp_session_t *session)
 
             /* insert retransmit request */
             retransmission[count].request_type = htons(REQUEST_RETRANSMIT);
-            retransmission[count].block        = htonl(block);
+            retransmission[count].block        = htonl((u_int32_t) block);
+            retransmission[count].block_high   = htonl((u_int32_t) (block >> 32));
             ++count;
 
             #ifdef DEBUG_RETX
@@ -350,12 +652,14 @@ int ttp_repeat_retransmit(ttp_session_t *session)
     }
 
     /* if there are too many entries, restart transfer from earlier point */
-    if (count >= MAX_RETRANSMISSION_BUFFER) {
+    /* (not with several streams or mirrors, whose originals would all come again) */
+    if ((count >= MAX_RETRANSMISSION_BUFFER) && (xfer->stream == NULL)) {
 
         /* restart from first missing block */
         block                          = min(xfer->block_count, xfer->gapless_to_block + 1);
         retransmission[0].request_type = htons(REQUEST_RESTART);
-        retransmission[0].block        = htonl(block);
+        retransmission[0].block        = htonl((u_int32_t) block);
+        retransmission[0].block_high   = htonl((u_int32_t) (block >> 32));
 
         /* send out the request */
         status = fwrite(&retransmission[0], sizeof(retransmission[0]), 1, session->server);
@@ -363,14 +667,21 @@ int ttp_repeat_retransmit(ttp_session_t *session)
             return warn("Could not send restart-at request");
         }
 
+        /* the server takes us out of a multicast group then, whose originals would only get in the way */
+        if (xfer->mcast_fd >= 0) {
+            close(xfer->mcast_fd);
+            xfer->mcast_fd = -1;
+        }
+
         /* remember the request so we can then ignore blocks that are still on the wire */
         xfer->restart_pending        = 1;
         xfer->restart_lastidx        = rexmit->table[rexmit->index_max - 1];
         xfer->restart_wireclearidx   = min(xfer->block_count, xfer->restart_lastidx + xfer->on_wire_estimate);
 
         #ifdef DEBUG_RETX
-        printf("ttp_repeat_restransmit: restart_pending=1, range %u to %u, clear at %u, gapless to %u, old head %u\n",
-               block, xfer->restart_lastidx, xfer->restart_wireclearidx, xfer->gapless_to_block, xfer->next_block);
+        printf("ttp_repeat_restransmit: restart_pending=1, range %llu to %llu, clear at %llu, gapless to %llu, old head %llu\n",
+               (ull_t) block, (ull_t) xfer->restart_lastidx, (ull_t) xfer->restart_wireclearidx,
+               (ull_t) xfer->gapless_to_block, (ull_t) xfer->next_block);
         #endif
 
         /* reset the retransmission table and head block */
@@ -379,11 +690,12 @@ int ttp_repeat_retransmit(ttp_session_t *session)
 
        xfer->stats.this_retransmits = MAX_RETRANSMISSION_BUFFER;
 
-    /* queue is small enough */
+    /* queue is small enough, or sent in slices */
     } else {
 
-        /* update to shrunken size */
-        rexmit->index_max = count;
+        /* update to shrunken size, keeping the requests of later slices */
+        memmove(rexmit->table + count, rexmit->table + entry, (rexmit->index_max - entry) * sizeof(u_int64_t));
+        rexmit->index_max = count + (rexmit->index_max - entry);
 
         /* update the statistics */
         xfer->stats.this_retransmits   = count;
@@ -413,25 +725,26 @@ int ttp_repeat_retransmit(ttp_session_t *session)
 
 
 /*------------------------------------------------------------------------
- * int ttp_request_retransmit(ttp_session_t *session, u_int32_t block);
+ * int ttp_request_retransmit(ttp_session_t *session, u_int64_t block);
  *
  * Requests a retransmission of the given block in the current transfer.
  * Returns 0 on success and non-zero otherwise.
  *------------------------------------------------------------------------*/
-int ttp_request_retransmit(ttp_session_t *session, u_int32_t block)
+int ttp_request_retransmit(ttp_session_t *session, u_int64_t block)
 {
    #ifdef RETX_REQBLOCK_SORTING
-   u_int32_t     tmp32_ins = 0, tmp32_up;
+   u_int64_t     tmp64_ins = 0, tmp64_up;
    u_int32_t     idx = 0;
    #endif
 
-   u_int32_t    *ptr;
+   u_int64_t    *ptr;
    retransmit_t *rexmit = &(session->transfer.retransmit);
 
    /* double checking: if we already got the block, don't add it */
    if (got_block(session, block)) {
       return 0;
    }
+   session->transfer.stats.this_losses++;
 
    /* if we don't have space for the request */
    if (rexmit->index_max >= rexmit->table_size) {
@@ -441,13 +754,13 @@ int ttp_request_retransmit(ttp_session_t *session, u_int32_t block)
          return 0;
 
       /* try to reallocate the table twice the size*/
-      ptr = (u_int32_t *) realloc(rexmit->table, 2 * sizeof(u_int32_t)*rexmit->table_size);
+      ptr = (u_int64_t *) realloc(rexmit->table, 2 * sizeof(u_int64_t)*rexmit->table_size);
       if (ptr == NULL)
          return warn("Could not grow retransmission table");
 
       /* prepare the new table space */
       rexmit->table = ptr;
-      memset(rexmit->table + rexmit->table_size, 0, sizeof(u_int32_t) * rexmit->table_size);
+      memset(rexmit->table + rexmit->table_size, 0, sizeof(u_int64_t) * rexmit->table_size);
       rexmit->table_size *= 2;
 
       #if DEBUG_RETX
@@ -484,11 +797,11 @@ int ttp_request_retransmit(ttp_session_t *session, u_int32_t block)
       // fprintf(stderr, "duplicate retransmit req for block %d discarded\n", block);
    } else { 
       /* insert and shift remaining table upwards - linked list could be nice... */
-      tmp32_ins = block;
+      tmp64_ins = block;
       do {
-         tmp32_up = rexmit->table[idx];
-         rexmit->table[idx++] = tmp32_ins;
-         tmp32_ins = tmp32_up;
+         tmp64_up = rexmit->table[idx];
+         rexmit->table[idx++] = tmp64_ins;
+         tmp64_ins = tmp64_up;
       } while(idx <= rexmit->index_max);
       rexmit->index_max++;
    }
@@ -555,14 +868,20 @@ int ttp_update_stats(ttp_session_t *session)
     double            data_this_rexmit;                       /* the amount of data in received retransmissions */ 
     double            data_this_goodpt;                       /* the amount of data as non-lost packets         */
     double            retransmits_fraction;                   /* how many retransmit requests there were vs received blocks */
+    double            network_fraction;                       /* the same without the datagrams our socket dropped */
+    u_int64_t         socket_drops;                           /* the datagrams dropped at our socket since last time */
+    u_int32_t         udp_buffer;
     double            total_retransmits_fraction;
     double            ringfill_fraction;
+    u_int32_t         ring_free;
     statistics_t     *stats = &(session->transfer.stats);
     retransmission_t  retransmission;
     int               status;
+    int               i;
     static u_int32_t  iteration = 0;
-    static char       stats_line[128];
-    static char       stats_flags[8];
+    char              stats_line[160];
+    char              stats_flags[8];
+    char              stats_share[16];
 
     double ff, fb;
 
@@ -587,13 +906,20 @@ int ttp_update_stats(ttp_session_t *session)
     data_this_goodpt = ((double) session->parameter->block_size) * stats->this_flow_originals;
     // <=> data_this == data_this_rexmit + data_this_goodpt
 
-    /* get the current UDP receive error count reported by the operating system */
-    stats->this_udp_errors = get_udp_in_errors();
+    /* get the current UDP receive error count, for our socket if the kernel tells us and host-wide otherwise */
+    stats->this_udp_errors = session->transfer.rxq_ovfl ? (u_int64_t) session->transfer.socket_drops + session->transfer.mcast_drops
+                                                        : get_udp_in_errors();
+    socket_drops           = stats->this_udp_errors - stats->last_udp_errors;
+    stats->last_udp_errors = stats->this_udp_errors;
 
     /* precalculate some fractions */
     retransmits_fraction = stats->this_retransmits / (1.0 + stats->this_retransmits + stats->total_blocks - stats->this_blocks);
-    ringfill_fraction    = session->transfer.ring_buffer->count_data / MAX_BLOCKS_QUEUED;
-    total_retransmits_fraction = stats->total_retransmits / (stats->total_retransmits + stats->total_blocks);
+    network_fraction     = retransmits_fraction;
+    if (session->transfer.rxq_ovfl && (stats->this_losses > 0))
+        network_fraction = retransmits_fraction * (stats->this_losses - min(stats->this_losses, socket_drops)) / stats->this_losses;
+    ring_free            = MAX_BLOCKS_QUEUED - 1 - session->transfer.ring_buffer->count_data - session->transfer.ring_buffer->count_reserved;
+    ringfill_fraction    = (double) session->transfer.ring_buffer->count_data / MAX_BLOCKS_QUEUED;
+    total_retransmits_fraction = (double) stats->total_retransmits / max(stats->total_retransmits + stats->total_blocks, 1);
 
     /* update the rate statistics */
     // incoming transmit rate R = goodput R (Mbit/s) + retransmit R (Mbit/s)
@@ -608,41 +934,93 @@ int ttp_update_stats(ttp_session_t *session)
     stats->transmit_rate = fb * stats->transmit_rate + ff * stats->this_transmit_rate;
 
     // IIR filtered composite error and loss, some sort of knee function
-    stats->error_rate = fb * stats->error_rate + ff * 500*100 * (retransmits_fraction + ringfill_fraction);
+    // with backpressure the ring fill is reported on its own and not mistaken for network loss
+    if (session->transfer.backpressure)
+        ringfill_fraction = 0.0;
+    // blocks that our own socket dropped are no network loss either, we grow the socket buffer for them instead
+    stats->error_rate = fb * stats->error_rate + ff * 500*100 * (network_fraction + ringfill_fraction);
+    if (session->transfer.rxq_ovfl && (socket_drops > 0)) {
+        udp_buffer = grow_udp_buffer(session);
+        if ((udp_buffer > 0) && session->parameter->verbose_yn)
+            printf("Socket overflow: %llu datagrams dropped, receive buffer grown to %u bytes\n", (ull_t) socket_drops, udp_buffer);
+    }
+
+    /* find the rate at which the disk thread writes while it is busy, which is what our disk can take */
+    if (stats->disk_usec > stats->this_disk_usec) {
+        double this_disk_rate = 8.0 * session->parameter->block_size * (stats->disk_blocks - stats->this_disk_blocks)
+                              * 1e6 / (stats->disk_usec - stats->this_disk_usec);
+        stats->disk_rate        = (stats->disk_rate == 0.0) ? this_disk_rate : (fb * stats->disk_rate + ff * this_disk_rate);
+        stats->this_disk_blocks = stats->disk_blocks;
+        stats->this_disk_usec   = stats->disk_usec;
+    }
+
+    /* find the queueing delay (mean one-way delay over the base delay) and its trend */
+    if (stats->this_delay_count > 0) {
+        double  this_delay = stats->this_delay_sum / stats->this_delay_count;
+        int64_t base_delay = this_delay;
+        for (i = 0; i < DELAY_HISTORY; ++i)
+            if ((stats->base_minute[i] > now_epoch / 60 - DELAY_HISTORY) && (stats->base_delay[i] < base_delay))
+                base_delay = stats->base_delay[i];
+        stats->queue_delay      = this_delay - base_delay;
+        stats->delay_trend      = (stats->delay_reports++ > 0) ? (this_delay - stats->last_delay) : 0.0;
+        stats->last_delay       = this_delay;
+        stats->this_delay_sum   = 0.0;
+        stats->this_delay_count = 0;
+    }
         
     /* send the current error rate information to the server */
     memset(&retransmission, 0, sizeof(retransmission));
-    retransmission.request_type = htons(REQUEST_ERROR_RATE);
-    retransmission.error_rate   = htonl((u_int64_t) session->transfer.stats.error_rate);
+    retransmission.request_type  = htons(REQUEST_ERROR_RATE);
+    retransmission.block         = htonl((u_int32_t) session->transfer.last_block);
+    retransmission.block_high    = htonl((u_int32_t) (session->transfer.last_block >> 32));
+    retransmission.error_rate    = htonl((u_int64_t) session->transfer.stats.error_rate);
+    retransmission.delivery_rate = htonl((u_int32_t) (stats->this_transmit_rate * u_mega / 1000.0));
+    retransmission.queue_delay   = htonl((u_int32_t) max(stats->queue_delay, 0.0));
+    retransmission.delay_trend   = htonl((int32_t) stats->delay_trend);
+    retransmission.received      = htonl(stats->total_blocks - stats->this_blocks);
+    retransmission.ce_marks      = htonl(stats->this_ce_marks);
+    retransmission.fec_recovered = htonl(stats->this_fec_recovered);
+    retransmission.ring_free     = htonl(ring_free);
+    retransmission.disk_rate     = htonl((u_int32_t) min(stats->disk_rate / 1000.0, 4294967295.0));
+    if (stats->echo_sent > 0)
+        retransmission.echo_time = htonl((u_int32_t) (stats->echo_sent + get_usec_since(&stats->echo_arrival)));
     status = fwrite(&retransmission, sizeof(retransmission), 1, session->server);
     if ((status <= 0) || fflush(session->server))
         return warn("Could not send error rate information");
+    if ((mirror_report(session, delta) < 0) || (stream_report(session, delta) < 0) || (concurrent_report(session) < 0))
+        return -1;
 
     /* build the stats string */    
-    sprintf(stats_flags, "%c%c",
+    sprintf(stats_flags, "%c%c%c",
                ((session->transfer.restart_pending) ? 'R' : '-'),
-               (!(session->transfer.ring_buffer->space_ready) ? 'F' : '-')
+               (!(session->transfer.ring_buffer->space_ready) ? 'F' : '-'),
+               ((stats->this_ce_marks > 0) ? 'C' : '-')
     );
+    stats_share[0] = '\0';
+    if (session->transfer.congestion == TS_CC_LEDBAT)
+        sprintf(stats_share, " %5.1f%%", 100.0 * stats->this_transmit_rate * u_mega / session->parameter->target_rate);
     #ifdef STATS_MATLABFORMAT
-    sprintf(stats_line, "%02d\t%02d\t%02d\t%03d\t%4u\t%6.2f\t%6.1f\t%5.1f\t%7u\t%6.1f\t%6.1f\t%5.1f\t%5d\t%5d\t%7u\t%8u\t%8Lu\t%s\n",
+    if (stats_share[0]) stats_share[0] = '\t';
+    sprintf(stats_line, "%02d\t%02d\t%02d\t%03d\t%4u\t%6.2f\t%6.1f\t%5.1f\t%7Lu\t%6.1f\t%6.1f\t%5.1f\t%5d\t%5d\t%7Lu\t%8u\t%8Lu\t%s%s\n",
     #else
-    sprintf(stats_line, "%02d:%02d:%02d.%03d %4u %6.2fM %6.1fMbps %5.1f%% %7u %6.1fG %6.1fMbps %5.1f%% %5d %5d %7u %8u %8Lu %s\n",
+    sprintf(stats_line, "%02d:%02d:%02d.%03d %4u %6.2fM %6.1fMbps %5.1f%% %7Lu %6.1fG %6.1fMbps %5.1f%% %5d %5d %7Lu %8u %8Lu %s%s\n",
     #endif
         hours, minutes, seconds, milliseconds,
-        stats->total_blocks - stats->this_blocks,
+        (u_int32_t) (stats->total_blocks - stats->this_blocks),
         stats->this_retransmit_rate,
         stats->this_transmit_rate,
         100.0 * retransmits_fraction,
-        session->transfer.stats.total_blocks,
+        (ull_t)session->transfer.stats.total_blocks,
         data_total / u_giga,
         data_total_rate,
         100.0 * total_retransmits_fraction,
         session->transfer.retransmit.index_max,
         session->transfer.ring_buffer->count_data,
-        session->transfer.blocks_left, 
+        (ull_t)session->transfer.blocks_left,
         stats->this_retransmits,
         (ull_t)(stats->this_udp_errors - stats->start_udp_errors),
-        stats_flags
+        stats_flags,
+        stats_share
         );
 
     /* give the user a show if they want it */
@@ -654,16 +1032,27 @@ int ttp_update_stats(ttp_session_t *session)
             printf("Current time:   %s\n", ctime(&now_epoch));
             printf("Elapsed time:   %02d:%02d:%02d.%03d\n\n", hours, minutes, seconds, milliseconds);
             printf("Last interval\n--------------------------------------------------\n");
-            printf("Blocks count:     %u\n",             stats->total_blocks - stats->this_blocks);
+            printf("Blocks count:     %u\n",             (u_int32_t) (stats->total_blocks - stats->this_blocks));
             printf("Data transferred: %0.2f GB\n",       data_this  / u_giga);
             printf("Transfer rate:    %0.2f Mbps\n",     stats->this_transmit_rate);
             printf("Retransmissions:  %u (%0.2f%%)\n\n", stats->this_retransmits, 100.0*retransmits_fraction);
             printf("Cumulative\n--------------------------------------------------\n");
-            printf("Blocks count:     %u\n",             session->transfer.stats.total_blocks);
+            printf("Blocks count:     %llu\n",           (ull_t) session->transfer.stats.total_blocks);
             printf("Data transferred: %0.2f GB\n",       data_total / u_giga);
             printf("Transfer rate:    %0.2f Mbps\n",     data_total_rate);
-            printf("Retransmissions:  %u (%0.2f%%)\n",   stats->total_retransmits, 100.0*total_retransmits_fraction);
-            printf("Flags          :  %s\n\n",           stats_flags);
+            printf("Retransmissions:  %llu (%0.2f%%)\n", (ull_t) stats->total_retransmits, 100.0*total_retransmits_fraction);
+            printf("Flags          :  %s\n",             stats_flags);
+            if (session->transfer.header_flags & TS_HDR_TIMESTAMP)
+                printf("Queueing delay:   %0.2f ms (%+0.2f ms)\n", stats->queue_delay / 1000.0, stats->delay_trend / 1000.0);
+            if (session->transfer.congestion == TS_CC_LEDBAT)
+                printf("Scavenger share: %s of %0.2f Mbps\n", stats_share, session->parameter->target_rate / u_mega);
+            if (session->transfer.ecn)
+                printf("ECN CE marks:     %u (%u total)\n", stats->this_ce_marks, stats->total_ce_marks);
+            if (session->transfer.fec != TS_FEC_NONE)
+                printf("FEC rebuilt:      %u (%llu total)\n", stats->this_fec_recovered, (ull_t) stats->total_fec_recovered);
+            if (session->transfer.backpressure)
+                printf("Receiver room:    %u ring blocks, disk at %0.2f Mbps\n", ring_free, stats->disk_rate / u_mega);
+            printf("\n");
             printf("OS UDP rx errors: %llu\n",           (ull_t)(stats->this_udp_errors - stats->start_udp_errors));
 
         /* line mode */
@@ -673,7 +1062,8 @@ int ttp_update_stats(ttp_session_t *session)
             #ifndef STATS_NOHEADER
             if (!(iteration++ % 23)) {
                 printf("             last_interval                   transfer_total                   buffers      transfer_remaining  OS UDP\n");
-                printf("time          blk    data       rate rexmit     blk    data       rate rexmit queue  ring     blk   rt_len      err \n");
+                printf("time          blk    data       rate rexmit     blk    data       rate rexmit queue  ring     blk   rt_len      err %s\n",
+                       (session->transfer.congestion == TS_CC_LEDBAT) ? "     share" : "");
             }
             #endif
             printf("%s", stats_line);
@@ -690,8 +1080,11 @@ int ttp_update_stats(ttp_session_t *session)
     /* reset the statistics for the next interval */
     stats->this_blocks              = stats->total_blocks;
     stats->this_retransmits         = 0;
+    stats->this_losses              = 0;
     stats->this_flow_originals      = 0;
     stats->this_flow_retransmitteds = 0;
+    stats->this_ce_marks            = 0;
+    stats->this_fec_recovered       = 0;
     gettimeofday(&(stats->this_time), NULL);
 
     /* indicate success */
@@ -699,6 +1092,109 @@ int ttp_update_stats(ttp_session_t *session)
 }
 
 
+/*------------------------------------------------------------------------
+ * int ttp_read_option(ttp_session_t *session, u_int16_t *key,
+ *                     u_int64_t *value);
+ *
+ * Reads a single transfer option from the server.  An option is a
+ * 16-bit key followed by a 64-bit value, both in network byte order;
+ * a list of options ends with the key TS_OPT_END.  Returns 0 on success
+ * and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int ttp_read_option(ttp_session_t *session, u_int16_t *key, u_int64_t *value)
+{
+    u_char option[10];
+
+    if (fread(option, 10, 1, session->server) < 1)
+        return -1;
+
+    memcpy(key,   option,     2);  *key   = ntohs(*key);
+    memcpy(value, option + 2, 8);  *value = ntohll(*value);
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int ttp_write_option(ttp_session_t *session, u_int16_t key,
+ *                      u_int64_t value);
+ *
+ * Queues a single transfer option for the server, see ttp_read_option()
+ * for the format.  The caller is responsible for flushing the control
+ * channel.  Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int ttp_write_option(ttp_session_t *session, u_int16_t key, u_int64_t value)
+{
+    u_char option[10];
+
+    key   = htons(key);    memcpy(option,     &key,   2);
+    value = htonll(value); memcpy(option + 2, &value, 8);
+
+    return (fwrite(option, 10, 1, session->server) < 1) ? -1 : 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int ttp_recv_probe(ttp_session_t *session);
+ *
+ * Receives the startup probe train from the server and reports back
+ * how many of its datagrams arrived and the time (usec) between the
+ * first and the last of them.  Gives up on the rest of the train after
+ * PROBE_TIMEOUT without a datagram.  Returns 0 on success and non-zero
+ * on failure.
+ *------------------------------------------------------------------------*/
+int ttp_recv_probe(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    ttp_header_t    header;
+    struct timeval  start, first, last, timeout;
+    fd_set          readable;
+    u_char         *datagram;
+    u_int32_t       temp;
+    int             status;
+
+    datagram = (u_char *) malloc(xfer->header_size + session->parameter->block_size);
+    if (datagram == NULL)
+	return warn("Could not allocate probe datagram");
+
+    /* collect the train, the first datagram is a round trip away */
+    xfer->probe_received = 0;
+    gettimeofday(&start, NULL);
+    first = last = start;
+    timeout.tv_sec  = 1;
+    timeout.tv_usec = 0;
+    while (xfer->probe_received < xfer->probe_train) {
+	FD_ZERO(&readable);
+	FD_SET(xfer->udp_fd, &readable);
+	if (select(xfer->udp_fd + 1, &readable, NULL, NULL, &timeout) <= 0)
+	    break;
+	status = recvfrom(xfer->udp_fd, datagram, xfer->header_size + session->parameter->block_size, 0, NULL, 0);
+	if (status < 0)
+	    break;
+	gettimeofday(&last, NULL);
+	ttp_header_unpack(datagram, &header, xfer->header_flags);
+	if (header.type != TS_BLOCK_PROBE)
+	    continue;
+	if (xfer->probe_received++ == 0)
+	    first = last;
+	if (header.block == xfer->probe_train)
+	    break;
+	timeout.tv_sec  = 0;
+	timeout.tv_usec = PROBE_TIMEOUT;
+    }
+    free(datagram);
+    xfer->probe_dispersion = (xfer->probe_received > 1) ? tv_diff_usec(last, first) : 0;
+    xfer->probe_rtt        = (xfer->probe_received > 0) ? tv_diff_usec(first, start) : 0;
+
+    /* and tell the server what we saw */
+    temp = htonl(xfer->probe_received);    if (fwrite(&temp, 4, 1, session->server) < 1) return warn("Could not send probe result");
+    temp = htonl(xfer->probe_dispersion);  if (fwrite(&temp, 4, 1, session->server) < 1) return warn("Could not send probe result");
+    if (fflush(session->server))
+	return warn("Could not send probe result");
+
+    return 0;
+}
+
+
 /*========================================================================
  * $Log: protocol.c,v $
  * Revision 1.30  2009/12/22 23:01:21  jwagnerhki
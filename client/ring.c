@@ -140,8 +140,9 @@ int ring_cancel(ring_buffer_t *ring)
  * int ring_confirm(ring_buffer *ring);
  *
  * Confirms that data is now available in the slot that was most
- * recently reserved.  This data will be handled by the disk thread.
- * Returns 0 on success and nonzero on error.
+ * recently reserved.  This data will be handled by the disk thread,
+ * or by the disk engine of the transfers running at once.  Returns 0
+ * on success and nonzero on error.
  *------------------------------------------------------------------------*/
 int ring_confirm(ring_buffer_t *ring)
 {
@@ -168,6 +169,10 @@ int ring_confirm(ring_buffer_t *ring)
     if (status != 0)
 	error("Could not relinquish access to ring buffer mutex");
 
+    /* which has more than one ring to look after */
+    if (ring->engine != NULL)
+	concurrent_notify(ring->engine);
+
     /* we succeeded */
     return 0;
 }
@@ -179,7 +184,8 @@ int ring_confirm(ring_buffer_t *ring)
  * Creates the ring buffer data structure for a Tsunami transfer and
  * returns a pointer to the new data structure.  Returns NULL if
  * allocation and initialization failed.  The new ring buffer will hold
- * ([6 + block_size] * MAX_BLOCKS_QUEUED datagrams.
+ * MAX_BLOCKS_QUEUED datagrams of [MAX_HEADER_SIZE + block_size] bytes,
+ * so that the next file of a pipelined GET * fits whatever its headers.
  *------------------------------------------------------------------------*/
 ring_buffer_t *ring_create(ttp_session_t *session)
 {
@@ -192,7 +198,7 @@ ring_buffer_t *ring_create(ttp_session_t *session)
 	error("Could not allocate ring buffer object");
 
     /* try to allocate the buffer */
-    ring->datagram_size = 6 + session->parameter->block_size;
+    ring->datagram_size = MAX_HEADER_SIZE + session->parameter->block_size;
     ring->datagrams = (u_char *) malloc(ring->datagram_size * MAX_BLOCKS_QUEUED);
     if (ring->datagrams == NULL)
 	error("Could not allocate buffer for ring buffer");
@@ -257,6 +263,41 @@ int ring_destroy(ring_buffer_t *ring)
 }
 
 
+/*------------------------------------------------------------------------
+ * int ring_drain(ring_buffer_t *ring);
+ *
+ * Blocks until the disk thread has taken every datagram out of the
+ * ring, the last one written out too.  Returns 0 on success and
+ * nonzero on error.
+ *------------------------------------------------------------------------*/
+int ring_drain(ring_buffer_t *ring)
+{
+    int status;
+
+    /* get a lock on the ring buffer */
+    status = pthread_mutex_lock(&ring->mutex);
+    if (status != 0)
+	return warn("Could not get access to ring buffer mutex");
+
+    /* every pop signals the space it makes */
+    while (ring->count_data > 0) {
+	status = pthread_cond_wait(&ring->space_ready_cond, &ring->mutex);
+	if (status != 0) {
+	    pthread_mutex_unlock(&ring->mutex);
+	    return warn("Could not wait for ring buffer to drain");
+	}
+    }
+
+    /* release the mutex */
+    status = pthread_mutex_unlock(&ring->mutex);
+    if (status != 0)
+	return warn("Could not relinquish access to ring buffer mutex");
+
+    /* we succeeded */
+    return 0;
+}
+
+
 /*------------------------------------------------------------------------
  * int ring_dump(ring_buffer_t *ring, FILE *out);
  *
@@ -0,0 +1,652 @@
+/*========================================================================
+ * stream.c  --  Parallel UDP data streams for Tsunami client.
+ *
+ * With TS_OPT_STREAMS, the server sends the original blocks of the file
+ * over several UDP sockets, each taking the next block still to go, so
+ * every stream brings its originals in order but any block may come in
+ * on any stream.  Stream 0 is the usual data socket, received by the
+ * main loop in command_get() along with the retransmissions and the
+ * terminate blocks.  Every other stream has a socket and a thread of
+ * its own, which puts its blocks into the same ring buffer and bitmap.
+ * A block that is still missing below the last original of every
+ * stream that is still bringing any is lost, and is asked for in
+ * lossless mode (stream_passed()).  Feedback goes out over the one
+ * control connection from whichever thread finds it due, with a report
+ * on every stream for the server to share the rate out by.
+ *
+ * With 'set paths', each stream after the first is bound to a local
+ * address of its own and may name a server address to come from, so
+ * that a transfer can use several interfaces and uplinks at once.  The
+ * addresses go to the server after the stream's port (TS_OPT_PATHS).
+ *
+ * The mirrors of a transfer (see mirror.c) come in as further streams
+ * after those of the server, each with a range of the file to itself,
+ * so their gaps are found per stream.
+ *
+ * The threads and the main loop share the transfer state under
+ * xfer->stream_lock, which the main loop only lets go of while it
+ * waits for its next datagram.
+ *
+ * Without extra streams from the server, the data port itself can be
+ * shared (set rxqueues): rx_queues SO_REUSEPORT sockets are bound to
+ * it, and a classic BPF program on the group hands original block b
+ * to socket (b - 1) % rx_queues and everything else to socket 0.  To
+ * the rest of the client these sockets look just like streams, and
+ * the kernel's copying and our accounting spread over as many cores.
+ * Each receiver thread is pinned to the core that delivered its first
+ * datagram, i.e. the one servicing its NIC queue, unless another
+ * thread got there first.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <arpa/inet.h>    /* for inet_pton()                       */
+#include <sched.h>        /* for CPU_SET() and friends             */
+#include <stdlib.h>       /* for calloc() and free()               */
+#include <string.h>       /* for memcpy(), memset()                */
+#include <sys/socket.h>   /* for recvfrom(), setsockopt()          */
+#include <unistd.h>       /* for close()                           */
+#ifdef __linux__
+#include <linux/filter.h> /* for the reuseport steering program    */
+#endif
+
+#include <tsunami-client.h>
+
+#define STREAM_POLL  100000    /* how often (usec) the stream threads look for the stop flag */
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+int   stream_bind    (ttp_parameter_t *parameter, const u_char *host, u_int16_t port);
+void  stream_init    (ttp_stream_t *stream, ttp_session_t *session, u_int16_t index, int udp_fd);
+int   stream_path    (ttp_parameter_t *parameter, int index, u_char *local, u_char *remote);
+void  stream_pin     (ttp_stream_t *stream);
+void *stream_receiver(void *arg);
+int   stream_socket  (ttp_parameter_t *parameter, const struct sockaddr *address, socklen_t length, int share);
+void  stream_update  (ttp_session_t *session);
+
+
+/*------------------------------------------------------------------------
+ * int stream_open(ttp_session_t *session);
+ *
+ * Creates a UDP socket for each stream besides the main one and sends
+ * its port number to the server, after the port of the main socket,
+ * along with its addresses if the streams have any.  The control
+ * connection is left for the caller to flush.  Returns 0 on success
+ * and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int stream_open(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer   = &session->transfer;
+    ttp_parameter_t *param  =  session->parameter;
+    u_int16_t        first  =  param->client_port;
+    size_t           length =  param->ipv6_yn ? 16 : 4;
+    struct sockaddr_storage udp_address;
+    socklen_t        udp_length;
+    u_char           local[16], remote[16];
+    u_int16_t        port;
+    int              i;
+
+    xfer->streams_stop = 0;
+    if (((xfer->streams <= 1) && (xfer->mirrors == 0)) || xfer->shared_port)
+	return 0;
+
+    xfer->stream = (ttp_stream_t *) calloc(xfer->streams + xfer->mirrors, sizeof(ttp_stream_t));
+    if (xfer->stream == NULL)
+	return warn("Could not allocate UDP streams");
+    stream_init(&xfer->stream[0], session, 0, xfer->udp_fd);
+
+    /* the mirrors have their sockets already */
+    for (i = 0; i < xfer->mirrors; ++i) {
+	stream_init(&xfer->stream[xfer->streams + i], session, xfer->streams + i, xfer->mirror[i].session->transfer.udp_fd);
+	xfer->stream[xfer->streams + i].mirror = &xfer->mirror[i];
+	xfer->mirror[i].stream = &xfer->stream[xfer->streams + i];
+    }
+
+    for (i = 1; i < xfer->streams; ++i) {
+
+	/* take the ports after the main one, without counting them as other clients */
+	if (xfer->paths) {
+	    if (stream_path(param, i, local, remote) < 0) {
+		warn("Bad address in paths");
+		break;
+	    }
+	    stream_init(&xfer->stream[i], session, i, stream_bind(param, local, first + i));
+	} else {
+	    ++param->client_port;
+	    stream_init(&xfer->stream[i], session, i, create_udp_socket(param));
+	}
+	if (xfer->stream[i].udp_fd < 0)
+	    break;
+
+	memset(&udp_address, 0, sizeof(udp_address));
+	udp_length = sizeof(udp_address);
+	getsockname(xfer->stream[i].udp_fd, (struct sockaddr *) &udp_address, &udp_length);
+	port = param->ipv6_yn ? ((struct sockaddr_in6 *) &udp_address)->sin6_port : ((struct sockaddr_in *) &udp_address)->sin_port;
+	if (fwrite(&port, 2, 1, session->server) < 1)
+	    break;
+	if (xfer->paths && ((fwrite(local, length, 1, session->server) < 1) || (fwrite(remote, length, 1, session->server) < 1)))
+	    break;
+    }
+    param->client_port = first;
+
+    if (i < xfer->streams) {
+	for (i = 1; i < xfer->streams; ++i)
+	    if (xfer->stream[i].udp_fd > 0)
+		close(xfer->stream[i].udp_fd);
+	for (i = 0; i < xfer->mirrors; ++i)
+	    xfer->mirror[i].stream = NULL;
+	free(xfer->stream);
+	xfer->stream = NULL;
+	return warn("Could not open UDP streams");
+    }
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int stream_passed(ttp_session_t *session, ttp_stream_t *stream,
+ *                   u_int64_t block);
+ *
+ * Notes that the given original block came in on the given stream, and
+ * in lossless mode requests the blocks that this shows to be lost, see
+ * above.  Streams that brought no originals since the last report are
+ * left out, or a stream that is done or down would hold up the rest.
+ * With mirrors, each stream only answers for the blocks of its own
+ * range.  Must be called with the transfer lock held.  Returns 0 on
+ * success and non-zero if a request failed.
+ *------------------------------------------------------------------------*/
+int stream_passed(ttp_session_t *session, ttp_stream_t *stream, u_int64_t block)
+{
+    ttp_transfer_t *xfer  = &session->transfer;
+    u_int64_t       front = block;
+    int             i;
+
+    stream->stale = 0;
+    stream->this_originals++;
+
+    /* a source of a mirrored transfer sends its range in order, the blocks it skipped there are lost */
+    if (xfer->mirrors > 0) {
+	if ((block < stream->range_first) || (block >= stream->range_end) || (block <= stream->last_original))
+	    return 0;
+	for (front = stream->last_original + 1; front < block; ++front)
+	    if (session->parameter->lossless && !got_block(session, front) && (ttp_request_retransmit(session, front) < 0))
+		return warn("Retransmission request failed");
+	stream->last_original = block;
+	return 0;
+    }
+
+    stream->last_original = max(stream->last_original, block);
+
+    for (i = 0; i < xfer->streams; ++i)
+	if (!xfer->stream[i].stale)
+	    front = min(front, xfer->stream[i].last_original);
+    if (front < xfer->next_block)
+	return 0;
+
+    for (; xfer->next_block < front; ++xfer->next_block)
+	if (session->parameter->lossless && (ttp_request_retransmit(session, xfer->next_block) < 0))
+	    return warn("Retransmission request failed");
+    xfer->next_block = front + 1;
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int stream_report(ttp_session_t *session, u_int64_t delta);
+ *
+ * Sends the server a report on each of its streams (REQUEST_PATH)
+ * covering the last delta usec, and marks the streams that brought no
+ * originals in that time as stale.  Must be called with the transfer
+ * lock held.  Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int stream_report(ttp_session_t *session, u_int64_t delta)
+{
+    ttp_transfer_t   *xfer   = &session->transfer;
+    int               report = (xfer->streams > 1) && !xfer->shared_port;
+    ttp_stream_t     *stream;
+    retransmission_t  retransmission;
+    double            rate;
+    int               i;
+
+    if (xfer->stream == NULL)
+	return 0;
+
+    for (i = 0; i < xfer->streams + xfer->mirrors; ++i) {
+	stream = &xfer->stream[i];
+	stream->stale = (stream->this_originals == 0);
+
+	/* the sockets of a shared port are all one stream to the server, and the mirrors report on their own */
+	if (report && (i < xfer->streams)) {
+	    rate = 8.0 * stream->this_blocks * session->parameter->block_size / max(delta, 1) * 1000.0;
+	    memset(&retransmission, 0, sizeof(retransmission));
+	    retransmission.request_type  = htons(REQUEST_PATH);
+	    retransmission.block         = htonl(i);
+	    retransmission.received      = htonl(stream->this_blocks);
+	    retransmission.delivery_rate = htonl((u_int32_t) min(rate, 4294967295.0));
+	    if (fwrite(&retransmission, sizeof(retransmission), 1, session->server) < 1)
+		return warn("Could not send stream report");
+	}
+
+	stream->this_blocks    = 0;
+	stream->this_originals = 0;
+    }
+
+    if (report && fflush(session->server))
+	return warn("Could not send stream report");
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int stream_share_port(ttp_session_t *session);
+ *
+ * Turns the freshly bound data socket into a group of rx_queues
+ * SO_REUSEPORT sockets on the same port, with the steering program
+ * described above, if rxqueues is set and the transfer has a single
+ * stream.  Like several streams, this needs gaps to be found per
+ * socket, which semi-lossy mode and FEC don't do.  Without the
+ * steering, the kernel would hash every datagram of the one server
+ * socket onto the same member, so the group is only kept if the
+ * program could be attached.  Returns 0 on success and non-zero if
+ * the data socket was lost on the way.
+ *------------------------------------------------------------------------*/
+int stream_share_port(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+
+    if ((param->rx_queues <= 1) || (xfer->streams > 1) || (xfer->mirrors > 0) || (xfer->fec != TS_FEC_NONE) ||
+        (!param->lossless && (param->losswindow_ms > 0)))
+	return 0;
+
+    #if defined(SO_REUSEPORT) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    {
+	struct sockaddr_storage udp_address;
+	socklen_t               udp_length = sizeof(udp_address);
+	struct sock_filter      code[7];
+	struct sock_fprog       program;
+	u_int16_t               queues;
+	int                     i;
+
+	/* the block number decides the socket, so count sockets in powers of two, for blocks beyond 32 bits */
+	for (queues = 1; 2 * queues <= min(param->rx_queues, MAX_STREAMS); queues *= 2);
+
+	xfer->stream = (ttp_stream_t *) calloc(queues, sizeof(ttp_stream_t));
+	if (xfer->stream == NULL)
+	    return warn("Could not allocate UDP receive sockets");
+
+	/* the port is ours, hand it over to the group, socket 0 first */
+	memset(&udp_address, 0, sizeof(udp_address));
+	getsockname(xfer->udp_fd, (struct sockaddr *) &udp_address, &udp_length);
+	close(xfer->udp_fd);
+	xfer->udp_fd = stream_socket(param, (struct sockaddr *) &udp_address, udp_length, 1);
+	if (xfer->udp_fd < 0) {
+	    free(xfer->stream);
+	    xfer->stream = NULL;
+	    return warn("Could not rebind the UDP data port");
+	}
+	stream_init(&xfer->stream[0], session, 0, xfer->udp_fd);
+	for (i = 1; i < queues; ++i) {
+	    stream_init(&xfer->stream[i], session, i, stream_socket(param, (struct sockaddr *) &udp_address, udp_length, 1));
+	    if (xfer->stream[i].udp_fd < 0)
+		break;
+	}
+
+	/* originals go by (block - 1) % queues, the rest to socket 0 */
+	code[0] = (struct sock_filter) BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 4);
+	code[1] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   TS_BLOCK_ORIGINAL, 0, 4);
+	code[2] = (struct sock_filter) BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 0);
+	code[3] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_SUB | BPF_K,   1);
+	code[4] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_AND | BPF_K,   queues - 1);
+	code[5] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A,             0);
+	code[6] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K,             0);
+	program.len    = 7;
+	program.filter = code;
+
+	if ((i == queues) && (setsockopt(xfer->udp_fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == 0)) {
+	    xfer->streams     = queues;
+	    xfer->shared_port = 1;
+	    printf("Receiving on %u sockets sharing the data port.\n", queues);
+	    return 0;
+	}
+
+	warn("Could not steer a shared data port, receiving on a single socket");
+	while (--i > 0)
+	    close(xfer->stream[i].udp_fd);
+	free(xfer->stream);
+	xfer->stream = NULL;
+    }
+    #else
+    warn("No SO_REUSEPORT steering on this system, receiving on a single socket");
+    #endif
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int stream_start(ttp_session_t *session);
+ *
+ * Sets up the transfer lock, takes it for the caller and starts the
+ * receiver threads of the streams besides the main one, those of the
+ * mirrors included.  Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int stream_start(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    int             i;
+
+    if ((pthread_mutex_init(&xfer->stream_lock, NULL) != 0) || (pthread_mutex_lock(&xfer->stream_lock) != 0))
+	return warn("Could not create stream mutex");
+
+    for (i = 1; (xfer->stream != NULL) && (i < xfer->streams + xfer->mirrors); ++i) {
+	if (pthread_create(&xfer->stream[i].thread, NULL, stream_receiver, &xfer->stream[i]) != 0)
+	    return warn("Could not start UDP stream thread");
+	xfer->stream[i].running = 1;
+    }
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void stream_stop(ttp_session_t *session);
+ *
+ * Stops the receiver threads, closes and frees the streams and takes
+ * down the transfer lock, which the caller must not hold.
+ *------------------------------------------------------------------------*/
+void stream_stop(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    int             i;
+
+    xfer->streams_stop = 1;
+    for (i = 1; (xfer->stream != NULL) && (i < xfer->streams + xfer->mirrors); ++i) {
+	if (xfer->stream[i].running)
+	    pthread_join(xfer->stream[i].thread, NULL);
+	close(xfer->stream[i].udp_fd);
+    }
+
+    free(xfer->stream);
+    xfer->stream = NULL;
+    pthread_mutex_destroy(&xfer->stream_lock);
+}
+
+
+/*------------------------------------------------------------------------
+ * int stream_bind(ttp_parameter_t *parameter, const u_char *host,
+ *                 u_int16_t port);
+ *
+ * Creates a UDP socket on the given local address (4 or 16 bytes, as
+ * in the paths), on the given port or the first free one after it.
+ * Returns the file descriptor, or -1 on error.
+ *------------------------------------------------------------------------*/
+int stream_bind(ttp_parameter_t *parameter, const u_char *host, u_int16_t port)
+{
+    struct sockaddr_storage address;
+    socklen_t               length;
+    int                     socket_fd = -1;
+    int                     attempt;
+
+    memset(&address, 0, sizeof(address));
+    if (parameter->ipv6_yn) {
+	address.ss_family = AF_INET6;
+	memcpy(&((struct sockaddr_in6 *) &address)->sin6_addr, host, 16);
+	length = sizeof(struct sockaddr_in6);
+    } else {
+	address.ss_family = AF_INET;
+	memcpy(&((struct sockaddr_in *) &address)->sin_addr, host, 4);
+	length = sizeof(struct sockaddr_in);
+    }
+
+    for (attempt = 0; (attempt < 256) && (socket_fd < 0); ++attempt) {
+	if (parameter->ipv6_yn)
+	    ((struct sockaddr_in6 *) &address)->sin6_port = htons(port + attempt);
+	else
+	    ((struct sockaddr_in *)  &address)->sin_port  = htons(port + attempt);
+	socket_fd = stream_socket(parameter, (struct sockaddr *) &address, length, 0);
+    }
+
+    return socket_fd;
+}
+
+
+/*------------------------------------------------------------------------
+ * void stream_init(ttp_stream_t *stream, ttp_session_t *session,
+ *                  u_int16_t index, int udp_fd);
+ *
+ * Fills in a stream with the given number and socket.  The sockets of
+ * the threads are set up to time out now and then, so that they see
+ * the stop flag.
+ *------------------------------------------------------------------------*/
+void stream_init(ttp_stream_t *stream, ttp_session_t *session, u_int16_t index, int udp_fd)
+{
+    struct timeval timeout;
+
+    stream->session = session;
+    stream->index   = index;
+    stream->udp_fd  = udp_fd;
+    stream->cpu     = -1;
+
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = STREAM_POLL;
+    if ((index > 0) && (udp_fd >= 0))
+	setsockopt(udp_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+
+/*------------------------------------------------------------------------
+ * int stream_path(ttp_parameter_t *parameter, int index,
+ *                 u_char *local, u_char *remote);
+ *
+ * Looks up the addresses of the given stream (1 and up) in the paths,
+ * a comma separated list of "local" or "local/remote" addresses, one
+ * per stream after the first.  The addresses are stored as 4 or 16
+ * bytes in network order, all zeros for a missing remote one.  Returns
+ * 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int stream_path(ttp_parameter_t *parameter, int index, u_char *local, u_char *remote)
+{
+    int         family = parameter->ipv6_yn ? AF_INET6 : AF_INET;
+    const char *entry  = parameter->paths;
+    char        text[2 * INET6_ADDRSTRLEN + 2];
+    char       *slash;
+    size_t      length;
+
+    /* find the entry */
+    while ((--index > 0) && (entry != NULL))
+	if ((entry = strchr(entry, ',')) != NULL)
+	    ++entry;
+    if (entry == NULL)
+	return -1;
+    length = strcspn(entry, ",");
+    if (length >= sizeof(text))
+	return -1;
+    memcpy(text, entry, length);
+    text[length] = '\0';
+
+    /* and take it apart */
+    memset(remote, 0, 16);
+    slash = strchr(text, '/');
+    if (slash != NULL) {
+	*slash++ = '\0';
+	if (inet_pton(family, slash, remote) != 1)
+	    return -1;
+    }
+    return (inet_pton(family, text, local) == 1) ? 0 : -1;
+}
+
+
+/*------------------------------------------------------------------------
+ * void stream_pin(ttp_stream_t *stream);
+ *
+ * Pins the calling thread of the given stream, which has just received
+ * a datagram, to the core that delivered it (SO_INCOMING_CPU), unless
+ * another stream is pinned there already.  Must be called with the
+ * transfer lock held.
+ *------------------------------------------------------------------------*/
+void stream_pin(ttp_stream_t *stream)
+{
+    stream->cpu = -2;
+
+    #if defined(SO_INCOMING_CPU) && defined(CPU_SET)
+    {
+	ttp_transfer_t *xfer   = &stream->session->transfer;
+	socklen_t       length = sizeof(int);
+	cpu_set_t       cpus;
+	int             cpu, i;
+
+	/* the kernel may not know, then spread the threads over the cores by number */
+	if ((getsockopt(stream->udp_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &length) < 0) || (cpu < 0))
+	    cpu = stream->index % max(1, sysconf(_SC_NPROCESSORS_ONLN));
+	for (i = 1; i < xfer->streams + xfer->mirrors; ++i)
+	    if (xfer->stream[i].cpu == cpu)
+		return;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0)
+	    stream->cpu = cpu;
+    }
+    #endif
+}
+
+
+/*------------------------------------------------------------------------
+ * void *stream_receiver(void *arg);
+ *
+ * The receiver thread of one stream (the ttp_stream_t in arg).  New
+ * blocks go to the disk thread like those of the main loop, and the
+ * originals go to stream_passed().  A full ring buffer drops the block
+ * without noting it, so that it is asked for later on.  The blocks of
+ * a mirror are kept out of the statistics of the server's flow.
+ *------------------------------------------------------------------------*/
+void *stream_receiver(void *arg)
+{
+    ttp_stream_t    *stream  = (ttp_stream_t *) arg;
+    ttp_session_t   *session = stream->session;
+    ttp_transfer_t  *xfer    = &session->transfer;
+    size_t           length  = xfer->header_size + session->parameter->block_size;
+    u_char           datagram[MAX_BLOCK_SIZE + MAX_HEADER_SIZE];
+    ttp_header_t     header;
+    u_char          *slot;
+
+    while (!xfer->streams_stop) {
+
+	/* timeouts bring us back to the stop flag, and with mirrors, any of which may be the last one busy, to the feedback */
+	if (recvfrom(stream->udp_fd, datagram, length, 0, NULL, 0) < 0) {
+	    if (xfer->mirrors > 0) {
+		pthread_mutex_lock(&xfer->stream_lock);
+		stream_update(session);
+		pthread_mutex_unlock(&xfer->stream_lock);
+	    }
+	    continue;
+	}
+	ttp_header_unpack(datagram, &header, xfer->header_flags);
+	if ((header.block == 0) || (header.block > xfer->block_count))
+	    continue;
+
+	pthread_mutex_lock(&xfer->stream_lock);
+	if (stream->cpu == -1)
+	    stream_pin(stream);
+	stream->this_blocks++;
+	if (stream->mirror != NULL)
+	    stream->mirror->total_blocks++;
+	else if (header.type == TS_BLOCK_RETRANSMISSION) {
+	    xfer->stats.total_blocks++;
+	    xfer->stats.this_flow_retransmitteds++;
+	    xfer->stats.total_recvd_retransmits++;
+	} else {
+	    xfer->stats.total_blocks++;
+	    xfer->stats.this_flow_originals++;
+	}
+
+	if (!ring_full(xfer->ring_buffer)) {
+
+	    /* hand new blocks to the disk thread */
+	    if (!got_block(session, header.block)) {
+		slot = ring_reserve(xfer->ring_buffer);
+		memcpy(slot, datagram, length);
+		if (ring_confirm(xfer->ring_buffer) < 0)
+		    warn("Error in accepting stream block");
+		xfer->received[header.block / 8] |= (1 << (header.block % 8));
+		if (xfer->blocks_left > 0)
+		    --(xfer->blocks_left);
+	    }
+
+	    /* and see what went missing */
+	    if (header.type == TS_BLOCK_ORIGINAL)
+		stream_passed(session, stream, header.block);
+	}
+
+	/* the feedback is due no matter which stream is busy */
+	if (!(stream->this_blocks % 50))
+	    stream_update(session);
+	pthread_mutex_unlock(&xfer->stream_lock);
+    }
+
+    return NULL;
+}
+
+
+/*------------------------------------------------------------------------
+ * int stream_socket(ttp_parameter_t *parameter,
+ *                   const struct sockaddr *address, socklen_t length,
+ *                   int share);
+ *
+ * Creates a UDP socket on the given local address, with the receive
+ * buffer of create_udp_socket().  If share is non-zero, the socket
+ * joins the SO_REUSEPORT group on that address.  Returns the file
+ * descriptor, or -1 on error.
+ *------------------------------------------------------------------------*/
+int stream_socket(ttp_parameter_t *parameter, const struct sockaddr *address, socklen_t length, int share)
+{
+    int socket_fd;
+    int yes = 1;
+
+    socket_fd = socket(address->sa_family, SOCK_DGRAM, 0);
+    if (socket_fd < 0)
+	return -1;
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &parameter->udp_buffer, sizeof(parameter->udp_buffer));
+
+    #ifdef SO_REUSEPORT
+    if (share && (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0))
+	share = -1;
+    #else
+    if (share)
+	share = -1;
+    #endif
+
+    if ((share < 0) || (bind(socket_fd, address, length) < 0)) {
+	close(socket_fd);
+	return -1;
+    }
+
+    return socket_fd;
+}
+
+
+/*------------------------------------------------------------------------
+ * void stream_update(ttp_session_t *session);
+ *
+ * Repeats the retransmission requests and sends the feedback if it is
+ * due.  Must be called with the transfer lock held.
+ *------------------------------------------------------------------------*/
+void stream_update(ttp_session_t *session)
+{
+    if (get_usec_since(&session->transfer.stats.this_time) > UPDATE_PERIOD) {
+	if (ttp_repeat_retransmit(session) < 0)
+	    warn("Repeat of retransmission requests failed");
+	ttp_update_stats(session);
+    }
+}
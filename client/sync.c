@@ -0,0 +1,165 @@
+/*========================================================================
+ * sync.c  --  Syncing an existing copy of a file for Tsunami client.
+ *
+ * With 'set sync', a GET of a file that is here already offers the
+ * server the copy (TS_OPT_SYNC, see server/sync.c).  If the server
+ * takes it, it says how many blocks a segment has, we send the digests
+ * of the segments of our copy (see common/sync.c), and the server sends
+ * back the ranges of blocks that differ.  Only those are transferred,
+ * into the copy as it is; the blocks of all other segments count as
+ * received from the start.  A file that hasn't changed needs no data
+ * at all, which is what lets 'get *' skip the unchanged files.
+ *
+ * A transfer that resumes from a journal knows better what it has and
+ * is not synced.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <fcntl.h>        /* for open()                            */
+#include <stdlib.h>       /* for *alloc() and free()               */
+#include <sys/stat.h>     /* for stat()                            */
+#include <unistd.h>       /* for access(), close()                 */
+
+#include <tsunami-client.h>
+
+
+/*------------------------------------------------------------------------
+ * void sync_apply(ttp_session_t *session);
+ *
+ * Marks the blocks that the server said are the same in our copy as
+ * received, as written in the relay map if there is one, and as on
+ * disk in the journal if there is one.  Must be called once the
+ * received bitfield is allocated.
+ *------------------------------------------------------------------------*/
+void sync_apply(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer  = &session->transfer;
+    u_int64_t       block = 1;
+    u_int64_t       same  = 0;
+    u_int64_t       end;
+    u_int32_t       i;
+
+    if (session->sync == NULL)
+	return;
+
+    for (i = 0; i <= session->sync_count; ++i) {
+	end = (i < session->sync_count) ? session->sync[2 * i] : xfer->block_count + 1;
+	for (; block < end; ++block, ++same) {
+	    xfer->received[block / 8] |= (1 << (block % 8));
+	    if (xfer->relay_map != NULL)
+		((u_char *) (xfer->relay_map + 1))[(block - 1) / 8] |= 1 << ((block - 1) % 8);
+	    journal_mark(session, block);
+	}
+	if (i < session->sync_count)
+	    block = session->sync[2 * i + 1];
+    }
+    xfer->blocks_left -= min(same, xfer->blocks_left);
+
+    printf("Syncing '%s': %llu of %llu blocks are the same here already.\n", xfer->local_filename,
+	   (ull_t) same, (ull_t) xfer->block_count);
+    free(session->sync);
+    session->sync       = NULL;
+    session->sync_count = 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * u_int64_t sync_offer(ttp_session_t *session,
+ *                      const char *local_filename);
+ *
+ * Returns the size of the copy of the file to the given local file
+ * that the transfer about to be asked for offers to sync with, or 0
+ * if it offers none.  Bundles, mirrors and the sessions of mirrors
+ * are not synced, and neither is a file resumed from a journal.
+ *------------------------------------------------------------------------*/
+u_int64_t sync_offer(ttp_session_t *session, const char *local_filename)
+{
+    ttp_parameter_t *param = session->parameter;
+    struct stat      info;
+
+    free(session->sync);
+    session->sync       = NULL;
+    session->sync_count = 0;
+
+    if (!param->sync || (session->bundle != NULL) || param->mirror || (param->mirrors != NULL))
+	return 0;
+    if ((session->journal != NULL) && (session->journal->held != NULL))
+	return 0;
+    if (stat(local_filename, &info) || !S_ISREG(info.st_mode) || access(local_filename, W_OK))
+	return 0;
+
+    return info.st_size;
+}
+
+
+/*------------------------------------------------------------------------
+ * int sync_request(ttp_session_t *session);
+ *
+ * Sends the server the digests of the segments of our copy of the file
+ * and reads the ranges of blocks that differ, which are all that is
+ * sent.  A copy that can't be read has no segments, so all of the file
+ * is sent.  Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int sync_request(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer     = &session->transfer;
+    u_int64_t       segment  =  xfer->sync_segment * session->parameter->block_size;
+    u_int64_t       segments = (xfer->block_count + xfer->sync_segment - 1) / xfer->sync_segment;
+    u_char         *digests;
+    u_int64_t       end = 1;
+    u_int32_t       count = 0;
+    u_int32_t       i;
+    struct stat     info;
+    int             fd;
+
+    if (segments > MAX_SYNC_SEGMENTS)
+	return warn("Too many segments to sync");
+    digests = (u_char *) malloc(max(segments, 1) * SYNC_DIGEST);
+    if (digests == NULL)
+	return warn("Could not allocate segment digests");
+
+    /* hash the segments that our copy has */
+    fd = open(xfer->local_filename, O_RDONLY);
+    if ((fd >= 0) && (fstat(fd, &info) == 0)) {
+	count = min(segments, (info.st_size + segment - 1) / segment);
+	if (sync_digests(fd, info.st_size, segment, count, digests) != 0)
+	    count = 0;
+    }
+    if (fd >= 0)
+	close(fd);
+
+    /* and send their digests */
+    i = htonl(count);
+    if ((fwrite(&i, 4, 1, session->server) < 1) ||
+	((count > 0) && (fwrite(digests, SYNC_DIGEST, count, session->server) < count)) ||
+	fflush(session->server)) {
+	free(digests);
+	return warn("Could not send segment digests");
+    }
+    free(digests);
+
+    /* the server answers with the ranges that differ */
+    if (fread(&count, 4, 1, session->server) < 1)
+	return warn("Could not read the number of changed ranges");
+    count = ntohl(count);
+    if (count > (segments + 1) / 2)
+	return warn("Too many changed ranges");
+    session->sync = (u_int64_t *) malloc(2 * sizeof(u_int64_t) * max(count, 1));
+    if (session->sync == NULL)
+	return warn("Could not allocate changed ranges");
+    if ((count > 0) && (fread(session->sync, 2 * sizeof(u_int64_t), count, session->server) < count))
+	return warn("Could not read the changed ranges");
+
+    for (i = 0; i < 2 * count; i += 2) {
+	session->sync[i]     = ntohll(session->sync[i]);
+	session->sync[i + 1] = ntohll(session->sync[i + 1]);
+	if ((session->sync[i] < end) || (session->sync[i + 1] <= session->sync[i]) || (session->sync[i + 1] > xfer->block_count + 1))
+	    return warn("Changed range out of order");
+	end = session->sync[i + 1];
+    }
+    session->sync_count = count;
+
+    return 0;
+}
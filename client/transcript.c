@@ -76,7 +76,7 @@ void xscript_close(ttp_session_t *session, u_int64_t delta)
     ttp_transfer_t *xfer = &session->transfer;
 
     mb_thru  = xfer->stats.total_blocks * session->parameter->block_size;
-    mb_good  = mb_thru - xfer->stats.total_recvd_retransmits * session->parameter->block_size;
+    mb_good  = mb_thru - (xfer->stats.total_recvd_retransmits + xfer->stats.total_fec_parity) * session->parameter->block_size;
     mb_file  = xfer->file_size;
     mb_thru /= (1024.0*1024.0);
     mb_good /= (1024.0*1024.0);
@@ -90,6 +90,17 @@ void xscript_close(ttp_session_t *session, u_int64_t delta)
     fprintf(xfer->transcript, "throughput = %0.2f\n", 8.0 * mb_thru / secs);
     fprintf(xfer->transcript, "goodput_with_restarts = %0.2f\n", 8.0 * mb_good / secs);
     fprintf(xfer->transcript, "file_rate = %0.2f\n", 8.0 * mb_file / secs);
+    if (xfer->ecn)
+        fprintf(xfer->transcript, "ce_marks = %u\n", xfer->stats.total_ce_marks);
+    if (xfer->fec != TS_FEC_NONE) {
+        fprintf(xfer->transcript, "fec_parity = %llu\n", (ull_t)xfer->stats.total_fec_parity);
+        fprintf(xfer->transcript, "fec_recovered = %llu\n", (ull_t)xfer->stats.total_fec_recovered);
+    }
+    if (xfer->rxq_ovfl) {
+        fprintf(xfer->transcript, "socket_drops = %llu\n", (ull_t)(xfer->socket_drops - xfer->stats.start_udp_errors));
+        fprintf(xfer->transcript, "udp_buffer_final = %u\n", xfer->udp_buffer);
+        fprintf(xfer->transcript, "udp_buffer_stuck = %u\n", xfer->udp_buffer_stuck);
+    }
     fclose(xfer->transcript);
 }
 
@@ -145,9 +156,14 @@ void xscript_open(ttp_session_t *session)
     ttp_transfer_t  *xfer  = &session->transfer;
     ttp_parameter_t *param =  session->parameter;
     char             filename[64];
+    char             extension[16];
 
-    /* open the transcript file */
-    make_transcript_filename(filename, xfer->epoch, "tsuc");
+    /* open the transcript file, transfers running at once each have one of their own */
+    if (session->concurrent != NULL)
+        sprintf(extension, "%u.tsuc", session->slot);
+    else
+        strcpy(extension, "tsuc");
+    make_transcript_filename(filename, xfer->epoch, extension);
     xfer->transcript = fopen(filename, "w");
     if (xfer->transcript == NULL) {
 	warn("Could not create transcript file");
@@ -158,10 +174,11 @@ void xscript_open(ttp_session_t *session)
     fprintf(xfer->transcript, "remote_filename = %s\n", xfer->remote_filename);
     fprintf(xfer->transcript, "local_filename = %s\n",  xfer->local_filename);
     fprintf(xfer->transcript, "file_size = %llu\n",     (ull_t)xfer->file_size);
-    fprintf(xfer->transcript, "block_count = %u\n",     xfer->block_count);
+    fprintf(xfer->transcript, "block_count = %llu\n",   (ull_t)xfer->block_count);
     fprintf(xfer->transcript, "udp_buffer = %u\n",      param->udp_buffer);
     fprintf(xfer->transcript, "block_size = %u\n",      param->block_size);
-    fprintf(xfer->transcript, "target_rate = %u\n",     param->target_rate);
+    fprintf(xfer->transcript, "target_rate = %llu\n",   (ull_t)param->target_rate);
+    fprintf(xfer->transcript, "ipd_time = %llu\n",      (ull_t)xfer->ipd_time);
     fprintf(xfer->transcript, "error_rate = %u\n",      param->error_rate);
     fprintf(xfer->transcript, "slower_num = %u\n",      param->slower_num);
     fprintf(xfer->transcript, "slower_den = %u\n",      param->slower_den);
@@ -171,6 +188,30 @@ void xscript_open(ttp_session_t *session)
     fprintf(xfer->transcript, "lossless = %u\n",        param->lossless);
     fprintf(xfer->transcript, "losswindow = %u\n",      param->losswindow_ms);
     fprintf(xfer->transcript, "blockdump = %u\n",       param->blockdump);
+    fprintf(xfer->transcript, "congestion = %s\n",      CONGESTION_NAMES[xfer->congestion]);
+    fprintf(xfer->transcript, "header_flags = 0x%x\n",  xfer->header_flags);
+    if (xfer->congestion == TS_CC_LEDBAT)
+        fprintf(xfer->transcript, "delay_target = %u\n", xfer->delay_target);
+    fprintf(xfer->transcript, "ecn = %u\n",             xfer->ecn);
+    fprintf(xfer->transcript, "probe_train = %u\n",     xfer->probe_train);
+    fprintf(xfer->transcript, "fec = %s\n",             FEC_NAMES[xfer->fec]);
+    if (xfer->fec != TS_FEC_NONE)
+        fprintf(xfer->transcript, "fec_group = %u\n",   xfer->fec_group);
+    fprintf(xfer->transcript, "tail_copies = %u\n",     xfer->tail_copies);
+    fprintf(xfer->transcript, "backpressure = %u\n",    xfer->backpressure);
+    fprintf(xfer->transcript, "streams = %u\n",         xfer->streams);
+    fprintf(xfer->transcript, "shared_port = %u\n",     xfer->shared_port);
+    fprintf(xfer->transcript, "paths = %u\n",           xfer->paths);
+    fprintf(xfer->transcript, "mirrors = %u\n",         xfer->mirrors);
+    fprintf(xfer->transcript, "multicast = %u\n",       xfer->multicast);
+    fprintf(xfer->transcript, "relay_map = %u\n",       xfer->relay_map != NULL);
+    fprintf(xfer->transcript, "pipeline = %u\n",        xfer->pipeline);
+    fprintf(xfer->transcript, "bundle_files = %u\n",    (session->bundle != NULL) ? session->bundle->count : 0);
+    fprintf(xfer->transcript, "rate_share = %u\n",      xfer->rate_share);
+    fprintf(xfer->transcript, "probe_received = %u\n",  xfer->probe_received);
+    fprintf(xfer->transcript, "probe_dispersion = %u\n", xfer->probe_dispersion);
+    fprintf(xfer->transcript, "probe_rate = %0.0f\n",   (xfer->probe_dispersion > 0) ?
+            (xfer->probe_received - 1) * 8.0 * param->block_size * 1000000.0 / xfer->probe_dispersion : 0.0);
     fprintf(xfer->transcript, "update_period = %llu\n", UPDATE_PERIOD);
     fprintf(xfer->transcript, "rexmit_period = %llu\n", UPDATE_PERIOD);
     fprintf(xfer->transcript, "protocol_version = 0x%x\n", PROTOCOL_REVISION);
@@ -77,12 +77,55 @@
  * Definitions of global constants.
  *------------------------------------------------------------------------*/
 
-const u_int32_t PROTOCOL_REVISION  = 0x20061025; // yyyymmdd
+const u_int32_t PROTOCOL_REVISION  = 0x20261018; // yyyymmdd
 
 const u_int16_t REQUEST_RETRANSMIT = 0;
 const u_int16_t REQUEST_RESTART    = 1;
 const u_int16_t REQUEST_STOP       = 2;
 const u_int16_t REQUEST_ERROR_RATE = 3;
+const u_int16_t REQUEST_PATH       = 4;
+const u_int16_t REQUEST_RANGE      = 5;
+const u_int16_t REQUEST_TARGET_RATE = 6;
+
+const char     *CONGESTION_NAMES[] = { "tsunami", "bbr", "ledbat", NULL };  /* indexed by TS_CC_* */
+const char     *FEC_NAMES[]        = { "none", "xor", "rs", NULL };         /* indexed by TS_FEC_* */
+
+
+/*------------------------------------------------------------------------
+ * int get_congestion_by_name(const char *name);
+ *
+ * Looks up the congestion controller with the given name (case does
+ * not matter).  Returns its TS_CC_* number, or -1 if there is no
+ * controller of that name.
+ *------------------------------------------------------------------------*/
+int get_congestion_by_name(const char *name)
+{
+    int i;
+
+    for (i = 0; CONGESTION_NAMES[i] != NULL; ++i)
+        if (!strcasecmp(name, CONGESTION_NAMES[i]))
+            return i;
+
+    return -1;
+}
+
+
+/*------------------------------------------------------------------------
+ * int get_fec_by_name(const char *name);
+ *
+ * Looks up the FEC code with the given name (case does not matter).
+ * Returns its TS_FEC_* number, or -1 if there is no code of that name.
+ *------------------------------------------------------------------------*/
+int get_fec_by_name(const char *name)
+{
+    int i;
+
+    for (i = 0; FEC_NAMES[i] != NULL; ++i)
+        if (!strcasecmp(name, FEC_NAMES[i]))
+            return i;
+
+    return -1;
+}
 
 
 /*------------------------------------------------------------------------
@@ -384,6 +427,117 @@ ssize_t full_read(int fd, void *buf, size_t count)
    return nread;
 }
 
+/*------------------------------------------------------------------------
+ * u_int32_t ttp_header_size(u_int32_t flags);
+ *
+ * Returns the size in bytes of a datagram header with the given set of
+ * TS_HDR_* extensions.
+ *------------------------------------------------------------------------*/
+u_int32_t ttp_header_size(u_int32_t flags)
+{
+    u_int32_t size = 6;
+
+    if (flags & TS_HDR_TIMESTAMP)  size += 8;
+    if (flags & TS_HDR_WIDE)       size += 4;
+    if (flags & TS_HDR_FILE)       size += 4;
+
+    return size;
+}
+
+
+/*------------------------------------------------------------------------
+ * void ttp_header_pack(u_char *datagram, const ttp_header_t *header,
+ *                      u_int32_t flags);
+ *
+ * Stores the given header at the start of the datagram.  The header
+ * is the block number and block type, followed by the fields of the
+ * TS_HDR_* extensions in flags in the order of their flag bits:
+ *
+ *     32                    0
+ *     +---------------------+
+ *     |     block_number    |
+ *     +----------+----------+
+ *     |   type   | timestamp:
+ *     +----------+          :
+ *     :   (TS_HDR_TIMESTAMP)|
+ *     +----------+----------+
+ *     |  block_number_high  |
+ *     |    (TS_HDR_WIDE)    |
+ *     +----------+----------+
+ *     |     file_number     |
+ *     |    (TS_HDR_FILE)    |
+ *     +----------+----------+
+ *     |   data   :     :    :
+ *
+ * Without TS_HDR_WIDE only the lower 32 bits of the block number are
+ * sent.  All fields are in network byte order and are not aligned, so
+ * the datagram buffer may be any byte buffer.
+ *------------------------------------------------------------------------*/
+void ttp_header_pack(u_char *datagram, const ttp_header_t *header, u_int32_t flags)
+{
+    u_int32_t block = htonl((u_int32_t) header->block);
+    u_int16_t type  = htons(header->type);
+    u_int64_t timestamp;
+
+    memcpy(datagram + 0, &block, 4);
+    memcpy(datagram + 4, &type,  2);
+    datagram += 6;
+
+    if (flags & TS_HDR_TIMESTAMP) {
+        timestamp = htonll(header->timestamp);
+        memcpy(datagram, &timestamp, 8);
+        datagram += 8;
+    }
+
+    if (flags & TS_HDR_WIDE) {
+        block = htonl((u_int32_t) (header->block >> 32));
+        memcpy(datagram, &block, 4);
+        datagram += 4;
+    }
+
+    if (flags & TS_HDR_FILE) {
+        block = htonl(header->file);
+        memcpy(datagram, &block, 4);
+        datagram += 4;
+    }
+}
+
+
+/*------------------------------------------------------------------------
+ * void ttp_header_unpack(const u_char *datagram, ttp_header_t *header,
+ *                        u_int32_t flags);
+ *
+ * Retrieves the header from the start of the given datagram, see
+ * ttp_header_pack() for the format.  Fields of extensions that are not
+ * in flags are set to zero.
+ *------------------------------------------------------------------------*/
+void ttp_header_unpack(const u_char *datagram, ttp_header_t *header, u_int32_t flags)
+{
+    u_int32_t block;
+
+    memset(header, 0, sizeof(*header));
+
+    memcpy(&block,         datagram + 0, 4);  header->block = ntohl(block);
+    memcpy(&header->type,  datagram + 4, 2);  header->type  = ntohs(header->type);
+    datagram += 6;
+
+    if (flags & TS_HDR_TIMESTAMP) {
+        memcpy(&header->timestamp, datagram, 8);  header->timestamp = ntohll(header->timestamp);
+        datagram += 8;
+    }
+
+    if (flags & TS_HDR_WIDE) {
+        memcpy(&block, datagram, 4);  header->block |= ((u_int64_t) ntohl(block)) << 32;
+        datagram += 4;
+    }
+
+    if (flags & TS_HDR_FILE) {
+        memcpy(&block, datagram, 4);  header->file = ntohl(block);
+        datagram += 4;
+    }
+}
+
+
 /*========================================================================
  * $Log: common.c,v $
  * Revision 1.12  2009/12/21 15:10:38  jwagnerhki
@@ -86,6 +86,9 @@ const u_int16_t REQUEST_RETRANSMIT = 0;
 const u_int16_t REQUEST_RESTART    = 1;
 const u_int16_t REQUEST_STOP       = 2;
 const u_int16_t REQUEST_ERROR_RATE = 3;
+const u_int16_t REQUEST_PATH       = 4;
+const u_int16_t REQUEST_RANGE      = 5;
+const u_int16_t REQUEST_TARGET_RATE = 6;
 
 
 /*------------------------------------------------------------------------
@@ -0,0 +1,264 @@
+/*========================================================================
+ * fec.c  --  Block erasure code shared by the Tsunami client and server.
+ *
+ * Forward error correction works on groups of up to MAX_FEC_GROUP data
+ * blocks, for which the server sends up to MAX_FEC_PARITY parity blocks
+ * of the same size.  Parity block j of a group is
+ *
+ *   p[j] = sum over i of c(j,i) * d[i]
+ *
+ * with the arithmetic done bytewise in GF(2^8).  Two codes are known:
+ *
+ *   xor  -- c(j,i) = 1, a single parity block that repairs one lost
+ *           data block per group, at the cost of a plain XOR
+ *
+ *   rs   -- c(j,i) = 1 / (x[j] + y[i]) with x[j] = MAX_FEC_GROUP + j
+ *           and y[i] = i, a Cauchy Reed-Solomon code: every square
+ *           submatrix of a Cauchy matrix is invertible, so any m
+ *           parity blocks repair any m lost data blocks of the group
+ *
+ * The multiply-add over whole blocks is where the time goes.  It runs
+ * 16 bytes at a time with SSE2 for XOR and, if the compiler is allowed
+ * to use SSSE3 (-mssse3 or -march=native), with two 16-entry PSHUFB
+ * nibble tables for the other coefficients; the scalar fallback uses a
+ * full multiplication table.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <string.h>       /* for memset(), memcpy()                */
+
+#ifdef __SSE2__
+#include <emmintrin.h>    /* for the SSE2 intrinsics               */
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>    /* for _mm_shuffle_epi8()                */
+#endif
+
+#include "tsunami.h"
+
+#define GF_POLYNOMIAL  0x11d   /* x^8 + x^4 + x^3 + x^2 + 1, with 2 as the generator */
+
+
+/*------------------------------------------------------------------------
+ * Module-scope variables.
+ *------------------------------------------------------------------------*/
+
+static u_char gf_exp[512];         /* powers of the generator, twice over */
+static u_char gf_log[256];         /* and their logarithms                */
+static u_char gf_mul[256][256];    /* the full multiplication table       */
+static int    gf_ready = 0;        /* 1 once the tables are filled in     */
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+void   gf_init   ();
+u_char gf_inverse(u_char value);
+
+
+/*------------------------------------------------------------------------
+ * u_char fec_coefficient(u_int16_t code, u_int32_t row,
+ *                        u_int32_t column);
+ *
+ * Returns the coefficient of data block number 'column' (0-based within
+ * its group) in parity block number 'row' under the given code
+ * (TS_FEC_*).
+ *------------------------------------------------------------------------*/
+u_char fec_coefficient(u_int16_t code, u_int32_t row, u_int32_t column)
+{
+    if (code != TS_FEC_RS)
+        return 1;
+
+    if (!gf_ready)
+        gf_init();
+    return gf_inverse((MAX_FEC_GROUP + row) ^ column);
+}
+
+
+/*------------------------------------------------------------------------
+ * int fec_decode(u_int16_t code, u_int32_t k, u_char **data,
+ *                const u_char *have, u_char **parity,
+ *                const u_int16_t *rows, u_int32_t parities,
+ *                size_t length);
+ *
+ * Rebuilds the missing data blocks of a group of k blocks.  data[i]
+ * points to the buffer of data block i, which holds the block if
+ * have[i] is non-zero and receives it otherwise; parity[r] holds the
+ * parity block of row rows[r].  All blocks are 'length' bytes long.
+ * The parity buffers are used as scratch space and are garbage
+ * afterwards.
+ *
+ * Returns the number of blocks rebuilt, or -1 if there are more missing
+ * blocks than parity blocks.
+ *------------------------------------------------------------------------*/
+int fec_decode(u_int16_t code, u_int32_t k, u_char **data, const u_char *have,
+	       u_char **parity, const u_int16_t *rows, u_int32_t parities, size_t length)
+{
+    u_int32_t missing[MAX_FEC_PARITY];
+    u_char    matrix[MAX_FEC_PARITY][2 * MAX_FEC_PARITY];
+    u_int32_t count = 0;
+    u_int32_t i, r, c, pivot;
+    u_char    scale, factor;
+
+    if (!gf_ready)
+	gf_init();
+
+    /* find the blocks to rebuild */
+    for (i = 0; i < k; ++i)
+	if (!have[i]) {
+	    if ((count == parities) || (count == MAX_FEC_PARITY))
+		return -1;
+	    missing[count++] = i;
+	}
+    if (count == 0)
+	return 0;
+
+    /* take the blocks we have out of the first 'count' parity blocks */
+    for (r = 0; r < count; ++r)
+	for (i = 0; i < k; ++i)
+	    if (have[i])
+		fec_mul_add(parity[r], data[i], fec_coefficient(code, rows[r], i), length);
+
+    /* what remains is the missing blocks times a square submatrix, invert that (Gauss-Jordan) */
+    memset(matrix, 0, sizeof(matrix));
+    for (r = 0; r < count; ++r) {
+	for (c = 0; c < count; ++c)
+	    matrix[r][c] = fec_coefficient(code, rows[r], missing[c]);
+	matrix[r][count + r] = 1;
+    }
+    for (c = 0; c < count; ++c) {
+	for (pivot = c; (pivot < count) && (matrix[pivot][c] == 0); ++pivot);
+	if (pivot == count)
+	    return -1;
+	if (pivot != c) {
+	    u_char temp[2 * MAX_FEC_PARITY];
+	    memcpy(temp,          matrix[c],     sizeof(temp));
+	    memcpy(matrix[c],     matrix[pivot], sizeof(temp));
+	    memcpy(matrix[pivot], temp,          sizeof(temp));
+	}
+	scale = gf_inverse(matrix[c][c]);
+	for (i = 0; i < 2 * count; ++i)
+	    matrix[c][i] = gf_mul[scale][matrix[c][i]];
+	for (r = 0; r < count; ++r)
+	    if ((r != c) && ((factor = matrix[r][c]) != 0))
+		for (i = 0; i < 2 * count; ++i)
+		    matrix[r][i] ^= gf_mul[factor][matrix[c][i]];
+    }
+
+    /* and multiply the remainders by the inverse */
+    for (c = 0; c < count; ++c) {
+	memset(data[missing[c]], 0, length);
+	for (r = 0; r < count; ++r)
+	    fec_mul_add(data[missing[c]], parity[r], matrix[c][count + r], length);
+    }
+
+    return count;
+}
+
+
+/*------------------------------------------------------------------------
+ * void fec_mul_add(u_char *dst, const u_char *src, u_char coefficient,
+ *                  size_t length);
+ *
+ * Adds the given coefficient times the block at src onto the block at
+ * dst, both 'length' bytes long, in GF(2^8).
+ *------------------------------------------------------------------------*/
+void fec_mul_add(u_char *dst, const u_char *src, u_char coefficient, size_t length)
+{
+    const u_char *row;
+    size_t        i = 0;
+
+    if (coefficient == 0)
+	return;
+
+    /* XOR, the whole of the xor code and one column of the Cauchy matrix */
+    if (coefficient == 1) {
+	#ifdef __SSE2__
+	for (; i + 16 <= length; i += 16)
+	    _mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *) (dst + i)),
+								   _mm_loadu_si128((const __m128i *) (src + i))));
+	#else
+	u_int64_t a, b;
+	for (; i + 8 <= length; i += 8) {
+	    memcpy(&a, dst + i, 8);
+	    memcpy(&b, src + i, 8);
+	    a ^= b;
+	    memcpy(dst + i, &a, 8);
+	}
+	#endif
+	for (; i < length; ++i)
+	    dst[i] ^= src[i];
+	return;
+    }
+
+    if (!gf_ready)
+	gf_init();
+    row = gf_mul[coefficient];
+
+    #ifdef __SSSE3__
+    {
+	u_char  low[16], high[16];
+	__m128i table_low, table_high, mask, in, product;
+	int     n;
+
+	/* c*x = c*(x & 0x0f) + c*(x & 0xf0), a 16-entry lookup each */
+	for (n = 0; n < 16; ++n) {
+	    low[n]  = row[n];
+	    high[n] = row[n << 4];
+	}
+	table_low  = _mm_loadu_si128((const __m128i *) low);
+	table_high = _mm_loadu_si128((const __m128i *) high);
+	mask       = _mm_set1_epi8(0x0f);
+
+	for (; i + 16 <= length; i += 16) {
+	    in      = _mm_loadu_si128((const __m128i *) (src + i));
+	    product = _mm_xor_si128(_mm_shuffle_epi8(table_low,  _mm_and_si128(in, mask)),
+				    _mm_shuffle_epi8(table_high, _mm_and_si128(_mm_srli_epi64(in, 4), mask)));
+	    _mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *) (dst + i)), product));
+	}
+    }
+    #endif
+
+    for (; i < length; ++i)
+	dst[i] ^= row[src[i]];
+}
+
+
+/*------------------------------------------------------------------------
+ * void gf_init();
+ *
+ * Fills in the exponent, logarithm and multiplication tables of
+ * GF(2^8).
+ *------------------------------------------------------------------------*/
+void gf_init()
+{
+    int a, b, value = 1;
+
+    for (a = 0; a < 255; ++a) {
+	gf_exp[a] = gf_exp[a + 255] = value;
+	gf_log[value] = a;
+	value <<= 1;
+	if (value & 0x100)
+	    value ^= GF_POLYNOMIAL;
+    }
+
+    for (a = 0; a < 256; ++a)
+	for (b = 0; b < 256; ++b)
+	    gf_mul[a][b] = ((a == 0) || (b == 0)) ? 0 : gf_exp[gf_log[a] + gf_log[b]];
+
+    gf_ready = 1;
+}
+
+
+/*------------------------------------------------------------------------
+ * u_char gf_inverse(u_char value);
+ *
+ * Returns the multiplicative inverse of the given non-zero value.
+ *------------------------------------------------------------------------*/
+u_char gf_inverse(u_char value)
+{
+    return gf_exp[255 - gf_log[value]];
+}
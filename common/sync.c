@@ -0,0 +1,151 @@
+/*========================================================================
+ * sync.c  --  Segment checksums for syncing files, shared by the
+ *             Tsunami client and server.
+ *
+ * To sync a copy of a file, both ends cut their file into segments of
+ * the same whole number of blocks and take a digest of each: the first
+ * SYNC_DIGEST bytes of its MD5.  Blocks sit at fixed offsets in the
+ * protocol, so a segment is compared only with the segment at the same
+ * offset, which catches data appended to a file or patched in place.
+ *
+ * Hashing is bound by the disk on one end and by MD5 on the other, so
+ * the segments are handed out in order to up to MAX_SYNC_THREADS
+ * threads that read them with pread() and hash them side by side.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <pthread.h>     /* for the thread routines               */
+#include <stdlib.h>      /* for *alloc() and free()               */
+#include <unistd.h>      /* for pread(), sysconf()                */
+
+#include "md5.h"         /* for MD5 message digest support        */
+#include "tsunami.h"     /* for Tsunami function prototypes, etc. */
+
+#define SYNC_CHUNK  65536   /* the bytes read and hashed at a time */
+
+
+/*------------------------------------------------------------------------
+ * The work shared by the threads of one sync_digests() call.
+ *------------------------------------------------------------------------*/
+
+typedef struct {
+    int              fd;          /* the file being hashed               */
+    u_int64_t        size;        /* its size in bytes                   */
+    u_int64_t        segment;     /* the bytes of a segment              */
+    u_int32_t        count;       /* the number of segments              */
+    u_char          *digests;     /* SYNC_DIGEST bytes for each of them  */
+    u_int32_t        next;        /* the next segment to hash            */
+    int              failed;      /* non-zero once a read failed         */
+    pthread_mutex_t  lock;        /* for next and failed                 */
+} sync_work_t;
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+void *sync_thread(void *arg);
+
+
+/*------------------------------------------------------------------------
+ * int sync_digests(int fd, u_int64_t size, u_int64_t segment,
+ *                  u_int32_t count, u_char *digests);
+ *
+ * Stores the digests of the first count segments of the given number
+ * of bytes of the open file with the given size into the given array,
+ * SYNC_DIGEST bytes each.  The last segment ends where the file does.
+ * Returns 0 on success and non-zero if the file could not be read.
+ *------------------------------------------------------------------------*/
+int sync_digests(int fd, u_int64_t size, u_int64_t segment, u_int32_t count, u_char *digests)
+{
+    sync_work_t work;
+    pthread_t   thread[MAX_SYNC_THREADS];
+    long        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long        i, started;
+
+    work.fd      = fd;
+    work.size    = size;
+    work.segment = segment;
+    work.count   = count;
+    work.digests = digests;
+    work.next    = 0;
+    work.failed  = 0;
+    pthread_mutex_init(&work.lock, NULL);
+
+    /* as many threads as there are processors, and the caller hashes too */
+    threads = max(1, min(min(threads, MAX_SYNC_THREADS), (long) count));
+    for (started = 0; started < threads - 1; ++started)
+        if (pthread_create(&thread[started], NULL, sync_thread, &work) != 0)
+            break;
+    sync_thread(&work);
+    for (i = 0; i < started; ++i)
+        pthread_join(thread[i], NULL);
+
+    pthread_mutex_destroy(&work.lock);
+    return work.failed ? warn("Could not read the file to sync") : 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void *sync_thread(void *arg);
+ *
+ * Hashes the segments of the shared work, one after the other, until
+ * none are left or a read fails.  Returns NULL.
+ *------------------------------------------------------------------------*/
+void *sync_thread(void *arg)
+{
+    sync_work_t *work = (sync_work_t *) arg;
+    md5_state_t  state;
+    u_char       digest[16];
+    u_char      *buffer;
+    u_int64_t    offset, end;
+    ssize_t      length;
+    u_int32_t    index;
+
+    buffer = (u_char *) malloc(SYNC_CHUNK);
+    if (buffer == NULL) {
+        pthread_mutex_lock(&work->lock);
+        work->failed = 1;
+        pthread_mutex_unlock(&work->lock);
+        return NULL;
+    }
+
+    while (1) {
+
+        /* take the next segment */
+        pthread_mutex_lock(&work->lock);
+        index = work->next;
+        if (!work->failed && (index < work->count))
+            ++work->next;
+        else
+            index = work->count;
+        pthread_mutex_unlock(&work->lock);
+        if (index == work->count)
+            break;
+
+        /* and hash it */
+        offset = (u_int64_t) index * work->segment;
+        end    = min(offset + work->segment, work->size);
+        md5_init(&state);
+        while (offset < end) {
+            length = pread(work->fd, buffer, min(end - offset, SYNC_CHUNK), offset);
+            if (length <= 0)
+                break;
+            md5_append(&state, buffer, length);
+            offset += length;
+        }
+        md5_finish(&state, digest);
+        memcpy(work->digests + (u_int64_t) index * SYNC_DIGEST, digest, SYNC_DIGEST);
+
+        if (offset < end) {
+            pthread_mutex_lock(&work->lock);
+            work->failed = 1;
+            pthread_mutex_unlock(&work->lock);
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
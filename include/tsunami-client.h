@@ -64,6 +64,7 @@
 #define __CLIENT_H
 
 #include <netinet/in.h>  /* for struct sockaddr_in, etc.                 */
+#include <pthread.h>     /* for the ring buffer and stream threads       */
 #include <stdio.h>       /* for NULL, FILE *, etc.                       */
 #include <sys/types.h>   /* for various system data types                */
 #include <string.h>      /* for memcpy                                   */
@@ -97,16 +98,57 @@ extern const u_int16_t  DEFAULT_HISTORY;        /* default percentage of history
 extern const u_char     DEFAULT_LOSSLESS;       /* default client policy for retransmit request */
 extern const u_int32_t  DEFAULT_LOSSWINDOW_MS;  /* default time window (msec) for semi-lossless */
 extern const u_char     DEFAULT_BLOCKDUMP;      /* the default to write bitmap dump to a file   */
+extern const u_int16_t  DEFAULT_CONGESTION;     /* the default congestion controller (TS_CC_*)  */
+extern const u_char     DEFAULT_TIMESTAMPS;     /* the default for sender timestamps            */
+extern const u_int32_t  DEFAULT_DELAY_TARGET;   /* default scavenger target queueing delay (ms) */
+extern const u_char     DEFAULT_ECN;            /* the default for ECN capable data             */
+extern const u_int32_t  DEFAULT_PROBE_TRAIN;    /* default length of the startup probe train    */
+extern const u_char     DEFAULT_PMTU;           /* the default for fitting blocks to the MTU    */
+extern const u_int16_t  DEFAULT_FEC;            /* the default FEC code (TS_FEC_*)              */
+extern const u_int32_t  DEFAULT_FEC_GROUP;      /* the default data blocks per FEC group        */
+extern const u_int32_t  DEFAULT_TAIL_COPIES;    /* the default final blocks to get twice        */
+extern const u_char     DEFAULT_BACKPRESSURE;   /* the default for pacing to our headroom       */
+extern const u_char     DEFAULT_MULTICAST;      /* the default for joining a multicast group    */
+extern const u_char     DEFAULT_RELAYMAP;       /* the default for keeping a relay map          */
+extern const u_char     DEFAULT_PIPELINE;       /* the default for pipelining the files of GET * */
+extern const u_int32_t  DEFAULT_BUNDLE;         /* the default largest file to bundle, 0=none   */
+extern const u_int16_t  DEFAULT_STREAMS;        /* the default parallel UDP data streams        */
+extern const u_int16_t  DEFAULT_RX_QUEUES;      /* the default sockets sharing the data port    */
+extern const u_int16_t  DEFAULT_CONCURRENT;     /* the default transfers to run at once         */
+extern const u_char     DEFAULT_RESUME;         /* the default for keeping a journal to resume  */
+extern const u_char     DEFAULT_SYNC;           /* the default for syncing an existing copy     */
 
 #define DEFAULT_SECRET             "kitten"     /* the default passphrase for servers */
+#define DEFAULT_PROFILE_FILE       ".tsunami_profile" /* the path profile file in $HOME      */
 
 #define SCREEN_MODE                0            /* screen-based output mode                     */
 #define LINE_MODE                  1            /* line-based (vmstat-like) output mode         */
 
-#define MAX_COMMAND_WORDS          10           /* maximum number of words in any command       */
+#define MAX_COMMAND_WORDS          64           /* maximum number of words in any command       */
 #define MAX_RETRANSMISSION_BUFFER  2048         /* maximum number of requests to send at once   */
 #define MAX_BLOCKS_QUEUED          4096         /* maximum number of blocks in ring buffer      */
+#define MAX_UDP_BUFFER             67108864     /* largest UDP receive buffer grown to (bytes)  */
 #define UPDATE_PERIOD              350000LL     /* length of the update period in microseconds  */
+#define PROBE_TIMEOUT              200000LL     /* usec to wait for the rest of the probe train */
+#define DELAY_HISTORY              10           /* minutes of base one-way delay history        */
+#define MAX_PROFILE_NAME           1024         /* maximum length of the path profile file name */
+#define PROFILE_MAX_ENTRIES        256          /* maximum number of destinations in a profile  */
+#define PROFILE_HALF_LIFE          86400.0      /* seconds after which a profile counts half    */
+#define PROFILE_MAX_AGE            (30*86400)   /* seconds after which a profile is dropped     */
+#define MAX_RELAY_NAME             1024         /* maximum length of the relay map file name    */
+#define PROFILE_HEADROOM           1.15         /* target rate over the profiled rate           */
+#define PROFILE_MIN_TIME           1.0          /* seconds a transfer must last to be profiled  */
+#define FEC_WINDOW                 8            /* FEC groups kept for repairs at a time        */
+#define MAX_CONCURRENT             16           /* maximum transfers run at once                */
+#define JOURNAL_MAGIC              "TSJRNL01"   /* first bytes of a journal                     */
+#define JOURNAL_EXTENSION          ".journal"   /* appended to the local file name for its journal */
+#define JOURNAL_PENDING            256          /* ranges written before the journal is synced  */
+#define JOURNAL_SYNC               1000000LL    /* usec at most between two syncs of the journal */
+#define SHARE_HEADROOM             1.25         /* share over the delivered rate of a slow one  */
+#define SHARE_FLOOR                0.25         /* smallest share, as a part of an even split   */
+#define SHARE_SETTLE               3            /* reports before the delivered rate counts     */
+#define SHARE_CHANGE               0.05         /* smallest change of a share sent to a server  */
+#define ENGINE_BATCH               64           /* blocks written of one transfer in a row      */
 
 extern const int        MAX_COMMAND_LENGTH;     /* maximum length of a single command           */
 
@@ -129,12 +171,13 @@ typedef struct {
     struct timeval      start_time;               /* when we started timing the transfer         */
     struct timeval      stop_time;                /* when we finished timing the transfer        */
     struct timeval      this_time;                /* when we began this data collection period   */
-    u_int32_t           this_blocks;              /* the number of blocks in this interval       */
+    u_int64_t           this_blocks;              /* the total_blocks count at this interval     */
     u_int32_t           this_retransmits;         /* the number of retransmits in this interval  */
-    u_int32_t           total_blocks;             /* the total number of blocks transmitted      */
-    u_int32_t           total_retransmits;        /* the total number of retransmission requests */
-    u_int32_t           total_recvd_retransmits;  /* the total number of received retransmits    */
-    u_int32_t           total_lost;               /* the final number of data blocks lost        */
+    u_int32_t           this_losses;              /* the blocks found missing in this interval   */
+    u_int64_t           total_blocks;             /* the total number of blocks transmitted      */
+    u_int64_t           total_retransmits;        /* the total number of retransmission requests */
+    u_int64_t           total_recvd_retransmits;  /* the total number of received retransmits    */
+    u_int64_t           total_lost;               /* the final number of data blocks lost        */
     u_int32_t           this_flow_originals;      /* the number of original blocks this interval */
     u_int32_t           this_flow_retransmitteds; /* the number of re-tx'ed blocks this interval */
     double              this_transmit_rate;       /* the unfiltered transmission rate (bps)      */
@@ -143,15 +186,39 @@ typedef struct {
     double              error_rate;               /* the smoothed error rate (% x 1000)          */
     u_int64_t           start_udp_errors;         /* the initial UDP error counter value of OS   */
     u_int64_t           this_udp_errors;          /* the current UDP error counter value of OS   */
+    u_int64_t           last_udp_errors;          /* the UDP error counter at this interval      */
+    int64_t             base_delay[DELAY_HISTORY];/* the minimum one-way delay of each minute    */
+    time_t              base_minute[DELAY_HISTORY];/* the minute of each base_delay entry        */
+    double              this_delay_sum;           /* the sum of one-way delays in this interval  */
+    u_int32_t           this_delay_count;         /* the number of delay samples in this interval */
+    u_int32_t           delay_reports;            /* the number of intervals with delay samples  */
+    double              last_delay;               /* the mean one-way delay of the last interval */
+    double              queue_delay;              /* the queueing delay estimate (usec)          */
+    double              delay_trend;              /* the change of the mean one-way delay (usec) */
+    u_int64_t           echo_sent;                /* the sender time of the last block, 0=none   */
+    struct timeval      echo_arrival;             /* and when that block arrived                 */
+    u_int32_t           this_ce_marks;            /* the CE marked datagrams in this interval    */
+    u_int32_t           total_ce_marks;           /* the total number of CE marked datagrams     */
+    u_int32_t           this_fec_recovered;       /* the blocks rebuilt from parity this interval */
+    u_int64_t           total_fec_recovered;      /* the total number of blocks rebuilt          */
+    u_int64_t           total_fec_parity;         /* the total number of parity blocks received  */
+    u_int64_t           disk_blocks;              /* the blocks written by the disk thread       */
+    u_int64_t           disk_usec;                /* the time it spent writing them (usec)       */
+    u_int64_t           this_disk_blocks;         /* the disk_blocks count at this interval      */
+    u_int64_t           this_disk_usec;           /* the disk_usec count at this interval        */
+    double              disk_rate;                /* the smoothed disk write rate (bps), 0=none  */
 } statistics_t;
 
 /* state of the retransmission table for a transfer */
 typedef struct {
-    u_int32_t          *table;                    /* the table of retransmission blocks          */
+    u_int64_t          *table;                    /* the table of retransmission blocks          */
     u_int32_t           table_size;               /* the size of the retransmission table        */
     u_int32_t           index_max;                /* the maximum table index in active use       */
 } retransmit_t;
 
+/* the transfers that run at once, see concurrent.c */
+typedef struct ttp_concurrent_s ttp_concurrent_t;
+
 /* ring buffer for queuing blocks to be written to disk */
 typedef struct {
     u_char             *datagrams;                /* the collection of queued datagrams          */
@@ -164,8 +231,32 @@ typedef struct {
     int                 data_ready;               /* nonzero when data is ready, else 0          */
     pthread_cond_t      space_ready_cond;         /* condition variable to indicate space ready  */
     int                 space_ready;              /* nonzero when space is available, else 0     */
+    ttp_concurrent_t   *engine;                   /* the disk engine shared with other transfers, or NULL */
 } ring_buffer_t;
 
+/* an FEC group collected for repairs */
+typedef struct {
+    u_int64_t           group;                    /* the number of the group in this slot        */
+    u_char              used;                     /* 1 once the slot holds a group               */
+    u_int32_t           present;                  /* the number of data blocks held              */
+    u_int32_t           parities;                 /* the number of parity blocks held            */
+    u_char              have[MAX_FEC_GROUP];      /* 1 for each data block held                  */
+    u_int16_t           rows[MAX_FEC_PARITY];     /* the rows of the parity blocks held          */
+    u_char             *data;                     /* the data blocks, then the parity blocks     */
+} fec_slot_t;
+
+/* what past transfers learned about a destination */
+typedef struct {
+    char                host[256];                /* the name of the server host                 */
+    u_int16_t           port;                     /* the TCP port of the server                  */
+    time_t              stamp;                    /* when the profile was last updated           */
+    double              rate;                     /* the average achieved file rate (bps)        */
+    double              rtt;                      /* the average round-trip time (usec), 0=none  */
+    double              loss;                     /* the average fraction of retransmissions     */
+    u_int32_t           block_size;               /* the block size of the fastest transfer      */
+    double              best_rate;                /* the file rate of the fastest transfer (bps) */
+} path_profile_t;
+
 /* Tsunami transfer protocol parameters */
 typedef struct {
     char               *server_name;              /* the name of the host running tsunamid       */
@@ -177,7 +268,8 @@ typedef struct {
     u_char              ipv6_yn;                  /* 1 for IPv6, 0 for IPv4                      */
     u_char              output_mode;              /* either SCREEN_MODE or LINE_MODE             */
     u_int32_t           block_size;               /* the size of each block (in bytes)           */
-    u_int32_t           target_rate;              /* the transfer rate that we're targetting     */
+    u_char              block_size_set;           /* 1 once the block size was set by hand       */
+    u_int64_t           target_rate;              /* the transfer rate that we're targetting     */
     u_char              rate_adjust;              /* 1 for adjusting target to achieved rate     */
     u_int32_t           error_rate;               /* the threshhold error rate (in % x 1000)     */
     u_int16_t           slower_num;               /* the numerator of the increase-IPD factor    */
@@ -190,8 +282,86 @@ typedef struct {
     u_char              blockdump;                /* 1 to write received block bitmap to a file  */
     char                *passphrase;              /* the passphrase to use for authentication    */
     char                *ringbuf;                 /* Pointer to ring buffer start                */
+    u_int16_t           congestion;               /* the congestion controller to ask for        */
+    u_char              timestamps;               /* 1 to ask for sender timestamps in datagrams */
+    u_int32_t           delay_target;             /* the scavenger target queueing delay (msec)  */
+    u_char              ecn;                      /* 1 to ask for ECN capable data datagrams     */
+    u_int32_t           probe_train;              /* the startup probe train length, 0=no probe  */
+    u_char              pmtu;                     /* 1 to shrink blocks to fit the path MTU      */
+    u_int16_t           fec;                      /* the FEC code to ask for (TS_FEC_*)          */
+    u_int32_t           fec_group;                /* the data blocks per FEC group to ask for    */
+    u_int32_t           tail_copies;              /* the final blocks to get twice, 0=none       */
+    u_char              backpressure;             /* 1 to have the server pace to our headroom   */
+    u_int16_t           streams;                  /* the parallel UDP data streams to ask for    */
+    u_int16_t           rx_queues;                /* the sockets to share the data port among    */
+    char               *paths;                    /* the addresses of further streams, or NULL   */
+    char               *mirrors;                  /* the servers mirroring the file, or NULL     */
+    u_char              mirror;                   /* 1 on the session with a mirror              */
+    u_char              multicast;                /* 1 to join the server's multicast group      */
+    u_char              relaymap;                 /* 1 to keep a map of the blocks on disk       */
+    u_char              pipeline;                 /* 1 to keep the data port for the files of GET * */
+    u_int32_t           bundle;                   /* the largest file GET * bundles (bytes), 0=none */
+    u_int16_t           concurrent;               /* the transfers to run at once, 1=one by one  */
+    u_char              resume;                   /* 1 to keep a journal and resume from it      */
+    u_char              sync;                     /* 1 to get only the blocks a local copy lacks */
+    char               *profile;                  /* the path profile file, NULL for none        */
+    u_int64_t           start_rate;               /* the rate to start the transfer at, 0=server's choice */
+    u_int32_t           rtt_hint;                 /* the expected round-trip time (usec), 0=none */
+    u_int32_t           pipeline_file;            /* the number of the next file of a pipelined GET *, 0=none */
 } ttp_parameter_t;    
 
+/* a parallel UDP data stream of a transfer, see stream.c */
+typedef struct ttp_stream_s ttp_stream_t;
+
+/* a server mirroring the file of a transfer, see mirror.c */
+typedef struct ttp_mirror_s ttp_mirror_t;
+
+/* a file packed into a bundle, see bundle.c */
+typedef struct {
+    char               *name;                     /* its name, on the server and here            */
+    u_int64_t           offset;                   /* where it starts in the block stream         */
+    u_int64_t           size;                     /* its size in bytes                           */
+    int                 fd;                       /* the local file, or -1                       */
+} ttp_bundle_file_t;
+
+/* several files asked for as one transfer */
+typedef struct {
+    char              **manifest;                 /* the names of the files asked for            */
+    u_int32_t           asked;                    /* and how many there are                      */
+    ttp_bundle_file_t  *files;                    /* the files the server packed, in order       */
+    u_int32_t           count;                    /* and how many there are                      */
+    u_char              refused;                  /* 1 if the server does not know bundles       */
+} ttp_bundle_t;
+
+/* the head of a journal of the blocks on disk ('set resume'), in host byte order */
+typedef struct {
+    char                magic[8];                 /* JOURNAL_MAGIC                               */
+    u_int64_t           file_size;                /* the size of the file in bytes               */
+    u_int64_t           file_time;                /* its modification time on the server (sec)   */
+    u_int32_t           block_size;               /* the block size of the transfer              */
+    u_int32_t           reserved;
+} ttp_journal_head_t;
+
+/* a range of blocks on disk, as appended to the journal */
+typedef struct {
+    u_int64_t           first;                    /* the first block of the range                */
+    u_int32_t           count;                    /* the number of blocks in it                  */
+    u_int32_t           check;                    /* a check of the two, to spot torn records    */
+} ttp_journal_record_t;
+
+/* the journal of the file being received, see journal.c */
+typedef struct {
+    ttp_journal_head_t  head;                     /* what the journal is of                      */
+    char               *name;                     /* the name of the journal file                */
+    int                 fd;                       /* the journal file, -1 until it is written    */
+    u_char             *held;                     /* the blocks on disk from before, a bit each as
+                                                     in the received bitfield, or NULL          */
+    u_int64_t           held_count;               /* and how many there are                      */
+    ttp_journal_record_t pending[JOURNAL_PENDING];/* the ranges written since the last sync      */
+    u_int32_t           pending_count;            /* and how many there are                      */
+    struct timeval      sync_time;                /* when the journal was last synced            */
+} ttp_journal_t;
+
 /* state of a TTP transfer */
 typedef struct {
     time_t              epoch;                    /* the Unix epoch used to identify this run    */
@@ -202,18 +372,61 @@ typedef struct {
     FILE               *transcript;               /* the transcript file that we're writing to   */
     int                 udp_fd;                   /* the file descriptor of our UDP socket       */
     u_int64_t           file_size;                /* the total file size (in bytes)              */
-    u_int32_t           block_count;              /* the total number of blocks in the file      */
-    u_int32_t           next_block;               /* the index of the next block we expect       */
-    u_int32_t           gapless_to_block;         /* the last block in the fully received range  */
+    u_int64_t           block_count;              /* the total number of blocks in the file      */
+    u_int64_t           next_block;               /* the index of the next block we expect       */
+    u_int64_t           gapless_to_block;         /* the last block in the fully received range  */
     retransmit_t        retransmit;               /* the retransmission data for the transfer    */
     statistics_t        stats;                    /* the statistical data for the transfer       */
     ring_buffer_t      *ring_buffer;              /* the blocks waiting for a disk write         */
     u_char             *received;                 /* bitfield for the received blocks of data    */
-    u_int32_t           blocks_left;              /* the number of blocks left to receive        */
+    u_int64_t           blocks_left;              /* the number of blocks left to receive        */
     u_char              restart_pending;          /* 1 to ignore too new packets                 */
-    u_int32_t           restart_lastidx;          /* the last index in the restart list          */
-    u_int32_t           restart_wireclearidx;     /* the max on-wire block number before react   */
+    u_int64_t           restart_lastidx;          /* the last index in the restart list          */
+    u_int64_t           restart_wireclearidx;     /* the max on-wire block number before react   */
     u_int32_t           on_wire_estimate;         /* the max packets on wire if RTT is 500ms     */
+    u_int64_t           last_block;               /* the most recently received block            */
+    u_int16_t           congestion;               /* the congestion controller the server runs   */
+    u_int32_t           header_flags;             /* the datagram header extensions (TS_HDR_*)   */
+    u_int32_t           header_size;              /* the size of the datagram header in bytes    */
+    u_int32_t           delay_target;             /* the scavenger target queueing delay (usec)  */
+    u_char              ecn;                      /* 1 if the server sends ECN capable data      */
+    u_int32_t           probe_train;              /* the length of the probe train, 0=no probe   */
+    u_int32_t           probe_received;           /* the probe datagrams that arrived            */
+    u_int32_t           probe_dispersion;         /* the spread of the arrived train (usec)      */
+    u_int32_t           probe_rtt;                /* the time until the probe arrived (usec)     */
+    u_int64_t           ipd_time;                 /* the server's IPD at the target rate (nsec)  */
+    u_int16_t           fec;                      /* the FEC code the server uses (TS_FEC_*)     */
+    u_int32_t           fec_group;                /* the data blocks per FEC group               */
+    u_int64_t           fec_current;              /* the group that is still arriving            */
+    fec_slot_t         *fec_slots;                /* the FEC groups kept for repairs             */
+    u_char             *fec_buffer;               /* the block storage of those groups           */
+    u_int32_t           tail_copies;              /* the final blocks the server sends twice     */
+    u_char              backpressure;             /* 1 if the server paces to our headroom       */
+    u_char              rxq_ovfl;                 /* 1 if the kernel counts our sockets' drops  */
+    u_int32_t           socket_drops;             /* the datagrams our socket dropped so far     */
+    u_int32_t           mcast_drops;              /* and those the multicast group's socket did  */
+    u_int32_t           udp_buffer;               /* the current UDP receive buffer size         */
+    u_char              udp_buffer_stuck;         /* 1 once the buffer could not grow further    */
+    u_int16_t           streams;                  /* the data streams or sockets, 1=just one     */
+    u_char              shared_port;              /* 1 if the streams are sockets on one port    */
+    u_char              paths;                    /* 1 if the streams have their own addresses  */
+    ttp_stream_t       *stream;                   /* the streams, 0 the main one, or NULL        */
+    u_int16_t           mirrors;                  /* the mirrors sending along, 0=none           */
+    u_char              mirrored;                 /* 1 if the server sends the ranges asked for  */
+    ttp_mirror_t       *mirror;                   /* the mirrors, or NULL                        */
+    u_char              multicast;                /* 1 if the originals come by multicast        */
+    u_int32_t           mcast_group;              /* the IPv4 multicast group (host order)       */
+    u_int16_t           mcast_port;               /* the UDP port of the multicast group         */
+    int                 mcast_fd;                 /* the socket joined to the group, or -1       */
+    ttp_relay_map_t    *relay_map;                /* the map of the blocks on disk, or NULL      */
+    size_t              relay_length;             /* the size of that map in bytes               */
+    u_int32_t           pipeline;                 /* the file number in a pipelined GET *, 0=none */
+    u_char              rate_share;               /* 1 if the server lets us move its target rate */
+    u_int64_t           file_time;                /* the file's modification time on the server, 0=unknown */
+    u_char              resumed;                  /* 1 if the server sends only what the journal misses */
+    u_int64_t           sync_segment;             /* the blocks per segment of a synced file, 0=not synced */
+    pthread_mutex_t     stream_lock;              /* guards the transfer against stream threads  */
+    volatile u_char     streams_stop;             /* 1 to have the stream threads quit           */
 } ttp_transfer_t;
 
 /* state of a Tsunami session as a whole */
@@ -223,33 +436,143 @@ typedef struct {
     FILE               *server;                   /* the connection to the remote server         */
     struct sockaddr    *server_address;           /* the socket address of the remote server     */
     socklen_t           server_address_length;    /* the size of the socket address              */
+    ttp_bundle_t       *bundle;                   /* the bundle being asked for, or NULL         */
+    ttp_journal_t      *journal;                  /* the journal of the file asked for, or NULL  */
+    u_int64_t          *sync;                     /* the first and end block of each range a sync sends, or NULL */
+    u_int32_t           sync_count;               /* and how many ranges there are               */
+    ttp_concurrent_t   *concurrent;               /* the transfers running alongside, or NULL    */
+    u_int16_t           slot;                     /* and our place among them                    */
 } ttp_session_t;
 
+/* a parallel UDP data stream or path, received by a thread of its own unless it is stream 0 */
+struct ttp_stream_s {
+    ttp_session_t      *session;                  /* the session the stream belongs to           */
+    u_int16_t           index;                    /* the stream number, 0 for the main one       */
+    int                 udp_fd;                   /* the file descriptor of its UDP socket       */
+    u_int64_t           last_original;            /* the last original block it brought          */
+    u_char              stale;                    /* 1 if no originals came of late              */
+    u_int32_t           this_blocks;              /* the datagrams it brought since the report   */
+    u_int32_t           this_originals;           /* and the originals among them                */
+    pthread_t           thread;                   /* the receiver thread                         */
+    u_char              running;                  /* 1 if the thread was started                 */
+    int                 cpu;                      /* the core the thread is pinned to, or -1     */
+    ttp_mirror_t       *mirror;                   /* the mirror it comes from, or NULL           */
+    u_int64_t           range_first;              /* with mirrors, the first original it sends   */
+    u_int64_t           range_end;                /* and the first one it doesn't                */
+    u_int32_t           quiet;                    /* the reports without originals while busy    */
+};
+
+/* a server mirroring the file, which sends a range of the blocks over a stream of the transfer */
+struct ttp_mirror_s {
+    ttp_parameter_t     parameter;                /* the parameters of its session               */
+    ttp_session_t      *session;                  /* the session with the mirror                 */
+    ttp_stream_t       *stream;                   /* the stream it sends over                    */
+    u_int64_t           report_original;          /* its last original at the last report        */
+    double              error_rate;               /* the smoothed error rate (% x 1000)          */
+    u_int64_t           total_blocks;             /* the blocks it brought                       */
+};
+
+/* a file to get alongside others */
+typedef struct {
+    const char         *host;                     /* the server to get it from                   */
+    const char         *remote_filename;          /* its name there                              */
+    const char         *local_filename;           /* and here                                    */
+} ttp_job_t;
+
+/* the transfers that run at once, each over a session of its own, and what they share */
+struct ttp_concurrent_s {
+    pthread_mutex_t     lock;                     /* guards everything below                     */
+    pthread_cond_t      wake;                     /* signalled on new blocks and finished writes */
+    pthread_t           engine;                   /* the thread writing the blocks of them all   */
+    u_char              engine_stop;              /* 1 to have it quit once nothing is pending   */
+    ttp_session_t      *writer[MAX_CONCURRENT];   /* the transfer in each slot, or NULL          */
+    ttp_session_t      *busy;                     /* the one whose blocks are being written      */
+    u_int32_t           pending;                  /* the blocks waiting in their rings           */
+    u_int16_t           turn;                     /* the slot the engine looks at first next     */
+    double              total_rate;               /* the target rate of them all (bps)           */
+    u_char              active[MAX_CONCURRENT];   /* 1 for each slot with a transfer running     */
+    u_int32_t           reports[MAX_CONCURRENT];  /* the reports each one made so far            */
+    double              demand[MAX_CONCURRENT];   /* the rate each one delivered last (bps)      */
+    double              share[MAX_CONCURRENT];    /* and its part of the total rate (bps)        */
+    const ttp_job_t    *jobs;                     /* the files to get                            */
+    u_int32_t           job_count;                /* and how many there are                      */
+    u_int32_t           job_next;                 /* the next one to start                       */
+    u_int32_t           job_failed;               /* the ones that failed                        */
+    u_int64_t           bytes;                    /* the data of the ones received               */
+};
+
 
 /*------------------------------------------------------------------------
  * Function prototypes.
  *------------------------------------------------------------------------*/
 
+/* bundle.c */
+void           bundle_close          (ttp_session_t *session);
+int            bundle_open           (ttp_session_t *session);
+int            bundle_request        (ttp_session_t *session);
+int            bundle_write          (ttp_session_t *session, u_int64_t block_index, const u_char *block, u_int32_t length);
+
 /* command.c */
 int            command_close         (command_t *command, ttp_session_t *session);
 ttp_session_t *command_connect       (command_t *command, ttp_parameter_t *parameter);
 int            command_get           (command_t *command, ttp_session_t *session);
 int            command_help          (command_t *command, ttp_session_t *session);
+int            command_mget          (command_t *command, ttp_parameter_t *parameter);
 int            command_quit          (command_t *command, ttp_session_t *session);
 int            command_set           (command_t *command, ttp_parameter_t *parameter);
 int            command_dir           (command_t *command, ttp_session_t *session);
 
-inline int     got_block             (ttp_session_t* session, u_int32_t blocknr);
+inline int     got_block             (ttp_session_t* session, u_int64_t blocknr);
+
+/* concurrent.c */
+void           concurrent_attach     (ttp_session_t *session);
+void           concurrent_detach     (ttp_session_t *session);
+int            concurrent_get        (ttp_parameter_t *parameter, const ttp_job_t *jobs, u_int32_t count);
+void           concurrent_notify     (ttp_concurrent_t *concurrent);
+int            concurrent_report     (ttp_session_t *session);
 
 /* config.c */
 void           reset_client          (ttp_parameter_t *parameter);
 
+/* fec.c */
+int            fec_accept_block      (ttp_session_t *session, u_int64_t block, u_int16_t type, const u_char *data);
+int            fec_accept_parity     (ttp_session_t *session, u_int64_t number, const u_char *data);
+int            fec_init              (ttp_session_t *session);
+int            fec_pending           (ttp_session_t *session, u_int64_t block);
+
 /* io.c */
-int            accept_block          (ttp_session_t *session, u_int32_t block_index, u_char *block);
+int            accept_block          (ttp_session_t *session, u_int64_t block_index, u_char *block);
+int            create_parents        (const char *path);
+void           relay_map_close       (ttp_session_t *session, u_int32_t state);
+int            relay_map_open        (ttp_session_t *session);
+
+/* journal.c */
+void           journal_apply         (ttp_session_t *session);
+void           journal_close         (ttp_session_t *session, int complete);
+int            journal_load          (ttp_session_t *session, const char *local_filename);
+void           journal_mark          (ttp_session_t *session, u_int64_t block);
+int            journal_open          (ttp_session_t *session);
+int            journal_request       (ttp_session_t *session);
+
+/* mirror.c */
+int            mirror_assign         (ttp_session_t *session);
+void           mirror_close          (ttp_session_t *session);
+int            mirror_open           (ttp_session_t *session);
+int            mirror_report         (ttp_session_t *session, u_int64_t delta);
 
 /* network.c */
 int            create_tcp_socket     (ttp_session_t *session, const char *server_name, u_int16_t server_port);
 int            create_udp_socket     (ttp_parameter_t *parameter);
+int            get_path_mtu          (ttp_session_t *session);
+u_int32_t      grow_udp_buffer       (ttp_session_t *session);
+int            create_mcast_socket   (ttp_session_t *session);
+int            test_ecn_socket       (ttp_parameter_t *parameter);
+
+/* profile.c */
+int            profile_lookup        (const char *filename, const char *host, u_int16_t port, path_profile_t *profile);
+int            profile_update        (const char *filename, const path_profile_t *sample);
+void           profile_seed          (ttp_parameter_t *parameter, const path_profile_t *profile);
+double         profile_weight        (const path_profile_t *profile);
 
 /* protocol.c */
 int            ttp_authenticate      (ttp_session_t *session, u_char *secret);
@@ -257,7 +580,7 @@ int            ttp_negotiate         (ttp_session_t *session);
 int            ttp_open_port         (ttp_session_t *session);
 int            ttp_open_transfer     (ttp_session_t *session, const char *remote_filename, const char *local_filename);
 int            ttp_repeat_retransmit (ttp_session_t *session);
-int            ttp_request_retransmit(ttp_session_t *session, u_int32_t block);
+int            ttp_request_retransmit(ttp_session_t *session, u_int64_t block);
 int            ttp_request_stop      (ttp_session_t *session);
 int            ttp_update_stats      (ttp_session_t *session);
 
@@ -266,6 +589,7 @@ int            ring_cancel           (ring_buffer_t *ring);
 int            ring_confirm          (ring_buffer_t *ring);
 ring_buffer_t *ring_create           (ttp_session_t *session);
 int            ring_destroy          (ring_buffer_t *ring);
+int            ring_drain            (ring_buffer_t *ring);
 int            ring_dump             (ring_buffer_t *ring, FILE *out);
 u_char        *ring_peek             (ring_buffer_t *ring);
 int            ring_pop              (ring_buffer_t *ring);
@@ -279,6 +603,19 @@ void stop_vsib (ttp_session_t *session);
 void write_vsib_block (ttp_session_t* session, unsigned char *memblk, size_t blksize);
 #endif
 
+/* stream.c */
+int            stream_open           (ttp_session_t *session);
+int            stream_passed         (ttp_session_t *session, ttp_stream_t *stream, u_int64_t block);
+int            stream_report         (ttp_session_t *session, u_int64_t delta);
+int            stream_share_port     (ttp_session_t *session);
+int            stream_start          (ttp_session_t *session);
+void           stream_stop           (ttp_session_t *session);
+
+/* sync.c */
+void           sync_apply            (ttp_session_t *session);
+u_int64_t      sync_offer            (ttp_session_t *session, const char *local_filename);
+int            sync_request          (ttp_session_t *session);
+
 /* transcript.c */
 void           xscript_close         (ttp_session_t *session, u_int64_t delta);
 void           xscript_data_log      (ttp_session_t *session, const char *logline);
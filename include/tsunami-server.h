@@ -64,6 +64,7 @@
 #define __TSUNAMI_SERVER_H
 
 #include <netinet/in.h>  /* for struct sockaddr_in, etc.                 */
+#include <pthread.h>     /* for the stream sender threads                */
 #include <stdio.h>       /* for NULL, FILE *, etc.                       */
 #include <sys/types.h>   /* for various system data types                */
 
@@ -82,15 +83,69 @@ extern const u_char     DEFAULT_VERBOSE_YN;         /* the default verbosity set
 extern const u_char     DEFAULT_TRANSCRIPT_YN;      /* the default transcript setting          */
 extern const u_char     DEFAULT_IPV6_YN;            /* the default IPv6 setting                */
 extern const u_int16_t  DEFAULT_HEARTBEAT_TIMEOUT;  /* the default timeout after no client heartbeat */
+extern const u_int16_t  DEFAULT_MCAST_PORT;         /* the default UDP port of a multicast group */
+extern const u_int32_t  DEFAULT_MCAST_WAIT;         /* the default time to gather receivers (msec) */
+extern const u_int32_t  DEFAULT_MCAST_EVICT;        /* the default error rate to evict at (% x 1000) */
+extern const char      *DEFAULT_RELAY_CLIENT;       /* the default client to fetch relayed files with */
 
 #define MAX_FILENAME_LENGTH  1024               /* maximum length of a requested filename  */
 #define RINGBUF_BLOCKS  1                       /* Size of ring buffer (disabled now) */
 #define FRAMES_IN_SLOT  40                      /* 0.02s timeslots for computers */
+#define CC_BW_WINDOW    10                      /* feedback rounds in the bandwidth filter */
+#define CC_RTT_WINDOW   10000000.0              /* lifetime of a minimum RTT sample (usec) */
+#define CC_QUEUE_DELAY  10000                   /* queueing delay (usec) above which a rising delay means congestion */
+#define CC_DELAY_TARGET 25000                   /* default scavenger target queueing delay (usec) */
+#define CC_RAMP_START   8                       /* the ramp after the probe starts at 1/8 of the estimate */
+#define CC_RAMP_MIN     1000                    /* the shortest ramp step (usec)           */
+#define CC_RING_HORIZON 500000                  /* the time (usec) the client's free ring space is spread over */
+#define CC_RING_DRAIN   0.9                     /* the share of the client's disk rate to pace at with a full ring */
+#define FEC_HEADROOM    2.0                     /* parity blocks per data block expected lost */
+#define TAIL_PERIOD_MIN 10000                   /* the shortest wait for a repair request in the tail (usec) */
+#define TAIL_PERIOD_MAX 1000000                 /* the longest wait between two terminate blocks (usec) */
+#define TAIL_SILENCE    2000000                 /* the client's silence (usec) in the tail that we report, several feedback periods */
+#define MCAST_MEMBERS   32                      /* the most receivers of a multicast group */
+#define MCAST_QUEUE     4096                    /* the repair requests the receivers can have queued */
+#define MCAST_RECENT    4096                    /* the repairs remembered to suppress repeated requests */
+#define MCAST_HOLDOFF   20000                   /* the least time (usec) a repeated request is suppressed */
+#define MCAST_STRIKES   3                       /* the reports above the threshold before a receiver is evicted */
+#define MCAST_TTL       32                      /* the time to live of the multicast datagrams */
+#define MCAST_SENDER    1                       /* the session sends to the group          */
+#define MCAST_MEMBER    2                       /* the session's client receives from it   */
+#define MCAST_EVICTED   3                       /* and gets its repairs by unicast         */
+#define RELAY_SCAN      64                      /* the blocks looked ahead for one that has been relayed */
+#define RELAY_POLL      10000                   /* the wait (usec) for the relayed file to grow */
+#define PIPELINE_PREFETCH (64 << 20)            /* the bytes of the next file of a GET * read ahead in the tail phase */
+#define SYNC_SEGMENT    (1 << 20)               /* the least bytes of a file that a segment of a sync covers */
+#define EGRESS_SESSIONS 64                      /* the most transfers sharing the egress budget at once */
+#define EGRESS_RULES    32                      /* the most clients given a weight or cap of their own */
+#define EGRESS_HEADROOM 1.25                    /* the ceiling over the rate a transfer that wants less than its share would send at */
+#define EGRESS_FLOOR    0.1                     /* the smallest ceiling, as a part of the weighted share */
 
 /*------------------------------------------------------------------------
  * Data structures.
  *------------------------------------------------------------------------*/
 
+/* a multicast group shared by the session processes, see multicast.c */
+typedef struct ttp_group_s ttp_group_t;
+
+/* the egress budget shared by the session processes, see egress.c */
+typedef struct ttp_egress_s ttp_egress_t;
+
+/* the weight and cap of a client, from --share */
+typedef struct {
+    char                address[INET6_ADDRSTRLEN]; /* the client's address as text         */
+    double              weight;       /* its weight in the share of the budget      */
+    u_int64_t           cap;          /* the most it may be sent in bps, 0=none     */
+} ttp_egress_rule_t;
+
+/* a file packed into a bundle, see bundle.c */
+typedef struct {
+    char               *name;         /* its name as the client asked for it        */
+    u_int64_t           offset;       /* where it starts in the block stream        */
+    u_int64_t           size;         /* its size in bytes                          */
+    int                 fd;           /* the open file                              */
+} ttp_bundle_file_t;
+
 /* Tsunami transfer protocol parameters */
 typedef struct {
     time_t              epoch;          /* the Unix epoch used to identify this run   */
@@ -103,10 +158,10 @@ typedef struct {
     const u_char       *secret;         /* the shared secret for users to prove       */
     u_int32_t           block_size;     /* the size of each block (in bytes)          */
     u_int64_t           file_size;      /* the total file size (in bytes)             */
-    u_int32_t           block_count;    /* the total number of blocks in the file     */
-    u_int32_t           target_rate;    /* the transfer rate that we're targetting    */
+    u_int64_t           block_count;    /* the total number of blocks in the file     */
+    u_int64_t           target_rate;    /* the transfer rate that we're targetting    */
     u_int32_t           error_rate;     /* the threshhold error rate (in % x 1000)    */
-    u_int32_t           ipd_time;       /* the inter-packet delay in usec             */
+    double              ipd_time;       /* the inter-packet delay in usec             */
     u_int16_t           slower_num;     /* the numerator of the increase-IPD factor   */
     u_int16_t           slower_den;     /* the denominator of the increase-IPD factor */
     u_int16_t           faster_num;     /* the numerator of the decrease-IPD factor   */
@@ -118,11 +173,83 @@ typedef struct {
     int                 samplerate;     /* Sample rate in MHz (optional)              */
     char                **file_names;   /* Store the local file_names on server       */
     size_t              *file_sizes;    /* Store the local file sizes on server       */
-    u_int16_t           file_name_size; /* Store the total size of the array          */
-    u_int16_t           total_files;    /* Store the total number of served files     */
+    u_int32_t           file_name_size; /* Store the total size of the array          */
+    u_int32_t           total_files;    /* Store the total number of served files     */
     long                wait_u_sec;
+    u_int16_t           congestion;     /* the congestion controller (TS_CC_*)        */
+    u_int32_t           header_flags;   /* the datagram header extensions (TS_HDR_*)  */
+    u_int32_t           header_size;    /* the size of the datagram header in bytes   */
+    u_int32_t           delay_target;   /* the scavenger target queueing delay (usec) */
+    u_char              ecn;            /* 1 to send the data as ECN capable (ECT(1)) */
+    u_int32_t           probe_train;    /* the length of the startup probe, 0=none    */
+    u_int64_t           start_rate;     /* the client's start rate hint in bps, 0=none */
+    u_int32_t           rtt_hint;       /* the client's RTT hint in usec, 0=none      */
+    u_int16_t           fec;            /* the FEC code (TS_FEC_*)                    */
+    u_int32_t           fec_group;      /* the data blocks per FEC group              */
+    u_int32_t           tail_copies;    /* the final blocks to send twice, 0=none     */
+    u_char              backpressure;   /* 1 to pace to the receiver's headroom       */
+    u_int16_t           streams;        /* the parallel UDP data streams, 1=just one  */
+    u_char              paths;          /* 1 if the client names addresses per stream */
+    u_char              mirror;         /* 1 to send only the ranges the client asks  */
+    u_char              multicast;      /* 1 if the client can receive from a group   */
+    u_int32_t           mcast_group;    /* the IPv4 group to multicast to, 0=none     */
+    u_int16_t           mcast_port;     /* and its UDP port                           */
+    u_int32_t           mcast_wait;     /* the time to gather receivers in msec       */
+    u_int32_t           mcast_evict;    /* the error rate (in % x 1000) to evict at   */
+    char               *relay_host;     /* the origin to relay missing files from     */
+    u_int16_t           relay_port;     /* and its TCP port                           */
+    const char         *relay_client;   /* the client to fetch them with              */
+    u_int32_t           pipeline;       /* the file number in a pipelined GET *, 0=none */
+    u_char              rate_share;     /* 1 if the client may change the target rate */
+    u_char              resume;         /* 1 if the client keeps a journal of the file */
+    u_int64_t           resume_time;    /* the modification time its journal is of, 0=new */
+    u_int64_t           resume_size;    /* and the file size, 0 unless it resumes     */
+    u_int64_t           sync_size;      /* the size of the client's copy to sync with, 0=none */
+    u_int64_t           sync_segment;   /* the blocks per segment of a synced file, 0=not synced */
+    ttp_group_t        *group;          /* the group in memory shared with sessions   */
+    u_int64_t           egress_rate;    /* the send budget of all sessions in bps, 0=none */
+    u_int64_t           client_cap;     /* the most one client may be sent in bps, 0=none */
+    ttp_egress_rule_t   egress_rule[EGRESS_RULES]; /* the clients with a weight or cap of their own */
+    u_int16_t           egress_rules;   /* and how many there are                     */
+    ttp_egress_t       *egress;         /* the budget in memory shared with sessions, or NULL */
 } ttp_parameter_t;
 
+/* feedback from the client, as seen by a congestion controller */
+typedef struct {
+    u_int32_t           error_rate;     /* the smoothed error rate (in % x 1000)      */
+    double              delivery_rate;  /* the client receive rate in bps, 0=unknown  */
+    double              rtt;            /* a round-trip time sample in usec, 0=none   */
+    double              queue_delay;    /* the queueing delay in usec, 0=unknown      */
+    double              delay_trend;    /* the one-way delay change in usec           */
+    double              ce_fraction;    /* the fraction of CE marked datagrams, 0..1  */
+} ttp_feedback_t;
+
+/* state of the congestion controller of a transfer */
+typedef struct {
+    double              pacing_rate;    /* the current pacing rate in bps             */
+    u_char              mode;           /* the controller-specific phase              */
+    u_int32_t           round;          /* the number of feedback rounds so far       */
+    u_int32_t           cycle;          /* the position in the pacing gain cycle      */
+    double              bw_sample[CC_BW_WINDOW]; /* the recent delivery rates in bps  */
+    double              btl_bw;         /* the bottleneck bandwidth estimate in bps   */
+    double              full_bw;        /* the bandwidth at the last growth check     */
+    u_int32_t           full_bw_count;  /* the rounds without significant growth      */
+    double              min_rtt;        /* the minimum round-trip time in usec        */
+    struct timeval      min_rtt_stamp;  /* when the minimum RTT was last refreshed    */
+    double              srtt;           /* the smoothed round-trip time in usec       */
+    u_int32_t           probe_received; /* the probe datagrams that arrived           */
+    double              probe_rate;     /* the probed path bandwidth in bps, 0=none   */
+    double              probe_rtt;      /* the probed round-trip time in usec, 0=none */
+    double              ramp_target;    /* the rate the ramp is heading for, 0=done   */
+    double              ramp_interval;  /* the time between two ramp steps in usec    */
+    struct timeval      ramp_stamp;     /* when the ramp last doubled the rate        */
+    double              receiver_rate;  /* the rate the client can take in bps, 0=any */
+    double              egress_rate;    /* our ceiling within the egress budget in bps, 0=none */
+} ttp_cc_t;
+
+/* a parallel UDP data stream of a transfer, see stream.c */
+typedef struct ttp_stream_s ttp_stream_t;
+
 /* state of a transfer */
 typedef struct {
     ttp_parameter_t    *parameter;    /* the TTP protocol parameters                */
@@ -134,27 +261,166 @@ typedef struct {
     struct sockaddr    *udp_address;  /* the destination for our file data          */
     socklen_t           udp_length;   /* the length of the UDP socket address       */
     double              ipd_current;  /* the inter-packet delay currently in usec   */
-    u_int32_t           block;        /* the current block that we're up to         */
+    u_int64_t           block;        /* the current block that we're up to         */
+    u_int64_t           range_end;    /* the first original block not to send       */
+    ttp_cc_t            cc;           /* the congestion controller state            */
+    u_char             *fec_parity;   /* the parity datagrams of the current group  */
+    u_int64_t           fec_index;    /* the number of the current group            */
+    u_int64_t           fec_next;     /* the block that continues the group, 0=none */
+    u_int32_t           fec_rows;     /* the parity blocks of the current group     */
+    u_int32_t           fec_count;    /* the parity blocks for the groups to come   */
+    double              fec_loss;     /* the smoothed loss rate seen by the client  */
+    u_char              tail;         /* 1 once every original block has been sent  */
+    u_int64_t           tail_copy;    /* the next final block to send twice         */
+    u_char              tail_due;     /* 1 if a terminate block should go out next  */
+    struct timeval      tail_stamp;   /* when the last terminate block went out     */
+    double              tail_period;  /* the wait before the next one in usec       */
+    ttp_stream_t       *streams;      /* the streams, 0 the main one, or NULL       */
+    pthread_mutex_t     stream_lock;  /* guards the next block against the threads  */
+    volatile u_char     streams_stop; /* 1 to have the stream threads quit          */
+    u_char              mcast;        /* the part in a multicast group (MCAST_*)    */
+    u_int32_t           mcast_generation; /* the group transfer we take part in     */
+    int                 mcast_slot;   /* our receiver in the group                  */
+    struct ttp_repair_s *mcast_recent;/* the last repairs to the group, by block    */
+    struct sockaddr    *mcast_unicast;/* our client's data address while sending to the group */
+    u_int64_t           mcast_repairs;    /* the repairs sent for other receivers   */
+    u_int64_t           mcast_suppressed; /* the repeated requests not acted on     */
+    ttp_relay_map_t    *relay;        /* the map of the file being relayed, or NULL */
+    size_t              relay_length; /* and the length of its mapping              */
+    u_char              relay_wait;   /* 1 while no more of it has arrived          */
+    ttp_bundle_file_t  *bundle;       /* the files of a bundle in stream order, or NULL */
+    u_int32_t           bundle_count; /* and how many there are                     */
+    u_char              egress;       /* 1 while we take part in the egress budget  */
+    int                 egress_slot;  /* and our entry in it                        */
+    u_int64_t          *resume;       /* the first and end block of each range a resuming client misses, or NULL */
+    u_int32_t           resume_count; /* and how many ranges there are              */
 } ttp_transfer_t;
 
+/* what a pipelined GET * keeps from one file for the next one */
+typedef struct {
+    u_int32_t           file;         /* the number of the last file sent, 0=none   */
+    int                 udp_fd;       /* its data socket                            */
+    struct sockaddr    *udp_address;  /* and the client address it sent to          */
+    socklen_t           udp_length;   /* the length of that address                 */
+    double              rate;         /* the pacing rate it ended at in bps         */
+    double              rtt;          /* and the smoothed round-trip time in usec   */
+    FILE               *next;         /* the file after it in the list, opened ahead */
+    const char         *next_name;    /* and its name                               */
+} ttp_pipeline_t;
+
 /* state of a Tsunami session as a whole */
 typedef struct {
     ttp_parameter_t    *parameter;    /* the TTP protocol parameters                */
     ttp_transfer_t      transfer;     /* the current transfer in progress, if any   */
     int                 client_fd;    /* the connection to the remote client        */
     int                 session_id;   /* the ID of the server session, autonumber   */
+    ttp_pipeline_t      pipeline;     /* the state a pipelined GET * keeps          */
 } ttp_session_t;
 
+/* a parallel UDP data stream or path, which sends its share of the original blocks from its own thread */
+struct ttp_stream_s {
+    ttp_session_t      *session;      /* the session the stream belongs to          */
+    u_int16_t           index;        /* the stream number, 0 for the main one      */
+    int                 udp_fd;       /* the file descriptor of its UDP socket      */
+    struct sockaddr    *udp_address;  /* the client address and port it sends to    */
+    pthread_t           thread;       /* the sender thread                          */
+    volatile u_char     done;         /* 1 once its blocks are out, 2 if no thread  */
+    double              share;        /* its part of the current rate, 0..1         */
+    double              capacity;     /* the rate it seems to carry, 0=unknown      */
+    double              loss;         /* the smoothed loss rate the client reports  */
+    u_int64_t           sent;         /* the datagrams sent by its sender           */
+    u_int64_t           repairs;      /* the repairs sent on it by the main loop    */
+    u_int64_t           reported;     /* sent + repairs at the last path report     */
+};
+
+
+/* a receiver of a multicast group */
+typedef struct {
+    pid_t               pid;          /* its session process, 0 for a free slot     */
+    u_char              state;        /* MCAST_MEMBER or MCAST_EVICTED              */
+    u_int32_t           error_rate;   /* its last reported error rate (% x 1000)    */
+    u_int32_t           delivery_rate;/* and receive rate (kbps)                    */
+    u_int32_t           strikes;      /* its reports in a row above the threshold   */
+} ttp_member_t;
+
+/* a multicast group, in memory shared by all session processes */
+struct ttp_group_s {
+    pthread_mutex_t     lock;         /* guards the rest against the other sessions */
+    u_int32_t           generation;   /* counts the transfers to the group          */
+    pid_t               sender;       /* the session process sending, 0=none        */
+    u_char              sending;      /* 0 while receivers may still join           */
+    char                filename[MAX_FILENAME_LENGTH]; /* the file being sent       */
+    u_int64_t           file_size;    /* and its size                               */
+    u_int32_t           block_size;   /* the block size of the transfer             */
+    u_int32_t           header_flags; /* and its datagram header extensions         */
+    u_int64_t           block;        /* the last original sent to the group        */
+    u_int32_t           reports;      /* the feedback reports of the receivers      */
+    ttp_member_t        member[MCAST_MEMBERS]; /* the receivers, the sender's first */
+    u_int64_t           queue[MCAST_QUEUE];    /* the blocks they ask to be repaired */
+    u_int32_t           queue_head;   /* the next request to take                   */
+    u_int32_t           queue_tail;   /* the next free entry                        */
+};
+
+/* a transfer taking part in the egress budget */
+typedef struct {
+    pid_t               pid;          /* its session process, 0 for a free slot     */
+    char                address[INET6_ADDRSTRLEN]; /* the address of its client     */
+    double              weight;       /* the weight of its client                   */
+    double              cap;          /* and the cap of its client in bps, 0=none   */
+    double              demand;       /* the rate it would send at in bps           */
+    double              ceiling;      /* and the most it may send at in bps, 0=none */
+} ttp_egress_slot_t;
+
+/* the egress budget, in memory shared by all session processes */
+struct ttp_egress_s {
+    pthread_mutex_t     lock;         /* guards the rest against the other sessions */
+    double              budget;       /* the send budget of them all in bps, 0=none */
+    ttp_egress_slot_t   slot[EGRESS_SESSIONS]; /* the transfers sharing it          */
+};
+
+/* a repair sent to a multicast group */
+typedef struct ttp_repair_s {
+    u_int64_t           block;        /* the block repaired                         */
+    struct timeval      sent;         /* and when                                   */
+} ttp_repair_t;
+
 
 /*------------------------------------------------------------------------
  * Function prototypes.
  *------------------------------------------------------------------------*/
 
+/* bundle.c */
+void bundle_close         (ttp_session_t *session);
+int  bundle_open          (ttp_session_t *session);
+int  bundle_read          (ttp_session_t *session, u_int64_t block_index, u_char *block);
+
+/* cc.c */
+void cc_feedback          (ttp_session_t *session, const retransmission_t *retransmission);
+void cc_init              (ttp_session_t *session);
+void cc_probe             (ttp_session_t *session, u_int32_t received, u_int32_t dispersion, double elapsed);
+void cc_sent              (ttp_session_t *session, u_int64_t block, const struct timeval *when);
+void cc_target            (ttp_session_t *session, u_int64_t rate);
+
 /* config.c */
 void reset_server         (ttp_parameter_t *parameter);
 
+/* egress.c */
+int  egress_init          (ttp_parameter_t *parameter);
+double egress_join        (ttp_session_t *session);
+void egress_leave         (ttp_session_t *session);
+double egress_update      (ttp_session_t *session, double rate);
+
+/* fec.c */
+int  fec_encode           (ttp_session_t *session, u_int64_t block, const u_char *datagram);
+void fec_feedback         (ttp_session_t *session, const retransmission_t *retransmission);
+int  fec_init             (ttp_session_t *session);
+int  fec_send             (ttp_session_t *session);
+
 /* io.c */
-int  build_datagram       (ttp_session_t *session, u_int32_t block_index, u_int16_t block_type, u_char *datagram);
+int  build_datagram       (ttp_session_t *session, u_int64_t block_index, u_int16_t block_type, u_char *datagram);
+FILE *open_file           (ttp_session_t *session, const char *filename);
+void prefetch_next        (ttp_session_t *session);
+int  share_files          (ttp_parameter_t *parameter, const char *name);
 
 /* vsibctl.c */
 #ifdef VSIB_REALTIME
@@ -166,9 +432,20 @@ void read_vsib_block(ttp_session_t *session, unsigned char *memblk, size_t blksi
 /* log.c */
 /* void log                  (FILE *log_file, const char *format, ...); */
 
+/* multicast.c */
+int  mcast_follow         (ttp_session_t *session);
+int  mcast_init           (ttp_parameter_t *parameter);
+int  mcast_join           (ttp_session_t *session);
+void mcast_leave          (ttp_session_t *session);
+void mcast_linger         (ttp_session_t *session, u_char *datagram);
+int  mcast_repair         (ttp_session_t *session, u_char *datagram);
+int  mcast_request        (ttp_session_t *session, retransmission_t *retransmission);
+int  mcast_start          (ttp_session_t *session);
+
 /* network.c */
 int  create_tcp_socket    (ttp_parameter_t *parameter);
 int  create_udp_socket    (ttp_parameter_t *parameter);
+int  test_ecn_socket      (ttp_parameter_t *parameter);
 
 /* protocol.c */
 int  ttp_accept_retransmit(ttp_session_t *session, retransmission_t *retransmission, u_char *datagram);
@@ -177,6 +454,32 @@ int  ttp_negotiate        (ttp_session_t *session);
 int  ttp_open_port        (ttp_session_t *session);
 int  ttp_open_transfer    (ttp_session_t *session);
 
+/* relay.c */
+void relay_close          (ttp_session_t *session);
+u_int64_t relay_next      (ttp_session_t *session, u_int64_t block, u_int64_t last);
+int  relay_open           (ttp_session_t *session);
+int  relay_ready          (ttp_session_t *session, u_int64_t block);
+
+/* resume.c */
+int  resume_check         (ttp_session_t *session);
+void resume_close         (ttp_session_t *session);
+u_int64_t resume_next     (ttp_session_t *session, u_int64_t block, u_int64_t last);
+int  resume_read          (ttp_session_t *session);
+
+/* stream.c */
+int  stream_active        (ttp_session_t *session);
+void stream_feedback      (ttp_session_t *session, const retransmission_t *retransmission);
+double stream_ipd         (ttp_session_t *session, u_int16_t index);
+u_int64_t stream_next     (ttp_session_t *session);
+int  stream_open          (ttp_session_t *session);
+ttp_stream_t *stream_repair(ttp_session_t *session);
+int  stream_start         (ttp_session_t *session);
+void stream_stop          (ttp_session_t *session);
+
+/* sync.c */
+int  sync_check           (ttp_session_t *session);
+int  sync_compare         (ttp_session_t *session);
+
 /* transcript.c */
 void xscript_close        (ttp_session_t *session, u_int64_t delta);
 void xscript_data_log     (ttp_session_t *session, const char *logline);
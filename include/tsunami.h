@@ -86,6 +86,8 @@
 #define max(a,b)  (((a) > (b)) ? (a) : (b))
 
 #define tv_diff_usec(newer,older) ((newer.tv_sec-older.tv_sec)*1e6 + (newer.tv_usec-older.tv_usec))
+#define request_block(req) ((((u_int64_t) (req)->block_high) << 32) | (req)->block)
+#define parity_block(group,row) ((u_int64_t) (group) * MAX_FEC_PARITY + (row))
 
 typedef unsigned long long ull_t;
 
@@ -95,6 +97,17 @@ typedef unsigned long long ull_t;
 
 #define MAX_ERROR_MESSAGE  512        /* maximum length of an error message */
 #define MAX_BLOCK_SIZE     65530      /* maximum size of a data block       */
+#define MAX_PROBE_TRAIN    256        /* maximum length of the probe train  */
+#define MAX_HEADER_SIZE    32         /* maximum size of a datagram header  */
+#define MAX_FEC_GROUP      64         /* maximum data blocks in an FEC group */
+#define MAX_FEC_PARITY     16         /* maximum parity blocks per FEC group */
+#define MAX_TAIL_COPIES    1024       /* maximum final blocks sent twice     */
+#define MAX_STREAMS        8          /* maximum parallel UDP data streams   */
+#define MAX_BUNDLE_FILES   512        /* maximum files packed into a bundle  */
+#define MAX_RESUME_RANGES  65536      /* maximum missing ranges of a resumed transfer */
+#define MAX_SYNC_SEGMENTS  131072     /* maximum segments of a synced file   */
+#define MAX_SYNC_THREADS   8          /* maximum threads hashing a synced file */
+#define SYNC_DIGEST        8          /* bytes of the digest of a segment    */
 
 extern const u_int32_t PROTOCOL_REVISION;
 
@@ -102,6 +115,12 @@ extern const u_int16_t REQUEST_RETRANSMIT;
 extern const u_int16_t REQUEST_RESTART;
 extern const u_int16_t REQUEST_STOP;
 extern const u_int16_t REQUEST_ERROR_RATE;
+extern const u_int16_t REQUEST_PATH;
+extern const u_int16_t REQUEST_RANGE;
+extern const u_int16_t REQUEST_TARGET_RATE;
+
+extern const char     *CONGESTION_NAMES[];
+extern const char     *FEC_NAMES[];
 
 #define  TS_TCP_PORT    46224   /* default TCP port of the remote server        */
 #define  TS_UDP_PORT    46224   /* default UDP port of the client / 47221       */
@@ -109,8 +128,55 @@ extern const u_int16_t REQUEST_ERROR_RATE;
 #define  TS_BLOCK_ORIGINAL          'O'   /* blocktype "original block" */
 #define  TS_BLOCK_TERMINATE         'X'   /* blocktype "end transmission" */
 #define  TS_BLOCK_RETRANSMISSION    'R'   /* blocktype "retransmitted block" */
+#define  TS_BLOCK_PROBE             'P'   /* blocktype "startup probe", no file data */
+#define  TS_BLOCK_PARITY            'F'   /* blocktype "FEC parity", numbered by parity_block() */
 
 #define  TS_DIRLIST_HACK_CMD        "!#DIR??" /* "file name" sent by the client to request a list of the shared files */
+#define  TS_BUNDLE_HACK_CMD         "!#BUNDLE" /* "file name" sent by the client to request several files packed into one */
+
+#define  TS_OPT_END                 0     /* transfer option "end of option list" */
+#define  TS_OPT_CONGESTION          1     /* transfer option "congestion controller", value is a TS_CC_* */
+#define  TS_OPT_HEADER              2     /* transfer option "datagram header extensions", value is TS_HDR_* flags */
+#define  TS_OPT_DELAY_TARGET        3     /* transfer option "target queueing delay" of the scavenger class, in usec */
+#define  TS_OPT_ECN                 4     /* transfer option "ECT(1) marked datagrams", value is 0 or 1 */
+#define  TS_OPT_PROBE               5     /* transfer option "startup probe", value is the packet train length */
+#define  TS_OPT_START_RATE          6     /* transfer option "rate to start at" from past transfers, in bps */
+#define  TS_OPT_RTT_HINT            7     /* transfer option "expected round-trip time" from past transfers, in usec */
+#define  TS_OPT_TARGET_RATE         8     /* transfer option "target rate" in bps, overrides the 32-bit field */
+#define  TS_OPT_IPD                 9     /* transfer option "inter-packet delay" at the target rate, in nsec */
+#define  TS_OPT_FEC                 10    /* transfer option "forward error correction", value is a TS_FEC_* */
+#define  TS_OPT_FEC_GROUP           11    /* transfer option "data blocks per FEC group" */
+#define  TS_OPT_TAIL_COPIES         12    /* transfer option "final blocks to send twice" ahead of the terminate block */
+#define  TS_OPT_BACKPRESSURE        13    /* transfer option "pace to the receiver's ring and disk headroom", value is 0 or 1 */
+#define  TS_OPT_STREAMS             14    /* transfer option "parallel UDP data streams", each with its own port */
+#define  TS_OPT_PATHS               15    /* transfer option "stream addresses", value is 0 or 1, see stream.c */
+#define  TS_OPT_MIRROR              16    /* transfer option "send only the ranges asked for", value is 0 or 1 */
+#define  TS_OPT_MULTICAST           17    /* transfer option "receive from a multicast group", echoed as IPv4 group << 16 | port */
+#define  TS_OPT_PIPELINE            18    /* transfer option "keep the data port for the next file of a GET *", value is the file number from 1 */
+#define  TS_OPT_RATE_SHARE          19    /* transfer option "the target rate may change during the transfer", value is 0 or 1 */
+#define  TS_OPT_RESUME              20    /* transfer option "keep a journal", value is the file's modification time (sec) the journal is of, 0=new */
+#define  TS_OPT_RESUME_SIZE         21    /* transfer option "size of the file the journal is of", echoed if the missing ranges are to follow */
+#define  TS_OPT_SYNC                22    /* transfer option "sync with the local copy", value is its size, echoed as the blocks per segment */
+
+#define  TS_HDR_TIMESTAMP           0x0001  /* header extension "sender time in usec" */
+#define  TS_HDR_WIDE                0x0002  /* header extension "upper 32 bits of the block number" */
+#define  TS_HDR_FILE                0x0004  /* header extension "file number of a pipelined GET *" */
+
+#define  TS_CC_TSUNAMI              0     /* congestion controller "error rate driven IPD" */
+#define  TS_CC_BBR                  1     /* congestion controller "bottleneck bandwidth and RTT model" */
+#define  TS_CC_LEDBAT               2     /* congestion controller "scavenger with a target queueing delay" */
+#define  TS_CC_COUNT                3     /* number of known congestion controllers */
+
+#define  TS_FEC_NONE                0     /* no forward error correction */
+#define  TS_FEC_XOR                 1     /* one XOR parity block per group */
+#define  TS_FEC_RS                  2     /* Cauchy Reed-Solomon parity blocks */
+#define  TS_FEC_COUNT               3     /* number of known FEC codes */
+
+#define  TS_RELAY_MAGIC             "TSRELAY1"   /* first bytes of a relay map */
+#define  TS_RELAY_EXTENSION         ".relaymap"  /* appended to the file name for its relay map */
+#define  TS_RELAY_FETCHING          0     /* relay map state "the client is still receiving the file" */
+#define  TS_RELAY_DONE              1     /* relay map state "the file is complete" */
+#define  TS_RELAY_FAILED            2     /* relay map state "the transfer failed" */
 
 /*------------------------------------------------------------------------
  * Data structures.
@@ -119,11 +185,48 @@ extern const u_int16_t REQUEST_ERROR_RATE;
 /* retransmission request */
 typedef struct {
     u_int16_t           request_type;  /* the retransmission request type           */
-    u_int32_t           block;         /* the block number to retransmit {at}       */
+    u_int32_t           block;         /* the block number to retransmit {at}, or
+                                          the last block received (error rate only) */
     u_int32_t           error_rate;    /* the current error rate (in % x 1000)      */
+    u_int32_t           delivery_rate; /* the receive rate of the last interval (kbps) */
+    u_int32_t           queue_delay;   /* the queueing delay estimate (usec)        */
+    int32_t             delay_trend;   /* the one-way delay change since the last
+                                          report (usec)                             */
+    u_int32_t           received;      /* the datagrams received since the last report */
+    u_int32_t           ce_marks;      /* of which were CE marked by the network    */
+    u_int32_t           block_high;    /* the upper 32 bits of the block number     */
+    u_int32_t           fec_recovered; /* the blocks rebuilt from parity since the
+                                          last report                               */
+    u_int32_t           ring_free;     /* the free blocks in the receive ring       */
+    u_int32_t           disk_rate;     /* the rate the receiver can write to disk
+                                          (kbps), 0=unknown                         */
+    u_int32_t           echo_time;     /* the sender time of the last block received
+                                          plus the time it was held (usec, lower 32
+                                          bits, TS_HDR_TIMESTAMP), 0=none           */
 } retransmission_t;
 
 
+/* datagram header, see ttp_header_pack() for the wire format */
+typedef struct {
+    u_int64_t           block;         /* the block number                          */
+    u_int16_t           type;          /* the block type (TS_BLOCK_*)               */
+    u_int64_t           timestamp;     /* the sender time in usec (TS_HDR_TIMESTAMP) */
+    u_int32_t           file;          /* the file number (TS_HDR_FILE)             */
+} ttp_header_t;
+
+
+/* the map a client keeps of a file it receives for a relaying server ('set relaymap'), */
+/* followed by a bit per block of its block size that is set once the block is on disk */
+typedef struct {
+    char                magic[8];      /* TS_RELAY_MAGIC                            */
+    u_int64_t           file_size;     /* the size of the file in bytes             */
+    u_int32_t           block_size;    /* the block size of the map, 0 until known  */
+    u_int32_t           pid;           /* the client process receiving the file     */
+    volatile u_int32_t  state;         /* TS_RELAY_*                                */
+    u_int32_t           reserved;
+} ttp_relay_map_t;
+
+
 /*------------------------------------------------------------------------
  * Global variables.
  *------------------------------------------------------------------------*/
@@ -136,6 +239,8 @@ extern char g_error[];  /* buffer for the most recent error string    */
  *------------------------------------------------------------------------*/
 
 /* common.c */
+int        get_congestion_by_name  (const char *name);
+int        get_fec_by_name         (const char *name);
 int        get_random_data         (u_char *buffer, size_t bytes);
 u_int64_t  get_usec_since          (struct timeval *old_time);
 u_int64_t  htonll                  (u_int64_t value);
@@ -145,10 +250,22 @@ u_char    *prepare_proof           (u_char *buffer, size_t bytes, const u_char *
 int        read_line               (int fd, char *buffer, size_t buffer_length);
 int        fread_line              (FILE *f, char *buffer, size_t buffer_length);
 void       usleep_that_works       (u_int64_t usec);
+u_int32_t  ttp_header_size         (u_int32_t flags);
+void       ttp_header_pack         (u_char *datagram, const ttp_header_t *header, u_int32_t flags);
+void       ttp_header_unpack       (const u_char *datagram, ttp_header_t *header, u_int32_t flags);
 u_int64_t  get_udp_in_errors       ();
 ssize_t    full_write              (int, const void*, size_t);
 ssize_t    full_read               (int, void*, size_t);
 
+/* fec.c */
+u_char     fec_coefficient         (u_int16_t code, u_int32_t row, u_int32_t column);
+int        fec_decode              (u_int16_t code, u_int32_t k, u_char **data, const u_char *have,
+                                    u_char **parity, const u_int16_t *rows, u_int32_t parities, size_t length);
+void       fec_mul_add             (u_char *dst, const u_char *src, u_char coefficient, size_t length);
+
+/* sync.c */
+int        sync_digests            (int fd, u_int64_t size, u_int64_t segment, u_int32_t count, u_char *digests);
+
 /* error.c */
 int        error_handler           (const char *file, int line, const char *message, int fatal_yn);
 
@@ -382,7 +382,7 @@ int command_get(command_t *command, ttp_session_t *session)
 	return warn("Creation of data socket failed");
 
     /* allocate the retransmission table */
-    rexmit->table = (u_int32_t *) calloc(DEFAULT_TABLE_SIZE, sizeof(u_int32_t));
+    rexmit->table = (u_int64_t *) calloc(DEFAULT_TABLE_SIZE, sizeof(u_int64_t));
     if (rexmit->table == NULL)
 	error("Could not allocate retransmission table");
 
@@ -471,7 +471,7 @@ int command_get(command_t *command, ttp_session_t *session)
               if (xfer->blocks_left > 0) {
                   --(xfer->blocks_left);
               } else {
-                  printf("Oops! Negative-going blocks_left count at block: type=%c this=%u final=%u left=%u\n", this_type, this_block, xfer->block_count, xfer->blocks_left);
+                  printf("Oops! Negative-going blocks_left count at block: type=%c this=%u final=%llu left=%llu\n", this_type, this_block, (ull_t) xfer->block_count, (ull_t) xfer->blocks_left);
               }
           }
 
@@ -650,7 +650,7 @@ int command_get(command_t *command, ttp_session_t *session)
         if (xfer->stats.total_lost == 0) {
            printf("lossless\n");
         } else {
-           printf("lossless mode - but lost count=%u > 0, please file a bug report!!\n", xfer->stats.total_lost);
+           printf("lossless mode - but lost count=%llu > 0, please file a bug report!!\n", (ull_t) xfer->stats.total_lost);
         }
     } else { 
         if (session->parameter->losswindow_ms == 0) {
@@ -887,7 +887,7 @@ int command_set(command_t *command, ttp_parameter_t *parameter)
     if (do_all || !strcasecmp(command->text[1], "transcript")) printf("transcript = %s\n",  parameter->transcript_yn ? "yes" : "no");
     if (do_all || !strcasecmp(command->text[1], "ip"))         printf("ip = %s\n",          parameter->ipv6_yn       ? "v6"  : "v4");
     if (do_all || !strcasecmp(command->text[1], "output"))     printf("output = %s\n",      (parameter->output_mode == SCREEN_MODE) ? "screen" : "line");
-    if (do_all || !strcasecmp(command->text[1], "rate"))       printf("rate = %u\n",        parameter->target_rate);
+    if (do_all || !strcasecmp(command->text[1], "rate"))       printf("rate = %llu\n",      (ull_t)parameter->target_rate);
     if (do_all || !strcasecmp(command->text[1], "error"))      printf("error = %0.2f%%\n",  parameter->error_rate / 1000.0);
     if (do_all || !strcasecmp(command->text[1], "slowdown"))   printf("slowdown = %d/%d\n", parameter->slower_num, parameter->slower_den);
     if (do_all || !strcasecmp(command->text[1], "speedup"))    printf("speedup = %d/%d\n",  parameter->faster_num, parameter->faster_den);
@@ -972,11 +972,11 @@ int parse_fraction(const char *fraction, u_int16_t *num, u_int16_t *den)
 
 
 /*------------------------------------------------------------------------
- * int got_block(ttp_session_t* session, u_int32_t blocknr)
+ * int got_block(ttp_session_t* session, u_int64_t blocknr)
  *
  * Returns non-0 if the block has already been received
  *------------------------------------------------------------------------*/
-inline int got_block(ttp_session_t* session, u_int32_t blocknr)
+inline int got_block(ttp_session_t* session, u_int64_t blocknr)
 {
     return (session->transfer.received[blocknr / 8] & (1 << (blocknr % 8)));
 }
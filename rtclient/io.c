@@ -64,12 +64,12 @@
 
 /*------------------------------------------------------------------------
  * int accept_block(ttp_session_t *session,
- *                  u_int32_t block_index, u_char *block);
+ *                  u_int64_t block_index, u_char *block);
  *
  * Accepts the given block of data, which involves writing the block
  * to disk.  Returns 0 on success and nonzero on failure.
  *------------------------------------------------------------------------*/
-int accept_block(ttp_session_t *session, u_int32_t block_index, u_char *block)
+int accept_block(ttp_session_t *session, u_int64_t block_index, u_char *block)
 {
     ttp_transfer_t  *transfer   = &session->transfer;
     u_int32_t        block_size = session->parameter->block_size;
@@ -103,14 +103,14 @@ int accept_block(ttp_session_t *session, u_int32_t block_index, u_char *block)
     /* seek to the proper location */
     status = fseeko(transfer->file, ((u_int64_t) block_size) * (block_index - 1), SEEK_SET);
     if (status < 0) {
-        sprintf(g_error, "Could not seek at block %d of file", block_index);
+        sprintf(g_error, "Could not seek at block %llu of file", (ull_t) block_index);
         return warn(g_error);
     }
 
     /* write the block to disk */
     status = fwrite(block, 1, write_size, transfer->file);
     if (status < write_size) {
-        sprintf(g_error, "Could not write block %d of file", block_index);
+        sprintf(g_error, "Could not write block %llu of file", (ull_t) block_index);
         return warn(g_error);
     }
     #endif
@@ -170,6 +170,7 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
     u_char           result;    /* the result byte from the server     */
     u_int32_t        temp;      /* used for transmitting 32-bit values */
     u_int16_t        temp16;    /* used for transmitting 16-bit values */
+    u_char           option[10];/* used for transmitting options       */
     int              status;
     ttp_transfer_t  *xfer  = &session->transfer;
     ttp_parameter_t *param =  session->parameter;
@@ -190,7 +191,7 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
 
     /* Submit the block size, target bitrate, and maximum error rate */
     temp = htonl(param->block_size);   if (fwrite(&temp, 4, 1, session->server) < 1) return warn("Could not submit block size");
-    temp = htonl(param->target_rate);  if (fwrite(&temp, 4, 1, session->server) < 1) return warn("Could not submit target rate");
+    temp = htonl(min(param->target_rate, 0xffffffffULL));  if (fwrite(&temp, 4, 1, session->server) < 1) return warn("Could not submit target rate");
     temp = htonl(param->error_rate);   if (fwrite(&temp, 4, 1, session->server) < 1) return warn("Could not submit error rate");
     if (fflush(session->server))
 	return warn("Could not flush control channel");
@@ -200,6 +201,9 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
     temp16 = htons(param->slower_den);  if (fwrite(&temp16, 2, 1, session->server) < 1) return warn("Could not submit slowdown denominator");
     temp16 = htons(param->faster_num);  if (fwrite(&temp16, 2, 1, session->server) < 1) return warn("Could not submit speedup numerator");
     temp16 = htons(param->faster_den);  if (fwrite(&temp16, 2, 1, session->server) < 1) return warn("Could not submit speedup denominator");
+
+    /* submit an empty transfer option list */
+    memset(option, 0, sizeof(option));  if (fwrite(option, 10, 1, session->server) < 1) return warn("Could not submit end of options");
     if (fflush(session->server))
 	return warn("Could not flush control channel");
 
@@ -211,9 +215,15 @@ int ttp_open_transfer(ttp_session_t *session, const char *remote_filename, const
     /* read in the file length, block size, block count, and run epoch */
     if (fread(&xfer->file_size,   8, 1, session->server) < 1) return warn("Could not read file size");         xfer->file_size   = ntohll(xfer->file_size);
     if (fread(&temp,              4, 1, session->server) < 1) return warn("Could not read block size");        if (htonl(temp) != param->block_size) return warn("Block size disagreement");
-    if (fread(&xfer->block_count, 4, 1, session->server) < 1) return warn("Could not read number of blocks");  xfer->block_count = ntohl (xfer->block_count);
+    if (fread(&temp,              4, 1, session->server) < 1) return warn("Could not read number of blocks");  xfer->block_count = ntohl (temp);
     if (fread(&xfer->epoch,       4, 1, session->server) < 1) return warn("Could not read run epoch");         xfer->epoch       = ntohl (xfer->epoch);
 
+    /* skip the transfer options the server replies with */
+    do {
+        if (fread(option, 10, 1, session->server) < 1) return warn("Could not read transfer options");
+        memcpy(&temp16, option, 2);
+    } while (ntohs(temp16) != TS_OPT_END);
+
     /* we start out with every block yet to transfer */
     xfer->blocks_left = xfer->block_count;
 
@@ -413,19 +423,19 @@ int ttp_repeat_retransmit(ttp_session_t *session)
 
 
 /*------------------------------------------------------------------------
- * int ttp_request_retransmit(ttp_session_t *session, u_int32_t block);
+ * int ttp_request_retransmit(ttp_session_t *session, u_int64_t block);
  *
  * Requests a retransmission of the given block in the current transfer.
  * Returns 0 on success and non-zero otherwise.
  *------------------------------------------------------------------------*/
-int ttp_request_retransmit(ttp_session_t *session, u_int32_t block)
+int ttp_request_retransmit(ttp_session_t *session, u_int64_t block)
 {
    #ifdef RETX_REQBLOCK_SORTING
-   u_int32_t     tmp32_ins = 0, tmp32_up;
+   u_int64_t     tmp64_ins = 0, tmp64_up;
    u_int32_t     idx = 0;
    #endif
 
-   u_int32_t    *ptr;
+   u_int64_t    *ptr;
    retransmit_t *rexmit = &(session->transfer.retransmit);
 
    /* double checking: if we already got the block, don't add it */
@@ -441,13 +451,13 @@ int ttp_request_retransmit(ttp_session_t *session, u_int32_t block)
          return 0;
 
       /* try to reallocate the table twice the size*/
-      ptr = (u_int32_t *) realloc(rexmit->table, 2 * sizeof(u_int32_t)*rexmit->table_size);
+      ptr = (u_int64_t *) realloc(rexmit->table, 2 * sizeof(u_int64_t)*rexmit->table_size);
       if (ptr == NULL)
          return warn("Could not grow retransmission table");
 
       /* prepare the new table space */
       rexmit->table = ptr;
-      memset(rexmit->table + rexmit->table_size, 0, sizeof(u_int32_t) * rexmit->table_size);
+      memset(rexmit->table + rexmit->table_size, 0, sizeof(u_int64_t) * rexmit->table_size);
       rexmit->table_size *= 2;
 
       #if DEBUG_RETX
@@ -484,11 +494,11 @@ int ttp_request_retransmit(ttp_session_t *session, u_int32_t block)
       // fprintf(stderr, "duplicate retransmit req for block %d discarded\n", block);
    } else { 
       /* insert and shift remaining table upwards - linked list could be nice... */
-      tmp32_ins = block;
+      tmp64_ins = block;
       do {
-         tmp32_up = rexmit->table[idx];
-         rexmit->table[idx++] = tmp32_ins;
-         tmp32_ins = tmp32_up;
+         tmp64_up = rexmit->table[idx];
+         rexmit->table[idx++] = tmp64_ins;
+         tmp64_ins = tmp64_up;
       } while(idx <= rexmit->index_max);
       rexmit->index_max++;
    }
@@ -619,22 +629,22 @@ int ttp_update_stats(ttp_session_t *session)
 
     /* build the stats string */    
     #ifdef STATS_MATLABFORMAT
-    sprintf(stats_line, "%02d\t%02d\t%02d\t%03d\t%4u\t%6.2f\t%6.1f\t%5.1f\t%7u\t%6.1f\t%6.1f\t%5.1f\t%5d\t%5d\t%7u\t%8u\t%8Lu\n",
+    sprintf(stats_line, "%02d\t%02d\t%02d\t%03d\t%4u\t%6.2f\t%6.1f\t%5.1f\t%7Lu\t%6.1f\t%6.1f\t%5.1f\t%5d\t%5d\t%7Lu\t%8u\t%8Lu\n",
     #else
-    sprintf(stats_line, "%02d:%02d:%02d.%03d %4u %6.2fM %6.1fMbps %5.1f%% %7u %6.1fG %6.1fMbps %5.1f%% %5d %5d %7u %8u %8Lu\n",
+    sprintf(stats_line, "%02d:%02d:%02d.%03d %4u %6.2fM %6.1fMbps %5.1f%% %7Lu %6.1fG %6.1fMbps %5.1f%% %5d %5d %7Lu %8u %8Lu\n",
     #endif
         hours, minutes, seconds, milliseconds,
-        stats->total_blocks - stats->this_blocks,
+        (u_int32_t) (stats->total_blocks - stats->this_blocks),
         stats->this_retransmit_rate,
         stats->this_transmit_rate,
         100.0 * retransmits_fraction,
-        session->transfer.stats.total_blocks,
+        (ull_t)session->transfer.stats.total_blocks,
         data_total / u_giga,
         data_total_rate,
         100.0 * total_retransmits_fraction,
         session->transfer.retransmit.index_max,
         session->transfer.ring_buffer->count_data,
-        session->transfer.blocks_left, 
+        (ull_t)session->transfer.blocks_left,
         stats->this_retransmits,
         (ull_t)(stats->this_udp_errors - stats->start_udp_errors)
         );
@@ -648,15 +658,15 @@ int ttp_update_stats(ttp_session_t *session)
             printf("Current time:   %s\n", ctime(&now_epoch));
             printf("Elapsed time:   %02d:%02d:%02d.%03d\n\n", hours, minutes, seconds, milliseconds);
             printf("Last interval\n--------------------------------------------------\n");
-            printf("Blocks count:     %u\n",             stats->total_blocks - stats->this_blocks);
+            printf("Blocks count:     %u\n",             (u_int32_t) (stats->total_blocks - stats->this_blocks));
             printf("Data transferred: %0.2f GB\n",       data_this  / u_giga);
             printf("Transfer rate:    %0.2f Mbps\n",     stats->this_transmit_rate);
             printf("Retransmissions:  %u (%0.2f%%)\n\n", stats->this_retransmits, 100.0*retransmits_fraction);
             printf("Cumulative\n--------------------------------------------------\n");
-            printf("Blocks count:     %u\n",             session->transfer.stats.total_blocks);
+            printf("Blocks count:     %llu\n",           (ull_t) session->transfer.stats.total_blocks);
             printf("Data transferred: %0.2f GB\n",       data_total / u_giga);
             printf("Transfer rate:    %0.2f Mbps\n",     data_total_rate);
-            printf("Retransmissions:  %u (%0.2f%%)\n\n", stats->total_retransmits, 100.0*total_retransmits_fraction);
+            printf("Retransmissions:  %llu (%0.2f%%)\n\n", (ull_t) stats->total_retransmits, 100.0*total_retransmits_fraction);
             printf("OS UDP rx errors: %Lu\n",            (ull_t)(stats->this_udp_errors - stats->start_udp_errors));
 
         /* line mode */
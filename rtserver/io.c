@@ -64,7 +64,7 @@
 //#define MODE_34TH 1
 
 /*------------------------------------------------------------------------
- * int build_datagram(ttp_session_t *session, u_int32_t block_index,
+ * int build_datagram(ttp_session_t *session, u_int64_t block_index,
  *                    u_int16_t block_type, u_char *datagram);
  *
  * Constructs to hold the given block of data, with the given type
@@ -83,11 +83,11 @@
  * six bytes longer than the block size for the transfer.  Returns 0 on
  * success and non-zero on failure.
  *------------------------------------------------------------------------*/
-int build_datagram(ttp_session_t *session, u_int32_t block_index,
+int build_datagram(ttp_session_t *session, u_int64_t block_index,
 		   u_int16_t block_type, u_char *datagram)
 {
     u_int32_t        block_size = session->parameter->block_size;
-    static u_int32_t last_block = 0;
+    static u_int64_t last_block = 0;
     static u_int32_t last_written_vsib_block = 0;
     int              status = 0;
     u_int32_t        write_size;
@@ -177,7 +177,7 @@ int build_datagram(ttp_session_t *session, u_int32_t block_index,
               write_size, session->transfer.file);
 
         if (status < write_size) {
-           sprintf(g_error, "Could not write block %d of file", block_index);
+           sprintf(g_error, "Could not write block %llu of file", (ull_t) block_index);
            return warn(g_error);
        }   
     }
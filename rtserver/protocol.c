@@ -127,8 +127,8 @@ int ttp_accept_retransmit(ttp_session_t *session, retransmission_t *retransmissi
     xfer->ipd_current = max(min(xfer->ipd_current, 10000.0), param->ipd_time);
 
     /* build the stats string */
-    sprintf(stats_line, "%6u %3.2fus %5uus %7u %6.2f %3u\n",
-        retransmission->error_rate, (float)xfer->ipd_current, param->ipd_time, xfer->block,
+    sprintf(stats_line, "%6u %3.2fus %5.1fus %7llu %6.2f %3u\n",
+        retransmission->error_rate, (float)xfer->ipd_current, param->ipd_time, (ull_t) xfer->block,
         100.0 * xfer->block / param->block_count, session->session_id);
 
 	/* print a status report */
@@ -335,6 +335,7 @@ int ttp_open_transfer(ttp_session_t *session)
     u_int64_t        file_size;                      /* network-order version of file size   */
     u_int32_t        block_size;                     /* network-order version of block size  */
     u_int32_t        block_count;                    /* network-order version of block count */
+    u_int32_t        target_rate;                    /* network-order version of target rate */
     time_t           epoch;
     int              status;
     ttp_transfer_t  *xfer  = &session->transfer;
@@ -352,6 +353,8 @@ int ttp_open_transfer(ttp_session_t *session)
     char       message[20];
     u_int16_t  i;
     struct     timeval ping_s, ping_e;
+    u_char     option[10];
+    u_int16_t  option_key;
 
     /* clear out the transfer data */
     memset(xfer, 0, sizeof(*xfer));
@@ -531,7 +534,7 @@ int ttp_open_transfer(ttp_session_t *session)
 
     /* read in the block size, target bitrate, and error rate */
     if (full_read(session->client_fd, &param->block_size,  4) < 0) return warn("Could not read block size");            param->block_size  = ntohl(param->block_size);
-    if (full_read(session->client_fd, &param->target_rate, 4) < 0) return warn("Could not read target bitrate");        param->target_rate = ntohl(param->target_rate);
+    if (full_read(session->client_fd, &target_rate,        4) < 0) return warn("Could not read target bitrate");        param->target_rate = ntohl(target_rate);
     if (full_read(session->client_fd, &param->error_rate,  4) < 0) return warn("Could not read error rate");            param->error_rate  = ntohl(param->error_rate);
 
     /* end round trip time estimation */
@@ -543,6 +546,12 @@ int ttp_open_transfer(ttp_session_t *session)
     if (full_read(session->client_fd, &param->faster_num,  2) < 0) return warn("Could not read speedup numerator");     param->faster_num  = ntohs(param->faster_num);
     if (full_read(session->client_fd, &param->faster_den,  2) < 0) return warn("Could not read speedup denominator");   param->faster_den  = ntohs(param->faster_den);
 
+    /* skip the transfer options up to TS_OPT_END, the realtime server supports none of them */
+    do {
+        if (full_read(session->client_fd, option, 10) < 0) return warn("Could not read transfer options");
+        memcpy(&option_key, option, 2);
+    } while (ntohs(option_key) != TS_OPT_END);
+
     #ifndef VSIB_REALTIME
     /* try to find the file statistics */
     fseeko(xfer->file, 0, SEEK_END);
@@ -581,13 +590,16 @@ int ttp_open_transfer(ttp_session_t *session)
     block_count = htonl (param->block_count);  if (full_write(session->client_fd, &block_count, 4) < 0) return warn("Could not submit block count");
     epoch       = htonl (param->epoch);        if (full_write(session->client_fd, &epoch,       4) < 0) return warn("Could not submit run epoch");
 
+    /* reply with an empty option list */
+    memset(option, 0, sizeof(option));            if (full_write(session->client_fd, option,      10) < 0) return warn("Could not submit end of options");
+
     /*calculate and convert RTT to u_sec*/
     session->parameter->wait_u_sec=(ping_e.tv_sec - ping_s.tv_sec)*1000000+(ping_e.tv_usec-ping_s.tv_usec);
     /*add a 10% safety margin*/
     session->parameter->wait_u_sec = session->parameter->wait_u_sec + ((int)(session->parameter->wait_u_sec* 0.1));  
 
     /* and store the inter-packet delay */
-    param->ipd_time   = (u_int32_t) ((1000000LL * 8 * param->block_size) / param->target_rate);
+    param->ipd_time   = (1000000.0 * 8 * param->block_size) / param->target_rate;
     xfer->ipd_current = param->ipd_time * 3;
 
     /* if we're doing a transcript */
@@ -0,0 +1,184 @@
+/*========================================================================
+ * bundle.c  --  Packing of many small files into one transfer for the
+ *               Tsunami server.
+ *
+ * A client asking for TS_BUNDLE_HACK_CMD instead of a file gets the
+ * files it names in one block stream, back to back and without any
+ * padding, so that a directory of small files takes a single request
+ * and leaves no block mostly empty.  We accept the request with a 0
+ * byte, and the client sends the number of files, the length of their
+ * names together and the names, each of them ending in a NUL:
+ *
+ *     count \n  length \n  name1 \0  ...  nameN \0
+ *
+ * We reply with the table of the files we could open, in the order in
+ * which they go into the stream, in the format of the file list:
+ *
+ *     count \0  name1 \0 size1 \0  ...  nameN \0 sizeN \0
+ *
+ * and go on with the usual result byte of the request and the rest of
+ * the negotiation, for a file as long as the files together.  Files we
+ * can't read are left out of the table, and a bundle with nothing in
+ * it is refused.  A bundle is never sent to a multicast group.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <fcntl.h>       /* for open()                     */
+#include <stdlib.h>      /* for *alloc() and free()        */
+#include <string.h>      /* for strlen(), strdup()         */
+#include <sys/stat.h>    /* for fstat()                    */
+#include <unistd.h>      /* for pread(), close()           */
+
+#include <tsunami-server.h>
+
+
+/*------------------------------------------------------------------------
+ * void bundle_close(ttp_session_t *session);
+ *
+ * Closes the files of the bundle of the transfer, if it has one.
+ *------------------------------------------------------------------------*/
+void bundle_close(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    u_int32_t       i;
+
+    if (xfer->bundle == NULL)
+	return;
+
+    for (i = 0; i < xfer->bundle_count; ++i) {
+	close(xfer->bundle[i].fd);
+	free(xfer->bundle[i].name);
+    }
+    free(xfer->bundle);
+    xfer->bundle       = NULL;
+    xfer->bundle_count = 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int bundle_open(ttp_session_t *session);
+ *
+ * Accepts a request for a bundle, reads its manifest from the client,
+ * opens the files of it that we can read and sends the table of them.
+ * Returns 0 on success and non-zero if there is nothing to send, in
+ * which case the transfer has no bundle.
+ *------------------------------------------------------------------------*/
+int bundle_open(ttp_session_t *session)
+{
+    ttp_transfer_t    *xfer = &session->transfer;
+    ttp_bundle_file_t *file;
+    struct stat        filestat;
+    char               line[32];
+    char              *names, *name, *table;
+    u_int32_t          count, length, i;
+    size_t             table_length = 0;
+    u_int64_t          offset       = 0;
+
+    /* take the request and read the manifest */
+    if (full_write(session->client_fd, "\000", 1) < 0)
+	return warn("Could not accept bundle request");
+    if ((read_line(session->client_fd, line, sizeof(line)) < 0) || (sscanf(line, "%u", &count) < 1) ||
+	(read_line(session->client_fd, line, sizeof(line)) < 0) || (sscanf(line, "%u", &length) < 1))
+	return warn("Could not read bundle manifest");
+    if ((count == 0) || (count > MAX_BUNDLE_FILES) || (length > count * MAX_FILENAME_LENGTH))
+	return warn("Bundle manifest out of range");
+    names = (char *) malloc(length + 1);
+    xfer->bundle = (ttp_bundle_file_t *) calloc(count, sizeof(ttp_bundle_file_t));
+    if ((names == NULL) || (xfer->bundle == NULL))
+	error("Could not allocate bundle");
+    if (full_read(session->client_fd, names, length) < 0) {
+	free(names);
+	bundle_close(session);
+	return warn("Could not read bundle manifest");
+    }
+    names[length] = '\0';
+
+    /* open what we can, in the order of the manifest */
+    for (i = 0, name = names; (i < count) && (name < names + length); ++i, name += strlen(name) + 1) {
+	file     = &xfer->bundle[xfer->bundle_count];
+	file->fd = open(name, O_RDONLY);
+	if (file->fd < 0)
+	    continue;
+	if ((fstat(file->fd, &filestat) < 0) || !S_ISREG(filestat.st_mode)) {
+	    close(file->fd);
+	    continue;
+	}
+	file->name    = strdup(name);
+	file->offset  = offset;
+	file->size    = filestat.st_size;
+	offset       += file->size;
+	table_length += strlen(name) + 22;
+	++xfer->bundle_count;
+    }
+    free(names);
+
+    /* and tell the client what they are, all in one go */
+    table = (char *) malloc(table_length + 12);
+    if (table == NULL)
+	error("Could not allocate bundle table");
+    table_length = sprintf(table, "%u", xfer->bundle_count) + 1;
+    for (i = 0; i < xfer->bundle_count; ++i) {
+	table_length += sprintf(table + table_length, "%s", xfer->bundle[i].name) + 1;
+	table_length += sprintf(table + table_length, "%llu", (ull_t) xfer->bundle[i].size) + 1;
+    }
+    if (full_write(session->client_fd, table, table_length) < 0) {
+	free(table);
+	bundle_close(session);
+	return warn("Could not send bundle table");
+    }
+    free(table);
+
+    /* a bundle with no data would have no blocks */
+    if (offset == 0) {
+	bundle_close(session);
+	return warn("Nothing to send in the bundle");
+    }
+
+    if (session->parameter->verbose_yn)
+	printf("Bundle of %u files, %llu bytes\n", xfer->bundle_count, (ull_t) offset);
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int bundle_read(ttp_session_t *session, u_int64_t block_index,
+ *                 u_char *block);
+ *
+ * Reads the given block of the bundle into the given buffer, from the
+ * files that it overlaps.  Several stream threads may read at once.
+ * Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int bundle_read(ttp_session_t *session, u_int64_t block_index, u_char *block)
+{
+    ttp_transfer_t    *xfer  = &session->transfer;
+    u_int64_t          start = ((u_int64_t) session->parameter->block_size) * (block_index - 1);
+    u_int64_t          end   = start + session->parameter->block_size;
+    u_int64_t          from, to;
+    u_int32_t          low   = 0;
+    u_int32_t          high  = xfer->bundle_count;
+    u_int32_t          middle;
+    ttp_bundle_file_t *file;
+
+    /* find the last file that starts before the block */
+    while (low + 1 < high) {
+	middle = (low + high) / 2;
+	if (xfer->bundle[middle].offset <= start)
+	    low = middle;
+	else
+	    high = middle;
+    }
+
+    /* and read from it and those after it until the block is full */
+    for (file = &xfer->bundle[low]; (file < xfer->bundle + xfer->bundle_count) && (file->offset < end); ++file) {
+	from = max(start, file->offset);
+	to   = min(end,   file->offset + file->size);
+	if (to <= from)
+	    continue;
+	if (pread(file->fd, block + (from - start), to - from, from - file->offset) < 0)
+	    return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,484 @@
+/*========================================================================
+ * cc.c  --  Congestion control for Tsunami server.
+ *
+ * The client feedback (error rate, delivery rate, the most recently
+ * received block and, with sender timestamps, the queueing delay and
+ * its trend) is turned into a pacing decision here.  Controllers
+ * are selected per transfer by the client, see TS_OPT_CONGESTION.
+ *
+ * With sender timestamps the client also echoes the timestamp of the
+ * last block it received, moved on by the time it held it, so that
+ * every report gives an RTT sample for the filters shared by all the
+ * controllers, however many blocks are in flight.
+ *
+ *   tsunami  -- the classic error rate driven inter-packet delay that
+ *               is slowed down and sped up by the client supplied
+ *               slowdown/speedup fractions
+ *
+ *   bbr      -- a model-based controller that tracks the bottleneck
+ *               bandwidth (windowed maximum of delivery rates) and the
+ *               minimum round-trip time, and paces at a gain-cycled
+ *               multiple of the bandwidth estimate instead of reacting
+ *               to every loss report
+ *
+ *   ledbat   -- a scavenger that keeps the queueing delay it causes
+ *               near a target (as in LEDBAT, RFC 6817) and so yields
+ *               to any other traffic that builds up a queue
+ *
+ * A controller returns the pacing rate in bps.  The rate is converted
+ * to the IPD and clamped to the target rate here, not in the
+ * controllers.  With backpressure (TS_OPT_BACKPRESSURE) it is also
+ * capped to what the client says it can take: the rate its disk thread
+ * writes at, plus its free ring space spread over CC_RING_HORIZON.  A
+ * full ring thus paces us a little below the disk rate until the ring
+ * drains, without the controllers mistaking a slow disk for network
+ * loss.
+ *
+ * With an egress budget (see egress.c), the rate is also capped to the
+ * transfer's share of the budget of the server as a whole.
+ *
+ * A client that runs several transfers at once may move the target rate
+ * of each of them during the transfer (TS_OPT_RATE_SHARE), to split
+ * its own target among them.
+ *
+ * If the client measured a startup probe, the transfer begins at a
+ * fraction of the probed bandwidth and doubles its rate every round
+ * trip until it reaches the estimate or a controller slows it down.
+ * Rate and RTT hints that the client remembers from earlier transfers
+ * to the same server let it start at the known rate instead.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <string.h>      /* for memset()                   */
+#include <sys/time.h>    /* for gettimeofday()             */
+
+#include <tsunami-server.h>
+
+
+/*------------------------------------------------------------------------
+ * Controller definitions.
+ *------------------------------------------------------------------------*/
+
+/* congestion controller operations */
+typedef struct {
+    void   (*init)    (ttp_cc_t *cc, const ttp_parameter_t *param);
+    double (*feedback)(ttp_cc_t *cc, const ttp_parameter_t *param, const ttp_feedback_t *feedback);
+} ttp_controller_t;
+
+#define BBR_STARTUP     0                 /* exponential search for the bottleneck  */
+#define BBR_DRAIN       1                 /* drain the queue built up in startup    */
+#define BBR_PROBE_BW    2                 /* gain-cycle around the bottleneck rate  */
+
+#define BBR_HIGH_GAIN   2.885             /* 2/ln(2), doubles delivery each round   */
+#define BBR_CWND_GAIN   2.0               /* the data in flight allowed, in BDPs    */
+#define BBR_CWND_RTT    1000.0            /* the least RTT of the BDP, usec, as the
+                                             RTT of a LAN is mostly host jitter     */
+
+#define LEDBAT_GAIN_UP   0.25             /* rate increase per round at zero delay  */
+#define LEDBAT_GAIN_DOWN 1.0              /* rate decrease per round per target     */
+
+static const double bbr_cycle_gain[8] = { 1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0 };
+
+void   cc_set_rate     (ttp_session_t *session, double rate);
+void   tsunami_init    (ttp_cc_t *cc, const ttp_parameter_t *param);
+double tsunami_feedback(ttp_cc_t *cc, const ttp_parameter_t *param, const ttp_feedback_t *feedback);
+void   bbr_init        (ttp_cc_t *cc, const ttp_parameter_t *param);
+double bbr_feedback    (ttp_cc_t *cc, const ttp_parameter_t *param, const ttp_feedback_t *feedback);
+void   ledbat_init     (ttp_cc_t *cc, const ttp_parameter_t *param);
+double ledbat_feedback (ttp_cc_t *cc, const ttp_parameter_t *param, const ttp_feedback_t *feedback);
+
+/* indexed by TS_CC_*, names are in CONGESTION_NAMES[] */
+static const ttp_controller_t controllers[TS_CC_COUNT] = {
+    { tsunami_init, tsunami_feedback },
+    { bbr_init,     bbr_feedback     },
+    { ledbat_init,  ledbat_feedback  }
+};
+
+
+/*------------------------------------------------------------------------
+ * void cc_init(ttp_session_t *session);
+ *
+ * Prepares the congestion controller state of the current transfer.
+ * The initial pacing rate is taken from the client's start rate hint
+ * if there is one and from the initial IPD otherwise, so this must be
+ * called after the IPD has been set up.
+ *------------------------------------------------------------------------*/
+void cc_init(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+
+    /* fall back to the classic controller on unknown requests */
+    if (param->congestion >= TS_CC_COUNT)
+        param->congestion = TS_CC_TSUNAMI;
+
+    /* start from a clean slate, within our share of the egress budget */
+    memset(&xfer->cc, 0, sizeof(xfer->cc));
+    xfer->cc.pacing_rate = (1000000.0 * 8 * param->block_size) / xfer->ipd_current;
+    xfer->cc.egress_rate = egress_join(session);
+    if (xfer->cc.egress_rate > 0.0)
+        cc_set_rate(session, xfer->cc.pacing_rate);
+    if (param->start_rate > 0)
+        cc_set_rate(session, param->start_rate);
+    if (param->rtt_hint > 0) {
+        gettimeofday(&xfer->cc.min_rtt_stamp, NULL);
+        xfer->cc.min_rtt = xfer->cc.srtt = param->rtt_hint;
+    }
+    controllers[param->congestion].init(&xfer->cc, param);
+
+    if (param->verbose_yn)
+        printf("Congestion control: %s\n", CONGESTION_NAMES[param->congestion]);
+}
+
+
+/*------------------------------------------------------------------------
+ * void cc_probe(ttp_session_t *session, u_int32_t received,
+ *               u_int32_t dispersion, double elapsed);
+ *
+ * Takes the result of the startup probe: the number of probe datagrams
+ * that the client received, the time (usec) between the first and the
+ * last of them at the client, and the time (usec) from sending the
+ * first one until the client's report came back.  Seeds the RTT filters
+ * and starts the exponential ramp towards the probed bandwidth, from
+ * the client's start rate hint if it has one.  A train that came in
+ * short gives no RTT, as the client waited out PROBE_TIMEOUT for the
+ * rest of it before it reported; the ramp then steps by the RTT we had
+ * already, from the client's hint or the ping of the control channel.
+ *------------------------------------------------------------------------*/
+void cc_probe(ttp_session_t *session, u_int32_t received, u_int32_t dispersion, double elapsed)
+{
+    ttp_parameter_t *param = session->parameter;
+    ttp_cc_t        *cc    = &session->transfer.cc;
+    struct timeval   now;
+
+    gettimeofday(&now, NULL);
+
+    /* the train spreads out to the bottleneck rate on its way */
+    cc->probe_received = received;
+    if ((received >= 2) && (dispersion > 0))
+        cc->probe_rate = (received - 1) * 8.0 * param->block_size * 1000000.0 / dispersion;
+    if ((received == param->probe_train) && (elapsed > dispersion))
+        cc->probe_rtt = elapsed - dispersion;
+
+    /* seed the round-trip time filters */
+    if (cc->probe_rtt > 0.0) {
+        cc->min_rtt       = cc->probe_rtt;
+        cc->min_rtt_stamp = now;
+        cc->srtt          = cc->probe_rtt;
+    }
+
+    /* without an estimate we stay at the conservative start */
+    if (cc->probe_rate == 0.0)
+        return;
+
+    /* ramp up from a fraction of the estimate */
+    cc->ramp_target   = min(cc->probe_rate, (double) param->target_rate);
+    cc->ramp_interval = (cc->probe_rtt > 0.0) ? cc->probe_rtt : max(cc->srtt, (double) param->wait_u_sec);
+    cc->ramp_interval = max(cc->ramp_interval, CC_RAMP_MIN);
+    cc->ramp_stamp    = now;
+    if (param->start_rate > 0)
+        cc_set_rate(session, min((double) param->start_rate, cc->ramp_target));
+    else
+        cc_set_rate(session, cc->ramp_target / CC_RAMP_START);
+}
+
+
+/*------------------------------------------------------------------------
+ * void cc_sent(ttp_session_t *session, u_int64_t block,
+ *              const struct timeval *when);
+ *
+ * Takes note that the given block went out at the given time, which
+ * moves the startup ramp along.
+ *------------------------------------------------------------------------*/
+void cc_sent(ttp_session_t *session, u_int64_t block, const struct timeval *when)
+{
+    ttp_cc_t *cc = &session->transfer.cc;
+
+    /* double the rate every round trip while ramping up */
+    if ((cc->ramp_target > 0.0) && (tv_diff_usec((*when), cc->ramp_stamp) >= cc->ramp_interval)) {
+        cc_set_rate(session, min(2.0 * cc->pacing_rate, cc->ramp_target));
+        cc->ramp_stamp = *when;
+        if (cc->pacing_rate >= 0.99 * cc->ramp_target)
+            cc->ramp_target = 0.0;
+    }
+}
+
+
+/*------------------------------------------------------------------------
+ * void cc_target(ttp_session_t *session, u_int64_t rate);
+ *
+ * Moves the target rate of the transfer to the given one (bps), as the
+ * client asked, and clamps the pacing rate and any startup ramp to it.
+ *------------------------------------------------------------------------*/
+void cc_target(ttp_session_t *session, u_int64_t rate)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+
+    param->target_rate = rate;
+    param->ipd_time    = (1000000.0 * 8 * param->block_size) / param->target_rate;
+    if (xfer->cc.ramp_target > rate)
+        xfer->cc.ramp_target = rate;
+    cc_set_rate(session, xfer->cc.pacing_rate);
+
+    if (param->verbose_yn)
+        printf("Target rate moved to %0.2f Mbps\n", rate / 1000000.0);
+}
+
+
+/*------------------------------------------------------------------------
+ * void cc_feedback(ttp_session_t *session,
+ *                  const retransmission_t *retransmission);
+ *
+ * Hands an error rate report (with fields already in host byte order)
+ * to the congestion controller of the transfer and updates the IPD
+ * from the pacing rate it decides on.  The echoed timestamp, if any,
+ * updates the RTT filters first.  A controller that slows down ends
+ * the startup ramp.
+ *------------------------------------------------------------------------*/
+void cc_feedback(ttp_session_t *session, const retransmission_t *retransmission)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    ttp_cc_t        *cc    = &xfer->cc;
+    ttp_feedback_t   feedback;
+    struct timeval   now;
+    int32_t          rtt;
+    double           rate;
+
+    /* assemble the feedback event */
+    feedback.error_rate    = retransmission->error_rate;
+    feedback.delivery_rate = 1000.0 * retransmission->delivery_rate;
+    feedback.rtt           = 0.0;
+    feedback.queue_delay   = 0.0;
+    feedback.delay_trend   = 0.0;
+    feedback.ce_fraction   = 0.0;
+    if (param->header_flags & TS_HDR_TIMESTAMP) {
+        feedback.queue_delay = retransmission->queue_delay;
+        feedback.delay_trend = retransmission->delay_trend;
+    }
+    if (param->ecn && (retransmission->received > 0))
+        feedback.ce_fraction = min(1.0, (double) retransmission->ce_marks / retransmission->received);
+
+    /* the echo of our own timestamp gives the round-trip time, modulo 2^32 usec */
+    if ((param->header_flags & TS_HDR_TIMESTAMP) && (retransmission->echo_time != 0)) {
+        gettimeofday(&now, NULL);
+        rtt = (int32_t) ((u_int32_t) (1000000LL * now.tv_sec + now.tv_usec) - retransmission->echo_time);
+        if (rtt > 0) {
+            feedback.rtt = rtt;
+            if ((cc->min_rtt == 0.0) || (feedback.rtt <= cc->min_rtt) || (tv_diff_usec(now, cc->min_rtt_stamp) > CC_RTT_WINDOW)) {
+                cc->min_rtt       = feedback.rtt;
+                cc->min_rtt_stamp = now;
+            }
+            cc->srtt = (cc->srtt == 0.0) ? feedback.rtt : (0.875 * cc->srtt + 0.125 * feedback.rtt);
+        }
+    }
+
+    /* find how much the receiver can take */
+    if (param->backpressure && (retransmission->disk_rate > 0))
+        cc->receiver_rate = CC_RING_DRAIN * 1000.0 * retransmission->disk_rate
+                          + (8.0 * param->block_size * retransmission->ring_free) * 1000000.0 / CC_RING_HORIZON;
+
+    /* let the controller decide on a rate */
+    rate = controllers[param->congestion].feedback(cc, param, &feedback);
+    if (rate <= 0.0)
+        rate = cc->pacing_rate;
+    if (rate < cc->pacing_rate)
+        cc->ramp_target = 0.0;
+
+    /* and keep it within our share of the egress budget */
+    if (xfer->egress)
+        cc->egress_rate = egress_update(session, rate);
+    cc_set_rate(session, rate);
+    cc->round++;
+}
+
+
+/*------------------------------------------------------------------------
+ * void cc_set_rate(ttp_session_t *session, double rate);
+ *
+ * Sets the IPD of the transfer from the given pacing rate (bps) and
+ * the pacing rate back from the IPD after range-checking it and
+ * capping it to the receiver's headroom and our egress ceiling.
+ *------------------------------------------------------------------------*/
+void cc_set_rate(ttp_session_t *session, double rate)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+
+    if (xfer->cc.receiver_rate > 0.0)
+        rate = min(rate, xfer->cc.receiver_rate);
+    if (xfer->cc.egress_rate > 0.0)
+        rate = min(rate, xfer->cc.egress_rate);
+
+    /* make sure the IPD is still in range, for later calculations */
+    xfer->ipd_current     = (1000000.0 * 8 * param->block_size) / rate;
+    xfer->ipd_current     = max(min(xfer->ipd_current, 10000.0), param->ipd_time);
+    xfer->cc.pacing_rate  = (1000000.0 * 8 * param->block_size) / xfer->ipd_current;
+}
+
+
+/*------------------------------------------------------------------------
+ * The classic Tsunami controller.
+ *
+ * The IPD is increased in proportion to how far the error rate exceeds
+ * the threshold, and decreased by the speedup fraction otherwise.  If
+ * the client reports delay, a queue above CC_QUEUE_DELAY that is still
+ * growing slows us down by the full slowdown fraction even before the
+ * first losses show up, and so does any CE mark from an ECN capable
+ * network.
+ *------------------------------------------------------------------------*/
+void tsunami_init(ttp_cc_t *cc, const ttp_parameter_t *param)
+{
+}
+
+double tsunami_feedback(ttp_cc_t *cc, const ttp_parameter_t *param, const ttp_feedback_t *feedback)
+{
+    double ipd = (1000000.0 * 8 * param->block_size) / cc->pacing_rate;
+
+    /* calculate a new IPD */
+    if (feedback->error_rate > param->error_rate) {
+        double factor1 = (1.0 * param->slower_num / param->slower_den) - 1.0;
+        double factor2 = (1.0 + feedback->error_rate - param->error_rate) / (100000.0 - param->error_rate);
+        ipd *= 1.0 + (factor1 * factor2);
+    } else if ((feedback->ce_fraction > 0.0) || ((feedback->queue_delay > CC_QUEUE_DELAY) && (feedback->delay_trend > 0))) {
+        ipd *= (double) param->slower_num / param->slower_den;
+    } else {
+        ipd *= (double) param->faster_num / param->faster_den;
+    }
+
+    return (1000000.0 * 8 * param->block_size) / ipd;
+}
+
+
+/*------------------------------------------------------------------------
+ * The model-based controller.
+ *
+ * Each feedback round adds the client delivery rate to a windowed max
+ * filter (the bottleneck bandwidth), next to the minimum RTT that
+ * cc_feedback() keeps.  Startup paces at a high gain until the bandwidth stops
+ * growing by 25% for three rounds or the error threshold is crossed,
+ * drain then empties the queue for one round, after which the rate
+ * cycles around the bandwidth estimate to probe for more capacity.
+ * Losses above the threshold, CE marks or a growing queue above
+ * CC_QUEUE_DELAY suppress the upward probes and end startup; with CE
+ * marks the rate also drops below the estimate by half the marked
+ * fraction, as in DCTCP.  A missing heartbeat (reported as 100% loss)
+ * halves the rate.  The data in flight at the pacing rate over the
+ * smoothed RTT is kept within BBR_CWND_GAIN times the bandwidth-delay
+ * product of the minimum RTT, so a queue that builds up slows us down.
+ * With a start rate from the client's path profile, startup is skipped
+ * and the rate is taken as the first bandwidth sample.
+ *------------------------------------------------------------------------*/
+void bbr_init(ttp_cc_t *cc, const ttp_parameter_t *param)
+{
+    cc->mode = BBR_STARTUP;
+    if (param->start_rate > 0) {
+        cc->bw_sample[0] = cc->btl_bw = cc->full_bw = param->start_rate;
+        cc->mode = BBR_PROBE_BW;
+    }
+}
+
+double bbr_feedback(ttp_cc_t *cc, const ttp_parameter_t *param, const ttp_feedback_t *feedback)
+{
+    double         gain = 1.0;
+    double         rate;
+    int            congested;
+    int            i;
+
+    /* no word from the client at all */
+    if (feedback->error_rate >= 100000)
+        return 0.5 * cc->pacing_rate;
+
+    /* update the bottleneck bandwidth filter */
+    if (feedback->delivery_rate > 0.0) {
+        cc->bw_sample[cc->round % CC_BW_WINDOW] = feedback->delivery_rate;
+        cc->btl_bw = 0.0;
+        for (i = 0; i < CC_BW_WINDOW; ++i)
+            cc->btl_bw = max(cc->btl_bw, cc->bw_sample[i]);
+    }
+
+    /* losses or a growing standing queue */
+    congested = (feedback->error_rate > param->error_rate) || (feedback->ce_fraction > 0.0) ||
+                ((feedback->queue_delay > CC_QUEUE_DELAY) && (feedback->delay_trend > 0));
+
+    /* nothing to base a decision on yet */
+    if (cc->btl_bw == 0.0)
+        return cc->pacing_rate;
+
+    /* run the state machine */
+    switch (cc->mode) {
+
+        case BBR_STARTUP:
+            gain = BBR_HIGH_GAIN;
+            if (cc->btl_bw >= 1.25 * cc->full_bw) {
+                cc->full_bw       = cc->btl_bw;
+                cc->full_bw_count = 0;
+            } else {
+                cc->full_bw_count++;
+            }
+            if ((cc->full_bw_count >= 3) || congested) {
+                cc->mode = BBR_DRAIN;
+                gain     = 1.0 / BBR_HIGH_GAIN;
+            }
+            break;
+
+        case BBR_DRAIN:
+            cc->mode  = BBR_PROBE_BW;
+            cc->cycle = 0;
+            /* fall through */
+
+        case BBR_PROBE_BW:
+            gain = bbr_cycle_gain[cc->cycle++ % 8];
+            if (congested)
+                gain = min(gain, 1.0 - 0.5 * feedback->ce_fraction);
+            break;
+    }
+
+    /* and no more in flight than the bandwidth-delay product allows */
+    rate = gain * cc->btl_bw;
+    if ((cc->min_rtt > 0.0) && (cc->srtt > 0.0))
+        rate = min(rate, BBR_CWND_GAIN * cc->btl_bw * max(cc->min_rtt, BBR_CWND_RTT) / cc->srtt);
+    return rate;
+}
+
+
+/*------------------------------------------------------------------------
+ * The scavenger controller.
+ *
+ * The rate moves in proportion to how far the queueing delay is off
+ * the target: up by at most LEDBAT_GAIN_UP per round when there is no
+ * queue at all, down in proportion to the excess delay when above the
+ * target, but never by more than half per round.  Losses above the
+ * threshold and CE marks halve the rate as well.  The rate is kept within twice the
+ * delivery rate so that it can't run away while the client is the
+ * bottleneck.
+ *------------------------------------------------------------------------*/
+void ledbat_init(ttp_cc_t *cc, const ttp_parameter_t *param)
+{
+}
+
+double ledbat_feedback(ttp_cc_t *cc, const ttp_parameter_t *param, const ttp_feedback_t *feedback)
+{
+    double off_target;
+    double rate;
+
+    /* losses, CE marks or no word from the client at all */
+    if ((feedback->error_rate > param->error_rate) || (feedback->ce_fraction > 0.0))
+        return 0.5 * cc->pacing_rate;
+
+    /* steer the queueing delay towards the target */
+    off_target = (param->delay_target - feedback->queue_delay) / param->delay_target;
+    if (off_target >= 0.0)
+        rate = cc->pacing_rate * (1.0 + LEDBAT_GAIN_UP * off_target);
+    else
+        rate = cc->pacing_rate * max(0.5, 1.0 + LEDBAT_GAIN_DOWN * off_target);
+
+    /* don't run ahead of what actually arrives */
+    if (feedback->delivery_rate > 0.0)
+        rate = min(rate, 2.0 * feedback->delivery_rate);
+
+    return rate;
+}
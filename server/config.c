@@ -77,6 +77,10 @@ const u_char     DEFAULT_VERBOSE_YN    = 1;         /* the default verbosity set
 const u_char     DEFAULT_TRANSCRIPT_YN = 0;         /* the default transcript setting          */
 const u_char     DEFAULT_IPV6_YN       = 0;         /* the default IPv6 setting                */
 const u_int16_t  DEFAULT_HEARTBEAT_TIMEOUT = 15;    /* the timeout to disconnect after no client feedback */
+const u_int16_t  DEFAULT_MCAST_PORT    = 46300;     /* the UDP port of a multicast group       */
+const u_int32_t  DEFAULT_MCAST_WAIT    = 2000;      /* the time to gather receivers (msec)     */
+const u_int32_t  DEFAULT_MCAST_EVICT   = 20000;     /* the error rate to evict at (% x 1000)   */
+const char      *DEFAULT_RELAY_CLIENT  = "tsunami"; /* the client to fetch relayed files with  */
 
 /*------------------------------------------------------------------------
  * void reset_server(ttp_parameter_t *parameter);
@@ -97,6 +101,12 @@ void reset_server(ttp_parameter_t *parameter)
     parameter->verbose_yn    = DEFAULT_VERBOSE_YN;
     parameter->transcript_yn = DEFAULT_TRANSCRIPT_YN;
     parameter->ipv6_yn       = DEFAULT_IPV6_YN;
+    parameter->mcast_port    = DEFAULT_MCAST_PORT;
+    parameter->mcast_wait    = DEFAULT_MCAST_WAIT;
+    parameter->mcast_evict   = DEFAULT_MCAST_EVICT;
+    parameter->relay_host    = NULL;
+    parameter->relay_port    = DEFAULT_TCP_PORT;
+    parameter->relay_client  = DEFAULT_RELAY_CLIENT;
 }
 
 
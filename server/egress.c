@@ -0,0 +1,310 @@
+/*========================================================================
+ * egress.c  --  Sharing of the server's send budget between its
+ *               sessions for Tsunami server.
+ *
+ * Every client has a session process of its own, which paces to the
+ * target rate its client asked for.  With --egress, the sessions keep
+ * to a budget for the server as a whole instead: they meet in a table
+ * in memory shared since before the fork (as in multicast.c), where
+ * every transfer enters the rate its congestion controller would send
+ * at, and gets back a ceiling that its pacing is capped to.
+ *
+ * The budget is split as in weighted max-min fair sharing.  A transfer
+ * that wants less than its weighted share is given a little more than
+ * it wants (EGRESS_HEADROOM), so that it can still speed up, and the
+ * rest goes to the others in proportion to their weights.  Weights and
+ * caps belong to clients (--share, --clientcap): several transfers of
+ * one client split its weight and cap between them.  With caps only
+ * and no budget, a transfer's ceiling is its part of the cap.
+ *
+ * The ceilings are worked out anew on every feedback report of any
+ * transfer, so a transfer that ends or slows down leaves its share to
+ * the others within a report or so.  A session that goes away without
+ * leaving the table loses its entry as soon as the process is gone.
+ * The session of a multicast receiver that is not the sender sends no
+ * originals of its own and doesn't take part.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <arpa/inet.h>   /* for inet_ntop()                */
+#include <errno.h>       /* for errno                      */
+#include <signal.h>      /* for kill()                     */
+#include <string.h>      /* for memset(), strcmp()         */
+#include <sys/mman.h>    /* for mmap()                     */
+#include <sys/socket.h>  /* for getpeername()              */
+#include <unistd.h>      /* for getpid()                   */
+
+#include <tsunami-server.h>
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+int  egress_alive   (pid_t pid);
+void egress_allocate(ttp_egress_t *egress);
+void egress_lock    (ttp_egress_t *egress);
+
+
+/*------------------------------------------------------------------------
+ * int egress_init(ttp_parameter_t *parameter);
+ *
+ * Sets up the table in memory that the session processes forked later
+ * on share the egress budget and client caps through.  Its lock is
+ * robust, so that a session that dies holding it doesn't hang the
+ * others (see egress_lock()).  Returns 0 on success and non-zero on
+ * failure.
+ *------------------------------------------------------------------------*/
+int egress_init(ttp_parameter_t *parameter)
+{
+    pthread_mutexattr_t attributes;
+    void               *memory;
+
+    memory = mmap(NULL, sizeof(ttp_egress_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+	return warn("Could not allocate shared memory for the egress budget");
+    memset(memory, 0, sizeof(ttp_egress_t));
+
+    if ((pthread_mutexattr_init(&attributes) != 0) ||
+        (pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED) != 0) ||
+        (pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST) != 0) ||
+        (pthread_mutex_init(&((ttp_egress_t *) memory)->lock, &attributes) != 0)) {
+	munmap(memory, sizeof(ttp_egress_t));
+	return warn("Could not create the egress budget lock");
+    }
+    pthread_mutexattr_destroy(&attributes);
+
+    ((ttp_egress_t *) memory)->budget = parameter->egress_rate;
+    parameter->egress = (ttp_egress_t *) memory;
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * double egress_join(ttp_session_t *session);
+ *
+ * Enters the transfer just negotiated into the egress table, with the
+ * weight and cap of its client and the target rate as what it wants.
+ * Any entry the session left behind from an earlier transfer goes.
+ * Returns the ceiling of the transfer in bps, or 0 if it has none.
+ *------------------------------------------------------------------------*/
+double egress_join(ttp_session_t *session)
+{
+    ttp_transfer_t          *xfer   = &session->transfer;
+    ttp_parameter_t         *param  =  session->parameter;
+    ttp_egress_t            *egress =  param->egress;
+    ttp_egress_slot_t       *slot   = NULL;
+    struct sockaddr_storage  address;
+    socklen_t                length = sizeof(address);
+    char                     name[INET6_ADDRSTRLEN] = "";
+    double                   ceiling;
+    int                      i;
+
+    xfer->egress = 0;
+    if ((egress == NULL) || (xfer->mcast == MCAST_MEMBER))
+	return 0.0;
+
+    /* find out who the client is */
+    if (getpeername(session->client_fd, (struct sockaddr *) &address, &length) == 0) {
+	if (address.ss_family == AF_INET6)
+	    inet_ntop(AF_INET6, &((struct sockaddr_in6 *) &address)->sin6_addr, name, sizeof(name));
+	else
+	    inet_ntop(AF_INET,  &((struct sockaddr_in  *) &address)->sin_addr,  name, sizeof(name));
+    }
+
+    /* take a free entry, after letting go of any we still have */
+    egress_lock(egress);
+    for (i = 0; i < EGRESS_SESSIONS; ++i)
+	if (egress->slot[i].pid == getpid())
+	    egress->slot[i].pid = 0;
+    for (i = 0; (i < EGRESS_SESSIONS) && (slot == NULL); ++i)
+	if (!egress_alive(egress->slot[i].pid))
+	    slot = &egress->slot[i];
+    if (slot == NULL) {
+	pthread_mutex_unlock(&egress->lock);
+	warn("Too many transfers for the egress budget, sending without a ceiling");
+	return 0.0;
+    }
+
+    /* and fill it in with what we know of the client */
+    memset(slot, 0, sizeof(*slot));
+    slot->pid    = getpid();
+    slot->weight = 1.0;
+    slot->cap    = param->client_cap;
+    slot->demand = param->target_rate;
+    strcpy(slot->address, name);
+    for (i = 0; i < param->egress_rules; ++i)
+	if (!strcmp(param->egress_rule[i].address, name)) {
+	    slot->weight = param->egress_rule[i].weight;
+	    if (param->egress_rule[i].cap > 0)
+		slot->cap = param->egress_rule[i].cap;
+	}
+    egress_allocate(egress);
+    ceiling = slot->ceiling;
+    pthread_mutex_unlock(&egress->lock);
+
+    xfer->egress      = 1;
+    xfer->egress_slot = slot - egress->slot;
+    if (param->verbose_yn)
+	printf("Egress ceiling for %s: %0.2f Mbps\n", name, ceiling / 1000000.0);
+    return ceiling;
+}
+
+
+/*------------------------------------------------------------------------
+ * void egress_leave(ttp_session_t *session);
+ *
+ * Takes the transfer out of the egress table, if it is in there.  The
+ * others get its share at their next report.
+ *------------------------------------------------------------------------*/
+void egress_leave(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer   = &session->transfer;
+    ttp_egress_t   *egress =  session->parameter->egress;
+
+    if (!xfer->egress)
+	return;
+
+    egress_lock(egress);
+    if (egress->slot[xfer->egress_slot].pid == getpid())
+	egress->slot[xfer->egress_slot].pid = 0;
+    egress_allocate(egress);
+    pthread_mutex_unlock(&egress->lock);
+    xfer->egress = 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * double egress_update(ttp_session_t *session, double rate);
+ *
+ * Enters the rate (bps) that the congestion controller of the transfer
+ * decided on as what the transfer wants, as far as its target rate and
+ * its client let it, and splits the budget anew.  Returns the ceiling
+ * of the transfer in bps, or 0 if it has none.
+ *------------------------------------------------------------------------*/
+double egress_update(ttp_session_t *session, double rate)
+{
+    ttp_transfer_t  *xfer   = &session->transfer;
+    ttp_parameter_t *param  =  session->parameter;
+    ttp_egress_t    *egress =  param->egress;
+    double           ceiling;
+
+    if (!xfer->egress)
+	return 0.0;
+
+    rate = min(rate, (double) param->target_rate);
+    if (xfer->cc.receiver_rate > 0.0)
+	rate = min(rate, xfer->cc.receiver_rate);
+
+    egress_lock(egress);
+    egress->slot[xfer->egress_slot].demand = rate;
+    egress_allocate(egress);
+    ceiling = egress->slot[xfer->egress_slot].ceiling;
+    pthread_mutex_unlock(&egress->lock);
+
+    return ceiling;
+}
+
+
+/*------------------------------------------------------------------------
+ * int egress_alive(pid_t pid);
+ *
+ * Returns non-zero if the given session process is still there.
+ *------------------------------------------------------------------------*/
+int egress_alive(pid_t pid)
+{
+    return (pid != 0) && ((pid == getpid()) || (kill(pid, 0) == 0) || (errno == EPERM));
+}
+
+
+/*------------------------------------------------------------------------
+ * void egress_lock(ttp_egress_t *egress);
+ *
+ * Takes the lock of the egress table.  If the session that held it
+ * last died with it, the entries of sessions that are gone are
+ * cleared first, weight and demand and all, so that the one it may
+ * have been filling in or updating takes no part in the budget.
+ *------------------------------------------------------------------------*/
+void egress_lock(ttp_egress_t *egress)
+{
+    int i;
+
+    if (pthread_mutex_lock(&egress->lock) != EOWNERDEAD)
+	return;
+
+    warn("A session died holding the egress budget lock, clearing its entry");
+    for (i = 0; i < EGRESS_SESSIONS; ++i)
+	if (!egress_alive(egress->slot[i].pid))
+	    memset(&egress->slot[i], 0, sizeof(egress->slot[i]));
+    pthread_mutex_consistent(&egress->lock);
+}
+
+
+/*------------------------------------------------------------------------
+ * void egress_allocate(ttp_egress_t *egress);
+ *
+ * Works out the ceiling of every transfer in the table.  Entries of
+ * sessions that are gone are freed first.  The caller holds the lock.
+ *------------------------------------------------------------------------*/
+void egress_allocate(ttp_egress_t *egress)
+{
+    ttp_egress_slot_t *slot;
+    double             weight[EGRESS_SESSIONS];
+    double             want[EGRESS_SESSIONS];
+    u_char             held[EGRESS_SESSIONS];
+    double             left  = egress->budget;
+    double             total = 0.0;
+    double             open  = 0.0;
+    u_int32_t          clients, settled;
+    int                i, j;
+
+    for (i = 0; i < EGRESS_SESSIONS; ++i)
+	if (!egress_alive(egress->slot[i].pid))
+	    egress->slot[i].pid = 0;
+
+    /* the transfers of one client split its weight and cap */
+    for (i = 0; i < EGRESS_SESSIONS; ++i) {
+	slot    = &egress->slot[i];
+	held[i] = 1;
+	if (slot->pid == 0)
+	    continue;
+	for (j = 0, clients = 0; j < EGRESS_SESSIONS; ++j)
+	    if ((egress->slot[j].pid != 0) && !strcmp(egress->slot[j].address, slot->address))
+		++clients;
+	weight[i]     = slot->weight / clients;
+	slot->ceiling = (slot->cap > 0.0) ? slot->cap / clients : 0.0;
+	held[i]       = 0;
+	total        += weight[i];
+    }
+    if (egress->budget <= 0.0)
+	return;
+
+    /* those that want less than their share get what they want, and a little more */
+    for (i = 0; i < EGRESS_SESSIONS; ++i) {
+	if (held[i])
+	    continue;
+	want[i] = max(EGRESS_HEADROOM * egress->slot[i].demand, EGRESS_FLOOR * egress->budget * weight[i] / total);
+	if (egress->slot[i].ceiling > 0.0)
+	    want[i] = min(want[i], egress->slot[i].ceiling);
+	open += weight[i];
+    }
+    do {
+	settled = 0;
+	for (i = 0; i < EGRESS_SESSIONS; ++i) {
+	    if (held[i] || (want[i] > left * weight[i] / open))
+		continue;
+	    egress->slot[i].ceiling = want[i];
+	    left   -= want[i];
+	    open   -= weight[i];
+	    held[i] = 1;
+	    ++settled;
+	}
+    } while ((settled > 0) && (open > 0.0));
+
+    /* and the others split the rest by their weights */
+    for (i = 0; i < EGRESS_SESSIONS; ++i)
+	if (!held[i])
+	    egress->slot[i].ceiling = left * weight[i] / open;
+}
@@ -0,0 +1,161 @@
+/*========================================================================
+ * fec.c  --  Forward error correction for Tsunami server.
+ *
+ * With FEC negotiated (TS_OPT_FEC), the original blocks of a transfer
+ * are split into groups of fec_group blocks, and parity blocks over
+ * each group (see common/fec.c for the codes) are sent right after its
+ * last block.  The parity of the final group goes out just before the
+ * terminate block instead, so that it has arrived by the time the
+ * client looks for what is still missing.  Parity is only built for
+ * groups that were sent from their first block on in one go; a restart
+ * in the middle of a group leaves that group without parity.
+ *
+ * The number of parity blocks per group follows the loss rate that the
+ * client reports: the blocks it had to ask for again plus the blocks
+ * it rebuilt from parity, with FEC_HEADROOM parity blocks for every
+ * data block expected to be lost.  Each parity block takes the place
+ * of a data block in the pacing.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <stdlib.h>      /* for malloc() and free()        */
+#include <string.h>      /* for memset()                   */
+#include <sys/socket.h>  /* for sendto()                   */
+#include <sys/time.h>    /* for gettimeofday()             */
+
+#include <tsunami-server.h>
+
+
+/*------------------------------------------------------------------------
+ * int fec_encode(ttp_session_t *session, u_int64_t block,
+ *                const u_char *datagram);
+ *
+ * Adds the given original block, as sent in the given datagram, to the
+ * parity of its group.  Returns the number of parity blocks that are
+ * ready to go out with fec_send() if this completed the group, and 0
+ * otherwise.
+ *------------------------------------------------------------------------*/
+int fec_encode(ttp_session_t *session, u_int64_t block, const u_char *datagram)
+{
+    ttp_transfer_t  *xfer   = &session->transfer;
+    ttp_parameter_t *param  =  session->parameter;
+    u_int32_t        size   = param->header_size + param->block_size;
+    u_int32_t        column = (block - 1) % param->fec_group;
+    u_int32_t        row;
+
+    /* a group starts with its first block, using the parity count of the moment */
+    if (column == 0) {
+	xfer->fec_next  = block;
+	xfer->fec_index = (block - 1) / param->fec_group;
+	xfer->fec_rows  = xfer->fec_count;
+	for (row = 0; row < xfer->fec_rows; ++row)
+	    memset(xfer->fec_parity + row * size, 0, size);
+    }
+
+    /* and it gets parity only if it is sent in order */
+    if ((block != xfer->fec_next) || (xfer->fec_rows == 0))
+	return 0;
+
+    for (row = 0; row < xfer->fec_rows; ++row)
+	fec_mul_add(xfer->fec_parity + row * size + param->header_size, datagram + param->header_size,
+		    fec_coefficient(param->fec, row, column), param->block_size);
+    xfer->fec_next = block + 1;
+
+    return ((column == param->fec_group - 1) || (block == param->block_count)) ? xfer->fec_rows : 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void fec_feedback(ttp_session_t *session,
+ *                   const retransmission_t *retransmission);
+ *
+ * Updates the loss estimate from an error rate report (with fields
+ * already in host byte order) and picks the number of parity blocks
+ * for the groups to come.
+ *------------------------------------------------------------------------*/
+void fec_feedback(ttp_session_t *session, const retransmission_t *retransmission)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    u_int32_t        most  = (param->fec == TS_FEC_XOR) ? 1 : min(MAX_FEC_PARITY, max(1, param->fec_group / 2));
+    u_int32_t        count;
+    double           loss;
+
+    /* reports without any blocks received (like our own on a lost heartbeat) say nothing about loss */
+    if (retransmission->received == 0)
+	return;
+
+    /* the error rate scales the fraction of blocks asked for again by 50000, see the client */
+    loss  = min(1.0, retransmission->error_rate / 50000.0);
+    loss += (double) retransmission->fec_recovered / retransmission->received;
+    xfer->fec_loss = 0.75 * xfer->fec_loss + 0.25 * min(loss, 1.0);
+
+    count = min(most, 1 + (u_int32_t) (FEC_HEADROOM * xfer->fec_loss * param->fec_group));
+    if ((count != xfer->fec_count) && param->verbose_yn)
+	printf("FEC: %u parity blocks per %u data blocks (%0.2f%% loss)\n", count, param->fec_group, 100.0 * xfer->fec_loss);
+    xfer->fec_count = count;
+}
+
+
+/*------------------------------------------------------------------------
+ * int fec_init(ttp_session_t *session);
+ *
+ * Sets up the FEC encoder for a new transfer, once the header size is
+ * known.  Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int fec_init(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+
+    xfer->fec_parity = (u_char *) malloc(MAX_FEC_PARITY * (param->header_size + param->block_size));
+    if (xfer->fec_parity == NULL)
+	return warn("Could not allocate FEC parity buffers");
+
+    xfer->fec_next  = 0;
+    xfer->fec_rows  = 0;
+    xfer->fec_count = 1;
+    xfer->fec_loss  = 0.0;
+
+    if (param->verbose_yn)
+	printf("FEC: %s code over groups of %u blocks\n", FEC_NAMES[param->fec], param->fec_group);
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int fec_send(ttp_session_t *session);
+ *
+ * Sends out the parity blocks of the group that fec_encode() just
+ * completed.  Returns the number of parity blocks sent.
+ *------------------------------------------------------------------------*/
+int fec_send(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    u_int32_t        size  = param->header_size + param->block_size;
+    ttp_header_t     header;
+    struct timeval   now;
+    u_int32_t        row;
+    int              sent  = 0;
+
+    header.type = TS_BLOCK_PARITY;
+    header.file = param->pipeline;
+    for (row = 0; row < xfer->fec_rows; ++row) {
+	header.block = parity_block(xfer->fec_index, row);
+	if (param->header_flags & TS_HDR_TIMESTAMP) {
+	    gettimeofday(&now, NULL);
+	    header.timestamp = 1000000LL * now.tv_sec + now.tv_usec;
+	}
+	ttp_header_pack(xfer->fec_parity + row * size, &header, param->header_flags);
+	if (sendto(xfer->udp_fd, xfer->fec_parity + row * size, size, 0, xfer->udp_address, xfer->udp_length) < 0) {
+	    sprintf(g_error, "Could not transmit parity block %u of group %llu", row, (ull_t) xfer->fec_index);
+	    warn(g_error);
+	} else
+	    ++sent;
+    }
+
+    return sent;
+}
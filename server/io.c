@@ -60,11 +60,18 @@
  * INFORMATION GENERATED USING SOFTWARE.
  *========================================================================*/
 
+#include <dirent.h>      /* for scandir() */
+#include <fcntl.h>       /* for posix_fadvise() */
+#include <stdlib.h>      /* for realloc() */
+#include <string.h>      /* for strcmp() */
+#include <sys/stat.h>    /* for stat() */
+#include <unistd.h>      /* for pread() */
+
 #include <tsunami-server.h>
 
 
 /*------------------------------------------------------------------------
- * int build_datagram(ttp_session_t *session, u_int32_t block_index,
+ * int build_datagram(ttp_session_t *session, u_int64_t block_index,
  *                    u_int16_t block_type, u_char *datagram);
  *
  * Constructs to hold the given block of data, with the given type
@@ -79,45 +86,170 @@
  *     :     :          :    :
  *     +---------------------+
  *
+ * unless the client negotiated header extensions, which then go in
+ * between the type and the data (see ttp_header_pack()).  A sender
+ * timestamp is taken after the block has been read.  The block of a
+ * bundle is read from the files it is made of (see bundle.c).
+ *
  * The datagram is stored in the given buffer, which must be at least
- * six bytes longer than the block size for the transfer.  Returns 0 on
- * success and non-zero on failure.
+ * header_size bytes longer than the block size for the transfer.
+ * The block is read with pread(), so the stream threads may build
+ * datagrams at the same time as the main loop.
+ * Returns 0 on success and non-zero on failure.
  *------------------------------------------------------------------------*/
-int build_datagram(ttp_session_t *session, u_int32_t block_index,
+int build_datagram(ttp_session_t *session, u_int64_t block_index,
 		   u_int16_t block_type, u_char *datagram)
 {
+    ttp_header_t     header;
+    struct timeval   now;
+
 #ifdef DEBUG_DISKLESS
     /* build the datagram header */
-    *((u_int32_t *) (datagram + 0)) = htonl(block_index);
-    *((u_int16_t *) (datagram + 4)) = htons(block_type);
+    header.block = block_index;
+    header.type  = block_type;
+    header.file  = session->parameter->pipeline;
+    gettimeofday(&now, NULL);
+    header.timestamp = 1000000LL * now.tv_sec + now.tv_usec;
+    ttp_header_pack(datagram, &header, session->parameter->header_flags);
 
    return 0;
 #else
-    static u_int32_t last_block = 0;
-    int              status;
-
-    /* move the file pointer to the appropriate location */
-    if (block_index != (last_block + 1))
-	fseeko(session->transfer.file, ((u_int64_t) session->parameter->block_size) * (block_index - 1), SEEK_SET);
+    ssize_t          status;
 
     /* try to read in the block */
-    status = fread(datagram + 6, 1, session->parameter->block_size, session->transfer.file);
+    if (session->transfer.bundle != NULL)
+        status = bundle_read(session, block_index, datagram + session->parameter->header_size);
+    else
+        status = pread(fileno(session->transfer.file), datagram + session->parameter->header_size, session->parameter->block_size,
+		       ((u_int64_t) session->parameter->block_size) * (block_index - 1));
     if (status < 0) {
-	sprintf(g_error, "Could not read block #%u", block_index);
+	sprintf(g_error, "Could not read block #%llu", (ull_t) block_index);
 	return warn(g_error);
     }
 
     /* build the datagram header */
-    *((u_int32_t *) (datagram + 0)) = htonl(block_index);
-    *((u_int16_t *) (datagram + 4)) = htons(block_type);
+    header.block = block_index;
+    header.type  = block_type;
+    header.file  = session->parameter->pipeline;
+    if (session->parameter->header_flags & TS_HDR_TIMESTAMP) {
+        gettimeofday(&now, NULL);
+        header.timestamp = 1000000LL * now.tv_sec + now.tv_usec;
+    }
+    ttp_header_pack(datagram, &header, session->parameter->header_flags);
 
     /* return success */
-    last_block = block_index;
     return 0;
 #endif
 }
 
 
+/*------------------------------------------------------------------------
+ * FILE *open_file(ttp_session_t *session, const char *filename);
+ *
+ * Opens the requested file for reading, or takes it over if it is the
+ * one prefetch_next() opened ahead.  A file opened ahead for another
+ * request is closed.  Returns NULL if the file can't be read.
+ *------------------------------------------------------------------------*/
+FILE *open_file(ttp_session_t *session, const char *filename)
+{
+    ttp_pipeline_t *pipeline = &session->pipeline;
+    FILE           *file     = pipeline->next;
+
+    pipeline->next = NULL;
+    if ((file != NULL) && !strcmp(filename, pipeline->next_name))
+        return file;
+    if (file != NULL)
+        fclose(file);
+
+    return fopen(filename, "r");
+}
+
+
+/*------------------------------------------------------------------------
+ * void prefetch_next(ttp_session_t *session);
+ *
+ * Opens the file that follows the current one in our list of shared
+ * files, which is what a pipelined GET * asks for next, and has the
+ * kernel read the first PIPELINE_PREFETCH bytes of it meanwhile.
+ *------------------------------------------------------------------------*/
+void prefetch_next(ttp_session_t *session)
+{
+    ttp_parameter_t *param    =  session->parameter;
+    ttp_pipeline_t  *pipeline = &session->pipeline;
+    int              i;
+
+    if (pipeline->next != NULL)
+        return;
+
+    for (i = 0; i + 1 < param->total_files; ++i)
+        if (!strcmp(param->file_names[i], session->transfer.filename))
+            break;
+    if (i + 1 >= param->total_files)
+        return;
+
+    pipeline->next = fopen(param->file_names[i + 1], "r");
+    if (pipeline->next == NULL)
+        return;
+    pipeline->next_name = param->file_names[i + 1];
+    posix_fadvise(fileno(pipeline->next), 0, PIPELINE_PREFETCH, POSIX_FADV_WILLNEED);
+}
+
+
+/*------------------------------------------------------------------------
+ * int share_files(ttp_parameter_t *parameter, const char *name);
+ *
+ * Adds the given file to the list of files we share for GET * and the
+ * file list, or every file below it in sorted order if it is a
+ * directory.  Links to directories below it are not followed, so that
+ * a loop can't make the list endless.  Returns 0 on success and
+ * non-zero if the file can't be found.
+ *------------------------------------------------------------------------*/
+int share_files(ttp_parameter_t *parameter, const char *name)
+{
+    struct stat     filestat;
+    struct dirent **entries;
+    char            path[MAX_FILENAME_LENGTH];
+    size_t          length = strlen(name);
+    int             count, i;
+
+    if (stat(name, &filestat) < 0) {
+        sprintf(g_error, "Could not find shared file '%s'", name);
+        return warn(g_error);
+    }
+
+    /* a directory shares what is below it */
+    if (S_ISDIR(filestat.st_mode)) {
+        count = scandir(name, &entries, NULL, alphasort);
+        if (count < 0) {
+            sprintf(g_error, "Could not list shared directory '%s'", name);
+            return warn(g_error);
+        }
+        for (i = 0; i < count; ++i) {
+            if (strcmp(entries[i]->d_name, ".") && strcmp(entries[i]->d_name, "..") &&
+                (snprintf(path, sizeof(path), "%s%s%s", name, ((length > 0) && (name[length - 1] == '/')) ? "" : "/",
+                          entries[i]->d_name) < (int) sizeof(path)) &&
+                (lstat(path, &filestat) == 0) &&
+                (!S_ISLNK(filestat.st_mode) || ((stat(path, &filestat) == 0) && !S_ISDIR(filestat.st_mode))))
+                share_files(parameter, path);
+            free(entries[i]);
+        }
+        free(entries);
+        return 0;
+    }
+
+    /* anything else goes on the list as it is */
+    parameter->file_names = (char **)  realloc(parameter->file_names, (parameter->total_files + 1) * sizeof(char *));
+    parameter->file_sizes = (size_t *) realloc(parameter->file_sizes, (parameter->total_files + 1) * sizeof(size_t));
+    if ((parameter->file_names == NULL) || (parameter->file_sizes == NULL))
+        error("Could not grow the list of shared files");
+    parameter->file_names[parameter->total_files] = strdup(name);
+    parameter->file_sizes[parameter->total_files] = filestat.st_size;
+    parameter->file_name_size += length + 1;
+    ++parameter->total_files;
+    return 0;
+}
+
+
 /*========================================================================
  * $Log: io.c,v $
  * Revision 1.3  2008/05/22 18:30:44  jwagnerhki
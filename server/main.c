@@ -64,6 +64,7 @@
 #define _GNU_SOURCE
 #endif
 
+#include <ctype.h>       /* for toupper()                         */
 #include <errno.h>       /* for the errno variable and perror()   */
 #include <fcntl.h>       /* for the fcntl() function              */
 #include <getopt.h>      /* for getopt_long()                     */
@@ -71,6 +72,7 @@
 #include <stdlib.h>      /* for memory allocation, exit(), etc.   */
 #include <string.h>      /* for memset(), sprintf(), etc.         */
 #include <sys/types.h>   /* for standard system data types        */
+#include <sys/select.h>  /* for select()                          */
 #include <sys/socket.h>  /* for the BSD sockets library           */
 #include <sys/stat.h>
 #include <arpa/inet.h>   /* for inet_ntoa()                       */
@@ -86,9 +88,10 @@
  * Function prototypes (module scope).
  *------------------------------------------------------------------------*/
 
-void client_handler (ttp_session_t *session);
-void process_options(int argc, char *argv[], ttp_parameter_t *parameter);
-void reap           (int signum);
+void      client_handler (ttp_session_t *session);
+u_int64_t parse_rate     (const char *text);
+void      process_options(int argc, char *argv[], ttp_parameter_t *parameter);
+void      reap           (int signum);
 
 
 /*------------------------------------------------------------------------
@@ -110,6 +113,14 @@ int main(int argc, char *argv[])
     /* process our command-line options */
     process_options(argc, argv, &parameter);
 
+    /* set up the multicast group that the client processes share */
+    if ((parameter.mcast_group != 0) && (mcast_init(&parameter) < 0))
+        return error("Could not set up multicast");
+
+    /* and the egress budget */
+    if (((parameter.egress_rate > 0) || (parameter.client_cap > 0) || (parameter.egress_rules > 0)) && (egress_init(&parameter) < 0))
+        return error("Could not set up the egress budget");
+
     /* obtain our server socket */
     server_fd = create_tcp_socket(&parameter);
     if (server_fd < 0) {
@@ -195,15 +206,19 @@ void client_handler(ttp_session_t *session)
     struct timeval    lasthblostreport;              /* the time since last 'heartbeat lost' report    */
     u_int32_t         deadconnection_counter;        /* the counter for checking dead conn timeout     */
     int               retransmitlen;                 /* number of bytes read from retransmission queue */
-    u_char            datagram[MAX_BLOCK_SIZE + 6];  /* the datagram containing the file block         */
-    int64_t           ipd_time;                      /* the time to delay/sleep after packet, signed   */
-    int64_t           ipd_usleep_diff;               /* the time correction to ipd_time, signed        */
-    int64_t           ipd_time_max;
+    u_char            datagram[MAX_BLOCK_SIZE + MAX_HEADER_SIZE];  /* the datagram containing the file block */
+    int64_t           ipd_time;                      /* the time to delay/sleep after packet in nsec   */
+    int64_t           ipd_usleep_diff;               /* the time correction to ipd_time in nsec        */
     int               status;
     ttp_transfer_t   *xfer  = &session->transfer;
     ttp_parameter_t  *param =  session->parameter;
     u_int64_t         delta;
     u_char            block_type;
+    u_int64_t         block_index;                   /* the block to send next, 0=none                 */
+    u_char            first_pass;                    /* 1 if that block is sent as an original         */
+    int               parities;
+    fd_set            readable;
+    struct timeval    timeout;
 
     /* negotiate the connection parameters */
     status = ttp_negotiate(session);
@@ -240,10 +255,16 @@ void client_handler(ttp_session_t *session)
     /* negotiate a data transfer port */
     status = ttp_open_port(session);
     if (status < 0) {
+        mcast_leave(session);
+        egress_leave(session);
         warn("UDP socket creation failed");
         continue;
     }
 
+    /* the sender of a multicast group waits for the other receivers, then sends to the group */
+    if (mcast_start(session) < 0)
+        warn("Multicast failed, sending by unicast");
+
     /* make the client descriptor non-blocking again */
     status = fcntl(session->client_fd, F_SETFL, O_NONBLOCK);
     if (status < 0)
@@ -256,30 +277,34 @@ void client_handler(ttp_session_t *session)
     if (param->transcript_yn)
         xscript_data_start(session, &start);
 
+    /* set the other streams going */
+    stream_start(session);
+
     lasthblostreport       = start;
     lastfeedback           = start;
     prevpacketT            = start;
     deadconnection_counter = 0;
     ipd_time               = 0;
-    ipd_time_max           = 0;
     ipd_usleep_diff        = 0;
     retransmitlen          = 0;
 
     /* start by blasting out every block */
-    xfer->block = 0;
+    xfer->block     = 0;
+    xfer->range_end = param->mirror ? 0 : param->block_count + 1;
+    xfer->tail      = 0;
     while (xfer->block <= param->block_count) {
 
         /* default: flag as retransmitted block */
         block_type = TS_BLOCK_RETRANSMISSION;
 
-        /* precalculate time to wait after sending the next packet */
+        /* precalculate time to wait after sending the next packet, repairs in the tail phase go at the target rate */
+        /* and before that, stream 0 has its share of the current rate                                             */
         gettimeofday(&currpacketT, NULL);
-        ipd_usleep_diff = xfer->ipd_current + tv_diff_usec(prevpacketT, currpacketT);
+        ipd_usleep_diff = 1000.0 * ((xfer->tail ? param->ipd_time : stream_ipd(session, 0)) + tv_diff_usec(prevpacketT, currpacketT));
         prevpacketT = currpacketT;
         if (ipd_usleep_diff > 0 || ipd_time > 0) {
             ipd_time += ipd_usleep_diff;
         }
-        ipd_time_max = (ipd_time > ipd_time_max) ? ipd_time : ipd_time_max;
 
         /* see if transmit requests are available */
         status = read(session->client_fd, ((char*)&retransmission)+retransmitlen, sizeof(retransmission)-retransmitlen);
@@ -301,36 +326,120 @@ void client_handler(ttp_session_t *session)
             lasthblostreport       = currpacketT;
             deadconnection_counter = 0;
 
-            /* if it's a stop request, go back to waiting for a filename */
+            /* if it's a stop request, go back to waiting for a filename, once the rest of a multicast group is done too */
             if (ntohs(retransmission.request_type) == REQUEST_STOP) {
+                mcast_linger(session, datagram);
                 fprintf(stderr, "Transmission complete.\n");
                 break;
             }
 
-            /* otherwise, handle the retransmission */
-            status = ttp_accept_retransmit(session, &retransmission, datagram);
-            if (status < 0)
-                warn("Retransmission error");
+            /* otherwise, handle the retransmission, unless the multicast group takes care of it */
+            if (!mcast_request(session, &retransmission)) {
+                status = ttp_accept_retransmit(session, &retransmission, datagram);
+                if (status < 0)
+                    warn("Retransmission error");
+            }
             retransmitlen = 0;
 
+        /* the sender of a multicast group repairs what the other receivers miss, ahead of its originals */
+        } else if (mcast_repair(session, datagram) > 0) {
+
         /* if we have no retransmission */
         } else if (retransmitlen < sizeof(retransmission_t)) {
 
-            /* build the block */
-            xfer->block = min(xfer->block + 1, param->block_count);
-            block_type = (xfer->block == param->block_count) ? TS_BLOCK_TERMINATE : TS_BLOCK_ORIGINAL;
-            status = build_datagram(session, xfer->block, block_type, datagram);
-            if (status < 0) {
-                sprintf(g_error, "Could not read block #%u", xfer->block);
-                error(g_error);
+            /* take the next original block for stream 0, and once they are all out everywhere, enter the tail phase; */
+            /* a mirror, or a server whose range was cut short, waits for the client to give it more instead           */
+            first_pass  = !xfer->tail;
+            block_index = 0;
+            if (first_pass && mcast_follow(session)) {
+
+                /* the client of a multicast group gets its originals from the group's sender */
+                block_index = 0;
+
+            } else if (first_pass) {
+                block_index = stream_next(session);
+                block_type  = TS_BLOCK_ORIGINAL;
+                if ((block_index == param->block_count) &&
+                    (stream_active(session) || param->mirror || (xfer->range_end <= param->block_count)))
+                    block_index = 0;
+                else if ((block_index == param->block_count) && !relay_ready(session, block_index))
+                    block_index = 0;
+                else if (block_index == param->block_count) {
+                    block_index     = xfer->block = param->block_count;
+                    xfer->tail      = 1;
+                    xfer->tail_due  = 1;
+                    xfer->tail_copy = param->block_count - min(param->tail_copies, param->block_count - 1);
+                    if (xfer->tail_copy == param->block_count)
+                        block_type = TS_BLOCK_TERMINATE;
+                    #ifndef VSIB_REALTIME
+                    if (param->pipeline > 0)
+                        prefetch_next(session);
+                    #endif
+                }
+
+            /* in the tail phase, send the final blocks a second time if asked to, those a relay has so far */
+            } else if (xfer->tail_copy < param->block_count) {
+                block_index = xfer->tail_copy++;
+                if (!relay_ready(session, block_index))
+                    block_index = 0;
+
+            /* then a terminate block right after the copies or a round of repairs, and with backoff while the client is quiet */
+            } else if (xfer->tail_due || (get_usec_since(&xfer->tail_stamp) >= xfer->tail_period)) {
+                block_index = param->block_count;
+                block_type  = TS_BLOCK_TERMINATE;
             }
 
-            /* transmit the block */
-            status = sendto(xfer->udp_fd, datagram, 6 + param->block_size, 0, xfer->udp_address, xfer->udp_length);
-            if (status < 0) {
-                sprintf(g_error, "Could not transmit block #%u", xfer->block);
-                warn(g_error);
-                continue;
+            if (block_type == TS_BLOCK_TERMINATE) {
+                xfer->tail_period = xfer->tail_due ? max(TAIL_PERIOD_MIN, 2.0 * max(xfer->cc.srtt, param->wait_u_sec))
+                                                   : min(2.0 * xfer->tail_period, TAIL_PERIOD_MAX);
+                xfer->tail_due    = 0;
+                xfer->tail_stamp  = currpacketT;
+            }
+
+            /* with nothing to send, wait for the client's repair requests rather than spinning */
+            if (block_index == 0) {
+                FD_ZERO(&readable);
+                FD_SET(session->client_fd, &readable);
+                timeout.tv_sec  = 0;
+                timeout.tv_usec = xfer->tail ? min(100000, max(0.0, xfer->tail_period - get_usec_since(&xfer->tail_stamp))) : 1000;
+                select(session->client_fd + 1, &readable, NULL, NULL, &timeout);
+                ipd_time = 0;
+
+                /* a client waiting on a relayed file that doesn't grow isn't a dead one */
+                if (xfer->relay_wait) {
+                    lastfeedback           = currpacketT;
+                    deadconnection_counter = 0;
+                }
+
+            } else {
+
+                /* build the block */
+                status = build_datagram(session, block_index, block_type, datagram);
+                if (status < 0) {
+                    sprintf(g_error, "Could not read block #%llu", (ull_t) block_index);
+                    error(g_error);
+                }
+
+                /* add originals to their FEC group, the parity of the last group goes out ahead of the terminate block */
+                parities = ((param->fec != TS_FEC_NONE) && first_pass) ? fec_encode(session, block_index, datagram) : 0;
+                if ((parities > 0) && (block_type == TS_BLOCK_TERMINATE))
+                    fec_send(session);
+
+                /* transmit the block */
+                status = sendto(xfer->udp_fd, datagram, param->header_size + param->block_size, 0, xfer->udp_address, xfer->udp_length);
+                if (status < 0) {
+                    sprintf(g_error, "Could not transmit block #%llu", (ull_t) block_index);
+                    warn(g_error);
+                    continue;
+                }
+                cc_sent(session, block_index, &currpacketT);
+                if (xfer->streams != NULL)
+                    ++xfer->streams[0].sent;
+
+                /* and the parity of the group it completed, which is paced like as many data blocks */
+                if ((parities > 0) && (block_type != TS_BLOCK_TERMINATE))
+                    fec_send(session);
+                ipd_time += 1000.0 * xfer->ipd_current * parities;
             }
 
         /* if we have too long retransmission message */
@@ -341,8 +450,8 @@ void client_handler(ttp_session_t *session)
 
         }
 
-        /* monitor client heartbeat and disconnect dead client */
-        if ((deadconnection_counter++) > 2048) {
+        /* monitor client heartbeat and disconnect dead client, in the tail phase that is mostly spent waiting only silence counts */
+        if (xfer->tail ? (get_usec_since(&lastfeedback) > TAIL_SILENCE) : ((deadconnection_counter++) > 2048)) {
             char stats_line[160];
 
             deadconnection_counter = 0;
@@ -351,20 +460,32 @@ void client_handler(ttp_session_t *session)
             if (get_usec_since(&lasthblostreport) < 500000.0) continue;
             gettimeofday(&lasthblostreport, NULL);
 
-            /* throttle IPD with fake 100% loss report */
+            /* throttle IPD with fake 100% loss report, the repairs of the tail go at the target rate anyway */
             #ifndef VSIB_REALTIME
-            retransmission.request_type = htons(REQUEST_ERROR_RATE);
-            retransmission.error_rate   = htonl(100000);
-            retransmission.block = 0;
-            ttp_accept_retransmit(session, &retransmission, datagram);
+            if (!xfer->tail) {
+                retransmission.request_type = htons(REQUEST_ERROR_RATE);
+                retransmission.error_rate   = htonl(100000);
+                retransmission.block         = 0;
+                retransmission.block_high    = 0;
+                retransmission.delivery_rate = 0;
+                retransmission.queue_delay   = 0;
+                retransmission.delay_trend   = 0;
+                retransmission.received      = 0;
+                retransmission.ce_marks      = 0;
+                retransmission.fec_recovered = 0;
+                retransmission.ring_free     = 0;
+                retransmission.disk_rate     = 0;
+                retransmission.echo_time     = 0;
+                ttp_accept_retransmit(session, &retransmission, datagram);
+            }
             #endif
 
             delta = get_usec_since(&lastfeedback);
 
             /* show an (additional) statistics line */
             snprintf(stats_line, sizeof(stats_line)-1,
-                                "   n/a     n/a     n/a %7u %6.2f %3u -- no heartbeat since %3.2fs\n",
-                                xfer->block, 100.0 * xfer->block / param->block_count, session->session_id,
+                                "   n/a     n/a     n/a %7llu %6.2f %3u -- no heartbeat since %3.2fs\n",
+                                (ull_t) xfer->block, 100.0 * xfer->block / param->block_count, session->session_id,
                                 1e-6*delta);
             if (param->transcript_yn)
                xscript_data_log(session, stats_line);
@@ -379,7 +500,7 @@ void client_handler(ttp_session_t *session)
             #else
             /* handle timeout condition for : realtime with local backup, simple realtime */
             if ((1e-6 * delta) > param->hb_timeout) {
-                if ((session->parameter->fileout) && (block_type == TS_BLOCK_TERMINATE)) {
+                if ((session->parameter->fileout) && xfer->tail) {
                     fprintf(stderr, "Reached the Terminate block and timed out, terminating transfer.\n");
                     break;
                 } else if(!session->parameter->fileout) {
@@ -393,11 +514,8 @@ void client_handler(ttp_session_t *session)
         }
 
          /* wait before handling the next packet */
-         if (block_type == TS_BLOCK_TERMINATE) {
-             usleep_that_works(10*ipd_time_max);
-         }
-         if (ipd_time > 0) {
-             usleep_that_works(ipd_time);
+         if (ipd_time >= 1000) {
+             usleep_that_works(ipd_time / 1000);
          }
 
     }
@@ -406,6 +524,9 @@ void client_handler(ttp_session_t *session)
      * STOP TIMING
      *---------------------------*/
     gettimeofday(&stop, NULL);
+    stream_stop(session);
+    mcast_leave(session);
+    egress_leave(session);
     if (param->transcript_yn)
         xscript_data_stop(session, &stop);
     delta = 1000000LL * (stop.tv_sec - start.tv_sec) + stop.tv_usec - start.tv_usec;
@@ -422,8 +543,12 @@ void client_handler(ttp_session_t *session)
 
     #ifndef VSIB_REALTIME
 
-    /* close the file */
-    fclose(xfer->file);
+    /* close the file, or the files of the bundle */
+    if (xfer->file != NULL)
+        fclose(xfer->file);
+    bundle_close(session);
+    resume_close(session);
+    relay_close(session);
 
     #else
 
@@ -438,8 +563,17 @@ void client_handler(ttp_session_t *session)
 
     #endif
 
-    /* close the UDP socket */
-    close(xfer->udp_fd);
+    /* close the UDP socket, unless the next file of a pipelined GET * goes out on it */
+    if (param->pipeline > 0) {
+        session->pipeline.file        = param->pipeline;
+        session->pipeline.udp_fd      = xfer->udp_fd;
+        session->pipeline.udp_address = xfer->udp_address;
+        session->pipeline.udp_length  = xfer->udp_length;
+        session->pipeline.rate        = xfer->cc.pacing_rate;
+        session->pipeline.rtt         = xfer->cc.srtt;
+    } else
+        close(xfer->udp_fd);
+    free(xfer->fec_parity);
     memset(xfer, 0, sizeof(*xfer));
 
     } //while(1)
@@ -447,6 +581,27 @@ void client_handler(ttp_session_t *session)
 }
 
 
+/*------------------------------------------------------------------------
+ * u_int64_t parse_rate(const char *text);
+ *
+ * Returns the rate in bps given in the text, which may end in 'k', 'M',
+ * 'G' or 'T' as the client's 'set rate' does.
+ *------------------------------------------------------------------------*/
+u_int64_t parse_rate(const char *text)
+{
+    char   *end;
+    double  rate = strtod(text, &end);
+
+    switch (toupper(*end)) {
+        case 'K': rate *= 1e3;  break;
+        case 'M': rate *= 1e6;  break;
+        case 'G': rate *= 1e9;  break;
+        case 'T': rate *= 1e12; break;
+    }
+    return (u_int64_t) max(rate, 0.0);
+}
+
+
 /*------------------------------------------------------------------------
  * void process_options(int argc, char *argv[],
  *                      ttp_parameter_t *parameter);
@@ -463,13 +618,23 @@ void process_options(int argc, char *argv[], ttp_parameter_t *parameter)
                      { "secret",     1, NULL, 's' },
                      { "buffer",     1, NULL, 'b' },
                      { "hbtimeout",  1, NULL, 'h' },
+                     { "multicast",  1, NULL, 'm' },
+                     { "mcastwait",  1, NULL, 'w' },
+                     { "mcastevict", 1, NULL, 'e' },
+                     { "relay",      1, NULL, 'r' },
+                     { "relayclient",1, NULL, 'c' },
+                     { "egress",     1, NULL, 'g' },
+                     { "clientcap",  1, NULL, 'k' },
+                     { "share",      1, NULL, 'f' },
                      { "v",          0, NULL, 'v' },
                      #ifdef VSIB_REALTIME
                      { "vsibmode",   1, NULL, 'M' },
                      { "vsibskip",   1, NULL, 'S' },
                      #endif
                      { NULL,         0, NULL, 0 } };
-    struct stat   filestat;
+    struct in_addr group;
+    ttp_egress_rule_t *rule;
+    char         *colon;
     int           which;
 
     /* for each option found */
@@ -506,6 +671,64 @@ void process_options(int argc, char *argv[], ttp_parameter_t *parameter)
         case 'h': parameter->hb_timeout = atoi(optarg);
             break;
 
+        /* --multicast=a[:p] : IPv4 multicast group (and port) to send to */
+        case 'm': colon = strchr(optarg, ':');
+            if (colon != NULL)
+                *colon++ = '\0';
+            if (!inet_aton(optarg, &group) || !IN_MULTICAST(ntohl(group.s_addr))) {
+                fprintf(stderr, "Not an IPv4 multicast group: %s\n", optarg);
+                exit(1);
+            }
+            parameter->mcast_group = ntohl(group.s_addr);
+            parameter->mcast_port  = (colon != NULL) ? atoi(colon) : DEFAULT_MCAST_PORT;
+            break;
+
+        /* --mcastwait=i : time to gather multicast receivers in msec */
+        case 'w': parameter->mcast_wait = atoi(optarg);
+            break;
+
+        /* --mcastevict=f : loss in percent at which a receiver is evicted from the group */
+        case 'e': parameter->mcast_evict = 1000.0 * atof(optarg);
+            break;
+
+        /* --relay=h[:p] : origin server (and port) to fetch missing files from */
+        case 'r': colon = strchr(optarg, ':');
+            if (colon != NULL)
+                *colon++ = '\0';
+            parameter->relay_host = optarg;
+            parameter->relay_port = (colon != NULL) ? atoi(colon) : DEFAULT_TCP_PORT;
+            break;
+
+        /* --relayclient=s : the client program that fetches them */
+        case 'c': parameter->relay_client = optarg;
+            break;
+
+        /* --egress=r : the send budget of all sessions together in bps */
+        case 'g': parameter->egress_rate = parse_rate(optarg);
+            break;
+
+        /* --clientcap=r : the most one client may be sent in bps */
+        case 'k': parameter->client_cap = parse_rate(optarg);
+            break;
+
+        /* --share=a,w[,r] : the weight (and cap) of the client at the given address */
+        case 'f': if (parameter->egress_rules == EGRESS_RULES) {
+                fprintf(stderr, "Too many clients to share the egress with, at most %d\n", EGRESS_RULES);
+                exit(1);
+            }
+            rule  = &parameter->egress_rule[parameter->egress_rules];
+            colon = strchr(optarg, ',');
+            if ((colon == NULL) || (colon - optarg >= INET6_ADDRSTRLEN) || (atof(colon + 1) <= 0.0)) {
+                fprintf(stderr, "Not a client address and weight: %s\n", optarg);
+                exit(1);
+            }
+            strncpy(rule->address, optarg, colon - optarg);
+            rule->weight = atof(colon + 1);
+            colon        = strchr(colon + 1, ',');
+            rule->cap    = (colon != NULL) ? parse_rate(colon + 1) : 0;
+            ++parameter->egress_rules;
+            break;
+
         #ifdef VSIB_REALTIME
         /* --vsibmode=i   : size of socket buffer */
         case 'M':  vsib_mode = atoi(optarg);
@@ -519,7 +742,10 @@ void process_options(int argc, char *argv[], ttp_parameter_t *parameter)
         /* otherwise    : display usage information */
         default: 
              fprintf(stderr, "Usage: tsunamid [--verbose] [--transcript] [--v6] [--port=n] [--buffer=bytes]\n");
-             fprintf(stderr, "                [--hbtimeout=seconds] ");
+             fprintf(stderr, "                [--hbtimeout=seconds] [--multicast=group[:port]] [--mcastwait=msec]\n");
+             fprintf(stderr, "                [--mcastevict=percent] [--relay=host[:port]] [--relayclient=path]\n");
+             fprintf(stderr, "                [--egress=rate] [--clientcap=rate] [--share=address,weight[,rate]]\n");
+             fprintf(stderr, "                ");
              #ifdef VSIB_REALTIME
              fprintf(stderr, "[--vsibmode=mode] [--vsibskip=skip] [filename1 filename2 ...]\n\n");
              #else
@@ -532,11 +758,19 @@ void process_options(int argc, char *argv[], ttp_parameter_t *parameter)
              fprintf(stderr, "secret       : specifies the shared secret for the client and server\n");
              fprintf(stderr, "buffer       : specifies the desired size for UDP socket send buffer (in bytes)\n");
              fprintf(stderr, "hbtimeout    : specifies the timeout in seconds for disconnect after client heartbeat lost\n");
+             fprintf(stderr, "multicast    : specifies an IPv4 multicast group to send a file to all clients asking for it at once\n");
+             fprintf(stderr, "mcastwait    : specifies how long to wait for more clients after the first (in msec)\n");
+             fprintf(stderr, "mcastevict   : specifies the loss (in percent) above which a client gets its repairs by unicast\n");
+             fprintf(stderr, "relay        : specifies an origin server to fetch requested files from that aren't here, while sending them on\n");
+             fprintf(stderr, "relayclient  : specifies the Tsunami client program to fetch them with\n");
+             fprintf(stderr, "egress       : specifies the rate (in bps, or with k/M/G) that all clients together are sent at most\n");
+             fprintf(stderr, "clientcap    : specifies the rate that one client is sent at most, over all its transfers\n");
+             fprintf(stderr, "share        : specifies the weight of a client's share of the egress rate, and its own cap\n");
              #ifdef VSIB_REALTIME
              fprintf(stderr, "vsibmode     : specifies the VSIB mode to use (see VSIB documentation for modes)\n");
              fprintf(stderr, "vsibskip     : a value N other than 0 will skip N samples after every 1 sample\n");
              #endif
-             fprintf(stderr, "filenames    : list of files to share for downloaded via a client 'GET *'\n");
+             fprintf(stderr, "filenames    : list of files, or directories of them, to share for downloaded via a client 'GET *'\n");
              fprintf(stderr, "\n");
              fprintf(stderr, "Defaults: verbose    = %d\n",   DEFAULT_VERBOSE_YN);
              fprintf(stderr, "          transcript = %d\n",   DEFAULT_TRANSCRIPT_YN);
@@ -544,6 +778,14 @@ void process_options(int argc, char *argv[], ttp_parameter_t *parameter)
              fprintf(stderr, "          port       = %d\n",   DEFAULT_TCP_PORT);
              fprintf(stderr, "          buffer     = %d bytes\n",   DEFAULT_UDP_BUFFER);
              fprintf(stderr, "          hbtimeout  = %d seconds\n",   DEFAULT_HEARTBEAT_TIMEOUT);
+             fprintf(stderr, "          multicast  = none, port %d\n", DEFAULT_MCAST_PORT);
+             fprintf(stderr, "          mcastwait  = %d msec\n",   DEFAULT_MCAST_WAIT);
+             fprintf(stderr, "          mcastevict = %0.1f percent\n", DEFAULT_MCAST_EVICT / 1000.0);
+             fprintf(stderr, "          relay      = none, port %d\n", DEFAULT_TCP_PORT);
+             fprintf(stderr, "          relayclient= %s\n", DEFAULT_RELAY_CLIENT);
+             fprintf(stderr, "          egress     = none\n");
+             fprintf(stderr, "          clientcap  = none\n");
+             fprintf(stderr, "          share      = weight 1 for every client\n");
              #ifdef VSIB_REALTIME
              fprintf(stderr, "          vsibmode   = %d\n",   0);
              fprintf(stderr, "          vsibskip   = %d\n",   0);
@@ -555,15 +797,14 @@ void process_options(int argc, char *argv[], ttp_parameter_t *parameter)
 
     if (argc>optind) {
         int counter;
-        parameter->file_names = argv+optind;
+        parameter->file_names = NULL;
+        parameter->file_sizes = NULL;
         parameter->file_name_size = 0;
-        parameter->total_files = argc-optind;
-        parameter->file_sizes = (size_t*)malloc(sizeof(size_t) * parameter->total_files);
+        parameter->total_files = 0;
+        for (counter=optind; counter < argc; counter++)
+            share_files(parameter, argv[counter]);
         fprintf(stderr, "\nThe specified %d files will be listed on GET *:\n", parameter->total_files);
-        for (counter=0; counter < argc-optind; counter++) {
-            stat(parameter->file_names[counter], &filestat);
-            parameter->file_sizes[counter] = filestat.st_size;
-            parameter->file_name_size += strlen(parameter->file_names[counter])+1;
+        for (counter=0; counter < parameter->total_files; counter++) {
             fprintf(stderr, " %3d)   %-20s  %llu bytes\n", counter+1, parameter->file_names[counter], (ull_t)parameter->file_sizes[counter]);
         }
         fprintf(stderr, "total characters %d\n", parameter->file_name_size);
@@ -0,0 +1,635 @@
+/*========================================================================
+ * multicast.c  --  One-to-many transfers over IP multicast for Tsunami
+ *                  server.
+ *
+ * With --multicast, clients that ask for it (TS_OPT_MULTICAST) and
+ * request the same file with the same block size and header at about
+ * the same time share a single stream of datagrams sent to an IPv4
+ * multicast group.  As every client still has a session process of
+ * its own, the sessions meet in a small group structure in memory
+ * shared since before the fork.  The first session to come along
+ * becomes the sender: it gathers receivers for --mcastwait msec, then
+ * runs the usual main loop with the group as its destination.  The
+ * sessions of the other receivers send no originals, they follow the
+ * sender's position and pass the repair requests of their clients on
+ * through a queue in the group.  The sender takes those as they come,
+ * one per datagram slot as for its own client, and drops a request
+ * for a block it repaired less than a round trip ago, which is likely
+ * the same loss seen by another receiver (mcast_suppress()).
+ *
+ * Every receiver's feedback goes into the group, and the sender paces
+ * to the highest loss among those below the eviction threshold (and
+ * to the lowest delivery rate), i.e. the slowest receiver it is still
+ * willing to wait for.  A receiver that reports more loss than that
+ * MCAST_STRIKES times in a row is evicted: its session sends it the
+ * repairs by unicast from then on, at the pace of its own controller,
+ * while the originals keep coming from the group.  A client that
+ * falls so far behind that it asks for a restart leaves the group
+ * altogether.  Should the group end or its sender go away before a
+ * receiver is done, that session sends the rest of the file by
+ * unicast itself.
+ *
+ * Once its own client is done, the sender keeps serving the group
+ * until every receiver that has not been evicted has left it.  There
+ * is one group per server; clients that come too late, or with other
+ * parameters, get a transfer of their own as usual.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <arpa/inet.h>   /* for htonl() and friends        */
+#include <errno.h>       /* for errno                      */
+#include <netinet/in.h>  /* for IP_MULTICAST_IF            */
+#include <signal.h>      /* for kill()                     */
+#include <stdlib.h>      /* for calloc() and free()        */
+#include <string.h>      /* for memset(), strcmp()         */
+#include <sys/mman.h>    /* for mmap()                     */
+#include <sys/socket.h>  /* for setsockopt(), sendto()     */
+#include <unistd.h>      /* for getpid()                   */
+
+#include <tsunami-server.h>
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+int  mcast_alive   (pid_t pid);
+void mcast_lock    (ttp_group_t *group);
+int  mcast_pace    (ttp_session_t *session, u_int32_t *error_rate, u_int32_t *delivery_rate);
+void mcast_report  (ttp_session_t *session, retransmission_t *retransmission);
+int  mcast_suppress(ttp_session_t *session, u_int64_t block);
+
+
+/*------------------------------------------------------------------------
+ * int mcast_follow(ttp_session_t *session);
+ *
+ * Keeps track of the group's originals, before the next one is taken:
+ * the sender publishes its position, and the session of any other
+ * receiver takes it over, so that it can carry on from there should
+ * the group end early.  Returns non-zero while the session's client
+ * gets its originals from the group, and 0 if the session sends its
+ * own (always for the sender and outside a group).
+ *------------------------------------------------------------------------*/
+int mcast_follow(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer  = &session->transfer;
+    ttp_group_t    *group =  session->parameter->group;
+    int             following;
+
+    if (xfer->mcast == 0)
+	return 0;
+
+    mcast_lock(group);
+    if (xfer->mcast == MCAST_SENDER) {
+	group->block = xfer->block;
+	pthread_mutex_unlock(&group->lock);
+	return 0;
+    }
+    following = (group->generation == xfer->mcast_generation) && mcast_alive(group->sender);
+    if (following)
+	xfer->block = group->block;
+    pthread_mutex_unlock(&group->lock);
+
+    if (!following) {
+	fprintf(stderr, "Multicast group ended, session %u sends on from block %llu by unicast.\n",
+		session->session_id, (ull_t) xfer->block + 1);
+	xfer->mcast = 0;
+    }
+    return following;
+}
+
+
+/*------------------------------------------------------------------------
+ * int mcast_init(ttp_parameter_t *parameter);
+ *
+ * Sets up the multicast group in memory that the session processes
+ * forked later on share.  Its lock is robust, so that a session that
+ * dies holding it doesn't hang the others (see mcast_lock()).  Returns
+ * 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int mcast_init(ttp_parameter_t *parameter)
+{
+    pthread_mutexattr_t attributes;
+    void               *memory;
+
+    memory = mmap(NULL, sizeof(ttp_group_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+	return warn("Could not allocate shared memory for the multicast group");
+    memset(memory, 0, sizeof(ttp_group_t));
+
+    if ((pthread_mutexattr_init(&attributes) != 0) ||
+        (pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED) != 0) ||
+        (pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST) != 0) ||
+        (pthread_mutex_init(&((ttp_group_t *) memory)->lock, &attributes) != 0)) {
+	munmap(memory, sizeof(ttp_group_t));
+	return warn("Could not create the multicast group lock");
+    }
+    pthread_mutexattr_destroy(&attributes);
+
+    parameter->group = (ttp_group_t *) memory;
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int mcast_join(ttp_session_t *session);
+ *
+ * Enters the transfer just negotiated into the multicast group: as its
+ * sender if the group is idle, or as a receiver if the group is still
+ * gathering receivers for the same file and parameters.  Must be
+ * called once the header size is settled.  Returns 0 on success and
+ * non-zero if the transfer has to go by unicast.
+ *------------------------------------------------------------------------*/
+int mcast_join(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    ttp_group_t     *group =  param->group;
+    int              i;
+
+    if ((group == NULL) || param->ipv6_yn)
+	return -1;
+
+    mcast_lock(group);
+
+    /* a group without a sender is ours */
+    if (!mcast_alive(group->sender)) {
+	memset(group->member, 0, sizeof(group->member));
+	strncpy(group->filename, xfer->filename, sizeof(group->filename) - 1);
+	group->generation++;
+	group->sender        = getpid();
+	group->sending       = 0;
+	group->file_size     = param->file_size;
+	group->block_size    = param->block_size;
+	group->header_flags  = param->header_flags;
+	group->block         = 0;
+	group->reports       = 0;
+	group->queue_head    = 0;
+	group->queue_tail    = 0;
+	group->member[0].pid   = getpid();
+	group->member[0].state = MCAST_MEMBER;
+	xfer->mcast      = MCAST_SENDER;
+	xfer->mcast_slot = 0;
+
+    /* otherwise, we may come along if it hasn't started yet */
+    } else if (!group->sending && !strcmp(group->filename, xfer->filename) && (group->file_size == param->file_size) &&
+               (group->block_size == param->block_size) && (group->header_flags == param->header_flags)) {
+	for (i = 1; (i < MCAST_MEMBERS) && mcast_alive(group->member[i].pid); ++i);
+	if (i < MCAST_MEMBERS) {
+	    group->member[i].pid      = getpid();
+	    group->member[i].state    = MCAST_MEMBER;
+	    group->member[i].strikes  = 0;
+	    group->member[i].error_rate    = 0;
+	    group->member[i].delivery_rate = 0;
+	    xfer->mcast      = MCAST_MEMBER;
+	    xfer->mcast_slot = i;
+	}
+    }
+    xfer->mcast_generation = group->generation;
+    xfer->mcast_unicast    = NULL;
+
+    pthread_mutex_unlock(&group->lock);
+
+    if (xfer->mcast == MCAST_SENDER) {
+	xfer->mcast_recent = (ttp_repair_t *) calloc(MCAST_RECENT, sizeof(ttp_repair_t));
+	if (xfer->mcast_recent == NULL) {
+	    mcast_leave(session);
+	    return warn("Could not allocate the multicast repair history");
+	}
+    }
+
+    return (xfer->mcast != 0) ? 0 : -1;
+}
+
+
+/*------------------------------------------------------------------------
+ * void mcast_leave(ttp_session_t *session);
+ *
+ * Takes the session out of its multicast group at the end of its
+ * transfer, or when its client restarts.  If it was the sender, the
+ * group ends with it and the data goes to its own client again.
+ *------------------------------------------------------------------------*/
+void mcast_leave(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer  = &session->transfer;
+    ttp_group_t    *group =  session->parameter->group;
+
+    if (xfer->mcast == 0)
+	return;
+
+    mcast_lock(group);
+    if (group->generation == xfer->mcast_generation) {
+	if (xfer->mcast == MCAST_SENDER) {
+	    group->sender  = 0;
+	    group->sending = 0;
+	} else
+	    group->member[xfer->mcast_slot].pid = 0;
+    }
+    pthread_mutex_unlock(&group->lock);
+
+    if (xfer->mcast_unicast != NULL) {
+	free(xfer->udp_address);
+	xfer->udp_address   = xfer->mcast_unicast;
+	xfer->udp_length    = sizeof(struct sockaddr_in);
+	xfer->mcast_unicast = NULL;
+    }
+
+    if ((xfer->mcast == MCAST_SENDER) && session->parameter->verbose_yn)
+	fprintf(stderr, "Multicast group sent %llu repairs for other receivers and suppressed %llu repeated requests.\n",
+		(ull_t) xfer->mcast_repairs, (ull_t) xfer->mcast_suppressed);
+
+    free(xfer->mcast_recent);
+    xfer->mcast_recent = NULL;
+    xfer->mcast        = 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void mcast_linger(ttp_session_t *session, u_char *datagram);
+ *
+ * Keeps the group going once the sender's own client is done, until
+ * the other receivers that have not been evicted are done as well or
+ * have gone quiet for the heartbeat timeout: the repairs they ask for
+ * go out as before, and a terminate block follows them, and backs off
+ * while they are quiet, as in the tail phase of the main loop.  Their
+ * feedback still drives the congestion controller.  The datagram
+ * buffer must be large enough for a block.
+ *------------------------------------------------------------------------*/
+void mcast_linger(ttp_session_t *session, u_char *datagram)
+{
+    ttp_transfer_t   *xfer  = &session->transfer;
+    ttp_parameter_t  *param =  session->parameter;
+    ttp_group_t      *group =  param->group;
+    retransmission_t  retransmission;
+    struct timeval    last_report;
+    u_int32_t         reports, error_rate, delivery_rate;
+    int               members, fresh;
+
+    if (xfer->mcast != MCAST_SENDER)
+	return;
+
+    mcast_lock(group);
+    group->member[0].pid = 0;
+    reports = group->reports;
+    pthread_mutex_unlock(&group->lock);
+    gettimeofday(&last_report, NULL);
+
+    while (1) {
+
+	mcast_lock(group);
+	members = mcast_pace(session, &error_rate, &delivery_rate);
+	fresh   = (group->reports != reports);
+	reports = group->reports;
+	pthread_mutex_unlock(&group->lock);
+	if (members == 0)
+	    break;
+
+	/* pace to the receivers that are left */
+	if (fresh) {
+	    gettimeofday(&last_report, NULL);
+	    memset(&retransmission, 0, sizeof(retransmission));
+	    retransmission.request_type  = htons(REQUEST_ERROR_RATE);
+	    retransmission.error_rate    = htonl(error_rate);
+	    retransmission.delivery_rate = htonl(delivery_rate);
+	    ttp_accept_retransmit(session, &retransmission, datagram);
+	} else if (get_usec_since(&last_report) > 1000000.0 * param->hb_timeout) {
+	    fprintf(stderr, "No feedback from the multicast group in %d seconds, ending it.\n", param->hb_timeout);
+	    break;
+	}
+
+	/* serve their repairs, then tell them we are through */
+	if (mcast_repair(session, datagram) > 0) {
+	    usleep_that_works(xfer->ipd_current);
+	    continue;
+	}
+	if (xfer->tail_due || (get_usec_since(&xfer->tail_stamp) >= xfer->tail_period)) {
+	    if ((build_datagram(session, param->block_count, TS_BLOCK_TERMINATE, datagram) < 0) ||
+	        (sendto(xfer->udp_fd, datagram, param->header_size + param->block_size, 0, xfer->udp_address, xfer->udp_length) < 0))
+		warn("Could not send terminate block to the multicast group");
+	    xfer->tail_period = xfer->tail_due ? max(TAIL_PERIOD_MIN, 2.0 * max(xfer->cc.srtt, param->wait_u_sec))
+	                                       : min(2.0 * xfer->tail_period, TAIL_PERIOD_MAX);
+	    xfer->tail_due    = 0;
+	    gettimeofday(&xfer->tail_stamp, NULL);
+	}
+	usleep_that_works(1000);
+    }
+}
+
+
+/*------------------------------------------------------------------------
+ * int mcast_repair(ttp_session_t *session, u_char *datagram);
+ *
+ * Sends the group the next repair that another receiver asked for, if
+ * it wasn't just repaired.  Only the sender does anything here.  The
+ * datagram buffer must be large enough for a block.  Returns 1 if a
+ * repair went out and 0 if none was due.
+ *------------------------------------------------------------------------*/
+int mcast_repair(ttp_session_t *session, u_char *datagram)
+{
+    ttp_transfer_t   *xfer  = &session->transfer;
+    ttp_parameter_t  *param =  session->parameter;
+    ttp_group_t      *group =  param->group;
+    retransmission_t  retransmission;
+    u_int64_t         block;
+
+    if (xfer->mcast != MCAST_SENDER)
+	return 0;
+
+    while (1) {
+	mcast_lock(group);
+	if (group->queue_head == group->queue_tail) {
+	    pthread_mutex_unlock(&group->lock);
+	    return 0;
+	}
+	block = group->queue[group->queue_head++ % MCAST_QUEUE];
+	pthread_mutex_unlock(&group->lock);
+
+	if ((block == 0) || (block > param->block_count) || mcast_suppress(session, block))
+	    continue;
+
+	memset(&retransmission, 0, sizeof(retransmission));
+	retransmission.request_type = htons(REQUEST_RETRANSMIT);
+	retransmission.block        = htonl((u_int32_t) block);
+	retransmission.block_high   = htonl((u_int32_t) (block >> 32));
+	if (ttp_accept_retransmit(session, &retransmission, datagram) < 0)
+	    warn("Retransmission error");
+	++xfer->mcast_repairs;
+	return 1;
+    }
+}
+
+
+/*------------------------------------------------------------------------
+ * int mcast_request(ttp_session_t *session,
+ *                   retransmission_t *retransmission);
+ *
+ * Looks at a request from the session's client (in network byte
+ * order) before it is handled as usual.  The sender drops repeated
+ * repair requests and turns its client's feedback into that of the
+ * group; the session of any other receiver passes its repair requests
+ * on to the sender and enters its feedback into the group, which may
+ * get it evicted.  A client that asks for a restart has fallen too
+ * far behind for the group and leaves it (as the client does), for a
+ * transfer of its own; if it is the sender's, the group ends and the
+ * other receivers carry on by unicast as well.  Returns non-zero if
+ * the request is taken care of.
+ *------------------------------------------------------------------------*/
+int mcast_request(ttp_session_t *session, retransmission_t *retransmission)
+{
+    ttp_transfer_t *xfer  = &session->transfer;
+    ttp_group_t    *group =  session->parameter->group;
+    u_int16_t       type  =  ntohs(retransmission->request_type);
+    u_int64_t       block = ((u_int64_t) ntohl(retransmission->block_high) << 32) | ntohl(retransmission->block);
+    int             taken =  0;
+
+    if (xfer->mcast == 0)
+	return 0;
+
+    if (type == REQUEST_RESTART) {
+	fprintf(stderr, "Session %u fell behind the multicast group, restarting from block %llu by unicast.\n",
+		session->session_id, (ull_t) block);
+	mcast_leave(session);
+	return 0;
+    }
+
+    if (xfer->mcast == MCAST_EVICTED)
+	return 0;
+
+    if (type == REQUEST_ERROR_RATE)
+	mcast_report(session, retransmission);
+
+    else if ((type == REQUEST_RETRANSMIT) && (xfer->mcast == MCAST_SENDER))
+	taken = mcast_suppress(session, block);
+
+    /* a full queue loses the request, which the client repeats */
+    else if (type == REQUEST_RETRANSMIT) {
+	mcast_lock(group);
+	if (group->queue_tail - group->queue_head < MCAST_QUEUE)
+	    group->queue[group->queue_tail++ % MCAST_QUEUE] = block;
+	pthread_mutex_unlock(&group->lock);
+	taken = 1;
+    }
+
+    return taken;
+}
+
+
+/*------------------------------------------------------------------------
+ * int mcast_start(ttp_session_t *session);
+ *
+ * Points the sender's data socket at the group, on the interface that
+ * its client's connection came in on, waits for the other receivers
+ * to join and closes the group to newcomers.  Does nothing for other
+ * sessions.  Returns 0 on success and non-zero on failure, in which
+ * case the group is ended and every receiver is served by unicast.
+ *------------------------------------------------------------------------*/
+int mcast_start(ttp_session_t *session)
+{
+    ttp_transfer_t     *xfer  = &session->transfer;
+    ttp_parameter_t    *param =  session->parameter;
+    ttp_group_t        *group =  param->group;
+    struct sockaddr_in  local;
+    socklen_t           length = sizeof(local);
+    struct sockaddr_in *address;
+    int                 ttl    = MCAST_TTL;
+    int                 members, i;
+
+    if (xfer->mcast != MCAST_SENDER)
+	return 0;
+
+    memset(&local, 0, sizeof(local));
+    address = (struct sockaddr_in *) calloc(1, sizeof(struct sockaddr_in));
+    if ((address == NULL) ||
+        (getsockname(session->client_fd, (struct sockaddr *) &local, &length) < 0) ||
+        (setsockopt(xfer->udp_fd, IPPROTO_IP, IP_MULTICAST_IF,  &local.sin_addr, sizeof(local.sin_addr)) < 0) ||
+        (setsockopt(xfer->udp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)) {
+	free(address);
+	mcast_leave(session);
+	return warn("Could not set up the data socket for multicast");
+    }
+    address->sin_family      = AF_INET;
+    address->sin_addr.s_addr = htonl(param->mcast_group);
+    address->sin_port        = htons(param->mcast_port);
+    xfer->mcast_unicast = xfer->udp_address;
+    xfer->udp_address   = (struct sockaddr *) address;
+    xfer->udp_length  = sizeof(struct sockaddr_in);
+
+    /* give the other receivers time to come along */
+    usleep_that_works(1000ULL * param->mcast_wait);
+
+    mcast_lock(group);
+    group->sending = 1;
+    for (members = 0, i = 0; i < MCAST_MEMBERS; ++i)
+	members += mcast_alive(group->member[i].pid);
+    pthread_mutex_unlock(&group->lock);
+
+    fprintf(stderr, "Multicasting '%s' to %d receivers on %s:%u\n", xfer->filename, members,
+	    inet_ntoa(address->sin_addr), param->mcast_port);
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int mcast_alive(pid_t pid);
+ *
+ * Returns non-zero if the given session process is still there.
+ *------------------------------------------------------------------------*/
+int mcast_alive(pid_t pid)
+{
+    return (pid != 0) && ((pid == getpid()) || (kill(pid, 0) == 0) || (errno == EPERM));
+}
+
+
+/*------------------------------------------------------------------------
+ * void mcast_lock(ttp_group_t *group);
+ *
+ * Takes the group lock.  If the session that held it last died with
+ * it, whatever it was in the middle of is put right first: receivers
+ * whose sessions are gone are dropped, a group whose sender is gone
+ * ends (its receivers carry on by unicast), and a repair queue left
+ * inconsistent is emptied, losing requests that the clients repeat.
+ *------------------------------------------------------------------------*/
+void mcast_lock(ttp_group_t *group)
+{
+    int i;
+
+    if (pthread_mutex_lock(&group->lock) != EOWNERDEAD)
+	return;
+
+    warn("A session died holding the multicast group lock, repairing the group");
+    for (i = 0; i < MCAST_MEMBERS; ++i)
+	if (!mcast_alive(group->member[i].pid))
+	    group->member[i].pid = 0;
+    if (!mcast_alive(group->sender)) {
+	group->sender  = 0;
+	group->sending = 0;
+    }
+    if (group->queue_tail - group->queue_head > MCAST_QUEUE)
+	group->queue_head = group->queue_tail;
+    pthread_mutex_consistent(&group->lock);
+}
+
+
+/*------------------------------------------------------------------------
+ * int mcast_pace(ttp_session_t *session, u_int32_t *error_rate,
+ *                u_int32_t *delivery_rate);
+ *
+ * Finds the feedback to pace the group by: the highest error rate and
+ * the lowest delivery rate of the receivers below the eviction
+ * threshold, or of all of them if there are none.  Receivers whose
+ * sessions are gone are dropped on the way.  Must be called with the
+ * group lock held.  Returns the number of receivers that haven't been
+ * evicted.
+ *------------------------------------------------------------------------*/
+int mcast_pace(ttp_session_t *session, u_int32_t *error_rate, u_int32_t *delivery_rate)
+{
+    ttp_group_t  *group = session->parameter->group;
+    ttp_member_t *member;
+    u_int32_t     all_error = 0, all_rate = 0;
+    int           members = 0, below = 0;
+    int           i;
+
+    *error_rate    = 0;
+    *delivery_rate = 0;
+    for (i = 0; i < MCAST_MEMBERS; ++i) {
+	member = &group->member[i];
+	if (!mcast_alive(member->pid)) {
+	    member->pid = 0;
+	    continue;
+	}
+	if (member->state != MCAST_MEMBER)
+	    continue;
+
+	/* a delivery rate of 0 is unknown */
+	++members;
+	all_error = max(all_error, member->error_rate);
+	if (member->delivery_rate > 0)
+	    all_rate = (all_rate == 0) ? member->delivery_rate : min(all_rate, member->delivery_rate);
+	if (member->error_rate > session->parameter->mcast_evict)
+	    continue;
+	++below;
+	*error_rate = max(*error_rate, member->error_rate);
+	if (member->delivery_rate > 0)
+	    *delivery_rate = (*delivery_rate == 0) ? member->delivery_rate : min(*delivery_rate, member->delivery_rate);
+    }
+
+    if (below == 0) {
+	*error_rate    = all_error;
+	*delivery_rate = all_rate;
+    }
+    return members;
+}
+
+
+/*------------------------------------------------------------------------
+ * void mcast_report(ttp_session_t *session,
+ *                   retransmission_t *retransmission);
+ *
+ * Enters the feedback of the session's client (a REQUEST_ERROR_RATE in
+ * network byte order) into the group.  For the sender, the request is
+ * then rewritten with the feedback of the group as a whole; any other
+ * receiver is evicted after MCAST_STRIKES reports in a row above the
+ * threshold.
+ *------------------------------------------------------------------------*/
+void mcast_report(ttp_session_t *session, retransmission_t *retransmission)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    ttp_group_t     *group =  param->group;
+    ttp_member_t    *member;
+    u_int32_t        error_rate    = ntohl(retransmission->error_rate);
+    u_int32_t        delivery_rate = ntohl(retransmission->delivery_rate);
+    int              evicted = 0;
+
+    mcast_lock(group);
+    if (group->generation == xfer->mcast_generation) {
+	member = &group->member[xfer->mcast_slot];
+	member->error_rate    = error_rate;
+	member->delivery_rate = delivery_rate;
+	group->reports++;
+
+	if (xfer->mcast == MCAST_SENDER) {
+	    mcast_pace(session, &error_rate, &delivery_rate);
+	    retransmission->error_rate    = htonl(error_rate);
+	    retransmission->delivery_rate = htonl(delivery_rate);
+	} else {
+	    member->strikes = (error_rate > param->mcast_evict) ? member->strikes + 1 : 0;
+	    if (member->strikes >= MCAST_STRIKES) {
+		member->state = MCAST_EVICTED;
+		xfer->mcast   = MCAST_EVICTED;
+		evicted       = 1;
+	    }
+	}
+    }
+    pthread_mutex_unlock(&group->lock);
+
+    if (evicted)
+	fprintf(stderr, "Session %u lost %0.1f%% of the multicast data, evicted to unicast repairs.\n",
+		session->session_id, error_rate / 1000.0);
+}
+
+
+/*------------------------------------------------------------------------
+ * int mcast_suppress(ttp_session_t *session, u_int64_t block);
+ *
+ * Returns non-zero if the sender repaired the given block less than a
+ * round trip (and at least MCAST_HOLDOFF usec) ago, so that a request
+ * for it can be dropped.  Otherwise, the block is noted as repaired
+ * now and 0 is returned.
+ *------------------------------------------------------------------------*/
+int mcast_suppress(ttp_session_t *session, u_int64_t block)
+{
+    ttp_transfer_t *xfer   = &session->transfer;
+    ttp_repair_t   *recent = &xfer->mcast_recent[block % MCAST_RECENT];
+
+    if ((recent->block == block) && (get_usec_since(&recent->sent) < max(MCAST_HOLDOFF, xfer->cc.srtt))) {
+	++xfer->mcast_suppressed;
+	return 1;
+    }
+
+    recent->block = block;
+    gettimeofday(&recent->sent, NULL);
+    return 0;
+}
@@ -175,6 +175,33 @@ int create_udp_socket(ttp_parameter_t *parameter)
 }
 
 
+/*------------------------------------------------------------------------
+ * int test_ecn_socket(ttp_parameter_t *parameter);
+ *
+ * Returns non-zero if a UDP socket like the one create_udp_socket()
+ * makes takes the ECT(1) mark, so that the client is not promised ECN
+ * capable data that goes out unmarked.
+ *------------------------------------------------------------------------*/
+int test_ecn_socket(ttp_parameter_t *parameter)
+{
+    int socket_fd;
+    int status;
+    int tos = 0x01;
+
+    socket_fd = socket(parameter->ipv6_yn ? AF_INET6 : AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd < 0)
+	return 0;
+
+    if (parameter->ipv6_yn)
+	status = setsockopt(socket_fd, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos));
+    else
+	status = setsockopt(socket_fd, IPPROTO_IP,   IP_TOS,      &tos, sizeof(tos));
+
+    close(socket_fd);
+    return (status == 0);
+}
+
+
 /*========================================================================
  * $Log: network.c,v $
  * Revision 1.3  2009/05/18 07:52:55  jwagnerhki
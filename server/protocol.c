@@ -79,6 +79,14 @@
 #include "parse_evn_filename.h" /* EVN file name parsing for start time, station code, etc */
 #endif
 
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+int ttp_read_options (ttp_session_t *session);
+int ttp_write_option (ttp_session_t *session, u_int16_t key, u_int64_t value);
+int ttp_send_probe   (ttp_session_t *session);
+
 /*------------------------------------------------------------------------
  * int ttp_accept_retransmit(ttp_session_t *session,
  *                           retransmission_t *retransmission,
@@ -89,10 +97,19 @@
  *
  *   REQUEST_RETRANSMIT -- Retransmit the given block.
  *   REQUEST_RESTART    -- Restart the transfer at the given block.
- *   REQUEST_ERROR_RATE -- Use the given error rate to adjust the IPD.
+ *   REQUEST_ERROR_RATE -- Pass the given feedback to the congestion
+ *                         controller, which adjusts the IPD.
+ *   REQUEST_PATH       -- Pass the given report on one stream to the
+ *                         scheduler of the streams.
+ *   REQUEST_RANGE      -- Send no original blocks from the given block
+ *                         on, and go into the tail phase only if that
+ *                         is past the last block (see TS_OPT_MIRROR).
+ *   REQUEST_TARGET_RATE -- Move the target rate to the given one (bps),
+ *                         in place of the block number, if the client
+ *                         asked for TS_OPT_RATE_SHARE.
  *
  * For REQUEST_RETRANSMIT messsages, the given buffer must be large
- * enough to hold (block_size + 6) bytes.  For other messages, the
+ * enough to hold (block_size + header_size) bytes.  For other messages, the
  * datagram parameter is ignored.
  *
  * Returns 0 on success and non-zero on failure.
@@ -102,70 +119,119 @@ int ttp_accept_retransmit(ttp_session_t *session, retransmission_t *retransmissi
     ttp_transfer_t  *xfer      = &session->transfer;
     ttp_parameter_t *param     = session->parameter;
     static int       iteration = 0;
-    static char      stats_line[80];
+    static char      stats_line[96];
     int              status;
     u_int16_t        type;
+    u_int64_t        block;
+    struct timeval   now;
+    ttp_stream_t    *path;
 
     /* convert the retransmission fields to host byte order */
     retransmission->block      = ntohl(retransmission->block);
+    retransmission->block_high = ntohl(retransmission->block_high);
+    block                      = request_block(retransmission);
     retransmission->error_rate = ntohl(retransmission->error_rate);
     type                       = ntohs(retransmission->request_type);
 
     /* if it's an error rate notification */
     if (type == REQUEST_ERROR_RATE) {
 
-	/* calculate a new IPD */
-	if (retransmission->error_rate > param->error_rate) {
-	    double factor1 = (1.0 * param->slower_num / param->slower_den) - 1.0;
-	    double factor2 = (1.0 + retransmission->error_rate - param->error_rate) / (100000.0 - param->error_rate);
-	    xfer->ipd_current *= 1.0 + (factor1 * factor2);
-	} else {
-	    xfer->ipd_current *= (double) param->faster_num / param->faster_den;
-	}
-
-    /* make sure the IPD is still in range, for later calculations */
-    xfer->ipd_current = max(min(xfer->ipd_current, 10000.0), param->ipd_time);
+	/* let the congestion controller calculate a new IPD */
+	retransmission->delivery_rate = ntohl(retransmission->delivery_rate);
+	retransmission->queue_delay   = ntohl(retransmission->queue_delay);
+	retransmission->delay_trend   = ntohl(retransmission->delay_trend);
+	retransmission->received      = ntohl(retransmission->received);
+	retransmission->ce_marks      = ntohl(retransmission->ce_marks);
+	retransmission->fec_recovered = ntohl(retransmission->fec_recovered);
+	retransmission->ring_free     = ntohl(retransmission->ring_free);
+	retransmission->disk_rate     = ntohl(retransmission->disk_rate);
+	retransmission->echo_time     = ntohl(retransmission->echo_time);
+	cc_feedback(session, retransmission);
+	if (param->fec != TS_FEC_NONE)
+	    fec_feedback(session, retransmission);
 
     /* build the stats string */
-    sprintf(stats_line, "%6u %3.2fus %5uus %7u %6.2f %3u\n",
-        retransmission->error_rate, (float)xfer->ipd_current, param->ipd_time, xfer->block,
-        100.0 * xfer->block / param->block_count, session->session_id);
+    sprintf(stats_line, "%6u %3.3fus %5.3fus %7llu %6.2f %3u %8.2f\n",
+        retransmission->error_rate, (float)xfer->ipd_current, param->ipd_time, (ull_t) xfer->block,
+        100.0 * xfer->block / param->block_count, session->session_id,
+        ((xfer->cc.egress_rate > 0.0) ? min(xfer->cc.egress_rate, (double) param->target_rate) : param->target_rate) / 1000000.0);
 
-	/* print a status report */
+	/* print a status report, with the rate we may go up to in Mbps */
 	if (!(iteration++ % 23))
-	    printf(" erate     ipd  target   block   %%done srvNr\n");
+	    printf(" erate      ipd   target   block   %%done srvNr  ceiling\n");
 	printf("%s", stats_line);
 
 	/* print to the transcript if the user wants */
 	if (param->transcript_yn)
 	    xscript_data_log(session, stats_line);
 
+    /* if it's a report on one of the streams */
+    } else if (type == REQUEST_PATH) {
+	retransmission->delivery_rate = ntohl(retransmission->delivery_rate);
+	retransmission->received      = ntohl(retransmission->received);
+	stream_feedback(session, retransmission);
+
+    /* if it's a new end to the range of originals */
+    } else if (type == REQUEST_RANGE) {
+	if (block > param->block_count + 1) {
+	    sprintf(g_error, "Attempt to end range at illegal block %llu", (ull_t) block);
+	    return warn(g_error);
+	}
+	xfer->range_end = block;
+
+    /* if it's a new target rate */
+    } else if (type == REQUEST_TARGET_RATE) {
+	if (!param->rate_share || (block == 0)) {
+	    sprintf(g_error, "Attempt to move target rate to %llu bps", (ull_t) block);
+	    return warn(g_error);
+	}
+	cc_target(session, block);
+
     /* if it's a restart request */
     } else if (type == REQUEST_RESTART) {
 
 	/* do range-checking first */
-	if ((retransmission->block == 0) || (retransmission->block > param->block_count)) {
-	    sprintf(g_error, "Attempt to restart at illegal block %u", retransmission->block);
+	if ((block == 0) || (block > param->block_count)) {
+	    sprintf(g_error, "Attempt to restart at illegal block %llu", (ull_t) block);
 	    return warn(g_error);
 	} else
-	    xfer->block = retransmission->block;
+	    xfer->block = block;
+
+	/* the blocks after it are originals again */
+	xfer->tail = 0;
 
     /* if it's a retransmit request */
     } else if (type == REQUEST_RETRANSMIT) {
 
+        /* a block that hasn't been relayed yet is asked for again later */
+        if (!relay_ready(session, block))
+            return 0;
+
         /* build the retransmission */
-        status = build_datagram(session, retransmission->block, TS_BLOCK_RETRANSMISSION, datagram);
+        status = build_datagram(session, block, TS_BLOCK_RETRANSMISSION, datagram);
         if (status < 0) {
-            sprintf(g_error, "Could not build retransmission for block %u", retransmission->block);
+            sprintf(g_error, "Could not build retransmission for block %llu", (ull_t) block);
             return warn(g_error);
         }
       
-        /* try to send out the block */
-        status = sendto(xfer->udp_fd, datagram, 6 + param->block_size, 0, xfer->udp_address, xfer->udp_length);
+        /* try to send out the block, on the stream that loses least */
+        gettimeofday(&now, NULL);
+        path = stream_repair(session);
+        if (path == NULL)
+            status = sendto(xfer->udp_fd, datagram, param->header_size + param->block_size, 0, xfer->udp_address, xfer->udp_length);
+        else
+            status = sendto(path->udp_fd, datagram, param->header_size + param->block_size, 0, path->udp_address, xfer->udp_length);
         if (status < 0) {
-            sprintf(g_error, "Could not retransmit block %u", retransmission->block);
+            sprintf(g_error, "Could not retransmit block %llu", (ull_t) block);
             return warn(g_error);
         }
+        if (path != NULL)
+            ++path->repairs;
+        cc_sent(session, block, &now);
+
+        /* in the tail phase, a terminate block follows the repairs */
+        if (xfer->tail)
+            xfer->tail_due = 1;
 
     /* if it's another kind of request */
     } else {
@@ -275,7 +341,11 @@ int ttp_negotiate(ttp_session_t *session)
  *
  * Creates a new UDP socket for transmitting the file data associated
  * with our pending transfer and receives the destination port number
- * from the client.  Returns 0 on success and non-zero on failure.
+ * from the client.  If a startup probe was negotiated, it is run over
+ * the new socket before the transcript is started.  The files of a
+ * pipelined GET * after the first are sent from the socket and to the
+ * port of the file before, without another exchange.  Returns 0 on
+ * success and non-zero on failure.
  *------------------------------------------------------------------------*/
 int ttp_open_port(ttp_session_t *session)
 {
@@ -283,6 +353,25 @@ int ttp_open_port(ttp_session_t *session)
     int                 status;
     u_int16_t           port;
     u_char              ipv6_yn = session->parameter->ipv6_yn;
+    ttp_pipeline_t     *pipeline = &session->pipeline;
+
+    /* the files of a pipelined GET * after the first go to the port of the one before */
+    if (session->parameter->pipeline > 1) {
+	session->transfer.udp_fd      = pipeline->udp_fd;
+	session->transfer.udp_address = pipeline->udp_address;
+	session->transfer.udp_length  = pipeline->udp_length;
+	pipeline->file = 0;
+	if (session->parameter->transcript_yn)
+	    xscript_open(session);
+	return 0;
+    }
+
+    /* any other request gets a port of its own */
+    if (pipeline->file > 0) {
+	close(pipeline->udp_fd);
+	free(pipeline->udp_address);
+	pipeline->file = 0;
+    }
 
     /* create the address structure */
     session->transfer.udp_length = ipv6_yn ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
@@ -311,8 +400,34 @@ int ttp_open_port(ttp_session_t *session)
     if (session->transfer.udp_fd < 0)
 	return warn("Could not create UDP socket");
 
-    /* we succeeded */
+    /* mark the data as ECN capable, ECT(1) */
+    if (session->parameter->ecn) {
+	int tos = 0x01;
+	if (ipv6_yn)
+	    status = setsockopt(session->transfer.udp_fd, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos));
+	else
+	    status = setsockopt(session->transfer.udp_fd, IPPROTO_IP,   IP_TOS,      &tos, sizeof(tos));
+	if (status < 0) {
+	    warn("Could not mark UDP socket as ECN capable");
+	    session->parameter->ecn = 0;
+	}
+    }
+
+    /* the ports of any further streams follow */
     session->transfer.udp_address = address;
+    if (stream_open(session) < 0)
+	return warn("Could not open UDP streams");
+
+    /* measure the path */
+    if (session->parameter->probe_train > 0)
+	if (ttp_send_probe(session) < 0)
+	    return warn("Startup probe failed");
+
+    /* if we're doing a transcript */
+    if (session->parameter->transcript_yn)
+	xscript_open(session);
+
+    /* we succeeded */
     return 0;
 }
 
@@ -335,8 +450,11 @@ int ttp_open_transfer(ttp_session_t *session)
     u_int64_t        file_size;                      /* network-order version of file size   */
     u_int32_t        block_size;                     /* network-order version of block size  */
     u_int32_t        block_count;                    /* network-order version of block count */
+    u_int32_t        target_rate;                    /* network-order version of target rate */
     time_t           epoch;
     int              status;
+    int              resumed = 0;
+    int              synced  = 0;
     ttp_transfer_t  *xfer  = &session->transfer;
     ttp_parameter_t *param =  session->parameter;
 
@@ -350,10 +468,12 @@ int ttp_open_transfer(ttp_session_t *session)
     char       size[10];
     char       file_no[10];
     char       message[20];
-    u_int16_t  i;
+    u_int32_t  i;
     struct     timeval ping_s, ping_e;
 
-    /* clear out the transfer data */
+    /* clear out the transfer data, and any files a failed bundle request left open */
+    bundle_close(session);
+    resume_close(session);
     memset(xfer, 0, sizeof(*xfer));
 
     /* read in the requested filename */
@@ -420,9 +540,13 @@ int ttp_open_transfer(ttp_session_t *session)
 
     #ifndef VSIB_REALTIME
 
-    /* try to open the file for reading */
-    xfer->file = fopen(filename, "r");
-    if (xfer->file == NULL) {
+    /* try to open the bundle or the file for reading, fetching the file first if we relay it */
+    if (!strcmp(filename, TS_BUNDLE_HACK_CMD))
+        bundle_open(session);
+    else if (relay_open(session) == 0)
+        xfer->file = open_file(session, filename);
+    if ((xfer->file == NULL) && (xfer->bundle == NULL)) {
+        relay_close(session);
         sprintf(g_error, "File '%s' does not exist or cannot be read", filename);
     	/* signal failure to the client */
     	status = full_write(session->client_fd, "\x008", 1);
@@ -519,7 +643,7 @@ int ttp_open_transfer(ttp_session_t *session)
 
     /* read in the block size, target bitrate, and error rate */
     if (full_read(session->client_fd, &param->block_size,  4) < 0) return warn("Could not read block size");            param->block_size  = ntohl(param->block_size);
-    if (full_read(session->client_fd, &param->target_rate, 4) < 0) return warn("Could not read target bitrate");        param->target_rate = ntohl(param->target_rate);
+    if (full_read(session->client_fd, &target_rate,        4) < 0) return warn("Could not read target bitrate");        param->target_rate = ntohl(target_rate);
     if (full_read(session->client_fd, &param->error_rate,  4) < 0) return warn("Could not read error rate");            param->error_rate  = ntohl(param->error_rate);
 
     /* end round trip time estimation */
@@ -531,11 +655,29 @@ int ttp_open_transfer(ttp_session_t *session)
     if (full_read(session->client_fd, &param->faster_num,  2) < 0) return warn("Could not read speedup numerator");     param->faster_num  = ntohs(param->faster_num);
     if (full_read(session->client_fd, &param->faster_den,  2) < 0) return warn("Could not read speedup denominator");   param->faster_den  = ntohs(param->faster_den);
 
+    /* read in the transfer options */
+    if (ttp_read_options(session) < 0)
+        return warn("Could not read transfer options");
+
+    /* promise ECN capable data only if the data socket can mark it */
+    if (param->ecn && !test_ecn_socket(param)) {
+        warn("Could not mark UDP socket as ECN capable, sending without ECN");
+        param->ecn = 0;
+    }
+
     #ifndef VSIB_REALTIME
-    /* try to find the file statistics */
-    fseeko(xfer->file, 0, SEEK_END);
-    param->file_size   = ftello(xfer->file);
-    fseeko(xfer->file, 0, SEEK_SET);
+    /* try to find the file statistics, a bundle is as long as its files together */
+    if (xfer->bundle != NULL) {
+        param->file_size = xfer->bundle[xfer->bundle_count - 1].offset + xfer->bundle[xfer->bundle_count - 1].size;
+    } else {
+        fseeko(xfer->file, 0, SEEK_END);
+        param->file_size   = ftello(xfer->file);
+        fseeko(xfer->file, 0, SEEK_SET);
+    }
+
+    /* a relayed file is only as long as it has grown so far */
+    if (xfer->relay != NULL)
+        param->file_size = xfer->relay->file_size;
     #else
     /* get length of recording in bytes from filename */
     if (get_aux_entry("flen", ef->auxinfo, ef->nr_auxinfo) != 0) {
@@ -551,30 +693,350 @@ int ttp_open_transfer(ttp_session_t *session)
     param->block_count = (param->file_size / param->block_size) + ((param->file_size % param->block_size) != 0);
     param->epoch       = time(NULL);
 
+    /* a relayed file arrives out of order, too late for parity and the group */
+    if (xfer->relay != NULL) {
+        param->fec       = TS_FEC_NONE;
+        param->multicast = 0;
+    }
+
+    /* and a bundle is made up for the one client that asked for it */
+    if (xfer->bundle != NULL)
+        param->multicast = 0;
+
+    /* a client with a journal of this very file only gets what it misses */
+    #ifndef VSIB_REALTIME
+    resumed = resume_check(session);
+    #else
+    param->resume = 0;
+    #endif
+
+    /* and one with a copy of it only gets the blocks that changed */
+    #ifndef VSIB_REALTIME
+    if (!resumed)
+        synced = sync_check(session);
+    #endif
+
+    /* the wide header is only worth its 4 bytes if the block (and parity block) numbers need it */
+    if ((param->block_count <= 0xffffffffULL) &&
+        ((param->fec == TS_FEC_NONE) || (parity_block(param->block_count / param->fec_group, MAX_FEC_PARITY) <= 0xffffffffULL)))
+        param->header_flags &= ~TS_HDR_WIDE;
+    param->header_size = ttp_header_size(param->header_flags);
+
+    /* set up the FEC encoder, the client gets no parity if that fails */
+    if ((param->fec != TS_FEC_NONE) && (fec_init(session) < 0))
+        param->fec = TS_FEC_NONE;
+
+    /* send to the multicast group, or have it send to the client, if we can */
+    if (param->multicast && (mcast_join(session) < 0))
+        param->multicast = 0;
+
+    /* whose pace is the group's, not that of one client */
+    if (param->multicast)
+        param->rate_share = 0;
+
+    /* store the inter-packet delay, which is well below a usec on fast links */
+    param->ipd_time   = (1000000.0 * 8 * param->block_size) / param->target_rate;
+    xfer->ipd_current = param->ipd_time * 3;
+
     /* reply with the length, block size, number of blocks, and run epoch */
     file_size   = htonll(param->file_size);    if (full_write(session->client_fd, &file_size,   8) < 0) return warn("Could not submit file size");
     block_size  = htonl (param->block_size);   if (full_write(session->client_fd, &block_size,  4) < 0) return warn("Could not submit block size");
-    block_count = htonl (param->block_count);  if (full_write(session->client_fd, &block_count, 4) < 0) return warn("Could not submit block count");
+    block_count = htonl (min(param->block_count, 0xffffffffULL));  if (full_write(session->client_fd, &block_count, 4) < 0) return warn("Could not submit block count");
     epoch       = htonl (param->epoch);        if (full_write(session->client_fd, &epoch,       4) < 0) return warn("Could not submit run epoch");
 
+    /* reply with the transfer options that are in effect */
+    if (ttp_write_option(session, TS_OPT_CONGESTION, param->congestion) < 0) return warn("Could not submit congestion controller");
+    if (ttp_write_option(session, TS_OPT_HEADER,     param->header_flags) < 0) return warn("Could not submit header extensions");
+    if (param->congestion == TS_CC_LEDBAT)
+        if (ttp_write_option(session, TS_OPT_DELAY_TARGET, param->delay_target) < 0) return warn("Could not submit target delay");
+    if (param->ecn)
+        if (ttp_write_option(session, TS_OPT_ECN, 1) < 0) return warn("Could not submit ECN setting");
+    if (param->probe_train > 0)
+        if (ttp_write_option(session, TS_OPT_PROBE, param->probe_train) < 0) return warn("Could not submit probe length");
+    if (param->fec != TS_FEC_NONE) {
+        if (ttp_write_option(session, TS_OPT_FEC,       param->fec)       < 0) return warn("Could not submit FEC code");
+        if (ttp_write_option(session, TS_OPT_FEC_GROUP, param->fec_group) < 0) return warn("Could not submit FEC group size");
+    }
+    if (param->tail_copies > 0)
+        if (ttp_write_option(session, TS_OPT_TAIL_COPIES, param->tail_copies) < 0) return warn("Could not submit tail copies");
+    if (param->backpressure)
+        if (ttp_write_option(session, TS_OPT_BACKPRESSURE, 1) < 0) return warn("Could not submit backpressure setting");
+    if (param->streams > 1)
+        if (ttp_write_option(session, TS_OPT_STREAMS, param->streams) < 0) return warn("Could not submit stream count");
+    if (param->paths)
+        if (ttp_write_option(session, TS_OPT_PATHS,   1)              < 0) return warn("Could not submit stream addresses");
+    if (param->mirror)
+        if (ttp_write_option(session, TS_OPT_MIRROR,  1)              < 0) return warn("Could not submit mirror mode");
+    if (param->multicast)
+        if (ttp_write_option(session, TS_OPT_MULTICAST, ((u_int64_t) param->mcast_group << 16) | param->mcast_port) < 0) return warn("Could not submit multicast group");
+    if (param->pipeline > 0)
+        if (ttp_write_option(session, TS_OPT_PIPELINE, param->pipeline) < 0) return warn("Could not submit pipeline file number");
+    if (param->rate_share)
+        if (ttp_write_option(session, TS_OPT_RATE_SHARE, 1) < 0) return warn("Could not submit rate sharing");
+    if (param->resume)
+        if (ttp_write_option(session, TS_OPT_RESUME, param->resume_time) < 0) return warn("Could not submit file modification time");
+    if (resumed)
+        if (ttp_write_option(session, TS_OPT_RESUME_SIZE, param->file_size) < 0) return warn("Could not submit resume acceptance");
+    if (synced)
+        if (ttp_write_option(session, TS_OPT_SYNC, param->sync_segment) < 0) return warn("Could not submit sync segment");
+    if (ttp_write_option(session, TS_OPT_IPD,        (u_int64_t) (1000.0 * param->ipd_time + 0.5)) < 0) return warn("Could not submit inter-packet delay");
+    if (ttp_write_option(session, TS_OPT_END,        0)                 < 0) return warn("Could not submit end of options");
+
+    /* and learn which blocks a resuming client still misses */
+    if (resumed && (resume_read(session) < 0))
+        return warn("Could not read the missing ranges");
+
+    /* or which blocks of a synced file it has already */
+    if (synced && (sync_compare(session) < 0))
+        return warn("Could not compare the file with the client's copy");
+
     /*calculate and convert RTT to u_sec*/
     session->parameter->wait_u_sec=(ping_e.tv_sec - ping_s.tv_sec)*1000000+(ping_e.tv_usec-ping_s.tv_usec);
     /*add a 10% safety margin*/
     session->parameter->wait_u_sec = session->parameter->wait_u_sec + ((int)(session->parameter->wait_u_sec* 0.1));  
 
-    /* and store the inter-packet delay */
-    param->ipd_time   = (u_int32_t) ((1000000LL * 8 * param->block_size) / param->target_rate);
-    xfer->ipd_current = param->ipd_time * 3;
-
-    /* if we're doing a transcript */
-    if (param->transcript_yn)
-	xscript_open(session);
+    /* set up the congestion controller */
+    cc_init(session);
 
     /* we succeeded! */
     return 0;
 }
 
 
+/*------------------------------------------------------------------------
+ * int ttp_read_options(ttp_session_t *session);
+ *
+ * Reads the list of transfer options that the client sends after the
+ * transfer parameters.  Each option is a 16-bit key followed by a
+ * 64-bit value, both in network byte order, and the list ends with the
+ * key TS_OPT_END.  As every option has that same length, one we don't
+ * know, from a client newer than this server, is skipped whole and
+ * left off; the client learns which options are in effect from our
+ * reply.  Servers from before the option list don't read one at all.
+ * Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int ttp_read_options(ttp_session_t *session)
+{
+    ttp_parameter_t *param = session->parameter;
+    u_char           option[10];
+    u_int16_t        key;
+    u_int64_t        value;
+
+    /* every option is off unless the client asks for it */
+    param->congestion   = TS_CC_TSUNAMI;
+    param->header_flags = 0;
+    param->delay_target = CC_DELAY_TARGET;
+    param->ecn          = 0;
+    param->probe_train  = 0;
+    param->start_rate   = 0;
+    param->rtt_hint     = 0;
+    param->fec          = TS_FEC_NONE;
+    param->fec_group    = 0;
+    param->tail_copies  = 0;
+    param->backpressure = 0;
+    param->streams      = 1;
+    param->paths        = 0;
+    param->mirror       = 0;
+    param->multicast    = 0;
+    param->pipeline     = 0;
+    param->rate_share   = 0;
+    param->resume       = 0;
+    param->resume_time  = 0;
+    param->resume_size  = 0;
+    param->sync_size    = 0;
+
+    while (1) {
+
+        /* read in the next option */
+        if (full_read(session->client_fd, option, 10) < 0)
+            return -1;
+        memcpy(&key,   option,     2);  key   = ntohs(key);
+        memcpy(&value, option + 2, 8);  value = ntohll(value);
+
+        /* and see if it's one we know */
+        if (key == TS_OPT_END)
+            break;
+        else if ((key == TS_OPT_CONGESTION) && (value < TS_CC_COUNT))
+            param->congestion = value;
+        else if (key == TS_OPT_HEADER)
+            param->header_flags = value & (TS_HDR_TIMESTAMP | TS_HDR_WIDE | TS_HDR_FILE);
+        else if ((key == TS_OPT_DELAY_TARGET) && (value > 0) && (value < 10000000))
+            param->delay_target = value;
+        else if (key == TS_OPT_ECN)
+            param->ecn = (value != 0);
+        else if (key == TS_OPT_PROBE)
+            param->probe_train = min(value, MAX_PROBE_TRAIN);
+        else if (key == TS_OPT_START_RATE)
+            param->start_rate  = value;
+        else if ((key == TS_OPT_TARGET_RATE) && (value > 0))
+            param->target_rate = value;
+        else if ((key == TS_OPT_RTT_HINT) && (value < 10000000))
+            param->rtt_hint    = value;
+        else if ((key == TS_OPT_FEC) && (value < TS_FEC_COUNT))
+            param->fec         = value;
+        else if ((key == TS_OPT_FEC_GROUP) && (value >= 2) && (value <= MAX_FEC_GROUP))
+            param->fec_group   = value;
+        else if (key == TS_OPT_TAIL_COPIES)
+            param->tail_copies = min(value, MAX_TAIL_COPIES);
+        else if (key == TS_OPT_BACKPRESSURE)
+            param->backpressure = (value != 0);
+        else if ((key == TS_OPT_STREAMS) && (value >= 1))
+            param->streams     = min(value, MAX_STREAMS);
+        else if (key == TS_OPT_PATHS)
+            param->paths       = (value != 0);
+        else if (key == TS_OPT_MIRROR)
+            param->mirror      = (value != 0);
+        else if (key == TS_OPT_MULTICAST)
+            param->multicast   = (value != 0) && (param->group != NULL);
+        else if (key == TS_OPT_PIPELINE)
+            param->pipeline    = value;
+        else if (key == TS_OPT_RATE_SHARE)
+            param->rate_share  = (value != 0);
+        else if (key == TS_OPT_RESUME) {
+            param->resume      = 1;
+            param->resume_time = value;
+        }
+        else if (key == TS_OPT_RESUME_SIZE)
+            param->resume_size = value;
+        else if (key == TS_OPT_SYNC)
+            param->sync_size   = value;
+    }
+
+    /* a mirror sends the ranges it is given, not those of a journal or a sync, but tells the time of its file */
+    if (param->mirror) {
+        param->resume_time = 0;
+        param->sync_size   = 0;
+    }
+
+    /* a code needs a group to work on */
+    if (param->fec_group == 0)
+        param->fec = TS_FEC_NONE;
+
+    /* a group gets plain originals on a single stream, and repairs for whoever asks */
+    if (param->mirror)
+        param->multicast = 0;
+    if (param->multicast) {
+        param->fec         = TS_FEC_NONE;
+        param->streams     = 1;
+    }
+
+    /* a mirror sends plain originals in the ranges it is given */
+    if (param->mirror) {
+        param->fec         = TS_FEC_NONE;
+        param->streams     = 1;
+        param->tail_copies = 0;
+    }
+
+    /* and the groups of a code need to go out in order, on a single stream */
+    if (param->fec != TS_FEC_NONE)
+        param->streams = 1;
+
+    /* addresses only come with streams to use them */
+    if (param->streams == 1)
+        param->paths = 0;
+
+    /* a pipelined GET * keeps a single data socket, and goes on only from the file sent last */
+    if ((param->streams > 1) || param->mirror || param->multicast ||
+        ((param->pipeline > 1) && (param->pipeline != session->pipeline.file + 1)))
+        param->pipeline = 0;
+    if (param->pipeline == 0)
+        param->header_flags &= ~TS_HDR_FILE;
+
+    /* and the files after the first start where the one before left off, without another probe */
+    if ((param->pipeline > 1) && (session->pipeline.rate > 0.0)) {
+        param->probe_train = 0;
+        if (param->start_rate == 0)
+            param->start_rate = session->pipeline.rate;
+        if (param->rtt_hint == 0)
+            param->rtt_hint = session->pipeline.rtt;
+    }
+
+    /* the start rate hint may come before the full target rate */
+    param->start_rate = min(param->start_rate, param->target_rate);
+
+    /* the scavenger can't work without the delay measurements */
+    if ((param->congestion == TS_CC_LEDBAT) && !(param->header_flags & TS_HDR_TIMESTAMP))
+        param->congestion = TS_CC_TSUNAMI;
+
+    param->header_size = ttp_header_size(param->header_flags);
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int ttp_write_option(ttp_session_t *session, u_int16_t key,
+ *                      u_int64_t value);
+ *
+ * Sends a single transfer option to the client, in the same format as
+ * ttp_read_options() expects.  Returns 0 on success and non-zero on
+ * failure.
+ *------------------------------------------------------------------------*/
+int ttp_write_option(ttp_session_t *session, u_int16_t key, u_int64_t value)
+{
+    u_char option[10];
+
+    key   = htons(key);    memcpy(option,     &key,   2);
+    value = htonll(value); memcpy(option + 2, &value, 8);
+
+    return (full_write(session->client_fd, option, 10) < 0) ? -1 : 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int ttp_send_probe(ttp_session_t *session);
+ *
+ * Sends the startup probe, a train of probe_train back-to-back
+ * datagrams of full size, and waits for the client to report how many
+ * of them arrived and how far the train was spread out by the path.
+ * The result goes to the congestion controller.  Returns 0 on success
+ * and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int ttp_send_probe(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    ttp_header_t     header;
+    struct timeval   start, stop;
+    u_char          *datagram;
+    u_int32_t        received, dispersion;
+    u_int32_t        i;
+
+    /* the probe carries no file data */
+    datagram = (u_char *) calloc(1, param->header_size + param->block_size);
+    if (datagram == NULL)
+	return warn("Could not allocate probe datagram");
+
+    /* send the train as fast as we can */
+    gettimeofday(&start, NULL);
+    header.type = TS_BLOCK_PROBE;
+    for (i = 1; i <= param->probe_train; ++i) {
+	header.block     = i;
+	header.timestamp = 0;
+	header.file      = param->pipeline;
+	if (param->header_flags & TS_HDR_TIMESTAMP) {
+	    gettimeofday(&stop, NULL);
+	    header.timestamp = 1000000LL * stop.tv_sec + stop.tv_usec;
+	}
+	ttp_header_pack(datagram, &header, param->header_flags);
+	if (sendto(xfer->udp_fd, datagram, param->header_size + param->block_size, 0, xfer->udp_address, xfer->udp_length) < 0)
+	    warn("Could not send probe datagram");
+    }
+    free(datagram);
+
+    /* read the result from the client */
+    if (full_read(session->client_fd, &received,   4) < 0) return warn("Could not read probe result");
+    if (full_read(session->client_fd, &dispersion, 4) < 0) return warn("Could not read probe result");
+    gettimeofday(&stop, NULL);
+    cc_probe(session, ntohl(received), ntohl(dispersion), tv_diff_usec(stop, start));
+
+    if (param->verbose_yn)
+	printf("Startup probe: %u of %u datagrams, %0.2f Mbps, RTT %0.2f ms\n",
+	       xfer->cc.probe_received, param->probe_train, xfer->cc.probe_rate / 1000000.0, xfer->cc.probe_rtt / 1000.0);
+
+    return 0;
+}
+
+
 /*========================================================================
  * $Log: protocol.c,v $
  * Revision 1.31  2009/12/21 15:03:35  jwagnerhki
@@ -0,0 +1,273 @@
+/*========================================================================
+ * relay.c  --  Cut-through relaying of files for Tsunami server.
+ *
+ * With --relay, a file that isn't here is fetched from the given
+ * origin server while it is being sent on.  The fetch is an ordinary
+ * Tsunami client, run in the background with 'set relaymap yes': it
+ * writes the file under its own name and keeps a map next to it (the
+ * name plus TS_RELAY_EXTENSION, see ttp_relay_map_t) with a bit for
+ * every block that is on disk.  The session sends what the map says
+ * is there: originals skip the blocks that haven't arrived yet (the
+ * client asks for them again as repairs) and wait once nothing more
+ * has arrived, and repair requests for missing blocks are dropped
+ * until they have.  The fetch and the sending each have their own
+ * congestion controller, and the origin's block size need not match.
+ *
+ * Sessions asking for a file that is still being fetched share the
+ * fetch; a file whose map says it is complete, or that has no map, is
+ * served as it is.  The map is locked while a session decides whether
+ * to start a fetch, and a fetch whose client has gone away without
+ * finishing is started over.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <errno.h>       /* for errno                      */
+#include <fcntl.h>       /* for open()                     */
+#include <signal.h>      /* for kill(), signal()           */
+#include <string.h>      /* for memcmp(), memcpy()         */
+#include <sys/file.h>    /* for flock()                    */
+#include <sys/mman.h>    /* for mmap()                     */
+#include <unistd.h>      /* for fork(), execlp(), pread()  */
+
+#include <tsunami-server.h>
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+int   relay_alive(const ttp_relay_map_t *head);
+pid_t relay_fetch(ttp_session_t *session);
+
+
+/*------------------------------------------------------------------------
+ * void relay_close(ttp_session_t *session);
+ *
+ * Lets go of the relay map of the transfer, if it has one.
+ *------------------------------------------------------------------------*/
+void relay_close(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+
+    if (xfer->relay == NULL)
+	return;
+
+    munmap(xfer->relay, xfer->relay_length);
+    xfer->relay = NULL;
+}
+
+
+/*------------------------------------------------------------------------
+ * u_int64_t relay_next(ttp_session_t *session, u_int64_t block,
+ *                      u_int64_t last);
+ *
+ * Returns the first block from the given one on up to the last one
+ * that the relayed file already has, looking at most RELAY_SCAN blocks
+ * ahead, or 0 if there is none yet.  Without a relay, the given block
+ * is returned.  Ends the session if the fetch has failed.
+ *------------------------------------------------------------------------*/
+u_int64_t relay_next(ttp_session_t *session, u_int64_t block, u_int64_t last)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    u_int64_t       index;
+
+    xfer->relay_wait = 0;
+    if ((xfer->relay == NULL) || (block > last))
+	return block;
+    last = min(last, block + RELAY_SCAN - 1);
+
+    for (index = block; index <= last; ++index)
+	if (relay_ready(session, index))
+	    return index;
+
+    if ((xfer->relay->state == TS_RELAY_FAILED) || !relay_alive(xfer->relay))
+	error("The relayed file could not be fetched from the origin");
+    xfer->relay_wait = 1;
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int relay_open(ttp_session_t *session);
+ *
+ * Makes sure the requested file can be opened as usual: if it isn't
+ * here and we are a relay, or a fetch of it is on its way, a fetch is
+ * started unless one is running, and the map of the fetch is attached
+ * to the transfer once the size of the file is known.  Returns 0 on
+ * success and non-zero if the file can't be relayed.
+ *------------------------------------------------------------------------*/
+int relay_open(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    char             name[MAX_FILENAME_LENGTH + sizeof(TS_RELAY_EXTENSION)];
+    ttp_relay_map_t  head;
+    u_int64_t        blocks;
+    struct timeval   start;
+    pid_t            pid;
+    void            *map;
+    int              fd;
+
+    xfer->relay      = NULL;
+    xfer->relay_wait = 0;
+    if (param->relay_host == NULL)
+	return 0;
+
+    /* a file that is here without a map is served as it is */
+    snprintf(name, sizeof(name), "%s%s", xfer->filename, TS_RELAY_EXTENSION);
+    if (access(name, F_OK) && !access(xfer->filename, R_OK))
+	return 0;
+
+    /* one session at a time decides whether the file has to be fetched */
+    fd = open(name, O_RDWR | O_CREAT, 0644);
+    if ((fd < 0) || (flock(fd, LOCK_EX) < 0)) {
+	if (fd >= 0)
+	    close(fd);
+	return warn("Could not open relay map");
+    }
+    memset(&head, 0, sizeof(head));
+    if ((pread(fd, &head, sizeof(head), 0) < (ssize_t) sizeof(head)) || memcmp(head.magic, TS_RELAY_MAGIC, sizeof(head.magic)) ||
+        ((head.state != TS_RELAY_DONE) && ((head.state != TS_RELAY_FETCHING) || !relay_alive(&head)))) {
+
+	/* the client of the fetch puts its own map over this one, under the same pid */
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, TS_RELAY_MAGIC, sizeof(head.magic));
+	head.state = TS_RELAY_FETCHING;
+	if ((ftruncate(fd, 0) < 0) || (pwrite(fd, &head, sizeof(head), 0) < (ssize_t) sizeof(head)) ||
+	    ((pid = relay_fetch(session)) < 0)) {
+	    close(fd);
+	    return warn("Could not start fetching the file from the origin");
+	}
+	head.pid = pid;
+	pwrite(fd, &head.pid, sizeof(head.pid), (char *) &head.pid - (char *) &head);
+	fprintf(stderr, "Relaying '%s' from %s:%u\n", xfer->filename, param->relay_host, param->relay_port);
+    }
+    close(fd);
+
+    /* wait for the fetch to learn the size of the file */
+    gettimeofday(&start, NULL);
+    while (1) {
+	fd = open(name, O_RDONLY);
+	memset(&head, 0, sizeof(head));
+	if (fd >= 0) {
+	    pread(fd, &head, sizeof(head), 0);
+	    if (!memcmp(head.magic, TS_RELAY_MAGIC, sizeof(head.magic)) && (head.block_size > 0))
+		break;
+	    close(fd);
+	}
+	if ((head.state == TS_RELAY_FAILED) || ((head.pid != 0) && !relay_alive(&head)) ||
+	    (get_usec_since(&start) > 1000000LL * param->hb_timeout))
+	    return warn("The origin did not deliver the file");
+	usleep_that_works(RELAY_POLL);
+    }
+
+    /* and follow its progress from there */
+    blocks = (head.file_size / head.block_size) + ((head.file_size % head.block_size) != 0);
+    xfer->relay_length = sizeof(ttp_relay_map_t) + blocks / 8 + 1;
+    map = mmap(NULL, xfer->relay_length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+	return warn("Could not map relay map");
+    xfer->relay = (ttp_relay_map_t *) map;
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * int relay_ready(ttp_session_t *session, u_int64_t block);
+ *
+ * Returns non-zero if the given block of the transfer can be read from
+ * the file, i.e. every block of the fetch that it overlaps is there.
+ *------------------------------------------------------------------------*/
+int relay_ready(ttp_session_t *session, u_int64_t block)
+{
+    ttp_transfer_t   *xfer  = &session->transfer;
+    ttp_parameter_t  *param =  session->parameter;
+    ttp_relay_map_t  *map   =  xfer->relay;
+    const u_char     *bits;
+    u_int64_t         first, last;
+
+    if ((map == NULL) || (map->state == TS_RELAY_DONE) || (block == 0) || (block > param->block_count))
+	return 1;
+
+    bits  = (const u_char *) (map + 1);
+    first = ((block - 1) * param->block_size) / map->block_size;
+    last  = (min(block * param->block_size, map->file_size) - 1) / map->block_size;
+    for ( ; first <= last; ++first)
+	if (!(bits[first / 8] & (1 << (first % 8))))
+	    return 0;
+    return 1;
+}
+
+
+/*------------------------------------------------------------------------
+ * int relay_alive(const ttp_relay_map_t *head);
+ *
+ * Returns non-zero if the client fetching the file of the given map
+ * is still there.
+ *------------------------------------------------------------------------*/
+int relay_alive(const ttp_relay_map_t *head)
+{
+    return (head->pid != 0) && ((kill(head->pid, 0) == 0) || (errno == EPERM));
+}
+
+
+/*------------------------------------------------------------------------
+ * pid_t relay_fetch(ttp_session_t *session);
+ *
+ * Starts a client in the background that fetches the requested file
+ * from the origin into a file of the same name, keeping a relay map,
+ * and logs in with our own shared secret.  The client is fed its
+ * commands through a pipe and goes on by itself after the session
+ * ends.  Returns its process ID, or -1 on failure.
+ *------------------------------------------------------------------------*/
+pid_t relay_fetch(ttp_session_t *session)
+{
+    ttp_parameter_t *param = session->parameter;
+    int              commands[2];
+    FILE            *input;
+    pid_t            pid;
+    int              fd;
+
+    if (pipe(commands) < 0)
+	return -1;
+
+    /* nobody waits for the fetch */
+    signal(SIGCHLD, SIG_IGN);
+    pid = fork();
+    if (pid < 0) {
+	close(commands[0]);
+	close(commands[1]);
+	return -1;
+    }
+
+    /* the child becomes the client, with nothing of ours but the log */
+    if (pid == 0) {
+	signal(SIGCHLD, SIG_DFL);
+	close(session->client_fd);
+	close(commands[1]);
+	dup2(commands[0], STDIN_FILENO);
+	close(commands[0]);
+	fd = open("/dev/null", O_WRONLY);
+	if (fd >= 0) {
+	    dup2(fd, STDOUT_FILENO);
+	    close(fd);
+	}
+	execlp(param->relay_client, param->relay_client, (char *) NULL);
+	fprintf(stderr, "Could not run relay client '%s'\n", param->relay_client);
+	_exit(1);
+    }
+
+    close(commands[0]);
+    input = fdopen(commands[1], "w");
+    if (input == NULL) {
+	close(commands[1]);
+	return pid;
+    }
+    fprintf(input, "set verbose no\nset lossless yes\nset relaymap yes\nset port %u\nset passphrase %s\nconnect %s\nget %s %s\nquit\n",
+	    param->relay_port, param->secret, param->relay_host, session->transfer.filename, session->transfer.filename);
+    fclose(input);
+    return pid;
+}
@@ -0,0 +1,160 @@
+/*========================================================================
+ * resume.c  --  Resumption of interrupted transfers for Tsunami server.
+ *
+ * A client that keeps a journal of the blocks it has on disk (see
+ * client/journal.c) sends TS_OPT_RESUME with the modification time of
+ * the file its journal is of, and TS_OPT_RESUME_SIZE with its size.
+ * We answer TS_OPT_RESUME with the modification time of the file as
+ * it is now, so that a new journal knows what it belongs to, and echo
+ * TS_OPT_RESUME_SIZE only if both match.  Then, after the options, the
+ * client sends the ranges of blocks it still misses, as a 32-bit count
+ * and the first and end block of each in 64 bits, all in network byte
+ * order and in ascending order, and we send no other originals.  A
+ * client that sends TS_OPT_RESUME with 0 resumes nothing and only
+ * learns the modification time, which is how the client of several
+ * mirrors makes sure that they all have the same file.
+ *
+ * Bundles and relayed files have no single modification time and are
+ * sent in full.  The originals of a resumed file skip around, so they
+ * go out without parity and not to a multicast group.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <stdlib.h>      /* for *alloc() and free()        */
+#include <sys/stat.h>    /* for fstat()                    */
+
+#include <tsunami-server.h>
+
+
+/*------------------------------------------------------------------------
+ * int resume_check(ttp_session_t *session);
+ *
+ * Finds out whether the file of the transfer just opened is the one
+ * the journal of the client is of, and makes a note of its own
+ * modification time for the reply.  Must be called once the size of
+ * the file is known.  Returns non-zero if the client is to send the
+ * ranges it misses.
+ *------------------------------------------------------------------------*/
+int resume_check(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    struct stat      info;
+    u_int64_t        asked = param->resume_time;
+
+    if (!param->resume)
+	return 0;
+    if ((xfer->file == NULL) || (xfer->relay != NULL) || (fstat(fileno(xfer->file), &info) < 0)) {
+	param->resume = 0;
+	return 0;
+    }
+
+    param->resume_time = info.st_mtime;
+    if ((asked == 0) || (asked != param->resume_time) || (param->resume_size != param->file_size)) {
+	if ((asked != 0) && param->verbose_yn)
+	    printf("File '%s' has changed since the client's journal of it, sending it in full\n", xfer->filename);
+	param->resume_size = 0;
+	return 0;
+    }
+
+    /* the originals go wherever the gaps are */
+    param->fec       = TS_FEC_NONE;
+    param->multicast = 0;
+    return 1;
+}
+
+
+/*------------------------------------------------------------------------
+ * void resume_close(ttp_session_t *session);
+ *
+ * Forgets the missing ranges of the transfer, if it has any.
+ *------------------------------------------------------------------------*/
+void resume_close(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+
+    free(xfer->resume);
+    xfer->resume       = NULL;
+    xfer->resume_count = 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * u_int64_t resume_next(ttp_session_t *session, u_int64_t block,
+ *                       u_int64_t last);
+ *
+ * Returns the first block from the given one on that the resuming
+ * client misses, or last + 1 if there is none up to the last one.
+ * Without a resume, the given block is returned.
+ *------------------------------------------------------------------------*/
+u_int64_t resume_next(ttp_session_t *session, u_int64_t block, u_int64_t last)
+{
+    ttp_transfer_t *xfer  = &session->transfer;
+    u_int32_t       low   = 0;
+    u_int32_t       high  = xfer->resume_count;
+    u_int32_t       middle;
+
+    if (xfer->resume == NULL)
+	return block;
+
+    /* find the first range that doesn't end before the block */
+    while (low < high) {
+	middle = (low + high) / 2;
+	if (xfer->resume[2 * middle + 1] <= block)
+	    low = middle + 1;
+	else
+	    high = middle;
+    }
+
+    if (low == xfer->resume_count)
+	return last + 1;
+    block = max(block, xfer->resume[2 * low]);
+    return min(block, last + 1);
+}
+
+
+/*------------------------------------------------------------------------
+ * int resume_read(ttp_session_t *session);
+ *
+ * Reads the ranges of blocks that the resuming client misses.  Ranges
+ * out of order or outside the file are an error.  Returns 0 on success
+ * and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int resume_read(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    u_int32_t        count;
+    u_int64_t        range[2];
+    u_int64_t        end = 1;
+    u_int32_t        i;
+
+    if (full_read(session->client_fd, &count, 4) < 0)
+	return warn("Could not read the number of missing ranges");
+    count = ntohl(count);
+    if (count > MAX_RESUME_RANGES)
+	return warn("Too many missing ranges");
+
+    xfer->resume = (u_int64_t *) malloc(2 * sizeof(u_int64_t) * max(count, 1));
+    if (xfer->resume == NULL)
+	return warn("Could not allocate missing ranges");
+
+    for (i = 0; i < count; ++i) {
+	if (full_read(session->client_fd, range, sizeof(range)) < 0)
+	    return warn("Could not read missing range");
+	range[0] = ntohll(range[0]);
+	range[1] = ntohll(range[1]);
+	if ((range[0] < end) || (range[1] <= range[0]) || (range[1] > param->block_count + 1))
+	    return warn("Missing range out of order");
+	xfer->resume[2 * i]     = range[0];
+	xfer->resume[2 * i + 1] = range[1];
+	end = range[1];
+	xfer->resume_count = i + 1;
+    }
+
+    if (param->verbose_yn)
+	printf("Resuming '%s' with %u missing ranges\n", xfer->filename, count);
+    return 0;
+}
@@ -0,0 +1,452 @@
+/*========================================================================
+ * stream.c  --  Parallel UDP data streams for Tsunami server.
+ *
+ * With TS_OPT_STREAMS, the original blocks of a transfer go out over
+ * several UDP sockets, each sending to its own client port.  Stream 0
+ * is the usual data socket, served by the main loop along with the
+ * retransmissions and the tail phase; every other stream gets a thread
+ * of its own.  The streams take their blocks from one counter, each
+ * the next block not yet sent, so every stream sends its blocks in
+ * order and a faster stream simply ends up with more of them.  The
+ * client still reports on all of it over the one control connection
+ * and the congestion controller sees a single transfer.
+ *
+ * With TS_OPT_PATHS as well, the client names an address of its own
+ * and one of ours for every stream after the first, so the streams
+ * can run over different interfaces and uplinks: a stream sends to
+ * its client address and, if it can bind to it, from its server
+ * address.  Stream 0 keeps the addresses of the control connection.
+ *
+ * Every stream is paced at its share of the current rate.  The client
+ * reports the datagrams each stream brought in (REQUEST_PATH), from
+ * which stream_feedback() keeps a loss rate and a capacity per stream:
+ * a lossy stream carries what got through, one without loss is given
+ * credit for a quarter more than that.  The shares follow the
+ * capacities, and the repairs go out on the stream that loses least.
+ *
+ * The last block of the file always goes out on stream 0, as it opens
+ * the tail phase, which only starts once every thread is done.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <arpa/inet.h>   /* for inet_ntop()                */
+#include <stdlib.h>      /* for malloc() and free()        */
+#include <string.h>      /* for memcpy()                   */
+#include <sys/socket.h>  /* for sendto()                   */
+#include <sys/time.h>    /* for gettimeofday()             */
+#include <unistd.h>      /* for close()                    */
+
+#include <tsunami-server.h>
+
+#define PATH_GAIN       0.25   /* the weight of a new loss sample of a stream               */
+#define PATH_LOSS       0.02   /* the loss rate from which a stream counts as full          */
+#define PATH_PROBE      1.25   /* the credit given to a stream without loss                 */
+#define PATH_SHARE_MIN  0.05   /* the least share of a stream, over the number of streams   */
+
+
+/*------------------------------------------------------------------------
+ * Prototypes for module-scope routines.
+ *------------------------------------------------------------------------*/
+
+int   stream_address(ttp_session_t *session, ttp_stream_t *stream);
+void *stream_sender (void *arg);
+
+
+/*------------------------------------------------------------------------
+ * int stream_active(ttp_session_t *session);
+ *
+ * Returns non-zero if any stream thread still has original blocks to
+ * send, and 0 otherwise.
+ *------------------------------------------------------------------------*/
+int stream_active(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    int             i;
+
+    if (xfer->streams == NULL)
+	return 0;
+    for (i = 1; i < session->parameter->streams; ++i)
+	if (!xfer->streams[i].done)
+	    return 1;
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void stream_feedback(ttp_session_t *session,
+ *                      const retransmission_t *retransmission);
+ *
+ * Takes in the client's report on one stream (a REQUEST_PATH, with the
+ * stream number in the block field, already in host byte order) and
+ * updates its loss rate and capacity.  The report on the last stream
+ * closes a round, after which the shares are set anew.
+ *------------------------------------------------------------------------*/
+void stream_feedback(ttp_session_t *session, const retransmission_t *retransmission)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    ttp_stream_t    *stream;
+    u_int64_t        sent;
+    double           sample, total;
+    int              i;
+
+    if ((xfer->streams == NULL) || (retransmission->block >= param->streams))
+	return;
+    stream = &xfer->streams[retransmission->block];
+
+    /* what went out since the last report against what came in */
+    sent             = stream->sent + stream->repairs - stream->reported;
+    stream->reported = stream->sent + stream->repairs;
+    if (sent > 0) {
+	sample       = max(0.0, 1.0 - (double) retransmission->received / sent);
+	stream->loss = (stream->capacity == 0) ? sample : (1.0 - PATH_GAIN) * stream->loss + PATH_GAIN * sample;
+    }
+
+    /* a full stream carries what it delivers, one with room may carry more */
+    if (stream->loss > PATH_LOSS)
+	stream->capacity = max(retransmission->delivery_rate, 1.0);
+    else
+	stream->capacity = max(stream->capacity, PATH_PROBE * max(retransmission->delivery_rate, 1.0));
+
+    /* once all streams have reported, share the rate out by capacity */
+    if (retransmission->block + 1 < param->streams)
+	return;
+    for (total = 0, i = 0; i < param->streams; ++i) {
+	if (xfer->streams[i].capacity == 0)
+	    return;
+	total += xfer->streams[i].capacity;
+    }
+    for (sample = 0, i = 0; i < param->streams; ++i) {
+	xfer->streams[i].share = max(xfer->streams[i].capacity / total, PATH_SHARE_MIN / param->streams);
+	sample += xfer->streams[i].share;
+    }
+    for (i = 0; i < param->streams; ++i)
+	xfer->streams[i].share /= sample;
+}
+
+
+/*------------------------------------------------------------------------
+ * double stream_ipd(ttp_session_t *session, u_int16_t index);
+ *
+ * Returns the inter-packet delay in usec of the given stream, which
+ * sends at its share of the current rate.
+ *------------------------------------------------------------------------*/
+double stream_ipd(ttp_session_t *session, u_int16_t index)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+
+    if (xfer->streams == NULL)
+	return xfer->ipd_current;
+    return xfer->ipd_current / xfer->streams[index].share;
+}
+
+
+/*------------------------------------------------------------------------
+ * u_int64_t stream_next(ttp_session_t *session);
+ *
+ * Takes the next original block for the calling stream and returns
+ * its number.  The last block of the file is left to the tail phase,
+ * its number is returned once there is nothing else left in the range
+ * the client asked for (REQUEST_RANGE), by default the whole file.
+ * A resumed file skips the blocks the client has from before.  A
+ * relayed file skips the blocks that haven't arrived yet, and 0 is
+ * returned while none of the next ones has.
+ *------------------------------------------------------------------------*/
+u_int64_t stream_next(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    u_int64_t       block;
+
+    if (xfer->streams != NULL)
+	pthread_mutex_lock(&xfer->stream_lock);
+    block = xfer->block + 1;
+    if ((block < xfer->range_end) && (block < session->parameter->block_count))
+	block = resume_next(session, block, min(xfer->range_end, session->parameter->block_count) - 1);
+    if ((block < xfer->range_end) && (block < session->parameter->block_count)) {
+	block = relay_next(session, block, min(xfer->range_end, session->parameter->block_count) - 1);
+	if (block != 0)
+	    xfer->block = block;
+    } else
+	block = session->parameter->block_count;
+    if (xfer->streams != NULL)
+	pthread_mutex_unlock(&xfer->stream_lock);
+
+    return block;
+}
+
+
+/*------------------------------------------------------------------------
+ * int stream_open(ttp_session_t *session);
+ *
+ * Reads the client ports of the streams besides the main one, which
+ * follow the main port, each with the addresses of its path if the
+ * client names them, and opens a UDP socket for each of them.  The
+ * main data socket and address must already be set up.  Returns 0 on
+ * success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int stream_open(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    ttp_stream_t    *stream;
+    u_int16_t        port;
+    int              i;
+
+    xfer->streams      = NULL;
+    xfer->streams_stop = 0;
+    if (param->streams <= 1)
+	return 0;
+
+    xfer->streams = (ttp_stream_t *) calloc(param->streams, sizeof(ttp_stream_t));
+    if ((xfer->streams == NULL) || (pthread_mutex_init(&xfer->stream_lock, NULL) != 0)) {
+	free(xfer->streams);
+	xfer->streams = NULL;
+	return warn("Could not allocate UDP streams");
+    }
+
+    for (i = 0; i < param->streams; ++i) {
+	stream          = &xfer->streams[i];
+	stream->session = session;
+	stream->index   = i;
+	stream->udp_fd  = -1;
+	stream->done    = 2;
+	stream->share   = 1.0 / param->streams;
+    }
+
+    /* stream 0 is the main socket */
+    xfer->streams[0].udp_fd      = xfer->udp_fd;
+    xfer->streams[0].udp_address = xfer->udp_address;
+
+    for (i = 1; i < param->streams; ++i) {
+	stream = &xfer->streams[i];
+
+	if (full_read(session->client_fd, &port, 2) < 0)
+	    return warn("Could not read UDP stream port number");
+
+	stream->udp_address = (struct sockaddr *) malloc(xfer->udp_length);
+	if (stream->udp_address == NULL)
+	    return warn("Could not allocate space for UDP stream address");
+	memcpy(stream->udp_address, xfer->udp_address, xfer->udp_length);
+	if (param->ipv6_yn)
+	    ((struct sockaddr_in6 *) stream->udp_address)->sin6_port = port;
+	else
+	    ((struct sockaddr_in *)  stream->udp_address)->sin_port  = port;
+
+	stream->udp_fd = create_udp_socket(param);
+	if (stream->udp_fd < 0)
+	    return warn("Could not create UDP stream socket");
+
+	if (param->paths && (stream_address(session, stream) < 0))
+	    return warn("Could not read UDP stream addresses");
+
+	if (param->verbose_yn)
+	    printf("Stream %d sending to client port %d\n", i, ntohs(port));
+    }
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * ttp_stream_t *stream_repair(ttp_session_t *session);
+ *
+ * Returns the stream that the next repair should go out on: stream 0,
+ * unless another one has clearly lost less of late.  Returns NULL if
+ * the transfer has a single stream.
+ *------------------------------------------------------------------------*/
+ttp_stream_t *stream_repair(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer = &session->transfer;
+    ttp_stream_t   *best;
+    int             i;
+
+    if (xfer->streams == NULL)
+	return NULL;
+
+    best = &xfer->streams[0];
+    for (i = 1; i < session->parameter->streams; ++i)
+	if ((xfer->streams[i].capacity > 0) && (xfer->streams[i].loss + PATH_LOSS < best->loss))
+	    best = &xfer->streams[i];
+
+    return best;
+}
+
+
+/*------------------------------------------------------------------------
+ * int stream_start(ttp_session_t *session);
+ *
+ * Starts the sender threads of the streams besides the main one.  A
+ * stream whose thread cannot be started leaves its share of the blocks
+ * to the others.  Returns the number of threads started.
+ *------------------------------------------------------------------------*/
+int stream_start(ttp_session_t *session)
+{
+    ttp_transfer_t *xfer    = &session->transfer;
+    int             started = 0;
+    int             i;
+
+    if (xfer->streams == NULL)
+	return 0;
+
+    for (i = 1; i < session->parameter->streams; ++i) {
+	xfer->streams[i].done = 0;
+	if (pthread_create(&xfer->streams[i].thread, NULL, stream_sender, &xfer->streams[i]) != 0) {
+	    warn("Could not start UDP stream thread");
+	    xfer->streams[i].done = 2;
+	} else
+	    ++started;
+    }
+
+    return started;
+}
+
+
+/*------------------------------------------------------------------------
+ * void stream_stop(ttp_session_t *session);
+ *
+ * Stops the sender threads, if any are still running, and closes and
+ * frees the streams besides the main one.
+ *------------------------------------------------------------------------*/
+void stream_stop(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+    ttp_stream_t    *stream;
+    int              i;
+
+    if (xfer->streams == NULL)
+	return;
+
+    xfer->streams_stop = 1;
+    for (i = 0; i < param->streams; ++i) {
+	stream = &xfer->streams[i];
+	if (param->verbose_yn)
+	    printf("Stream %d sent %llu blocks and %llu repairs, %.1f%% lost, %.0f%% share\n", i,
+		   (ull_t) stream->sent, (ull_t) stream->repairs, 100.0 * stream->loss, 100.0 * stream->share);
+	if (i == 0)
+	    continue;
+	if (stream->done != 2)
+	    pthread_join(stream->thread, NULL);
+	if (stream->udp_fd >= 0)
+	    close(stream->udp_fd);
+	free(stream->udp_address);
+    }
+
+    free(xfer->streams);
+    xfer->streams = NULL;
+    pthread_mutex_destroy(&xfer->stream_lock);
+}
+
+
+/*------------------------------------------------------------------------
+ * int stream_address(ttp_session_t *session, ttp_stream_t *stream);
+ *
+ * Reads the client address and the server address of the given stream,
+ * which follow its port, all zeros for "as for the main socket".  The
+ * stream sends to the client address, and its socket is bound to the
+ * server address if that is one of ours; otherwise the routing picks
+ * the way out.  Returns 0 on success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int stream_address(ttp_session_t *session, ttp_stream_t *stream)
+{
+    ttp_parameter_t        *param  =  session->parameter;
+    socklen_t               length =  param->ipv6_yn ? 16 : 4;
+    u_char                  client[16], server[16], none[16];
+    struct sockaddr_storage local;
+    void                   *host;
+
+    if ((full_read(session->client_fd, client, length) < 0) || (full_read(session->client_fd, server, length) < 0))
+	return -1;
+    memset(none, 0, sizeof(none));
+
+    if (memcmp(client, none, length)) {
+	host = param->ipv6_yn ? (void *) &((struct sockaddr_in6 *) stream->udp_address)->sin6_addr
+	                      : (void *) &((struct sockaddr_in *)  stream->udp_address)->sin_addr;
+	memcpy(host, client, length);
+    }
+
+    if (memcmp(server, none, length)) {
+	memset(&local, 0, sizeof(local));
+	local.ss_family = param->ipv6_yn ? AF_INET6 : AF_INET;
+	host = param->ipv6_yn ? (void *) &((struct sockaddr_in6 *) &local)->sin6_addr
+	                      : (void *) &((struct sockaddr_in *)  &local)->sin_addr;
+	memcpy(host, server, length);
+	if (bind(stream->udp_fd, (struct sockaddr *) &local, param->ipv6_yn ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)) < 0) {
+	    sprintf(g_error, "Stream %u could not bind to its server address", stream->index);
+	    warn(g_error);
+	}
+    }
+
+    if (param->verbose_yn) {
+	char name[INET6_ADDRSTRLEN];
+	host = param->ipv6_yn ? (void *) &((struct sockaddr_in6 *) stream->udp_address)->sin6_addr
+	                      : (void *) &((struct sockaddr_in *)  stream->udp_address)->sin_addr;
+	printf("Stream %u sending to %s\n", stream->index,
+	       inet_ntop(param->ipv6_yn ? AF_INET6 : AF_INET, host, name, sizeof(name)));
+    }
+
+    return 0;
+}
+
+
+/*------------------------------------------------------------------------
+ * void *stream_sender(void *arg);
+ *
+ * The sender thread of one stream (the ttp_stream_t in arg).  It takes
+ * original blocks until there are none left and sends them once,
+ * paced like the main loop at the stream's share of the current rate,
+ * and leaves the rest to the repairs.
+ *------------------------------------------------------------------------*/
+void *stream_sender(void *arg)
+{
+    ttp_stream_t    *stream  = (ttp_stream_t *) arg;
+    ttp_session_t   *session = stream->session;
+    ttp_transfer_t  *xfer    = &session->transfer;
+    ttp_parameter_t *param   =  session->parameter;
+    u_char           datagram[MAX_BLOCK_SIZE + MAX_HEADER_SIZE];
+    struct timeval   prevpacketT, currpacketT;
+    int64_t          ipd_time = 0;
+    int64_t          ipd_usleep_diff;
+    u_int64_t        block;
+
+    gettimeofday(&prevpacketT, NULL);
+    while (!xfer->streams_stop) {
+	block = stream_next(session);
+	if (block >= param->block_count)
+	    break;
+
+	/* wait for the relayed file to grow */
+	if (block == 0) {
+	    usleep_that_works(RELAY_POLL);
+	    gettimeofday(&prevpacketT, NULL);
+	    ipd_time = 0;
+	    continue;
+	}
+
+	/* precalculate the time to wait after this block, as in the main loop */
+	gettimeofday(&currpacketT, NULL);
+	ipd_usleep_diff = 1000.0 * (stream_ipd(session, stream->index) + tv_diff_usec(prevpacketT, currpacketT));
+	prevpacketT = currpacketT;
+	if ((ipd_usleep_diff > 0) || (ipd_time > 0))
+	    ipd_time += ipd_usleep_diff;
+
+	if (build_datagram(session, block, TS_BLOCK_ORIGINAL, datagram) < 0) {
+	    sprintf(g_error, "Stream %u could not read block #%llu", stream->index, (ull_t) block);
+	    warn(g_error);
+	    break;
+	}
+	if (sendto(stream->udp_fd, datagram, param->header_size + param->block_size, 0, stream->udp_address, xfer->udp_length) < 0) {
+	    sprintf(g_error, "Stream %u could not transmit block #%llu", stream->index, (ull_t) block);
+	    warn(g_error);
+	} else
+	    ++stream->sent;
+
+	if (ipd_time >= 1000)
+	    usleep_that_works(ipd_time / 1000);
+    }
+
+    stream->done = 1;
+    return NULL;
+}
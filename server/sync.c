@@ -0,0 +1,132 @@
+/*========================================================================
+ * sync.c  --  Syncing a client's copy of a file for Tsunami server.
+ *
+ * A client that has a copy of the file it asks for sends TS_OPT_SYNC
+ * with the size of its copy.  We answer with the blocks per segment
+ * (at least SYNC_SEGMENT bytes, and no more than MAX_SYNC_SEGMENTS
+ * segments to the file), and after the options the client sends the
+ * number of segments its copy has and their digests (see common/sync.c).
+ * We hash our file meanwhile, and send back the ranges of blocks of
+ * the segments that differ or that the copy doesn't have, in the
+ * format of the missing ranges of a resume.  They go where resume.c
+ * keeps those, so only they are sent as originals, and the client
+ * asks for repairs of them as usual.  A file that has not changed
+ * comes to no ranges at all.
+ *
+ * This file is distributed under the same license terms as the rest
+ * of the Tsunami package, see the LICENSE file.
+ *========================================================================*/
+
+#include <stdlib.h>      /* for *alloc() and free()        */
+#include <string.h>      /* for memcmp()                   */
+
+#include <tsunami-server.h>
+
+#define sync_differs(i) (whole || ((i) >= count) || memcmp(ours + (i) * SYNC_DIGEST, theirs + (i) * SYNC_DIGEST, SYNC_DIGEST))
+
+
+/*------------------------------------------------------------------------
+ * int sync_check(ttp_session_t *session);
+ *
+ * Decides whether the file of the transfer just opened is synced with
+ * the client's copy, and on how many blocks per segment.  Must be
+ * called once the size of the file is known.  Returns non-zero if the
+ * client is to send the digests of its copy.
+ *------------------------------------------------------------------------*/
+int sync_check(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer  = &session->transfer;
+    ttp_parameter_t *param =  session->parameter;
+
+    param->sync_segment = 0;
+    if ((param->sync_size == 0) || (param->block_count == 0) ||
+        (xfer->file == NULL) || (xfer->relay != NULL) || (xfer->bundle != NULL))
+	return 0;
+
+    param->sync_segment = max(SYNC_SEGMENT / param->block_size, 1);
+    param->sync_segment = max(param->sync_segment, (param->block_count + MAX_SYNC_SEGMENTS - 1) / MAX_SYNC_SEGMENTS);
+
+    /* the originals go wherever the changes are */
+    param->fec       = TS_FEC_NONE;
+    param->multicast = 0;
+    return 1;
+}
+
+
+/*------------------------------------------------------------------------
+ * int sync_compare(ttp_session_t *session);
+ *
+ * Hashes our file, reads the digests of the client's copy, and sends
+ * it the ranges of blocks that differ, which become the only ones to
+ * send.  If our file can't be read, all of it differs.  Returns 0 on
+ * success and non-zero on failure.
+ *------------------------------------------------------------------------*/
+int sync_compare(ttp_session_t *session)
+{
+    ttp_transfer_t  *xfer     = &session->transfer;
+    ttp_parameter_t *param    =  session->parameter;
+    u_int64_t        segment  =  param->sync_segment;
+    u_int32_t        segments = (param->block_count + segment - 1) / segment;
+    u_char          *ours     = (u_char *) malloc((u_int64_t) segments * SYNC_DIGEST);
+    u_char          *theirs   = (u_char *) malloc((u_int64_t) segments * SYNC_DIGEST);
+    u_int64_t        changed  = 0;
+    u_int32_t        count, ranges = 0;
+    u_int32_t        i, j;
+    ssize_t          status;
+    int              whole;
+
+    xfer->resume = (u_int64_t *) malloc(2 * sizeof(u_int64_t) * (segments / 2 + 1));
+    if ((ours == NULL) || (theirs == NULL) || (xfer->resume == NULL)) {
+	free(ours);
+	free(theirs);
+	return warn("Could not allocate segment digests");
+    }
+
+    /* hash our file while the client hashes its copy */
+    whole = (sync_digests(fileno(xfer->file), param->file_size, segment * param->block_size, segments, ours) != 0);
+
+    if (full_read(session->client_fd, &count, 4) < 0) {
+	free(ours);
+	free(theirs);
+	return warn("Could not read the number of segment digests");
+    }
+    count = ntohl(count);
+    if ((count > segments) || ((count > 0) && (full_read(session->client_fd, theirs, (u_int64_t) count * SYNC_DIGEST) < 0))) {
+	free(ours);
+	free(theirs);
+	return warn("Could not read the segment digests");
+    }
+
+    /* the segments that differ make up the ranges to send */
+    for (i = 0; i < segments; i = j) {
+	while ((i < segments) && !sync_differs(i))
+	    ++i;
+	if (i == segments)
+	    break;
+	for (j = i; (j < segments) && sync_differs(j); ++j);
+	xfer->resume[2 * ranges]     = (u_int64_t) i * segment + 1;
+	xfer->resume[2 * ranges + 1] = min((u_int64_t) j * segment, param->block_count) + 1;
+	changed += xfer->resume[2 * ranges + 1] - xfer->resume[2 * ranges];
+	++ranges;
+    }
+    xfer->resume_count = ranges;
+    free(ours);
+    free(theirs);
+
+    /* and the client learns them too */
+    count = htonl(ranges);
+    for (i = 0; i < 2 * ranges; ++i)
+	xfer->resume[i] = htonll(xfer->resume[i]);
+    status = full_write(session->client_fd, &count, 4);
+    if ((status >= 0) && (ranges > 0))
+	status = full_write(session->client_fd, xfer->resume, 2 * sizeof(u_int64_t) * ranges);
+    for (i = 0; i < 2 * ranges; ++i)
+	xfer->resume[i] = ntohll(xfer->resume[i]);
+    if (status < 0)
+	return warn("Could not send the changed ranges");
+
+    if (param->verbose_yn)
+	printf("Syncing '%s': %llu of %llu blocks differ from the client's copy\n", xfer->filename,
+	       (ull_t) changed, (ull_t) param->block_count);
+    return 0;
+}
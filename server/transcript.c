@@ -154,8 +154,21 @@ void xscript_open(ttp_session_t *session)
     fprintf(xfer->transcript, "slower_den = %u\n",    param->slower_den);
     fprintf(xfer->transcript, "faster_num = %u\n",    param->faster_num);
     fprintf(xfer->transcript, "faster_den = %u\n",    param->faster_den);
-    fprintf(xfer->transcript, "ipd_time = %u\n",      param->ipd_time);
-    fprintf(xfer->transcript, "ipd_current = %u\n",   (u_int32_t)xfer->ipd_current);
+    fprintf(xfer->transcript, "ipd_time = %0.3f\n",   param->ipd_time);
+    fprintf(xfer->transcript, "ipd_current = %0.3f\n", xfer->ipd_current);
+    fprintf(xfer->transcript, "congestion = %s\n",    CONGESTION_NAMES[param->congestion]);
+    fprintf(xfer->transcript, "header_flags = 0x%x\n", param->header_flags);
+    fprintf(xfer->transcript, "delay_target = %u\n",  param->delay_target);
+    fprintf(xfer->transcript, "ecn = %u\n",           param->ecn);
+    fprintf(xfer->transcript, "probe_train = %u\n",   param->probe_train);
+    fprintf(xfer->transcript, "probe_received = %u\n", xfer->cc.probe_received);
+    fprintf(xfer->transcript, "probe_rate = %0.0f\n",  xfer->cc.probe_rate);
+    fprintf(xfer->transcript, "probe_rtt = %0.0f\n",   xfer->cc.probe_rtt);
+    fprintf(xfer->transcript, "start_rate = %llu\n", (ull_t)param->start_rate);
+    fprintf(xfer->transcript, "rtt_hint = %u\n",      param->rtt_hint);
+    fprintf(xfer->transcript, "pipeline = %u\n",      param->pipeline);
+    fprintf(xfer->transcript, "bundle_files = %u\n",  xfer->bundle_count);
+    fprintf(xfer->transcript, "rate_share = %u\n",    param->rate_share);
     fprintf(xfer->transcript, "protocol_version = 0x%x\n", PROTOCOL_REVISION);
     fprintf(xfer->transcript, "software_version = %s\n",   TSUNAMI_CVS_BUILDNR);
     fprintf(xfer->transcript, "ipv6 = %u\n",          param->ipv6_yn);